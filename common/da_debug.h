@@ -35,30 +35,65 @@ extern unsigned int da_debug_flag;
 #define DA_DEBUG_ENTRYEXIT_FLAG 0x00000010
 #define DA_DEBUG_DEBUG_FLAG     0x00000020
 
+
+/*
+ *  Log levels compiled in, levels not in the mask compile to nothing.
+ *  Set from kernel/Makefile with DIME_DEBUG=off to drop ENTRY/EXIT/DEBUG
+ *  logs from the page fault path.
+ */
+#ifndef DA_DEBUG_COMPILE_MASK
+#define DA_DEBUG_COMPILE_MASK   0xffffffff
+#endif
+
+#if defined(__KERNEL__) && defined(DA_DEBUG_STATIC_KEYS)
+
+#include <linux/jump_label.h>
+
+/*
+ *  A static key for each log level, kept in sync with da_debug_flag by
+ *  da_kmodule.c. A disabled level costs a nop instead of a load and test.
+ */
+DECLARE_STATIC_KEY_FALSE(da_debug_key_alert);
+DECLARE_STATIC_KEY_FALSE(da_debug_key_warning);
+DECLARE_STATIC_KEY_FALSE(da_debug_key_error);
+DECLARE_STATIC_KEY_FALSE(da_debug_key_info);
+DECLARE_STATIC_KEY_FALSE(da_debug_key_entryexit);
+DECLARE_STATIC_KEY_FALSE(da_debug_key_debug);
+
+#define DA_DEBUG_RUNTIME_ON(FLAG, KEY)  static_branch_unlikely(&KEY)
+
+#else
+
+#define DA_DEBUG_RUNTIME_ON(FLAG, KEY)  (da_debug_flag & FLAG)
+
+#endif
+
+#define DA_DEBUG_ON(FLAG, KEY)  ((DA_DEBUG_COMPILE_MASK & FLAG) && DA_DEBUG_RUNTIME_ON(FLAG, KEY))
+
 #define DA_ENTRY()                                                                      \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_ENTRYEXIT_FLAG) {                                      \
+    if (DA_DEBUG_ON(DA_DEBUG_ENTRYEXIT_FLAG, da_debug_key_entryexit)) {                 \
         PRINT_LOG(LOG_INFO,"[ENTRY] :%30s:%4d : ", __FUNCTION__,__LINE__);                \
     }                                                                                   \
 } while(0)
 
 #define DA_EXIT()                                                                       \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_ENTRYEXIT_FLAG) {                                      \
+    if (DA_DEBUG_ON(DA_DEBUG_ENTRYEXIT_FLAG, da_debug_key_entryexit)) {                 \
         PRINT_LOG(LOG_INFO,"[EXIT]  :%30s:%4d : ", __FUNCTION__,__LINE__);                \
     }                                                                                   \
 } while(0)
 
 #define DA_DEBUG(msg, args...)                                                          \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_DEBUG_FLAG) {                                               \
+    if (DA_DEBUG_ON(DA_DEBUG_DEBUG_FLAG, da_debug_key_debug)) {                         \
         PRINT_LOG(LOG_INFO,"[DEBUG] :%30s:%4d : " msg, __FUNCTION__,__LINE__, ##args);    \
     }                                                                                   \
 } while(0)
 
 #define DA_INFO(msg, args...)                                                           \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_INFO_FLAG) {                                           \
+    if (DA_DEBUG_ON(DA_DEBUG_INFO_FLAG, da_debug_key_info)) {                           \
         PRINT_LOG(LOG_INFO,"[INFO]  :%30s:%4d : " msg, __FUNCTION__,__LINE__, ##args);    \
     }                                                                                   \
 } while(0)
@@ -66,21 +101,21 @@ do {
 
 #define DA_WARNING(msg, args...)                                                        \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_WARNING_FLAG) {                                        \
+    if (DA_DEBUG_ON(DA_DEBUG_WARNING_FLAG, da_debug_key_warning)) {                     \
         PRINT_LOG(LOG_WARNING,"[WARN]  :%30s:%4d : " msg, __FUNCTION__,__LINE__, ##args); \
     }                                                                                   \
 } while(0)
 
 #define DA_ERROR(msg, args...)                                                          \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_ERROR_FLAG) {                                          \
+    if (DA_DEBUG_ON(DA_DEBUG_ERROR_FLAG, da_debug_key_error)) {                         \
         PRINT_LOG(LOG_ERR,"[ERR]   :%30s:%4d : " msg, __FUNCTION__,__LINE__, ##args);     \
     }                                                                                   \
 } while(0)
 
 #define DA_ALERT(msg, args...)                                                          \
 do {                                                                                    \
-    if (da_debug_flag & DA_DEBUG_ALERT_FLAG) {                                          \
+    if (DA_DEBUG_ON(DA_DEBUG_ALERT_FLAG, da_debug_key_alert)) {                         \
         PRINT_LOG(LOG_ALERT,"[ALERT] :%30s:%4d : " msg, __FUNCTION__,__LINE__, ##args);   \
     }                                                                                   \
 } while(0)
@@ -0,0 +1,153 @@
+#ifndef __DIME_STATS_H__
+#define __DIME_STATS_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*****
+ *
+ *  Binary stats ABI of DiME, shared by kernel module and user space tools.
+ *
+ *  /dev/dime_stats character device answers two ioctls :
+ *      DIME_STATS_IOC_COUNT    returns number of instances
+ *      DIME_STATS_IOC_GET      fills struct dime_stats_instance of instance
+ *                              given in instance_id
+ *
+ *  Caller sets version and size of the struct it was built with. Kernel
+ *  rejects other major versions, copies at most size bytes and returns its
+ *  own size, so fields can be appended without breaking old readers.
+ *  Counters of an instance are read one by one, not as an atomic snapshot,
+ *  at about timestamp_ns of CLOCK_MONOTONIC. All times are in ns.
+ *
+ */
+#define DIME_STATS_DEVICE           "/dev/dime_stats"
+#define DIME_STATS_VERSION          1
+
+#define DIME_STATS_POLICY_MAX       32
+
+// Policy of instance, decides meaning of dime_stats_policy.value
+#define DIME_STATS_POLICY_NONE      0
+#define DIME_STATS_POLICY_FIFO      1
+#define DIME_STATS_POLICY_LRU       2
+#define DIME_STATS_POLICY_RANDOM    3
+#define DIME_STATS_POLICY_ARC       4
+
+// value[] indexes of FIFO policy
+#define DIME_STATS_FIFO_LOCAL_SIZE  0
+#define DIME_STATS_FIFO_NSLOTS      1
+#define DIME_STATS_FIFO_COUNT       2
+
+// value[] indexes of random policy
+#define DIME_STATS_RANDOM_FREE_SLOTS    0
+#define DIME_STATS_RANDOM_NSLOTS        1
+#define DIME_STATS_RANDOM_NSHARDS       2
+#define DIME_STATS_RANDOM_COUNT         3
+
+// value[] indexes of LRU policy, list sizes followed by stats_struct counters
+#define DIME_STATS_LRU_LPL_COUNT                        0
+#define DIME_STATS_LRU_FREE_SIZE                        1
+#define DIME_STATS_LRU_ACTIVE_PC_SIZE                   2
+#define DIME_STATS_LRU_INACTIVE_PC_SIZE                 3
+#define DIME_STATS_LRU_ACTIVE_AN_SIZE                   4
+#define DIME_STATS_LRU_INACTIVE_AN_SIZE                 5
+#define DIME_STATS_LRU_FREE_EVICT                       6
+#define DIME_STATS_LRU_ACTIVE_PC_EVICT                  7
+#define DIME_STATS_LRU_ACTIVE_AN_EVICT                  8
+#define DIME_STATS_LRU_INACTIVE_PC_EVICT                9
+#define DIME_STATS_LRU_INACTIVE_AN_EVICT                10
+#define DIME_STATS_LRU_FORCE_ACTIVE_PC_EVICT            11
+#define DIME_STATS_LRU_FORCE_ACTIVE_AN_EVICT            12
+#define DIME_STATS_LRU_FORCE_INACTIVE_PC_EVICT          13
+#define DIME_STATS_LRU_FORCE_INACTIVE_AN_EVICT          14
+#define DIME_STATS_LRU_PC_ACTIVE_TO_INACTIVE_MOVED      15
+#define DIME_STATS_LRU_AN_ACTIVE_TO_INACTIVE_MOVED      16
+#define DIME_STATS_LRU_PC_INACTIVE_TO_ACTIVE_MOVED      17
+#define DIME_STATS_LRU_AN_INACTIVE_TO_ACTIVE_MOVED      18
+#define DIME_STATS_LRU_PC_INACTIVE_TO_ACTIVE_PF_MOVED   19
+#define DIME_STATS_LRU_AN_INACTIVE_TO_ACTIVE_PF_MOVED   20
+#define DIME_STATS_LRU_PC_ACTIVE_TO_FREE_MOVED          21
+#define DIME_STATS_LRU_AN_ACTIVE_TO_FREE_MOVED          22
+#define DIME_STATS_LRU_PC_INACTIVE_TO_FREE_MOVED        23
+#define DIME_STATS_LRU_AN_INACTIVE_TO_FREE_MOVED        24
+#define DIME_STATS_LRU_COUNT                            25
+
+// value[] indexes of ARC policy
+#define DIME_STATS_ARC_C            0
+#define DIME_STATS_ARC_P            1
+#define DIME_STATS_ARC_T1_SIZE      2
+#define DIME_STATS_ARC_T2_SIZE      3
+#define DIME_STATS_ARC_B1_SIZE      4
+#define DIME_STATS_ARC_B2_SIZE      5
+#define DIME_STATS_ARC_B1_HITS      6
+#define DIME_STATS_ARC_B2_HITS      7
+#define DIME_STATS_ARC_T1_EVICT     8
+#define DIME_STATS_ARC_T2_EVICT     9
+#define DIME_STATS_ARC_T1_TO_T2     10
+#define DIME_STATS_ARC_COUNT        11
+
+struct dime_stats_policy {
+    __u32   id;                             // DIME_STATS_POLICY_*
+    __u32   count;                          // valid entries in value
+    __u64   value[DIME_STATS_POLICY_MAX];
+};
+
+struct dime_stats_instance {
+    __u32   version;                        // in : DIME_STATS_VERSION, out : kernel version
+    __u32   size;                           // in : sizeof struct of caller, out : sizeof struct of kernel
+    __u32   instance_id;                    // in
+    __u32   pid_count;
+
+    __u64   timestamp_ns;
+
+    // configuration
+    __u64   latency_ns;
+    __u64   bandwidth_bps;
+    __u64   local_npages;
+
+    // counters of dime_instance_struct
+    __u64   pagefaults;
+    __u64   duplicate_pfs;
+    __u64   pc_pagefaults;
+    __u64   an_pagefaults;
+    __u64   time_pfh;
+    __u64   time_ap;
+    __u64   time_inject;
+    __u64   time_pfh_ap;
+    __u64   time_pfh_ap_inject;
+
+    struct dime_stats_policy policy;
+
+    // appended fields, zero from older kernels
+    __u64   an_time_inject;                 // time_inject split by page class
+    __u64   pc_time_inject;
+    __u64   shared_pfs;                     // faults on pages already local under another mapping
+    __u64   adm_admitted;                   // window pages moved to the policy by admission filter
+    __u64   adm_rejected;                   // window pages evicted by admission filter
+    __u64   time_queue;                     // part of time_inject spent at shared link and server
+    __u64   fabric_losses;                  // lost fetches, each charged a timeout
+    __u64   fabric_brownouts;               // fetches stalled by a brownout
+    __u64   fabric_spikes;                  // fetches delayed by a latency spike
+    __u64   time_fabric;                    // part of time_inject caused by fabric faults
+    __u64   offload_pages;                  // evicted pages paged out to memory server
+    __u64   offload_failed;                 // evicted pages kept local, queue full or page out failed
+    __u64   offload_fetches;                // faults fetching an offloaded page back
+    __u64   time_fetch;                     // real time of those fetches, credited against injected delay
+    __u64   compress_stored;                // evicted pages compressed into the pool
+    __u64   compress_rejected;              // evicted pages not compressible below a page
+    __u64   compress_evicted;               // pool entries dropped to make room, fetched at remote cost
+    __u64   compress_hits;                  // faults decompressing a page from the pool
+    __u64   time_compress;                  // real time spent compressing
+    __u64   time_decompress;                // real time spent decompressing
+    __u64   pool_npages;                    // pages in the pool at sample time
+    __u64   pool_bytes;                     // compressed bytes in the pool
+    __u64   pool_alloc_bytes;               // bytes allocated for them, pool fragmentation included
+    __u64   warm_restored;                  // pages made local again from a warm start checkpoint
+    __u64   warm_skipped;                   // checkpoint pages not mapped, not tracked or already local
+    __u64   time_clamped;                   // delay not injected, beyond the busy wait limit of kprobe hook
+};
+
+#define DIME_STATS_IOC_MAGIC    'D'
+#define DIME_STATS_IOC_COUNT    _IOR(DIME_STATS_IOC_MAGIC, 1, __u32)
+#define DIME_STATS_IOC_GET      _IOWR(DIME_STATS_IOC_MAGIC, 2, struct dime_stats_instance)
+
+#endif//__DIME_STATS_H__
@@ -2,7 +2,12 @@
 #define __COMMON_H__
 
 #include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
 #include "../common/da_debug.h"
+#include "../common/dime_stats.h"
 
 //#define write_lock(lock) while(0){}
 //#define write_unlock(lock) while(0){}
@@ -24,21 +29,173 @@ struct pagefault_request {
 };
 */
 struct dime_instance_struct;
+struct dime_admission_struct;
+struct dime_compress_pool;
+struct cgroup;
+
+// number of lists a policy may report a page in for warm start, list ids are 0 .. DIME_WARM_LISTS-1
+#define DIME_WARM_LISTS				4
+
+// called for each local page by export_pages, nonzero return stops the walk and is returned
+typedef int (*dime_export_fn) (void *arg, struct mm_struct * mm, ulong address, int list);
 
 struct page_replacement_policy_struct {
-	int		(*add_page)		(struct dime_instance_struct *dime_instance, struct pid * pid_s, ulong address);
+	int		(*add_page)		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address);
 	void	(*clean)		(struct dime_instance_struct *dime_instance);
+	void	(*get_stats)	(struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats);		// optional, fills policy counters of stats ABI
+	// optional, returns 1 and key of page which add_page of (mm, address) would evict next, 0 if no page would be evicted
+	int		(*peek_victim)	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address,
+								struct mm_struct ** victim_mm, ulong * victim_address);
+	// optional, warm start : passes each local page to fn with its list, coldest first within a list
+	int		(*export_pages)	(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg);
+	// optional, warm start : adds present page as hottest page of list without a fault, evicting like add_page
+	void	(*restore_page)	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, int list);
+	// optional, frees local pages added without mm, i.e. synthetic pages of selftest benchmark, so real pages reuse them
+	void	(*drop_unowned)	(struct dime_instance_struct *dime_instance);
+	int		resizable;		// follows local_npages of config at once, policies sized at load time leave it 0
+	struct module	*owner;		// policy module, THIS_MODULE, held by dime_prp_get while callbacks run outside faults
 };
 
-struct dime_instance_struct {
-	int				instance_id;
-	int				pid[1000];
-	int				pid_count;
+/*
+ *  Memory classes with separate cost and local quota. Anonymous pages are
+ *  remote memory, page cache pages may model disaggregated storage.
+ */
+enum dime_page_class {
+	DIME_PAGE_ANON = 0,
+	DIME_PAGE_CACHE,
+	DIME_PAGE_CLASSES,
+};
+
+// pc_latency_ns and pc_bandwidth_bps value to charge page cache same as anon
+#define DIME_CONFIG_FOLLOW_ANON		ULONG_MAX
+
+// link and server value of an instance attached to no shared resource
+#define DIME_RESOURCE_NONE			ULONG_MAX
+
+// Admission filter in front of the policy
+enum dime_admission {
+	DIME_ADMISSION_NONE = 0,		// every faulted page is added to the policy
+	DIME_ADMISSION_TINYLFU,			// window of recent pages, then frequency sketch against policy victim
+	DIME_ADMISSION_MAX,
+};
+
+// Where pages evicted by the policy go
+enum dime_tier {
+	DIME_TIER_NONE = 0,				// page stays in local DRAM, only its pte is protected
+	DIME_TIER_OFFLOAD,				// page is paged out to swap device served by a memory server
+	DIME_TIER_COMPRESS,				// copy of page is compressed into a pool in front of remote memory
+	DIME_TIER_MAX,
+};
+
+// Cost of a fault on a page found in the compressed pool
+enum dime_compress_cost {
+	DIME_COMPRESS_COST_ADD = 0,		// decompression and remote fetch delay
+	DIME_COMPRESS_COST_REPLACE,		// decompression only
+};
+
+#define DIME_COMPRESS_ALG_MAX		32
+
+#define DIME_LATENCY_TABLE_BITS		10
+#define DIME_LATENCY_TABLE_SIZE		(1 << DIME_LATENCY_TABLE_BITS)
+#define DIME_LATENCY_CDF_MAX		32
+
+enum dime_latency_dist {
+	DIME_LATENCY_CONSTANT = 0,
+	DIME_LATENCY_NORMAL,			// mean latency_ns, stddev_ns
+	DIME_LATENCY_LOGNORMAL,			// median latency_ns, shape sigma_milli/1000
+	DIME_LATENCY_EMPIRICAL,			// piecewise linear CDF given by cdf points
+	DIME_LATENCY_DIST_MAX,
+};
+
+struct dime_latency_cdf_point {
+	u32				permille;			// cumulative probability * 1000
+	u32				latency_ns;
+};
+
+/*
+ *  One way latency distribution and congestion schedule of an instance.
+ *  Every congestion_period_ns, for congestion_duration_ns, latency is scaled
+ *  by congestion_latency_pct and bandwidth by congestion_bandwidth_pct.
+ */
+struct dime_latency_profile {
+	enum dime_latency_dist	dist;
+	ulong			stddev_ns;
+	ulong			sigma_milli;
+	int				cdf_points;
+	struct dime_latency_cdf_point cdf[DIME_LATENCY_CDF_MAX];
+
+	u64				congestion_period_ns;		// 0 disables schedule
+	u64				congestion_duration_ns;
+	ulong			congestion_latency_pct;
+	ulong			congestion_bandwidth_pct;
+};
+
+/*
+ *  Fabric faults of remote fetches of an instance. A fetch is lost with
+ *  probability loss_ppm per million and sent again after timeout_ns, which
+ *  may be lost again. Every brownout_period_ns, the server stalls fetches
+ *  for brownout_duration_ns. A fetch takes spike_ns longer with probability
+ *  spike_ppm. Draws depend only on seed and sequence number of the fetch.
+ */
+struct dime_fabric_profile {
+	u64				seed;
+	ulong			loss_ppm;
+	ulong			timeout_ns;
+	u64				brownout_period_ns;			// 0 disables brownouts
+	u64				brownout_duration_ns;
+	ulong			spike_ppm;
+	ulong			spike_ns;
+	u64				start_ns;					// ktime origin of brownout schedule
+};
+
+/*
+ *  Tunables of an instance. A published config is never modified, writers
+ *  build a new one and swap dime_instance->config, so a page fault sees
+ *  either all old or all new values. Old config is freed after a grace period.
+ */
+struct dime_config_struct {
 	ulong			latency_ns;
 	ulong			bandwidth_bps;
 	ulong			local_npages;
+	ulong			pc_latency_ns;		// DIME_CONFIG_FOLLOW_ANON or latency of page cache pages
+	ulong			pc_bandwidth_bps;	// DIME_CONFIG_FOLLOW_ANON or bandwidth of page cache pages
+	ulong			an_local_npages;	// local quota of anon pages, 0 if not set
+	ulong			pc_local_npages;	// local quota of page cache pages, 0 if not set
+	ulong			admission;			// enum dime_admission
+	ulong			admission_window_pct;	// percent of local_npages kept as admission window
+	ulong			link;				// shared link of fetches, DIME_RESOURCE_NONE if own link
+	ulong			server;				// shared memory server of fetches, DIME_RESOURCE_NONE if own server
+	ulong			tier;				// enum dime_tier
+	char			compress_alg[DIME_COMPRESS_ALG_MAX];	// crypto compression algorithm of tier=compress
+	ulong			compress_pool_npages;	// memory of compressed pool in pages, 0 if unlimited
+	ulong			compress_cost;		// enum dime_compress_cost
+	ulong			generation;			// incremented on every update of the instance
+
+	// derived per class values, indexed by enum dime_page_class
+	ulong			class_latency_ns[DIME_PAGE_CLASSES];
+	ulong			transmission_ns[DIME_PAGE_CLASSES];		// transmission delay of a page
+	ulong			delay_ns[DIME_PAGE_CLASSES];			// page fetch delay, transmission delay + two way latency
+	ulong			class_npages[DIME_PAGE_CLASSES];		// local pages of each class, all 0 if classes share local_npages
+	ulong			window_npages;							// local pages of admission window, 0 without admission
+
+	struct dime_latency_profile profile;
+	u64				schedule_start_ns;	// ktime of first congestion episode
+	struct dime_fabric_profile fabric;
+	struct rcu_head	rcu;
+	u32				latency_table[];	// DIME_LATENCY_TABLE_SIZE quantiles of one way latency, unless constant
+};
+
+struct dime_instance_struct {
+	int				instance_id;
+	struct list_head	pid_list;			// tracked processes, list of pt_node_struct
+	int				pid_count;
+	struct cgroup __rcu	*cgrp;				// cgroup v2 whose member tasks are emulated, if set
+	struct hlist_node	cgroup_node;		// link in cgroup hash of da_ptracker.c while cgrp is set
+	struct dime_config_struct __rcu *config;	// never NULL for instances below dime_instances_size
 	atomic_long_t	pc_pagefaults;
 	atomic_long_t	an_pagefaults;
+	atomic_long_t	pc_time_inject;		// delay injected for page cache pages
+	atomic_long_t	an_time_inject;		// delay injected for anon pages
 
 
 	atomic_long_t	pagefaults;
@@ -49,9 +206,33 @@ struct dime_instance_struct {
 	atomic_long_t	time_pfh_ap_inject;	// total time of all
 
 	atomic_long_t	duplecate_pfs;
+	atomic_long_t	shared_pfs;			// faults on pages already local under another mapping
+	atomic_long_t	adm_admitted;		// window pages moved to the policy by admission filter
+	atomic_long_t	adm_rejected;		// window pages evicted by admission filter
+	atomic_long_t	time_queue;			// part of time_inject spent at shared link and server
+	atomic64_t		fabric_seq;			// fetches drawn since fabric_seed was set
+	atomic_long_t	fabric_losses;		// lost fetches, each charged a timeout
+	atomic_long_t	fabric_brownouts;	// fetches stalled by a brownout
+	atomic_long_t	fabric_spikes;		// fetches delayed by a latency spike
+	atomic_long_t	time_fabric;		// part of time_inject caused by fabric faults
+	atomic_long_t	offload_pages;		// evicted pages paged out to memory server
+	atomic_long_t	offload_failed;		// evicted pages kept local, queue full or page out failed
+	atomic_long_t	offload_fetches;	// faults fetching an offloaded page back
+	atomic_long_t	time_fetch;			// real time of those fetches, credited against injected delay
+	atomic_long_t	compress_stored;	// evicted pages stored in compressed pool
+	atomic_long_t	compress_rejected;	// evicted pages not compressible, or no memory for them
+	atomic_long_t	compress_evicted;	// pages written back from full pool to remote memory
+	atomic_long_t	compress_hits;		// faults on pages found in compressed pool
+	atomic_long_t	time_compress;		// real time of compressions
+	atomic_long_t	time_decompress;	// real time of decompressions
+	atomic_long_t	warm_restored;		// pages made local again from a warm start checkpoint
+	atomic_long_t	warm_skipped;		// checkpoint pages not mapped, not tracked or already local
+	atomic_long_t	time_clamped;		// delay not injected, beyond the busy wait limit of kprobe hook
 	rwlock_t 		lock;
 
 	struct page_replacement_policy_struct *prp;
+	struct dime_admission_struct __rcu *admission;	// admission filter, set while a policy is registered
+	struct dime_compress_pool __rcu *compress;	// pool of tier=compress, replaced with config
 };
 
 struct dime_struct {
@@ -62,7 +243,7 @@ struct dime_struct {
 struct lpl_node_struct {
 	struct list_head list_node;
 	ulong address;
-	struct pid *pid_s;
+	struct mm_struct *mm;		// owner mm shared by all threads, holds mm_count reference
 	spinlock_t lock;
 };
 
@@ -77,8 +258,74 @@ struct lpl {
 extern struct dime_struct dime;
 
 
-void inject_delay(struct dime_instance_struct *dime_instance, unsigned long long diff);
+// must be called inside rcu read section
+static inline struct dime_config_struct * dime_config_get(struct dime_instance_struct *dime_instance) {
+	return rcu_dereference(dime_instance->config);
+}
+
+// local pages managed by the policy, local_npages less admission window, for readers outside rcu read section
+static inline ulong dime_local_npages(struct dime_instance_struct *dime_instance) {
+	struct dime_config_struct *config;
+	ulong local_npages;
+
+	rcu_read_lock();
+	config = dime_config_get(dime_instance);
+	local_npages = config->local_npages - config->window_npages;
+	rcu_read_unlock();
+	return local_npages;
+}
+
+// local quota of page class, 0 if classes share local_npages
+static inline ulong dime_class_npages(struct dime_instance_struct *dime_instance, enum dime_page_class page_class) {
+	ulong npages;
+
+	rcu_read_lock();
+	npages = dime_config_get(dime_instance)->class_npages[page_class];
+	rcu_read_unlock();
+	return npages;
+}
+
+// anonymous pages have PAGE_MAPPING_ANON bit set in page->mapping
+static inline enum dime_page_class dime_page_class(struct page *page) {
+	return PageAnon(page) ? DIME_PAGE_ANON : DIME_PAGE_CACHE;
+}
+
+
+void inject_delay(struct dime_instance_struct *dime_instance, long long adjust_ns, enum dime_page_class page_class);
 int register_page_replacement_policy(struct page_replacement_policy_struct *prp);
 int deregister_page_replacement_policy(struct page_replacement_policy_struct *prp);
+struct page_replacement_policy_struct * dime_prp_get(struct dime_instance_struct *dime_instance);
+void dime_prp_put(struct page_replacement_policy_struct *prp);
+
+/*
+ *  seq_file iterator over dime instances for procfs readers, shared by all
+ *  modules. First record is SEQ_START_TOKEN for the header line, followed by
+ *  a struct dime_instance_struct pointer for each instance.
+ */
+void *	dime_instance_seq_start	(struct seq_file *m, loff_t *pos);
+void *	dime_instance_seq_next	(struct seq_file *m, void *v, loff_t *pos);
+void	dime_instance_seq_stop	(struct seq_file *m, void *v);
+
+// procfs entries take struct proc_ops since 5.6
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+#define DIME_DEFINE_PROC_OPS(name, open_fn, write_fn)	\
+static const struct proc_ops name = {					\
+	.proc_open		= open_fn,							\
+	.proc_read		= seq_read,							\
+	.proc_lseek		= seq_lseek,						\
+	.proc_release	= seq_release,						\
+	.proc_write		= write_fn,							\
+}
+#else
+#define DIME_DEFINE_PROC_OPS(name, open_fn, write_fn)	\
+static const struct file_operations name = {			\
+	.owner			= THIS_MODULE,						\
+	.open			= open_fn,							\
+	.read			= seq_read,							\
+	.llseek			= seq_lseek,						\
+	.release		= seq_release,						\
+	.write			= write_fn,							\
+}
+#endif
 
 #endif //__COMMON_H__
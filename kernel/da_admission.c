@@ -0,0 +1,316 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/log2.h>
+#include <linux/sched.h>
+#include <linux/rcupdate.h>
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_shared.h"
+#include "da_admission.h"
+
+#define ADM_COUNTER_MAX         15
+#define ADM_SAMPLE_FACTOR       10          // sketch is halved after this many faults per local page
+#define ADM_AGE_CHUNK_WORDS     4096        // words halved under one hold of the lock
+#define ADM_MIN_WIDTH           64
+
+static const char *admission_names[DIME_ADMISSION_MAX] = {
+    [DIME_ADMISSION_NONE]       = "none",
+    [DIME_ADMISSION_TINYLFU]    = "tinylfu",
+};
+
+int dime_admission_parse(const char *name) {
+    int i;
+
+    for(i=0 ; i<DIME_ADMISSION_MAX ; ++i) {
+        if(strcmp(name, admission_names[i]) == 0)
+            return i;
+    }
+    DA_ERROR("invalid admission : %s", name);
+    return -EINVAL;
+}
+
+// Prints admission filter of config as one procfs column, e.g. "tinylfu/20", "-" if none
+void dime_admission_show(struct seq_file *m, const struct dime_config_struct *config) {
+    if(config->admission == DIME_ADMISSION_NONE)
+        seq_putc(m, '-');
+    else
+        seq_printf(m, "%s/%lu", admission_names[config->admission], config->window_npages);
+}
+
+
+/*
+ *
+ *  Count-min sketch
+ *
+ */
+
+static inline u64 adm_hash(struct mm_struct *mm, ulong address) {
+    return ml_page_hash(mm, address);
+}
+
+// counter of hash in row, rows use double hashing of the two halves of hash
+static inline ulong adm_counter_index(struct dime_admission_struct *adm, u64 hash, int row) {
+    u32 h1 = (u32) hash, h2 = (u32) (hash >> 32) | 1;
+    return (h1 + (ulong) row * h2) & adm->width_mask;
+}
+
+static inline u64 * adm_counter_word(struct dime_admission_struct *adm, int row, ulong index) {
+    return &adm->sketch[row * adm->row_words + (index >> 4)];
+}
+
+static inline uint adm_counter_shift(ulong index) {
+    return (index & 15) << 2;
+}
+
+// must be called with adm->lock held
+static uint adm_sketch_estimate(struct dime_admission_struct *adm, u64 hash) {
+    uint estimate = ADM_COUNTER_MAX;
+    ulong index;
+    int row;
+
+    for(row=0 ; row<ADM_SKETCH_DEPTH ; ++row) {
+        index = adm_counter_index(adm, hash, row);
+        estimate = min(estimate, (uint) (*adm_counter_word(adm, row, index) >> adm_counter_shift(index)) & ADM_COUNTER_MAX);
+    }
+    return estimate;
+}
+
+/*  adm_sketch_increment
+ *
+ *  Description:
+ *      Increments only counters of hash which are at current estimate
+ *      (conservative update), so that collisions inflate estimates less.
+ *      Schedules aging once sample_limit is reached. Must be called with
+ *      adm->lock held.
+ */
+static void adm_sketch_increment(struct dime_admission_struct *adm, u64 hash) {
+    uint estimate = adm_sketch_estimate(adm, hash);
+    ulong index;
+    u64 *word;
+    int row;
+
+    if(estimate < ADM_COUNTER_MAX) {
+        for(row=0 ; row<ADM_SKETCH_DEPTH ; ++row) {
+            index = adm_counter_index(adm, hash, row);
+            word = adm_counter_word(adm, row, index);
+            if(((*word >> adm_counter_shift(index)) & ADM_COUNTER_MAX) == estimate)
+                *word += 1ULL << adm_counter_shift(index);
+        }
+    }
+
+    if(++adm->samples >= adm->sample_limit && !adm->aging) {
+        adm->samples = 0;
+        adm->aging = true;
+        schedule_work(&adm->age_work);
+    }
+}
+
+// halves all counters, in chunks so that faults wait for at most one chunk
+static void adm_sketch_age(struct work_struct *work) {
+    struct dime_admission_struct *adm = container_of(work, struct dime_admission_struct, age_work);
+    ulong words = ADM_SKETCH_DEPTH * adm->row_words, i, j;
+
+    for(i=0 ; i<words ; i+=ADM_AGE_CHUNK_WORDS) {
+        spin_lock(&adm->lock);
+        for(j=i ; j<min(i + ADM_AGE_CHUNK_WORDS, words) ; ++j)
+            adm->sketch[j] = (adm->sketch[j] >> 1) & 0x7777777777777777ULL;
+        spin_unlock(&adm->lock);
+        cond_resched();
+    }
+
+    spin_lock(&adm->lock);
+    adm->aging = false;
+    spin_unlock(&adm->lock);
+}
+
+
+/*
+ *
+ *  Window and admission
+ *
+ */
+
+/*  adm_evict_window_page
+ *
+ *  Description:
+ *      Decides fate of page pushed out of the window. Page enters the policy
+ *      if the policy has a free page, cannot name its victim, or the victim
+ *      was faulted less often than this page; otherwise this page is
+ *      protected. Consumes window reference of mm.
+ */
+static void adm_evict_window_page(struct dime_instance_struct *dime_instance, struct dime_admission_struct *adm,
+                                    struct mm_struct *mm, ulong address) {
+    struct page_replacement_policy_struct *prp = READ_ONCE(dime_instance->prp);
+    struct mm_struct *victim_mm;
+    ulong victim_address;
+    pte_t *ptep = NULL;
+    int admit = 1;
+
+    if(mm) {
+        if(!ml_mm_get(mm))
+            goto release;       // owner has exited, page is gone
+
+        // page was unmapped since it entered the window
+        ptep = ml_get_ptep(mm, address);
+        admit = ml_is_inlist_pte(mm, address, ptep);
+        ml_put_ptep(ptep);
+        if(!admit)
+            goto put;
+    }
+
+    if(!prp || !prp->add_page)
+        goto put;
+
+    if(prp->peek_victim && prp->peek_victim(dime_instance, mm, address, &victim_mm, &victim_address)) {
+        spin_lock(&adm->lock);
+        admit = adm_sketch_estimate(adm, adm_hash(mm, address)) > adm_sketch_estimate(adm, adm_hash(victim_mm, victim_address));
+        spin_unlock(&adm->lock);
+    }
+
+    if(admit) {
+        prp->add_page(dime_instance, mm, address);
+        atomic_long_inc(&dime_instance->adm_admitted);
+    } else {
+        if(mm) {
+            trace_dime_evict(dime_instance->instance_id, mm, address, 0);
+            ptep = ml_get_ptep(mm, address);
+            sp_protect_pte(mm, address, ptep);
+            ml_put_ptep(ptep);
+        }
+        atomic_long_inc(&dime_instance->adm_rejected);
+    }
+
+put:
+    if(mm)
+        ml_mm_put(mm);
+release:
+    ml_mm_release(mm);
+}
+
+/*  dime_admission_add_page
+ *
+ *  Description:
+ *      Counts fault in the sketch and puts faulting page at window tail. If
+ *      window is full, its oldest page goes through admission against the
+ *      policy victim. Faulting page is always mapped, so it can be accessed
+ *      at least once. Returns 1, page was fetched from remote memory.
+ *      adm must be read under rcu_read_lock, which is held across the call.
+ */
+int dime_admission_add_page(struct dime_instance_struct *dime_instance, struct dime_admission_struct *adm,
+                                struct mm_struct *mm, ulong address) {
+    pte_t *ptep = (mm == NULL ? NULL : ml_get_ptep(mm, address));
+    struct lpl_node_struct *node;
+    struct mm_struct *old_mm = NULL;
+    ulong old_address = 0;
+    int full;
+
+    spin_lock(&adm->lock);
+    adm_sketch_increment(adm, adm_hash(mm, address));
+
+    full = list_empty(&adm->free_nodes);
+    if(full) {
+        // window reference moves to old page
+        node = list_first_entry(&adm->window, struct lpl_node_struct, list_node);
+        old_mm = node->mm;
+        old_address = node->address;
+    } else {
+        node = list_first_entry(&adm->free_nodes, struct lpl_node_struct, list_node);
+    }
+    node->mm = mm;
+    node->address = address;
+    ml_mm_hold(mm);
+    list_move_tail(&node->list_node, &adm->window);
+    ml_set_inlist_pte(mm, address, ptep);
+    spin_unlock(&adm->lock);
+    ml_put_ptep(ptep);
+
+    if(full)
+        adm_evict_window_page(dime_instance, adm, old_mm, old_address);
+
+    return 1;
+}
+
+/*  dime_admission_init
+ *
+ *  Description:
+ *      Creates admission filter of instance from its current config, called
+ *      when a policy is registered. Sketch has ADM_SKETCH_DEPTH rows of half
+ *      as many counters as local pages, rounded up to a power of two, i.e.
+ *      4MB for 10GB of local memory.
+ */
+int dime_admission_init(struct dime_instance_struct *dime_instance) {
+    struct dime_admission_struct *adm;
+    ulong local_npages, window_npages, width, i;
+
+    rcu_read_lock();
+    local_npages = dime_config_get(dime_instance)->local_npages;
+    window_npages = dime_config_get(dime_instance)->window_npages;
+    rcu_read_unlock();
+
+    RCU_INIT_POINTER(dime_instance->admission, NULL);
+    if(window_npages == 0)
+        return 0;
+
+    adm = (struct dime_admission_struct*) kzalloc(sizeof(struct dime_admission_struct), GFP_KERNEL);
+    if(!adm) {
+        DA_ERROR("unable to allocate memory");
+        return -ENOMEM;
+    }
+
+    width = roundup_pow_of_two(max(local_npages / 2, (ulong) ADM_MIN_WIDTH));
+    adm->row_words = width / 16;
+    adm->width_mask = width - 1;
+    adm->sample_limit = ADM_SAMPLE_FACTOR * local_npages;
+    adm->window_npages = window_npages;
+    spin_lock_init(&adm->lock);
+    INIT_WORK(&adm->age_work, adm_sketch_age);
+    INIT_LIST_HEAD(&adm->window);
+    INIT_LIST_HEAD(&adm->free_nodes);
+
+    adm->sketch = (u64*) vzalloc(sizeof(u64) * ADM_SKETCH_DEPTH * adm->row_words);
+    adm->nodes = (struct lpl_node_struct*) vzalloc(sizeof(struct lpl_node_struct) * window_npages);
+    if(!adm->sketch || !adm->nodes) {
+        DA_ERROR("unable to allocate memory");
+        vfree(adm->sketch);
+        vfree(adm->nodes);
+        kfree(adm);
+        return -ENOMEM;
+    }
+    for(i=0 ; i<window_npages ; ++i)
+        list_add_tail(&adm->nodes[i].list_node, &adm->free_nodes);
+
+    DA_INFO("instance %d : admission window %lu pages, sketch %lu KB", dime_instance->instance_id,
+                window_npages, (sizeof(u64) * ADM_SKETCH_DEPTH * adm->row_words) >> 10);
+    rcu_assign_pointer(dime_instance->admission, adm);
+    return 0;
+}
+
+/*  dime_admission_cleanup
+ *
+ *  Description:
+ *      Frees admission filter of instance when its policy is removed, pages
+ *      of the window are left as they are mapped, like pages of the policy.
+ *      Waits for faults still inside the filter before freeing it, and only
+ *      then for aging, which those faults may have scheduled.
+ */
+void dime_admission_cleanup(struct dime_instance_struct *dime_instance) {
+    struct dime_admission_struct *adm = rcu_dereference_protected(dime_instance->admission, 1);
+    struct lpl_node_struct *node;
+
+    if(!adm)
+        return;
+
+    RCU_INIT_POINTER(dime_instance->admission, NULL);
+    synchronize_rcu();
+    cancel_work_sync(&adm->age_work);
+    list_for_each_entry(node, &adm->window, list_node)
+        ml_mm_release(node->mm);
+
+    vfree(adm->sketch);
+    vfree(adm->nodes);
+    kfree(adm);
+}
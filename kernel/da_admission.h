@@ -0,0 +1,46 @@
+#ifndef __DA_ADMISSION_H__
+#define __DA_ADMISSION_H__
+
+#include <linux/workqueue.h>
+
+#include "common.h"
+
+#define ADM_SKETCH_DEPTH    4
+
+
+/*
+ *  W-TinyLFU admission filter of an instance. A faulted page first enters
+ *  the window, a small list of recently faulted pages ordered by fault. The
+ *  page pushed out of the window enters the policy only if its estimated
+ *  fault frequency is higher than that of the page the policy would evict,
+ *  else it is evicted itself.
+ *
+ *  Frequency is estimated with a count-min sketch of ADM_SKETCH_DEPTH rows
+ *  of 4 bit counters, 16 per word, updated on every fault and halved after
+ *  ADM_SAMPLE_FACTOR samples per local page, so that old history fades.
+ */
+struct dime_admission_struct {
+    spinlock_t              lock;           // protects window and sketch counters
+    u64                     *sketch;
+    ulong                   row_words;      // words of one row
+    ulong                   width_mask;     // counters of one row - 1
+    ulong                   samples;        // increments since last aging
+    ulong                   sample_limit;
+    bool                    aging;          // age_work is pending or running
+    struct work_struct      age_work;
+
+    struct lpl_node_struct  *nodes;         // window_npages nodes, hold mm_count reference while in window
+    struct list_head        window;         // oldest page at head
+    struct list_head        free_nodes;
+    ulong                   window_npages;
+};
+
+
+int     dime_admission_parse    (const char *name);
+void    dime_admission_show     (struct seq_file *m, const struct dime_config_struct *config);
+int     dime_admission_init     (struct dime_instance_struct *dime_instance);
+void    dime_admission_cleanup  (struct dime_instance_struct *dime_instance);
+int     dime_admission_add_page (struct dime_instance_struct *dime_instance, struct dime_admission_struct *adm,
+                                    struct mm_struct *mm, ulong address);
+
+#endif
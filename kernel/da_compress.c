@@ -0,0 +1,500 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+#include <linux/percpu.h>
+#include <linux/highmem.h>
+#include <linux/crypto.h>
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/clock.h>
+#endif
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_compress.h"
+
+/*****
+ *
+ *  Compressed tier of evicted pages.
+ *
+ *  With tier=compress, a page evicted by the policy is compressed with
+ *  compress_alg into a pool of the instance, like zswap would do, and a
+ *  fault on it decompresses it again. Page itself stays mapped and
+ *  protected, so the pool holds a copy; costs of compression and
+ *  decompression are real, and are paid by the faulting task as they would
+ *  be in reclaim and fault. With compress_cost=replace, a page found in the
+ *  pool costs only its decompression, else remote fetch delay is injected
+ *  on top. Pool is limited to compress_pool_npages pages of memory, oldest
+ *  pages are written back to remote memory to make room, and their next
+ *  fault pays remote fetch delay. Incompressible pages go to remote memory
+ *  at once.
+ *
+ */
+
+#define PROCFS_NAME             "dime_compress"
+
+#define COMPRESS_HASH_BITS      12
+#define COMPRESS_HIST           16          // log2 buckets of ns, from below 256ns
+#define COMPRESS_HIST_SHIFT     8
+
+static const char *cost_names[] = {
+    [DIME_COMPRESS_COST_ADD]        = "add",
+    [DIME_COMPRESS_COST_REPLACE]    = "replace",
+};
+
+struct compress_entry_struct {
+    struct hlist_node       hash_node;
+    struct list_head        lru_node;       // oldest first
+    struct mm_struct        *mm;            // holds mm_count reference
+    ulong                   address;
+    unsigned int            clen;           // compressed length
+    unsigned int            alloc_size;     // bytes taken from slab for entry
+    u8                      data[];
+};
+
+struct dime_compress_pool {
+    char                    alg[DIME_COMPRESS_ALG_MAX];
+    struct crypto_comp * __percpu *tfm;
+    spinlock_t              lock;           // hash, lru and sizes
+    DECLARE_HASHTABLE(hash, COMPRESS_HASH_BITS);
+    struct list_head        lru;
+    ulong                   npages;
+    ulong                   bytes;          // compressed bytes
+    ulong                   alloc_bytes;    // slab bytes, counted against capacity
+    atomic_long_t           hist_compress[COMPRESS_HIST];
+    atomic_long_t           hist_decompress[COMPRESS_HIST];
+};
+
+// Destination of compression and decompression, two pages since output may grow
+static DEFINE_PER_CPU(u8 *, compress_buffer);
+static DEFINE_MUTEX(compress_lock);        // pool replacement
+static bool compress_active = false;
+
+int dime_compress_parse_cost(const char *name) {
+    int i;
+
+    for(i=0 ; i<ARRAY_SIZE(cost_names) ; ++i) {
+        if(strcmp(name, cost_names[i]) == 0)
+            return i;
+    }
+    DA_ERROR("invalid compress_cost : %s", name);
+    return -EINVAL;
+}
+
+// Prints compressed tier of config in tier column, e.g. "compress/lz4/4096/replace"
+void dime_compress_show(struct seq_file *m, const struct dime_config_struct *config) {
+    seq_printf(m, "compress/%s/%lu/%s", config->compress_alg, config->compress_pool_npages,
+                    cost_names[config->compress_cost]);
+}
+
+int dime_compress_check(const struct dime_config_struct *config) {
+    if(!crypto_has_comp(config->compress_alg, 0, 0)) {
+        DA_ERROR("compression algorithm %s is not available", config->compress_alg);
+        return -ENOENT;
+    }
+    return 0;
+}
+
+static inline int compress_hist_bucket(u64 ns) {
+    int bucket = fls64(ns >> COMPRESS_HIST_SHIFT);
+    return bucket < COMPRESS_HIST ? bucket : COMPRESS_HIST - 1;
+}
+
+static struct compress_entry_struct *compress_find(struct dime_compress_pool *pool, struct mm_struct *mm, ulong address) {
+    struct compress_entry_struct *entry;
+
+    hash_for_each_possible(pool->hash, entry, hash_node, ml_page_hash(mm, address)) {
+        if(entry->mm == mm && entry->address == address)
+            return entry;
+    }
+    return NULL;
+}
+
+// Unlinks entry, must be called with pool lock held
+static void __compress_del(struct dime_compress_pool *pool, struct compress_entry_struct *entry) {
+    hash_del(&entry->hash_node);
+    list_del(&entry->lru_node);
+    --pool->npages;
+    pool->bytes -= entry->clen;
+    pool->alloc_bytes -= entry->alloc_size;
+}
+
+static void compress_free_entry(struct compress_entry_struct *entry) {
+    ml_mm_release(entry->mm);
+    kfree(entry);
+}
+
+/*  dime_compress_evict
+ *
+ *  Description:
+ *      Compresses page just evicted by the policy into pool of the instance,
+ *      making room by writing back oldest pages. Called under policy locks.
+ */
+void dime_compress_evict(struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address) {
+    struct dime_compress_pool *pool;
+    struct compress_entry_struct *entry = NULL, *old, *tmp;
+    struct page *page = NULL;
+    unsigned int dlen = 2 * PAGE_SIZE;
+    ulong capacity;
+    pte_t *ptep;
+    LIST_HEAD(free_list);
+    u64 start_ns, time_ns;
+    u8 *src, *dst;
+    int ret;
+
+    address &= PAGE_MASK;
+    if(!ml_mm_get(mm))
+        return;
+    ptep = ml_get_ptep(mm, address);
+    if(ptep && pte_present(*ptep) && pfn_valid(pte_pfn(*ptep))) {
+        page = pte_page(*ptep);
+        if(!get_page_unless_zero(page))
+            page = NULL;
+    }
+    ml_put_ptep(ptep);
+    ml_mm_put(mm);
+    if(!page)
+        return;
+
+    rcu_read_lock();
+    pool = rcu_dereference(dime_instance->compress);
+    if(!pool)
+        goto exit;
+    capacity = dime_config_get(dime_instance)->compress_pool_npages * PAGE_SIZE;
+
+    start_ns = sched_clock();
+    dst = *get_cpu_ptr(&compress_buffer);
+    src = kmap_atomic(page);
+    ret = crypto_comp_compress(*this_cpu_ptr(pool->tfm), src, PAGE_SIZE, dst, &dlen);
+    kunmap_atomic(src);
+    if(ret == 0 && dlen < PAGE_SIZE) {
+        entry = kmalloc(sizeof(struct compress_entry_struct) + dlen, GFP_ATOMIC | __GFP_NOWARN);
+        if(entry)
+            memcpy(entry->data, dst, dlen);
+    }
+    put_cpu_ptr(&compress_buffer);
+    time_ns = sched_clock() - start_ns;
+
+    atomic_long_add(time_ns, &dime_instance->time_compress);
+    atomic_long_inc(&pool->hist_compress[compress_hist_bucket(time_ns)]);
+    if(!entry) {
+        // incompressible, or no memory for it, page goes to remote memory
+        atomic_long_inc(&dime_instance->compress_rejected);
+        goto exit;
+    }
+
+    ml_mm_hold(mm);
+    entry->mm = mm;
+    entry->address = address;
+    entry->clen = dlen;
+    entry->alloc_size = ksize(entry);
+
+    spin_lock(&pool->lock);
+    old = compress_find(pool, mm, address);
+    if(old) {
+        __compress_del(pool, old);
+        list_add(&old->lru_node, &free_list);
+    }
+    hash_add(pool->hash, &entry->hash_node, ml_page_hash(mm, address));
+    list_add_tail(&entry->lru_node, &pool->lru);
+    ++pool->npages;
+    pool->bytes += entry->clen;
+    pool->alloc_bytes += entry->alloc_size;
+
+    // oldest pages are written back to remote memory, pages of exited processes dropped
+    list_for_each_entry_safe(old, tmp, &pool->lru, lru_node) {
+        bool dead = atomic_read(&old->mm->mm_users) == 0;
+        if(old == entry || (!dead && (capacity == 0 || pool->alloc_bytes <= capacity)))
+            break;
+        __compress_del(pool, old);
+        list_add(&old->lru_node, &free_list);
+        if(!dead)
+            atomic_long_inc(&dime_instance->compress_evicted);
+    }
+    spin_unlock(&pool->lock);
+    atomic_long_inc(&dime_instance->compress_stored);
+
+    list_for_each_entry_safe(old, tmp, &free_list, lru_node)
+        compress_free_entry(old);
+exit:
+    rcu_read_unlock();
+    put_page(page);
+}
+
+/*  dime_compress_fault
+ *
+ *  Description:
+ *      Decompresses faulted page if it is in pool of the instance, and takes
+ *      it out of the pool. Returns true if page was found and its
+ *      decompression replaces remote fetch delay.
+ */
+bool dime_compress_fault(struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address) {
+    struct dime_compress_pool *pool;
+    struct compress_entry_struct *entry = NULL;
+    unsigned int dlen = 2 * PAGE_SIZE;
+    bool replace = false;
+    u64 start_ns, time_ns;
+    u8 *dst;
+    int ret;
+
+    address &= PAGE_MASK;
+    rcu_read_lock();
+    pool = rcu_dereference(dime_instance->compress);
+    if(!pool)
+        goto exit;
+
+    spin_lock(&pool->lock);
+    entry = compress_find(pool, mm, address);
+    if(entry)
+        __compress_del(pool, entry);
+    spin_unlock(&pool->lock);
+    if(!entry)
+        goto exit;
+
+    start_ns = sched_clock();
+    dst = *get_cpu_ptr(&compress_buffer);
+    ret = crypto_comp_decompress(*this_cpu_ptr(pool->tfm), entry->data, entry->clen, dst, &dlen);
+    put_cpu_ptr(&compress_buffer);
+    time_ns = sched_clock() - start_ns;
+    if(ret || dlen != PAGE_SIZE)
+        DA_ERROR("decompression failed : %d, %u bytes", ret, dlen);
+
+    atomic_long_inc(&dime_instance->compress_hits);
+    atomic_long_add(time_ns, &dime_instance->time_decompress);
+    atomic_long_inc(&pool->hist_decompress[compress_hist_bucket(time_ns)]);
+    replace = dime_config_get(dime_instance)->compress_cost == DIME_COMPRESS_COST_REPLACE;
+    compress_free_entry(entry);
+exit:
+    rcu_read_unlock();
+    return replace;
+}
+
+// Pool gauges of the instance, all 0 without a pool
+void dime_compress_usage(struct dime_instance_struct *dime_instance, u64 *npages, u64 *bytes, u64 *alloc_bytes) {
+    struct dime_compress_pool *pool;
+
+    *npages = *bytes = *alloc_bytes = 0;
+    rcu_read_lock();
+    pool = rcu_dereference(dime_instance->compress);
+    if(pool) {
+        spin_lock(&pool->lock);
+        *npages = pool->npages;
+        *bytes = pool->bytes;
+        *alloc_bytes = pool->alloc_bytes;
+        spin_unlock(&pool->lock);
+    }
+    rcu_read_unlock();
+}
+
+void dime_compress_free(struct dime_compress_pool *pool) {
+    struct compress_entry_struct *entry, *tmp;
+    int cpu;
+
+    if(!pool)
+        return;
+    list_for_each_entry_safe(entry, tmp, &pool->lru, lru_node)
+        compress_free_entry(entry);
+    if(pool->tfm) {
+        for_each_possible_cpu(cpu) {
+            struct crypto_comp *tfm = *per_cpu_ptr(pool->tfm, cpu);
+            if(!IS_ERR_OR_NULL(tfm))
+                crypto_free_comp(tfm);
+        }
+        free_percpu(pool->tfm);
+    }
+    kfree(pool);
+}
+
+/*  dime_compress_prepare
+ *
+ *  Description:
+ *      Allocates pool for config about to be published, if instance gets a
+ *      compressed tier or changes its algorithm. Returns NULL if current
+ *      pool, or no pool, is fine, ERR_PTR on failure.
+ */
+struct dime_compress_pool *dime_compress_prepare(struct dime_instance_struct *dime_instance, const struct dime_config_struct *config) {
+    struct dime_compress_pool *pool, *current_pool = NULL;
+    int cpu;
+
+    if(config->tier != DIME_TIER_COMPRESS)
+        return NULL;
+    if(dime_instance)
+        current_pool = rcu_dereference_protected(dime_instance->compress, 1);
+    if(current_pool && strcmp(current_pool->alg, config->compress_alg) == 0)
+        return NULL;
+
+    pool = kzalloc(sizeof(struct dime_compress_pool), GFP_KERNEL);
+    if(!pool) {
+        DA_ERROR("unable to allocate memory");
+        return ERR_PTR(-ENOMEM);
+    }
+    strscpy(pool->alg, config->compress_alg, sizeof(pool->alg));
+    spin_lock_init(&pool->lock);
+    hash_init(pool->hash);
+    INIT_LIST_HEAD(&pool->lru);
+
+    pool->tfm = alloc_percpu(struct crypto_comp *);
+    if(!pool->tfm) {
+        dime_compress_free(pool);
+        DA_ERROR("unable to allocate memory");
+        return ERR_PTR(-ENOMEM);
+    }
+    for_each_possible_cpu(cpu) {
+        struct crypto_comp *tfm = crypto_alloc_comp(pool->alg, 0, 0);
+        *per_cpu_ptr(pool->tfm, cpu) = tfm;
+        if(IS_ERR(tfm)) {
+            DA_ERROR("could not allocate %s compressor : %ld", pool->alg, PTR_ERR(tfm));
+            dime_compress_free(pool);
+            return ERR_PTR(-ENOMEM);
+        }
+    }
+    return pool;
+}
+
+/*  dime_compress_install
+ *
+ *  Description:
+ *      Swaps in pool prepared for the published config, or drops current
+ *      pool if config has no compressed tier. Pages of a dropped pool go
+ *      to remote memory.
+ */
+void dime_compress_install(struct dime_instance_struct *dime_instance, struct dime_compress_pool *pool) {
+    struct dime_compress_pool *old;
+    bool keep;
+
+    mutex_lock(&compress_lock);
+    rcu_read_lock();
+    keep = !pool && dime_config_get(dime_instance)->tier == DIME_TIER_COMPRESS;
+    rcu_read_unlock();
+    if(keep || !compress_active) {
+        mutex_unlock(&compress_lock);
+        dime_compress_free(pool);       // module is going away
+        return;
+    }
+
+    old = rcu_dereference_protected(dime_instance->compress, lockdep_is_held(&compress_lock));
+    rcu_assign_pointer(dime_instance->compress, pool);
+    mutex_unlock(&compress_lock);
+
+    if(old) {
+        synchronize_rcu();
+        dime_compress_free(old);
+    }
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+    struct dime_instance_struct *dime_instance = v;
+    struct dime_compress_pool *pool;
+    ulong npages, bytes, alloc_bytes;
+    int i;
+
+    if(v == SEQ_START_TOKEN) {
+        seq_puts(m, "instance_id alg npages bytes alloc_bytes ratio frag_pct compress_hist decompress_hist\n");
+        return 0;
+    }
+
+    rcu_read_lock();
+    pool = rcu_dereference(dime_instance->compress);
+    if(!pool) {
+        rcu_read_unlock();
+        return 0;
+    }
+    spin_lock(&pool->lock);
+    npages = pool->npages;
+    bytes = pool->bytes;
+    alloc_bytes = pool->alloc_bytes;
+    spin_unlock(&pool->lock);
+
+    // ratio of page bytes to compressed bytes, fragmentation as slab bytes not holding data
+    seq_printf(m, "%d %s %lu %lu %lu %lu.%02lu %lu ", dime_instance->instance_id, pool->alg,
+                    npages, bytes, alloc_bytes,
+                    bytes ? npages * PAGE_SIZE / bytes : 0,
+                    bytes ? npages * PAGE_SIZE * 100 / bytes % 100 : 0,
+                    alloc_bytes ? (alloc_bytes - bytes) * 100 / alloc_bytes : 0);
+    for(i=0 ; i<COMPRESS_HIST ; ++i)
+        seq_printf(m, "%s%ld", i ? "," : "", atomic_long_read(&pool->hist_compress[i]));
+    seq_putc(m, ' ');
+    for(i=0 ; i<COMPRESS_HIST ; ++i)
+        seq_printf(m, "%s%ld", i ? "," : "", atomic_long_read(&pool->hist_decompress[i]));
+    seq_putc(m, '\n');
+    rcu_read_unlock();
+    return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+    .start  = dime_instance_seq_start,
+    .next   = dime_instance_seq_next,
+    .stop   = dime_instance_seq_stop,
+    .show   = procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &procfile_seq_ops);
+}
+
+DIME_DEFINE_PROC_OPS(compress_file_ops, procfile_open, NULL);
+
+static void compress_free_buffers(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        kfree(per_cpu(compress_buffer, cpu));
+        per_cpu(compress_buffer, cpu) = NULL;
+    }
+}
+
+int init_dime_compress(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        u8 *buffer = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+        if(!buffer) {
+            DA_ERROR("unable to allocate memory");
+            compress_free_buffers();
+            return -ENOMEM;
+        }
+        per_cpu(compress_buffer, cpu) = buffer;
+    }
+
+    if(proc_create(PROCFS_NAME, S_IFREG | S_IRUGO, NULL, &compress_file_ops) == NULL) {
+        DA_ALERT("could not initialize /proc/%s\n", PROCFS_NAME);
+        compress_free_buffers();
+        return -ENOMEM;
+    }
+
+    mutex_lock(&compress_lock);
+    compress_active = true;
+    mutex_unlock(&compress_lock);
+    DA_INFO("proc entry \"/proc/%s\" created\n", PROCFS_NAME);
+    return 0;
+}
+
+void cleanup_dime_compress(void) {
+    struct dime_compress_pool *pool;
+    int i;
+
+    remove_proc_entry(PROCFS_NAME, NULL);
+
+    // pools are dropped, faults see no pool and leave buffers alone
+    mutex_lock(&compress_lock);
+    compress_active = false;
+    for(i=0 ; i<dime.dime_instances_size ; ++i) {
+        pool = rcu_dereference_protected(dime.dime_instances[i].compress, lockdep_is_held(&compress_lock));
+        RCU_INIT_POINTER(dime.dime_instances[i].compress, NULL);
+        if(pool) {
+            synchronize_rcu();
+            dime_compress_free(pool);
+        }
+    }
+    mutex_unlock(&compress_lock);
+
+    compress_free_buffers();
+    DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
+}
@@ -0,0 +1,20 @@
+#ifndef __DA_COMPRESS_H__
+#define __DA_COMPRESS_H__
+
+
+#include "common.h"
+
+int     init_dime_compress      (void);
+void    cleanup_dime_compress   (void);
+int     dime_compress_parse_cost(const char *name);
+void    dime_compress_show      (struct seq_file *m, const struct dime_config_struct *config);
+int     dime_compress_check     (const struct dime_config_struct *config);
+struct dime_compress_pool *dime_compress_prepare(struct dime_instance_struct *dime_instance, const struct dime_config_struct *config);
+void    dime_compress_install   (struct dime_instance_struct *dime_instance, struct dime_compress_pool *pool);
+void    dime_compress_free      (struct dime_compress_pool *pool);
+void    dime_compress_evict     (struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address);
+bool    dime_compress_fault     (struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address);
+void    dime_compress_usage     (struct dime_instance_struct *dime_instance, u64 *npages, u64 *bytes, u64 *alloc_bytes);
+
+
+#endif
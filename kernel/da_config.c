@@ -1,24 +1,28 @@
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/timekeeping.h>
 #include <asm/uaccess.h>
 #include "da_config.h"
+#include "da_ptracker.h"
+#include "da_latency.h"
+#include "da_admission.h"
+#include "da_resource.h"
+#include "da_offload.h"
+#include "da_compress.h"
 
-#define PROCFS_MAX_SIZE     102400
 #define PROCFS_NAME         "dime_config"
-static char procfs_buffer[PROCFS_MAX_SIZE];     // The buffer used to store character for this module
-static unsigned long procfs_buffer_size = 0;    // The size of the buffer
 
-static ssize_t procfile_read(struct file*, char*, size_t, loff_t*);
-static ssize_t procfile_write(struct file *, const char *, size_t, loff_t *);
+static int procfile_open(struct inode *inode, struct file *file);
+static ssize_t procfile_write(struct file *, const char __user *, size_t, loff_t *);
 
 struct proc_dir_entry *dime_config_entry;
 
-static struct file_operations cmd_file_ops = {  
-    .owner = THIS_MODULE,
-    .read = procfile_read,
-    .write = procfile_write,
-};
+DIME_DEFINE_PROC_OPS(cmd_file_ops, procfile_open, procfile_write);
 
 int init_dime_config_procfs(void) {
     dime_config_entry = proc_create(PROCFS_NAME, S_IFREG | S_IRUGO, NULL, &cmd_file_ops);
@@ -45,79 +49,486 @@ void cleanup_dime_config_procfs(void) {
     DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
 }
 
-static ssize_t procfile_read(struct file *file, char *buffer, size_t length, loff_t *offset) {
-    int ret;
-    int seg_size;
-    
-    if(*offset == 0) {
-        // offset is 0, so first call to read the file.
-        // Initialize buffer with config parameters currently set
-        int i, j;
-                                                    // 1         2          3                    4            5                6             7             8             9          10         11          12          13                 14           15          16              17              18                     19
-        procfs_buffer_size = sprintf(procfs_buffer, "instance_id latency_ns bandwidth_bps        local_npages page_fault_count duplecate_pfs pc_pagefaults an_pagefaults time_pfh   time_ap    time_inject time_pfh_ap time_pfh_ap_inject time_pfh_ppf time_ap_ppf time_inject_ppf time_pfh_ap_ppf time_pfh_ap_inject_ppf pid\n");
-        for(i=0 ; i<dime.dime_instances_size ; ++i) {
-            unsigned long long total_pf             = atomic_long_read(&dime.dime_instances[i].pagefaults);
-            unsigned long long dup_pfs              = atomic_long_read(&dime.dime_instances[i].duplecate_pfs);
-            unsigned long long time_pfh             = atomic_long_read(&dime.dime_instances[i].time_pfh);
-            unsigned long long time_ap              = atomic_long_read(&dime.dime_instances[i].time_ap);
-            unsigned long long time_inject          = atomic_long_read(&dime.dime_instances[i].time_inject);
-            unsigned long long time_pfh_ap          = atomic_long_read(&dime.dime_instances[i].time_pfh_ap);
-            unsigned long long time_pfh_ap_inject   = atomic_long_read(&dime.dime_instances[i].time_pfh_ap_inject);
-            total_pf = total_pf<=0 ? 1 : total_pf;
-            procfs_buffer_size += sprintf(procfs_buffer+procfs_buffer_size, 
-                                            //1   2     3     4     5      6      7      8      9      10     11     12     13     14     15     16     17     18
-                                            "%11d %10lu %20lu %12lu %16llu %13llu %13lu %13lu %10llu %10llu %11llu %11llu %18llu %12llu %11llu %15llu %15llu %22llu ", 
-                                                                        dime.dime_instances[i].instance_id, // 1
-                                                                        dime.dime_instances[i].latency_ns, // 2
-                                                                        dime.dime_instances[i].bandwidth_bps, // 3
-                                                                        dime.dime_instances[i].local_npages, // 4
-                                                                        total_pf, // 5
-                                                                        dup_pfs, // 6
-                                                                        atomic_long_read(&dime.dime_instances[i].pc_pagefaults), // 7
-                                                                        atomic_long_read(&dime.dime_instances[i].an_pagefaults), // 8
-                                                                        time_pfh, // 9
-                                                                        time_ap, // 10
-                                                                        time_inject, // 11
-                                                                        time_pfh_ap, // 12
-                                                                        time_pfh_ap_inject, // 13
-                                                                        time_pfh / total_pf, // 14
-                                                                        time_ap / total_pf, // 15
-                                                                        time_inject / total_pf, // 16
-                                                                        time_pfh_ap / total_pf, // 17
-                                                                        time_pfh_ap_inject / total_pf); // 18
-            for(j=0 ; j<dime.dime_instances[i].pid_count ; ++j) {
-                procfs_buffer_size += sprintf(procfs_buffer+procfs_buffer_size, "%d,", dime.dime_instances[i].pid[j]);
-            }
-            procfs_buffer[procfs_buffer_size++] = '\n';
-        }
+/*
+ *  Instances are never freed and dime_instances_size only grows, so readers
+ *  walk the array without any lock. Each reader has its own seq_file buffer.
+ */
+void *dime_instance_seq_start(struct seq_file *m, loff_t *pos) {
+    if(*pos == 0)
+        return SEQ_START_TOKEN;
+    if(*pos <= dime.dime_instances_size)
+        return &dime.dime_instances[*pos - 1];
+    return NULL;
+}
+EXPORT_SYMBOL(dime_instance_seq_start);
+
+void *dime_instance_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++*pos;
+    return dime_instance_seq_start(m, pos);
+}
+EXPORT_SYMBOL(dime_instance_seq_next);
+
+void dime_instance_seq_stop(struct seq_file *m, void *v) {
+}
+EXPORT_SYMBOL(dime_instance_seq_stop);
+
+// Prints page cache cost and class quotas as one column, "-" if page cache is same as anon
+static void show_page_classes(struct seq_file *m, const struct dime_config_struct *config) {
+    bool separate_cost = config->pc_latency_ns != DIME_CONFIG_FOLLOW_ANON || config->pc_bandwidth_bps != DIME_CONFIG_FOLLOW_ANON;
+
+    if(!separate_cost && config->class_npages[DIME_PAGE_ANON] == 0) {
+        seq_putc(m, '-');
+        return;
+    }
+    if(separate_cost)
+        seq_printf(m, "pc=%lu/%lu", config->class_latency_ns[DIME_PAGE_CACHE],
+                    config->pc_bandwidth_bps != DIME_CONFIG_FOLLOW_ANON ? config->pc_bandwidth_bps : config->bandwidth_bps);
+    if(config->class_npages[DIME_PAGE_ANON])
+        seq_printf(m, "%squota=%lu/%lu", separate_cost ? "," : "",
+                    config->class_npages[DIME_PAGE_ANON], config->class_npages[DIME_PAGE_CACHE]);
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+    struct dime_instance_struct *dime_instance = v;
+    struct dime_config_struct *config;
+    struct pt_node_struct *node;
+    struct cgroup *cgrp;
+    char cgrp_path[128];
+    unsigned long long total_pf, dup_pfs, time_pfh, time_ap, time_inject, time_pfh_ap, time_pfh_ap_inject;
+
+    if(v == SEQ_START_TOKEN) {
+                    // 1         2          3                    4            5                6             7             8             9          10         11          12          13                 14           15          16              17              18                     19              20           21        22        23     24   25     26
+        seq_puts(m, "instance_id latency_ns bandwidth_bps        local_npages page_fault_count duplecate_pfs pc_pagefaults an_pagefaults time_pfh   time_ap    time_inject time_pfh_ap time_pfh_ap_inject time_pfh_ppf time_ap_ppf time_inject_ppf time_pfh_ap_ppf time_pfh_ap_inject_ppf latency_profile page_classes admission resources fabric tier cgroup pid\n");
+        return 0;
     }
 
-    // calculate max size of block that can be read
-    seg_size = length < procfs_buffer_size ? length : procfs_buffer_size;
-    if (*offset >= procfs_buffer_size) {
-        ret  = 0;   // offset value beyond the available data to read, finish reading
+    total_pf            = atomic_long_read(&dime_instance->pagefaults);
+    dup_pfs             = atomic_long_read(&dime_instance->duplecate_pfs);
+    time_pfh            = atomic_long_read(&dime_instance->time_pfh);
+    time_ap             = atomic_long_read(&dime_instance->time_ap);
+    time_inject         = atomic_long_read(&dime_instance->time_inject);
+    time_pfh_ap         = atomic_long_read(&dime_instance->time_pfh_ap);
+    time_pfh_ap_inject  = atomic_long_read(&dime_instance->time_pfh_ap_inject);
+    total_pf = total_pf<=0 ? 1 : total_pf;
+
+    rcu_read_lock();
+    config = dime_config_get(dime_instance);
+    seq_printf(m,
+                //1   2     3     4     5      6      7      8      9      10     11     12     13     14     15     16     17     18
+                "%11d %10lu %20lu %12lu %16llu %13llu %13lu %13lu %10llu %10llu %11llu %11llu %18llu %12llu %11llu %15llu %15llu %22llu ",
+                                            dime_instance->instance_id, // 1
+                                            config->latency_ns, // 2
+                                            config->bandwidth_bps, // 3
+                                            config->local_npages, // 4
+                                            total_pf, // 5
+                                            dup_pfs, // 6
+                                            atomic_long_read(&dime_instance->pc_pagefaults), // 7
+                                            atomic_long_read(&dime_instance->an_pagefaults), // 8
+                                            time_pfh, // 9
+                                            time_ap, // 10
+                                            time_inject, // 11
+                                            time_pfh_ap, // 12
+                                            time_pfh_ap_inject, // 13
+                                            time_pfh / total_pf, // 14
+                                            time_ap / total_pf, // 15
+                                            time_inject / total_pf, // 16
+                                            time_pfh_ap / total_pf, // 17
+                                            time_pfh_ap_inject / total_pf); // 18
+    dime_latency_show(m, config);   // 19
+    seq_putc(m, ' ');
+    show_page_classes(m, config);   // 20
+    seq_putc(m, ' ');
+    dime_admission_show(m, config); // 21
+    seq_putc(m, ' ');
+    dime_resource_show(m, config);  // 22
+    seq_putc(m, ' ');
+    dime_latency_show_fabric(m, config);    // 23
+    seq_putc(m, ' ');
+    dime_tier_show(m, config);      // 24
+    seq_putc(m, ' ');
+    cgrp = rcu_dereference(dime_instance->cgrp);
+    if(cgrp && cgroup_path(cgrp, cgrp_path, sizeof(cgrp_path)) >= 0) {
+        seq_printf(m, "%s ", cgrp_path);
     } else {
-        memcpy(buffer, procfs_buffer, seg_size);
-        *offset += seg_size;    // increment offset value
-        ret = seg_size;         // return number of bytes read
+        seq_puts(m, "- ");
     }
+    list_for_each_entry_rcu(node, &dime_instance->pid_list, list_node) {
+        // pid number as seen from pid namespace of the reader
+        seq_printf(m, "%d,", pid_vnr(node->pid_s));
+    }
+    rcu_read_unlock();
+    seq_putc(m, '\n');
+    return 0;
+}
 
-    return ret;
+static const struct seq_operations procfile_seq_ops = {
+    .start  = dime_instance_seq_start,
+    .next   = dime_instance_seq_next,
+    .stop   = dime_instance_seq_stop,
+    .show   = procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &procfile_seq_ops);
+}
+
+// serializes writers of procfs file
+static DEFINE_MUTEX(procfile_write_lock);
+// serializes config updates of all instances
+static DEFINE_MUTEX(dime_config_lock);
+
+/*
+ *  Parameters of one write. Nothing is applied until all of them are parsed
+ *  and validated, -1 means not given.
+ */
+struct config_update_struct {
+    long long int   instance_id;
+    long long int   latency_ns;
+    long long int   bandwidth_bps;
+    long long int   local_npages;
+    long long int   page_fault_count;
+    long long int   pc_latency_ns;      // UPDATE_FOLLOW_ANON to charge page cache as anon
+    long long int   pc_bandwidth_bps;
+    long long int   an_local_npages;
+    long long int   pc_local_npages;
+    long long int   admission;
+    long long int   admission_window_pct;
+    long long int   link;               // UPDATE_RESOURCE_NONE to detach
+    long long int   server;
+    long long int   tier;
+    char            compress_alg[DIME_COMPRESS_ALG_MAX];    // empty if not given
+    long long int   compress_pool_npages;
+    long long int   compress_cost;
+    long long int   latency_dist;
+    long long int   latency_stddev_ns;
+    long long int   latency_sigma_milli;
+    int             latency_cdf_points;
+    struct dime_latency_cdf_point latency_cdf[DIME_LATENCY_CDF_MAX];
+    long long int   congestion_period_ms;
+    long long int   congestion_duration_ms;
+    long long int   congestion_latency_pct;
+    long long int   congestion_bandwidth_pct;
+    long long int   fabric_seed;
+    long long int   loss_ppm;
+    long long int   loss_timeout_ns;
+    long long int   brownout_period_ms;
+    long long int   brownout_duration_ms;
+    long long int   spike_ppm;
+    long long int   spike_ns;
+    pid_t           *pids;              // grown on demand
+    long long int   pid_count;
+    long long int   pids_capacity;
+    char            *cgroup;            // empty path unbinds cgroup
+};
+
+#define UPDATE_FOLLOW_ANON  -2
+#define UPDATE_RESOURCE_NONE -2
+
+static void init_config_update(struct config_update_struct *update) {
+    memset(update, 0, sizeof(struct config_update_struct));
+    update->instance_id                 = -1;
+    update->latency_ns                  = -1;
+    update->bandwidth_bps               = -1;
+    update->local_npages                = -1;
+    update->page_fault_count            = -1;
+    update->pc_latency_ns               = -1;
+    update->pc_bandwidth_bps            = -1;
+    update->an_local_npages             = -1;
+    update->pc_local_npages             = -1;
+    update->admission                   = -1;
+    update->admission_window_pct        = -1;
+    update->link                        = -1;
+    update->server                      = -1;
+    update->tier                        = -1;
+    update->compress_pool_npages        = -1;
+    update->compress_cost               = -1;
+    update->latency_dist                = -1;
+    update->latency_stddev_ns           = -1;
+    update->latency_sigma_milli         = -1;
+    update->latency_cdf_points          = -1;
+    update->congestion_period_ms        = -1;
+    update->congestion_duration_ms      = -1;
+    update->congestion_latency_pct      = -1;
+    update->congestion_bandwidth_pct    = -1;
+    update->fabric_seed                 = -1;
+    update->loss_ppm                    = -1;
+    update->loss_timeout_ns             = -1;
+    update->brownout_period_ms          = -1;
+    update->brownout_duration_ms        = -1;
+    update->spike_ppm                   = -1;
+    update->spike_ns                    = -1;
+    update->pid_count                   = -1;
+}
+
+// Default config of a new instance
+static const struct dime_config_struct dime_config_default = {
+    .latency_ns     = 10000ULL,
+    .bandwidth_bps  = 10000000000ULL,
+    .local_npages   = 20ULL,
+    .pc_latency_ns      = DIME_CONFIG_FOLLOW_ANON,
+    .pc_bandwidth_bps   = DIME_CONFIG_FOLLOW_ANON,
+    .admission          = DIME_ADMISSION_NONE,
+    .admission_window_pct   = 1,
+    .link               = DIME_RESOURCE_NONE,
+    .server             = DIME_RESOURCE_NONE,
+    .compress_alg       = "lz4",
+    .profile        = {
+        .dist                       = DIME_LATENCY_CONSTANT,
+        .congestion_latency_pct     = 100,
+        .congestion_bandwidth_pct   = 100,
+    },
+};
+
+#define UPDATE_OR_OLD(field, old_field) (update->field != -1 ? update->field : old->old_field)
+#define UPDATE_OR_OLD_OR_ANON(field) (update->field == UPDATE_FOLLOW_ANON ? DIME_CONFIG_FOLLOW_ANON : UPDATE_OR_OLD(field, field))
+#define UPDATE_OR_OLD_OR_NONE(field) (update->field == UPDATE_RESOURCE_NONE ? DIME_RESOURCE_NONE : UPDATE_OR_OLD(field, field))
+
+/*  dime_config_derive_window
+ *
+ *  Description:
+ *      Computes local pages of admission window, taken out of local_npages,
+ *      so that window and policy together hold local_npages pages.
+ */
+static int dime_config_derive_window(struct dime_config_struct *config) {
+    config->window_npages = 0;
+    if(config->admission == DIME_ADMISSION_NONE || config->local_npages == 0)
+        return 0;
+
+    if(config->admission_window_pct == 0 || config->admission_window_pct > 50) {
+        DA_ERROR("admission_window_pct must be between 1 and 50");
+        return -EINVAL;
+    }
+    config->window_npages = max(1UL, (config->local_npages * config->admission_window_pct) / 100);
+    if(config->window_npages >= config->local_npages) {
+        DA_ERROR("admission needs at least 2 local_npages");
+        return -EINVAL;
+    }
+    return 0;
 }
 
-long long int update_instance_id = -1;
-int update_pids[1000]; 
-long long int update_pid_count = -1;
-long long int update_pids_append_flag = 0;
-long long int update_latency_ns = -1;
-long long int update_bandwidth_bps = -1;
-long long int update_local_npages = -1;
-long long int update_page_fault_count = -1;
+/*  dime_config_derive_classes
+ *
+ *  Description:
+ *      Computes per class cost and local pages of config. A class without
+ *      quota gets local pages left by the other one, no quota at all lets
+ *      both classes share local_npages. Quotas split pages of the policy,
+ *      admission window is not part of any class.
+ */
+static int dime_config_derive_classes(struct dime_config_struct *config) {
+    ulong bandwidth_bps[DIME_PAGE_CLASSES];
+    ulong an = config->an_local_npages, pc = config->pc_local_npages, local = config->local_npages - config->window_npages;
+    int c;
+
+    config->class_latency_ns[DIME_PAGE_ANON]  = config->latency_ns;
+    config->class_latency_ns[DIME_PAGE_CACHE] = config->pc_latency_ns != DIME_CONFIG_FOLLOW_ANON ? config->pc_latency_ns : config->latency_ns;
+    bandwidth_bps[DIME_PAGE_ANON]             = config->bandwidth_bps;
+    bandwidth_bps[DIME_PAGE_CACHE]            = config->pc_bandwidth_bps != DIME_CONFIG_FOLLOW_ANON ? config->pc_bandwidth_bps : config->bandwidth_bps;
+
+    for(c=0 ; c<DIME_PAGE_CLASSES ; ++c) {
+        if(bandwidth_bps[c] == 0) {
+            DA_ERROR("bandwidth_bps and pc_bandwidth_bps must be greater than zero");
+            return -EINVAL;
+        }
+        config->transmission_ns[c] = ((PAGE_SIZE * 8ULL) * 1000000000ULL) / bandwidth_bps[c];  // Transmission delay
+        config->delay_ns[c] = config->transmission_ns[c] + 2*config->class_latency_ns[c];      // Two way latency
+    }
 
+    if(local == 0 || (an == 0 && pc == 0)) {
+        config->class_npages[DIME_PAGE_ANON]  = 0;
+        config->class_npages[DIME_PAGE_CACHE] = 0;
+        return 0;
+    }
 
-void set_config_param(char *key, char *value) {
-    int err;
+    if(an > local || pc > local || (an && pc && an + pc > local)) {
+        DA_ERROR("an_local_npages + pc_local_npages exceeds local_npages less admission window");
+        return -EINVAL;
+    }
+    config->class_npages[DIME_PAGE_ANON]  = an ? an : local - pc;
+    config->class_npages[DIME_PAGE_CACHE] = pc ? pc : local - an;
+    if(config->class_npages[DIME_PAGE_ANON] == 0 || config->class_npages[DIME_PAGE_CACHE] == 0) {
+        DA_ERROR("an_local_npages or pc_local_npages leaves no local pages for other class");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/*  dime_config_build
+ *
+ *  Description:
+ *      Allocates new config from old one (default one if NULL) and update,
+ *      parameters not given in update keep their old value. Returns NULL on
+ *      invalid values or allocation failure.
+ */
+static struct dime_config_struct * dime_config_build(const struct dime_config_struct *old, const struct config_update_struct *update) {
+    struct dime_config_struct *config;
+    struct dime_latency_profile *profile;
+    struct dime_fabric_profile *fabric;
+    enum dime_latency_dist dist;
+    size_t size = sizeof(struct dime_config_struct);
+
+    old = old ? old : &dime_config_default;
+    dist = UPDATE_OR_OLD(latency_dist, profile.dist);
+    if(dist != DIME_LATENCY_CONSTANT)
+        size += sizeof(u32) * DIME_LATENCY_TABLE_SIZE;
+
+    config = (struct dime_config_struct*) kmalloc(size, GFP_KERNEL);
+    if(!config) {
+        DA_ERROR("unable to allocate memory");
+        return NULL;
+    }
+
+    config->generation      = old != &dime_config_default ? old->generation + 1 : 0;
+    config->latency_ns      = UPDATE_OR_OLD(latency_ns, latency_ns);
+    config->bandwidth_bps   = UPDATE_OR_OLD(bandwidth_bps, bandwidth_bps);
+    config->local_npages    = UPDATE_OR_OLD(local_npages, local_npages);
+    config->pc_latency_ns   = UPDATE_OR_OLD_OR_ANON(pc_latency_ns);
+    config->pc_bandwidth_bps= UPDATE_OR_OLD_OR_ANON(pc_bandwidth_bps);
+    config->an_local_npages = UPDATE_OR_OLD(an_local_npages, an_local_npages);
+    config->pc_local_npages = UPDATE_OR_OLD(pc_local_npages, pc_local_npages);
+    config->admission       = UPDATE_OR_OLD(admission, admission);
+    config->admission_window_pct = UPDATE_OR_OLD(admission_window_pct, admission_window_pct);
+    config->link            = UPDATE_OR_OLD_OR_NONE(link);
+    config->server          = UPDATE_OR_OLD_OR_NONE(server);
+    config->tier            = UPDATE_OR_OLD(tier, tier);
+    config->compress_pool_npages = UPDATE_OR_OLD(compress_pool_npages, compress_pool_npages);
+    config->compress_cost   = UPDATE_OR_OLD(compress_cost, compress_cost);
+    strscpy(config->compress_alg, update->compress_alg[0] ? update->compress_alg : old->compress_alg, DIME_COMPRESS_ALG_MAX);
+
+    profile = &config->profile;
+    *profile = old->profile;
+    profile->dist                       = dist;
+    profile->stddev_ns                  = UPDATE_OR_OLD(latency_stddev_ns, profile.stddev_ns);
+    profile->sigma_milli                = UPDATE_OR_OLD(latency_sigma_milli, profile.sigma_milli);
+    profile->congestion_latency_pct     = UPDATE_OR_OLD(congestion_latency_pct, profile.congestion_latency_pct);
+    profile->congestion_bandwidth_pct   = UPDATE_OR_OLD(congestion_bandwidth_pct, profile.congestion_bandwidth_pct);
+    if(update->congestion_period_ms != -1)
+        profile->congestion_period_ns   = update->congestion_period_ms * NSEC_PER_MSEC;
+    if(update->congestion_duration_ms != -1)
+        profile->congestion_duration_ns = update->congestion_duration_ms * NSEC_PER_MSEC;
+    if(update->latency_cdf_points != -1) {
+        profile->cdf_points = update->latency_cdf_points;
+        memcpy(profile->cdf, update->latency_cdf, sizeof(profile->cdf));
+    }
+
+    // schedule keeps its phase unless it is changed
+    if(profile->congestion_period_ns != old->profile.congestion_period_ns
+            || profile->congestion_duration_ns != old->profile.congestion_duration_ns)
+        config->schedule_start_ns = ktime_get_ns();
+    else
+        config->schedule_start_ns = old->schedule_start_ns;
+
+    fabric = &config->fabric;
+    *fabric = old->fabric;
+    fabric->seed                = UPDATE_OR_OLD(fabric_seed, fabric.seed);
+    fabric->loss_ppm            = UPDATE_OR_OLD(loss_ppm, fabric.loss_ppm);
+    fabric->timeout_ns          = UPDATE_OR_OLD(loss_timeout_ns, fabric.timeout_ns);
+    fabric->spike_ppm           = UPDATE_OR_OLD(spike_ppm, fabric.spike_ppm);
+    fabric->spike_ns            = UPDATE_OR_OLD(spike_ns, fabric.spike_ns);
+    if(update->brownout_period_ms != -1)
+        fabric->brownout_period_ns      = update->brownout_period_ms * NSEC_PER_MSEC;
+    if(update->brownout_duration_ms != -1)
+        fabric->brownout_duration_ns    = update->brownout_duration_ms * NSEC_PER_MSEC;
+
+    // brownouts restart with a new seed, so a run can be repeated from its start
+    if(update->fabric_seed != -1 || fabric->brownout_period_ns != old->fabric.brownout_period_ns
+            || fabric->brownout_duration_ns != old->fabric.brownout_duration_ns)
+        fabric->start_ns = ktime_get_ns();
+
+    if(dime_config_derive_window(config) || dime_config_derive_classes(config) || dime_latency_build_table(config)
+            || dime_latency_check_fabric(config) || dime_tier_check(config)) {
+        kfree(config);
+        return NULL;
+    }
+
+    return config;
+}
+
+#undef UPDATE_OR_OLD_OR_NONE
+#undef UPDATE_OR_OLD_OR_ANON
+#undef UPDATE_OR_OLD
+
+// Publishes config built by dime_config_build, must be called with dime_config_lock held
+static void __dime_config_publish(struct dime_instance_struct *dime_instance, struct dime_config_struct *config) {
+    struct dime_config_struct *old;
+
+    old = rcu_dereference_protected(dime_instance->config, lockdep_is_held(&dime_config_lock));
+    rcu_assign_pointer(dime_instance->config, config);
+    if(old)
+        kfree_rcu(old, rcu);
+}
+
+/*  dime_config_set
+ *
+ *  Description:
+ *      Replaces config of the instance at once, parameters set to -1 keep
+ *      their current value. Page faults see either old or new config.
+ */
+int dime_config_set(struct dime_instance_struct *dime_instance, long long int latency_ns, long long int bandwidth_bps, long long int local_npages) {
+    struct dime_config_struct *config;
+    struct config_update_struct update;
+
+    init_config_update(&update);
+    update.latency_ns       = latency_ns;
+    update.bandwidth_bps    = bandwidth_bps;
+    update.local_npages     = local_npages;
+
+    mutex_lock(&dime_config_lock);
+    config = dime_config_build(rcu_dereference_protected(dime_instance->config, lockdep_is_held(&dime_config_lock)), &update);
+    if(config)
+        __dime_config_publish(dime_instance, config);
+    mutex_unlock(&dime_config_lock);
+
+    return config ? 0 : -EINVAL;
+}
+
+// Frees configs of all instances, called on module exit after hooks are removed
+void dime_config_cleanup(void) {
+    int i;
+
+    for(i=0 ; i<dime.dime_instances_size ; ++i) {
+        kfree(rcu_dereference_protected(dime.dime_instances[i].config, 1));
+        RCU_INIT_POINTER(dime.dime_instances[i].config, NULL);
+    }
+}
+
+static int parse_number(char *value, long long int *number) {
     long long_val;
+    int err = kstrtol(value, 10, &long_val);
+
+    if(err != 0 || long_val < 0) {
+        DA_ERROR("invalid number : %s (error:%d)", value, err);
+        return -EINVAL;
+    }
+    *number = long_val;
+    return 0;
+}
+
+// page cache cost is a number or "anon" to charge page cache same as anon
+static int parse_class_cost(char *value, long long int *number) {
+    if(strcmp(value, "anon") == 0) {
+        *number = UPDATE_FOLLOW_ANON;
+        return 0;
+    }
+    return parse_number(value, number);
+}
+
+// shared resource is an id below max_id or "none" to detach
+static int parse_resource(char *value, long long int max_id, long long int *number) {
+    if(strcmp(value, "none") == 0) {
+        *number = UPDATE_RESOURCE_NONE;
+        return 0;
+    }
+    if(parse_number(value, number))
+        return -EINVAL;
+    if(*number >= max_id) {
+        DA_ERROR("resource id must be below %lld : %s", max_id, value);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+int set_config_param(struct config_update_struct *update, char *key, char *value) {
+    long long int number;
 
     // first trim the strings
     key = strim(key);
@@ -125,170 +536,352 @@ void set_config_param(char *key, char *value) {
 
     if(strcmp(key, "instance_id") == 0) {
         DA_INFO("setting instance_id : %s", value);
-        err = kstrtol(value, 10, &long_val);
-        if(err != 0) {
-            DA_ERROR("invalid number : %s (error:%d)", value, err);
-            return;
-        } else {
-            update_instance_id = long_val;
-        }
+        return parse_number(value, &update->instance_id);
     } else if(strcmp(key, "pid") == 0) {
         char *pid_start, *pid_end;
         pid_end = pid_start = value;
+        if(update->pid_count == -1)
+            update->pid_count = 0;          // empty list clears listed processes
         while( (pid_start = strsep(&pid_end, ",")) != NULL) {
             if(strlen(pid_start) == 0)
                 continue;       // invalid token, try again
 
             DA_INFO("adding PID : %s", pid_start);
             // TODO:: append mode for '+'
-            err = kstrtol(pid_start, 10, &long_val);
-            if(err != 0) {
-                DA_ERROR("invalid number : %s (error:%d)", pid_start, err);
-                return;
-            } else {
-                if(update_pid_count == -1)
-                    update_pid_count = 0;
-                update_pids[update_pid_count++] = long_val;
+            if(parse_number(pid_start, &number))
+                return -EINVAL;
+
+            if(update->pid_count == update->pids_capacity) {
+                long long int new_capacity = update->pids_capacity ? 2*update->pids_capacity : 64;
+                pid_t *new_pids = (pid_t*) krealloc(update->pids, sizeof(pid_t) * new_capacity, GFP_KERNEL);
+                if(!new_pids) {
+                    DA_ERROR("unable to allocate memory");
+                    return -ENOMEM;
+                }
+                update->pids = new_pids;
+                update->pids_capacity = new_capacity;
             }
+            update->pids[update->pid_count++] = number;
         }
+        return 0;
+    } else if(strcmp(key, "cgroup") == 0) {
+        DA_INFO("setting cgroup : %s", value);
+        kfree(update->cgroup);
+        update->cgroup = kstrdup(value, GFP_KERNEL);
+        return update->cgroup ? 0 : -ENOMEM;
     } else if(strcmp(key, "latency_ns") == 0) {
         DA_INFO("setting latency_ns : %s", value);
-        err = kstrtol(value, 10, &long_val);
-        if(err != 0) {
-            DA_ERROR("invalid number : %s (error:%d)", value, err);
-            return;
-        } else {
-            update_latency_ns = long_val;
-        }
+        return parse_number(value, &update->latency_ns);
     } else if(strcmp(key, "bandwidth_bps") == 0) {
         DA_INFO("setting bandwidth_bps : %s", value);
-        err = kstrtol(value, 10, &long_val);
-        if(err != 0) {
-            DA_ERROR("invalid number : %s (error:%d)", value, err);
-            return;
-        } else {
-            update_bandwidth_bps = long_val;
-        }
+        return parse_number(value, &update->bandwidth_bps);
     } else if(strcmp(key, "local_npages") == 0) {
         DA_INFO("setting local_npages : %s", value);
-        err = kstrtol(value, 10, &long_val);
-        if(err != 0) {
-            DA_ERROR("invalid number : %s (error:%d)", value, err);
-            return;
-        } else {
-            update_local_npages = long_val;
-        }
+        return parse_number(value, &update->local_npages);
     } else if(strcmp(key, "page_fault_count") == 0) {
         DA_INFO("setting page_fault_count : %s", value);
-        err = kstrtol(value, 10, &long_val);
-        if(err != 0) {
-            DA_ERROR("invalid number : %s (error:%d)", value, err);
-            return;
-        } else {
-            update_page_fault_count = long_val;
+        return parse_number(value, &update->page_fault_count);
+    } else if(strcmp(key, "pc_latency_ns") == 0) {
+        DA_INFO("setting pc_latency_ns : %s", value);
+        return parse_class_cost(value, &update->pc_latency_ns);
+    } else if(strcmp(key, "pc_bandwidth_bps") == 0) {
+        DA_INFO("setting pc_bandwidth_bps : %s", value);
+        return parse_class_cost(value, &update->pc_bandwidth_bps);
+    } else if(strcmp(key, "an_local_npages") == 0) {
+        DA_INFO("setting an_local_npages : %s", value);
+        return parse_number(value, &update->an_local_npages);
+    } else if(strcmp(key, "pc_local_npages") == 0) {
+        DA_INFO("setting pc_local_npages : %s", value);
+        return parse_number(value, &update->pc_local_npages);
+    } else if(strcmp(key, "admission") == 0) {
+        DA_INFO("setting admission : %s", value);
+        update->admission = dime_admission_parse(value);
+        return update->admission < 0 ? -EINVAL : 0;
+    } else if(strcmp(key, "admission_window_pct") == 0) {
+        DA_INFO("setting admission_window_pct : %s", value);
+        return parse_number(value, &update->admission_window_pct);
+    } else if(strcmp(key, "link") == 0) {
+        DA_INFO("setting link : %s", value);
+        return parse_resource(value, DIME_MAX_LINKS, &update->link);
+    } else if(strcmp(key, "server") == 0) {
+        DA_INFO("setting server : %s", value);
+        return parse_resource(value, DIME_MAX_SERVERS, &update->server);
+    } else if(strcmp(key, "tier") == 0) {
+        DA_INFO("setting tier : %s", value);
+        update->tier = dime_tier_parse(value);
+        return update->tier < 0 ? -EINVAL : 0;
+    } else if(strcmp(key, "compress_alg") == 0) {
+        DA_INFO("setting compress_alg : %s", value);
+        if(strscpy(update->compress_alg, value, DIME_COMPRESS_ALG_MAX) <= 0) {
+            DA_ERROR("invalid compress_alg : %s", value);
+            return -EINVAL;
         }
-    } else {
-        DA_ERROR("invalid config parameter : %s", key);
-        return;
+        return 0;
+    } else if(strcmp(key, "compress_pool_npages") == 0) {
+        DA_INFO("setting compress_pool_npages : %s", value);
+        return parse_number(value, &update->compress_pool_npages);
+    } else if(strcmp(key, "compress_cost") == 0) {
+        DA_INFO("setting compress_cost : %s", value);
+        update->compress_cost = dime_compress_parse_cost(value);
+        return update->compress_cost < 0 ? -EINVAL : 0;
+    } else if(strcmp(key, "latency_dist") == 0) {
+        DA_INFO("setting latency_dist : %s", value);
+        update->latency_dist = dime_latency_parse_dist(value);
+        return update->latency_dist < 0 ? -EINVAL : 0;
+    } else if(strcmp(key, "latency_stddev_ns") == 0) {
+        DA_INFO("setting latency_stddev_ns : %s", value);
+        return parse_number(value, &update->latency_stddev_ns);
+    } else if(strcmp(key, "latency_sigma_milli") == 0) {
+        DA_INFO("setting latency_sigma_milli : %s", value);
+        return parse_number(value, &update->latency_sigma_milli);
+    } else if(strcmp(key, "latency_cdf") == 0) {
+        DA_INFO("setting latency_cdf : %s", value);
+        return dime_latency_parse_cdf(value, update->latency_cdf, &update->latency_cdf_points);
+    } else if(strcmp(key, "congestion_period_ms") == 0) {
+        DA_INFO("setting congestion_period_ms : %s", value);
+        return parse_number(value, &update->congestion_period_ms);
+    } else if(strcmp(key, "congestion_duration_ms") == 0) {
+        DA_INFO("setting congestion_duration_ms : %s", value);
+        return parse_number(value, &update->congestion_duration_ms);
+    } else if(strcmp(key, "congestion_latency_pct") == 0) {
+        DA_INFO("setting congestion_latency_pct : %s", value);
+        return parse_number(value, &update->congestion_latency_pct);
+    } else if(strcmp(key, "congestion_bandwidth_pct") == 0) {
+        DA_INFO("setting congestion_bandwidth_pct : %s", value);
+        return parse_number(value, &update->congestion_bandwidth_pct);
+    } else if(strcmp(key, "fabric_seed") == 0) {
+        DA_INFO("setting fabric_seed : %s", value);
+        return parse_number(value, &update->fabric_seed);
+    } else if(strcmp(key, "loss_ppm") == 0) {
+        DA_INFO("setting loss_ppm : %s", value);
+        return parse_number(value, &update->loss_ppm);
+    } else if(strcmp(key, "loss_timeout_ns") == 0) {
+        DA_INFO("setting loss_timeout_ns : %s", value);
+        return parse_number(value, &update->loss_timeout_ns);
+    } else if(strcmp(key, "brownout_period_ms") == 0) {
+        DA_INFO("setting brownout_period_ms : %s", value);
+        return parse_number(value, &update->brownout_period_ms);
+    } else if(strcmp(key, "brownout_duration_ms") == 0) {
+        DA_INFO("setting brownout_duration_ms : %s", value);
+        return parse_number(value, &update->brownout_duration_ms);
+    } else if(strcmp(key, "spike_ppm") == 0) {
+        DA_INFO("setting spike_ppm : %s", value);
+        return parse_number(value, &update->spike_ppm);
+    } else if(strcmp(key, "spike_ns") == 0) {
+        DA_INFO("setting spike_ns : %s", value);
+        return parse_number(value, &update->spike_ns);
     }
-}
 
-static ssize_t procfile_write(struct file *file, const char *buffer, size_t length, loff_t *offset) {
-    char *token_start, *token_end;
+    DA_ERROR("invalid config parameter : %s", key);
+    return -EINVAL;
+}
 
-    //TODO:: handle multiple calls in segments of string to write
-    procfs_buffer_size = length;
-    if (procfs_buffer_size > PROCFS_MAX_SIZE) {
-        procfs_buffer_size = PROCFS_MAX_SIZE;   // if length is greater than available buffer size, then read max data
-        DA_WARNING("procfile buffer overflow");
-    }
+// Resets all fields of an instance slot, instance is not visible until dime_instances_size covers it
+void init_dime_instance(struct dime_instance_struct *dime_instance, int instance_id, struct dime_config_struct *config) {
+    rwlock_init(&dime_instance->lock);
+    dime_instance->instance_id = instance_id;
+    INIT_LIST_HEAD(&dime_instance->pid_list);
+    dime_instance->pid_count = 0;
+    RCU_INIT_POINTER(dime_instance->cgrp, NULL);
+    INIT_HLIST_NODE(&dime_instance->cgroup_node);
+    RCU_INIT_POINTER(dime_instance->config, config);
+    dime_instance->prp = NULL;
+    RCU_INIT_POINTER(dime_instance->admission, NULL);
+    RCU_INIT_POINTER(dime_instance->compress, NULL);
+    atomic_long_set(&dime_instance->pagefaults, 0);
+    atomic_long_set(&dime_instance->duplecate_pfs, 0);
+    atomic_long_set(&dime_instance->shared_pfs, 0);
+    atomic_long_set(&dime_instance->adm_admitted, 0);
+    atomic_long_set(&dime_instance->adm_rejected, 0);
+    atomic_long_set(&dime_instance->time_queue, 0);
+    atomic64_set(&dime_instance->fabric_seq, 0);
+    atomic_long_set(&dime_instance->fabric_losses, 0);
+    atomic_long_set(&dime_instance->fabric_brownouts, 0);
+    atomic_long_set(&dime_instance->fabric_spikes, 0);
+    atomic_long_set(&dime_instance->time_fabric, 0);
+    atomic_long_set(&dime_instance->offload_pages, 0);
+    atomic_long_set(&dime_instance->offload_failed, 0);
+    atomic_long_set(&dime_instance->offload_fetches, 0);
+    atomic_long_set(&dime_instance->time_fetch, 0);
+    atomic_long_set(&dime_instance->compress_stored, 0);
+    atomic_long_set(&dime_instance->compress_rejected, 0);
+    atomic_long_set(&dime_instance->compress_evicted, 0);
+    atomic_long_set(&dime_instance->compress_hits, 0);
+    atomic_long_set(&dime_instance->time_compress, 0);
+    atomic_long_set(&dime_instance->time_decompress, 0);
+    atomic_long_set(&dime_instance->warm_restored, 0);
+    atomic_long_set(&dime_instance->warm_skipped, 0);
+    atomic_long_set(&dime_instance->time_clamped, 0);
+    atomic_long_set(&dime_instance->pc_pagefaults, 0);
+    atomic_long_set(&dime_instance->an_pagefaults, 0);
+    atomic_long_set(&dime_instance->pc_time_inject, 0);
+    atomic_long_set(&dime_instance->an_time_inject, 0);
+    atomic_long_set(&dime_instance->time_pfh, 0);
+    atomic_long_set(&dime_instance->time_ap, 0);
+    atomic_long_set(&dime_instance->time_inject, 0);
+    atomic_long_set(&dime_instance->time_pfh_ap, 0);
+    atomic_long_set(&dime_instance->time_pfh_ap_inject, 0);
+}
 
-    if ( copy_from_user(procfs_buffer, buffer, procfs_buffer_size) ) {
-        return -EFAULT;
+/*  procfile_write
+ *
+ *  Description:
+ *      Applies one configuration string as a transaction. All parameters are
+ *      parsed, pids and cgroup resolved and new config built first; any error
+ *      leaves the instance untouched. Config is then published with a single
+ *      pointer swap, and the pid set is updated by difference, so processes
+ *      kept in the set are tracked throughout.
+ */
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+    struct config_update_struct update;
+    struct dime_instance_struct *dime_instance;
+    struct dime_config_struct *config = NULL;
+    struct dime_compress_pool *pool;
+    struct cgroup *cgrp = NULL;
+    struct pid **pids = NULL;
+    char *kbuf, *token_start, *token_end;
+    bool new_instance;
+    ssize_t ret;
+    int i, npids = 0;
+
+    kbuf = memdup_user_nul(buffer, length);
+    if (IS_ERR(kbuf)) {
+        return PTR_ERR(kbuf);
     }
 
-    // reset update parameters
-    update_instance_id = -1;
-    update_pid_count = -1;
-    update_pids_append_flag = 0;
-    update_latency_ns = -1;
-    update_bandwidth_bps = -1;
-    update_local_npages = -1;
-    update_page_fault_count = -1;
-
+    mutex_lock(&procfile_write_lock);
+    init_config_update(&update);
 
-    *offset += procfs_buffer_size;
-    procfs_buffer[procfs_buffer_size] = '\0';
-
-    token_start = token_end = procfs_buffer;
-    while( (token_start = strsep(&token_end, " ")) != NULL) {
-        char *key, *value, keyvalpair[1000];
+    token_start = token_end = kbuf;
+    while( (token_start = strsep(&token_end, " \n")) != NULL) {
+        char *key, *value;
         if(strlen(token_start) == 0)
             continue;
 
-        strcpy(keyvalpair, token_start);
-        key = value = keyvalpair;
+        // tokens are parsed in place, kbuf is private to this write
+        key = value = token_start;
         key = strsep(&value, "=");
 
-        if(key && value)
-            set_config_param(key, value);
+        if(key && value) {
+            ret = set_config_param(&update, key, value);
+            if(ret)
+                goto write_exit;
+        }
     }
 
     /*
-     * Now, set the modified config parameters
+     * Validate and prepare everything, nothing is visible to page faults yet
      */
 
-    if(update_instance_id == -1) {
+    if(update.instance_id == -1) {
         // instance_id was not given
         DA_ERROR("missing mandatory instance_id parameter");
-        return -EINVAL;
-    } else if (update_instance_id > dime.dime_instances_size) {
+        ret = -EINVAL;
+        goto write_exit;
+    } else if (update.instance_id > dime.dime_instances_size || update.instance_id >= MAX_DIME_INSTANCES) {
         DA_ERROR("instance_id of new instance must be +1 of max instance_id");
-        return -EINVAL;
-    } else if (dime.dime_instances_size == update_instance_id) {
-        // create new instance 
-        rwlock_init(&dime.dime_instances[update_instance_id].lock);
-        write_lock(&dime.dime_instances[update_instance_id].lock);
-        dime.dime_instances[update_instance_id].instance_id           = update_instance_id;
-        dime.dime_instances[update_instance_id].latency_ns            = 10000ULL;
-        dime.dime_instances[update_instance_id].bandwidth_bps         = 10000000000ULL;
-        dime.dime_instances[update_instance_id].local_npages          = 20ULL;
-        dime.dime_instances[update_instance_id].pid_count             = 0;
-        dime.dime_instances[update_instance_id].prp                   = NULL;
-        atomic_long_set(&dime.dime_instances[update_instance_id].pc_pagefaults, 0);
-        atomic_long_set(&dime.dime_instances[update_instance_id].an_pagefaults, 0);
-        atomic_long_set(&dime.dime_instances[update_instance_id].time_pfh, 0);
-        atomic_long_set(&dime.dime_instances[update_instance_id].time_ap, 0);
-        atomic_long_set(&dime.dime_instances[update_instance_id].time_inject, 0);
-        atomic_long_set(&dime.dime_instances[update_instance_id].time_pfh_ap, 0);
-        atomic_long_set(&dime.dime_instances[update_instance_id].time_pfh_ap_inject, 0);
-        dime.dime_instances_size                                      = update_instance_id+1;
-        write_unlock(&dime.dime_instances[update_instance_id].lock);
+        ret = -EINVAL;
+        goto write_exit;
+    }
+    dime_instance = &dime.dime_instances[update.instance_id];
+    new_instance = update.instance_id == dime.dime_instances_size;
+
+    if(update.pid_count != -1) {
+        pids = (struct pid **) kcalloc(update.pid_count ? update.pid_count : 1, sizeof(struct pid *), GFP_KERNEL);
+        if(!pids) {
+            DA_ERROR("unable to allocate memory");
+            ret = -ENOMEM;
+            goto write_exit;
+        }
+        for(npids=0 ; npids<update.pid_count ; ++npids) {
+            pids[npids] = pt_get_tgid_nr(update.pids[npids]);
+            if(!pids[npids]) {
+                ret = -ESRCH;
+                goto write_exit;
+            }
+        }
     }
 
-    if(update_pid_count != -1) {
-        int i=0;
-        dime.dime_instances[update_instance_id].pid_count = 0;  // Default mode is to set pids, not append
-        for(i=0 ; i<update_pid_count ; i++) {
-            dime.dime_instances[update_instance_id].pid[dime.dime_instances[update_instance_id].pid_count++] = update_pids[i];
-            // TODO:: protect this pid here, or later in page replacement policy
-            // TODO:: assumming instance_id and array index are same
-            // TODO:: check if pid exists before adding to list
-            // TODO:: add append pid list feature
+    if(update.cgroup) {
+        cgrp = pt_get_cgroup(update.cgroup);
+        if(IS_ERR(cgrp)) {
+            ret = PTR_ERR(cgrp);
+            cgrp = NULL;
+            goto write_exit;
         }
     }
 
-    if(update_local_npages != -1) {
-        dime.dime_instances[update_instance_id].local_npages = update_local_npages;
+    // every write publishes a new config generation, unchanged values are copied
+    mutex_lock(&dime_config_lock);
+    config = dime_config_build(new_instance ? NULL :
+                                rcu_dereference_protected(dime_instance->config, lockdep_is_held(&dime_config_lock)),
+                                &update);
+    if(!config) {
+        mutex_unlock(&dime_config_lock);
+        ret = -EINVAL;
+        goto write_exit;
     }
 
-    if(update_latency_ns != -1) {
-        dime.dime_instances[update_instance_id].latency_ns = update_latency_ns;
+    pool = dime_compress_prepare(new_instance ? NULL : dime_instance, config);
+    if(IS_ERR(pool)) {
+        kfree(config);
+        mutex_unlock(&dime_config_lock);
+        ret = PTR_ERR(pool);
+        goto write_exit;
     }
 
-    if(update_bandwidth_bps != -1) {
-        dime.dime_instances[update_instance_id].bandwidth_bps = update_bandwidth_bps;
+    /*
+     * Apply, page faults of listed processes may see the instance from here
+     */
+
+    if(new_instance) {
+        // instance has config before any process can be mapped to it
+        init_dime_instance(dime_instance, update.instance_id, config);
+        config = NULL;
     }
 
-    return procfs_buffer_size;
-}
\ No newline at end of file
+    if(pids) {
+        ret = pt_set_pids(dime_instance, pids, npids);
+        if(ret) {
+            if(new_instance) {
+                // instance was never visible
+                kfree(rcu_dereference_protected(dime_instance->config, 1));
+                RCU_INIT_POINTER(dime_instance->config, NULL);
+            }
+            kfree(config);      // unpublished config of existing instance, NULL for new one
+            dime_compress_free(pool);
+            mutex_unlock(&dime_config_lock);
+            goto write_exit;
+        }
+    }
+
+    if(update.cgroup) {
+        pt_set_cgroup(dime_instance, cgrp);     // takes over reference
+        cgrp = NULL;
+    }
+
+    if(config)
+        __dime_config_publish(dime_instance, config);
+    if(update.fabric_seed != -1)
+        atomic64_set(&dime_instance->fabric_seq, 0);
+    dime_compress_install(dime_instance, pool);
+
+    if(new_instance)
+        smp_store_release(&dime.dime_instances_size, update.instance_id+1);     // instance fields before size
+    mutex_unlock(&dime_config_lock);
+
+    *offset += length;
+    ret = length;
+
+write_exit:
+    if(cgrp)
+        cgroup_put(cgrp);
+    for(i=0 ; i<npids ; ++i)
+        put_pid(pids[i]);
+    kfree(pids);
+    kfree(update.cgroup);
+    kfree(update.pids);
+    mutex_unlock(&procfile_write_lock);
+    kfree(kbuf);
+    return ret;
+}
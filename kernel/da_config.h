@@ -8,5 +8,9 @@
 int init_dime_config_procfs(void);
 void cleanup_dime_config_procfs(void);
 
+void init_dime_instance(struct dime_instance_struct *dime_instance, int instance_id, struct dime_config_struct *config);
+int  dime_config_set(struct dime_instance_struct *dime_instance, long long int latency_ns, long long int bandwidth_bps, long long int local_npages);
+void dime_config_cleanup(void);
+
 
 #endif
\ No newline at end of file
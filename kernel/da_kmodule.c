@@ -10,6 +10,8 @@
 #include <linux/stat.h>
 #include <linux/fs.h>
 #include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/kprobes.h>
 #include <linux/version.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
 #include <linux/sched/clock.h>
@@ -21,8 +23,27 @@
 #include "da_mem_lib.h"
 #include "da_ptracker.h"
 #include "da_config.h"
+#include "da_stats.h"
+#include "da_wss.h"
+#include "da_repart.h"
+#include "da_resource.h"
+#include "da_offload.h"
+#include "da_compress.h"
+#include "da_warm.h"
+#include "da_latency.h"
+#include "da_shared.h"
+#include "da_admission.h"
 #include "common.h"
 
+// define tracepoints, after all headers which include dime_trace.h
+#define CREATE_TRACE_POINTS
+#include "dime_trace.h"
+
+EXPORT_TRACEPOINT_SYMBOL_GPL(dime_evict);
+EXPORT_TRACEPOINT_SYMBOL_GPL(dime_kswapd_balance);
+EXPORT_TRACEPOINT_SYMBOL_GPL(dime_tlb_flush);
+EXPORT_TRACEPOINT_SYMBOL_GPL(dime_inject_delay);
+
 EXPORT_SYMBOL(dime);
 unsigned int da_debug_flag =    DA_DEBUG_ALERT_FLAG
                                 | DA_DEBUG_INFO_FLAG
@@ -33,6 +54,58 @@ unsigned int da_debug_flag =    DA_DEBUG_ALERT_FLAG
                                 ;
 EXPORT_SYMBOL(da_debug_flag);
 
+#ifdef DA_DEBUG_STATIC_KEYS
+DEFINE_STATIC_KEY_FALSE(da_debug_key_alert);
+DEFINE_STATIC_KEY_FALSE(da_debug_key_warning);
+DEFINE_STATIC_KEY_FALSE(da_debug_key_error);
+DEFINE_STATIC_KEY_FALSE(da_debug_key_info);
+DEFINE_STATIC_KEY_FALSE(da_debug_key_entryexit);
+DEFINE_STATIC_KEY_FALSE(da_debug_key_debug);
+EXPORT_SYMBOL(da_debug_key_alert);
+EXPORT_SYMBOL(da_debug_key_warning);
+EXPORT_SYMBOL(da_debug_key_error);
+EXPORT_SYMBOL(da_debug_key_info);
+EXPORT_SYMBOL(da_debug_key_entryexit);
+EXPORT_SYMBOL(da_debug_key_debug);
+
+static bool da_debug_keys_ready = false;
+
+static void da_debug_key_set(struct static_key_false *key, unsigned int flag) {
+    if(da_debug_flag & flag)
+        static_branch_enable(key);
+    else
+        static_branch_disable(key);
+}
+
+/*  da_debug_update_keys
+ *
+ *  Description:
+ *      Patches log level static keys to match da_debug_flag
+ */
+static void da_debug_update_keys(void) {
+    da_debug_key_set(&da_debug_key_alert,       DA_DEBUG_ALERT_FLAG);
+    da_debug_key_set(&da_debug_key_warning,     DA_DEBUG_WARNING_FLAG);
+    da_debug_key_set(&da_debug_key_error,       DA_DEBUG_ERROR_FLAG);
+    da_debug_key_set(&da_debug_key_info,        DA_DEBUG_INFO_FLAG);
+    da_debug_key_set(&da_debug_key_entryexit,   DA_DEBUG_ENTRYEXIT_FLAG);
+    da_debug_key_set(&da_debug_key_debug,       DA_DEBUG_DEBUG_FLAG);
+}
+
+static int da_debug_flag_set(const char *val, const struct kernel_param *kp) {
+    int ret = param_set_uint(val, kp);
+
+    // keys are patched in init_module for the value given at insertion
+    if(ret == 0 && da_debug_keys_ready)
+        da_debug_update_keys();
+    return ret;
+}
+
+static const struct kernel_param_ops da_debug_flag_ops = {
+    .set    = da_debug_flag_set,
+    .get    = param_get_uint,
+};
+#endif
+
 /*****
  *
  *  Two hooks are required to set up in do_page_fault function in fault.c,
@@ -69,6 +142,12 @@ EXPORT_SYMBOL(da_debug_flag);
  *
  */
 
+// Patched do_page_fault hooks are available only for 4.9.44 kernel, see fault.c.diff
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,15,0) && !defined(DIME_FAULT_HOOK_KPROBE)
+#define DIME_FAULT_HOOK_KPROBE
+#endif
+
+#ifndef DIME_FAULT_HOOK_KPROBE
 // Set your hook function name, which is exported from fault.c, here
 #define HOOK_START_FN_NAME  do_page_fault_hook_start    // Called before __do_page_fault
 #define HOOK_END_FN_NAME    do_page_fault_hook_end      // Called after __do_page_fault
@@ -83,6 +162,7 @@ extern int (*HOOK_END_FN_NAME) (struct pt_regs *    regs,
                                     unsigned long   address,
                                     int *           hook_flag,
                                     ulong *         hook_timestamp);
+#endif
 int do_page_fault_hook_start_new (struct pt_regs *  regs,
                                     unsigned long   error_code,
                                     unsigned long   address,
@@ -96,6 +176,101 @@ int do_page_fault_hook_end_new (struct pt_regs *    regs,
 
 struct task_struct* get_task_by_pid(pid_t pid);
 
+#ifdef DIME_FAULT_HOOK_KPROBE
+/*****
+ *
+ *  Without a patched kernel, the same hook functions are called from a
+ *  kretprobe on handle_mm_fault; entry handler acts as start hook and return
+ *  handler as end hook. Both run with preemption disabled, so the delay can
+ *  only be busy waited, and is cut at DELAY_ATOMIC_MAX_NS so that long
+ *  queueing or fabric delays do not stall the cpu.
+ *
+ */
+#define DELAY_BUSY_WAIT_MAX_NS  ULLONG_MAX
+#define DELAY_ATOMIC_MAX_NS     1000000ULL
+
+struct dime_kretprobe_data {
+    int     hook_flag;
+    ulong   hook_timestamp;
+    ulong   address;
+};
+
+static int dime_kretprobe_fault_entry(struct kretprobe_instance *ri, struct pt_regs *regs) {
+    struct dime_kretprobe_data *data = (struct dime_kretprobe_data *) ri->data;
+    struct vm_area_struct *vma = (struct vm_area_struct *) regs->di;   // handle_mm_fault(vma, address, flags, ...)
+
+    if(!current->mm || vma->vm_mm != current->mm)
+        return 1;       // fault on mm of other process, e.g. by get_user_pages
+
+    data->address = regs->si;
+    do_page_fault_hook_start_new(regs, 0, data->address, &data->hook_flag, &data->hook_timestamp);
+
+    return data->hook_flag ? 0 : 1;     // non-zero return skips return handler
+}
+
+static int dime_kretprobe_fault_ret(struct kretprobe_instance *ri, struct pt_regs *regs) {
+    struct dime_kretprobe_data *data = (struct dime_kretprobe_data *) ri->data;
+    unsigned int fault = (unsigned int) regs_return_value(regs);
+
+    // fault is retried, or fails, and page is not mapped : retried call is
+    // accounted on its own return, so the page is added and delayed only once
+    if(fault & (VM_FAULT_RETRY | VM_FAULT_ERROR))
+        return 0;
+
+    do_page_fault_hook_end_new(regs, 0, data->address, &data->hook_flag, &data->hook_timestamp);
+    return 0;
+}
+
+static struct kretprobe dime_fault_kretprobe = {
+    .kp             = {
+                        .symbol_name = "handle_mm_fault",
+                    },
+    .entry_handler  = dime_kretprobe_fault_entry,
+    .handler        = dime_kretprobe_fault_ret,
+    .data_size      = sizeof(struct dime_kretprobe_data),
+};
+#else
+#define DELAY_BUSY_WAIT_MAX_NS  100000ULL
+#define DELAY_ATOMIC_MAX_NS     ULLONG_MAX
+#endif
+
+static bool dime_hook_installed = false;
+
+static int dime_hook_install(void) {
+#ifdef DIME_FAULT_HOOK_KPROBE
+    int ret;
+
+    // handle_mm_fault may sleep, allow an instance for each concurrently faulting task
+    dime_fault_kretprobe.maxactive = 64 * num_possible_cpus();
+    ret = register_kretprobe(&dime_fault_kretprobe);
+    if (ret < 0) {
+        DA_ERROR("handle_mm_fault kretprobe failed, returned %d", ret);
+        return ret;
+    }
+    DA_INFO("planted handle_mm_fault kretprobe at %p", dime_fault_kretprobe.kp.addr);
+#else
+    HOOK_START_FN_NAME  = do_page_fault_hook_start_new;
+    HOOK_END_FN_NAME    = do_page_fault_hook_end_new;
+#endif
+    dime_hook_installed = true;
+    DA_INFO("hook insertion complete");
+    return 0;
+}
+
+static void dime_hook_remove(void) {
+    if(!dime_hook_installed)
+        return;
+
+#ifdef DIME_FAULT_HOOK_KPROBE
+    unregister_kretprobe(&dime_fault_kretprobe);
+    DA_INFO("handle_mm_fault kretprobe removed, missed %d probes", dime_fault_kretprobe.nmissed);
+#else
+    HOOK_START_FN_NAME  = NULL;
+    HOOK_END_FN_NAME    = NULL;                    // Removing hook, setting to NULL
+#endif
+    dime_hook_installed = false;
+}
+
 /*****
  *
  *  Module params
@@ -105,23 +280,29 @@ MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Abhishek Ghogare, Dhantu");
 MODULE_DESCRIPTION("Disaggregation Emulator");
 
-static int      pid[1000]       = {10};
-static int      pid_count       = 0;
+static char *   pid             = "";
+static char *   cgroup          = "";
 static ulong    latency_ns      = 10000ULL;
 static ulong    bandwidth_bps   = 10000000000ULL;
        ulong    local_npages    = 20ULL;
 static ulong    page_fault_count= 0ULL;
 
-module_param_array(pid, int, &pid_count, 0444);    // Array of pids to run an emulator instance on
+module_param(pid, charp, 0444);                     // Comma separated list of pids to run an emulator instance on
+module_param(cgroup, charp, 0444);                  // cgroup v2 path, all member tasks are emulated
 //module_param(pid, int, 0444);                     // pid cannot be changed but read directly from sysfs
 module_param(latency_ns, ulong, 0644);
 module_param(bandwidth_bps, ulong, 0644);
+#ifdef DA_DEBUG_STATIC_KEYS
+module_param_cb(da_debug_flag, &da_debug_flag_ops, &da_debug_flag, 0644);  // debug level flags, can be set from sysfs
+#else
 module_param(da_debug_flag, uint, 0644);            // debug level flags, can be set from sysfs
+#endif
 module_param(local_npages, ulong, 0644);            // number of local pages, acts as a cache for remote memory
 module_param(page_fault_count, ulong, 0444);        // pid cannot be changed but read directly from sysfs 
 // TODO: unsigned long is 64bit in x86_64, need to change to ull
 
 MODULE_PARM_DESC(pid, "List of PIDs of a processes to track");
+MODULE_PARM_DESC(cgroup, "Path of cgroup v2, relative to cgroup2 root, whose tasks to track");
 MODULE_PARM_DESC(latency_ns, "One way latency in nano-sec");
 MODULE_PARM_DESC(bandwidth_bps, "Bandwidth of network in bits-per-sec");
 MODULE_PARM_DESC(da_debug_flag, "Module debug log level flags");
@@ -133,10 +314,39 @@ struct dime_struct dime = {
     .dime_instances_size = 0
 };
 
-void inject_delay(struct dime_instance_struct *dime_instance, unsigned long long diff) {
-    unsigned long long delay_ns = 0, curr;
-    delay_ns = ((PAGE_SIZE * 8ULL) * 1000000000ULL) / dime_instance->bandwidth_bps;  // Transmission delay
-    delay_ns += 2*dime_instance->latency_ns;                                         // Two way latency
+/*  inject_delay
+ *
+ *  Description:
+ *      Busy waits or sleeps for transfer delay of one page of page_class,
+ *      plus adjust_ns charged by the caller, e.g. for fabric faults. A
+ *      negative adjust_ns credits time the fetch has already taken. Delay
+ *      beyond DELAY_ATOMIC_MAX_NS is not waited but counted in time_clamped.
+ */
+void inject_delay(struct dime_instance_struct *dime_instance, long long adjust_ns, enum dime_page_class page_class) {
+    unsigned long long delay_ns = 0, queue_ns, curr;
+    unsigned long long start_ns = trace_dime_inject_delay_enabled() ? sched_clock() : 0;
+    struct dime_config_struct *config;
+
+    // transmission delay + two way latency, drawn from latency profile of config
+    rcu_read_lock();
+    config = dime_config_get(dime_instance);
+    delay_ns = dime_latency_delay_ns(config, page_class);
+    if(config->link != DIME_RESOURCE_NONE || config->server != DIME_RESOURCE_NONE) {
+        // queueing and service at resources shared with other instances
+        queue_ns = dime_resource_delay_ns(config);
+        atomic_long_add(queue_ns, &dime_instance->time_queue);
+        delay_ns += queue_ns;
+    }
+    rcu_read_unlock();
+    if(adjust_ns < 0 && (unsigned long long) -adjust_ns >= delay_ns)
+        delay_ns = 0;
+    else
+        delay_ns += adjust_ns;
+
+    if(delay_ns > DELAY_ATOMIC_MAX_NS) {
+        atomic_long_add(delay_ns - DELAY_ATOMIC_MAX_NS, &dime_instance->time_clamped);
+        delay_ns = DELAY_ATOMIC_MAX_NS;
+    }
 
     /*
     diff = atomic_long_read(&dime_instance->pagefaults)*delay_ns;
@@ -160,7 +370,7 @@ void inject_delay(struct dime_instance_struct *dime_instance, unsigned long long
 
 
 
-    if(delay_ns < 100000) {                                     // use custome busy loop for < 100us
+    if(delay_ns < DELAY_BUSY_WAIT_MAX_NS) {                     // use custome busy loop for < 100us
         unsigned long long hook_timestamp = sched_clock();
         while ((sched_clock() - hook_timestamp) < delay_ns) {
             // Wait for delay
@@ -170,6 +380,9 @@ void inject_delay(struct dime_instance_struct *dime_instance, unsigned long long
     } else {                                                    // use msleep for > 20ms
         msleep(delay_ns / 1000000);
     }
+
+    if(start_ns)
+        trace_dime_inject_delay(dime_instance->instance_id, delay_ns, sched_clock() - start_ns);
 }
 EXPORT_SYMBOL(inject_delay);
 
@@ -183,7 +396,11 @@ EXPORT_SYMBOL(inject_delay);
  */
 int init_module(void) {
     int ret = 0;
-    int i;
+    char *pid_list, *pid_start, *pid_end;
+#ifdef DA_DEBUG_STATIC_KEYS
+    da_debug_update_keys();
+    da_debug_keys_ready = true;
+#endif
     DA_ENTRY();
 
     if(init_mem_lib()) {
@@ -191,44 +408,89 @@ int init_module(void) {
         goto init_bad;
     }
 
+    init_dime_latency();
+
     if(init_dime_config_procfs()) {
         ret = -1; // TODO:: Error codes
         goto init_bad;
     }
 
-    HOOK_START_FN_NAME  = do_page_fault_hook_start_new;
-    HOOK_END_FN_NAME    = do_page_fault_hook_end_new;
-    DA_INFO("hook insertion complete");
+    if((ret = init_dime_stats()))
+        goto init_clean_config;
 
-    rwlock_init(&(dime.dime_instances[0].lock));
+    if((ret = init_dime_wss()))
+        goto init_clean_stats;
 
-    write_lock(&(dime.dime_instances[0].lock));
+    if((ret = init_dime_repart()))
+        goto init_clean_wss;
 
-    for(i=0 ; i<pid_count ; ++i) {
-        dime.dime_instances[0].pid[i] = pid[i];
-        dime.dime_instances[0].pid_count++;
+    if((ret = init_dime_resource()))
+        goto init_clean_repart;
+
+    if((ret = init_dime_offload()))
+        goto init_clean_resource;
+
+    if((ret = init_dime_compress()))
+        goto init_clean_offload;
+
+    if((ret = init_dime_warm()))
+        goto init_clean_compress;
+
+    // instance has config before any process is mapped to it
+    init_dime_instance(&dime.dime_instances[0], 0, NULL);
+    if((ret = dime_config_set(&dime.dime_instances[0], latency_ns, bandwidth_bps, local_npages)))
+        goto init_clean_warm;
+
+    pid_list = kstrdup(pid, GFP_KERNEL);
+    pid_end = pid_list;
+    while( pid_list && (pid_start = strsep(&pid_end, ",")) != NULL) {
+        int nr;
+        if(strlen(pid_start) == 0)
+            continue;
+
+        if(kstrtoint(pid_start, 10, &nr) != 0) {
+            DA_ERROR("invalid number : %s", pid_start);
+            continue;
+        }
+        pt_insert_nr(&dime.dime_instances[0], nr);
     }
+    kfree(pid_list);
 
-    dime.dime_instances[0].latency_ns       = latency_ns;
-    dime.dime_instances[0].bandwidth_bps    = bandwidth_bps;
-    dime.dime_instances[0].local_npages     = local_npages;
-    atomic_long_set(&dime.dime_instances[0].pc_pagefaults, 0);
-    atomic_long_set(&dime.dime_instances[0].an_pagefaults, 0);
-    atomic_long_set(&dime.dime_instances[0].pagefaults, 0);
-    atomic_long_set(&dime.dime_instances[0].time_pfh, 0);
-    atomic_long_set(&dime.dime_instances[0].time_ap, 0);
-    atomic_long_set(&dime.dime_instances[0].time_inject, 0);
-    atomic_long_set(&dime.dime_instances[0].time_pfh_ap, 0);
-    atomic_long_set(&dime.dime_instances[0].time_pfh_ap_inject, 0);
-    atomic_long_set(&dime.dime_instances[0].duplecate_pfs, 0);
-    dime.dime_instances_size                = 1;
-
-    write_unlock(&(dime.dime_instances[0].lock));
+    if(strlen(cgroup) > 0) {
+        struct cgroup *cgrp = pt_get_cgroup(cgroup);
+        if(!IS_ERR(cgrp))
+            pt_set_cgroup(&dime.dime_instances[0], cgrp);
+    }
+
+    smp_store_release(&dime.dime_instances_size, 1);
+
+    // install hooks only after instance 0 is ready
+    if((ret = dime_hook_install()))
+        goto init_clean_instance;
     goto init_good;
 
+    // unwind in reverse order of initialization
+init_clean_instance:
+    pt_cleanup();
+    dime_config_cleanup();
+init_clean_warm:
+    cleanup_dime_warm();
+init_clean_compress:
+    cleanup_dime_compress();
+init_clean_offload:
+    cleanup_dime_offload();
+init_clean_resource:
+    cleanup_dime_resource();
+init_clean_repart:
+    cleanup_dime_repart();
+init_clean_wss:
+    cleanup_dime_wss();
+init_clean_stats:
+    cleanup_dime_stats();
+init_clean_config:
+    cleanup_dime_config_procfs();
 init_bad:
-    HOOK_START_FN_NAME  = NULL;
-    HOOK_END_FN_NAME    = NULL;
+    dime_hook_remove();
     DA_ERROR("failed to initialize, exiting");
 
 init_good:
@@ -240,15 +502,25 @@ void cleanup_module(void)
 {
     int i;
     DA_ENTRY();
+    cleanup_dime_warm();
+    cleanup_dime_compress();
+    cleanup_dime_offload();
+    cleanup_dime_resource();
+    cleanup_dime_repart();
+    cleanup_dime_wss();
+    cleanup_dime_stats();
     cleanup_dime_config_procfs();
     // TODO:: Unprotect all pages before exiting
-    HOOK_START_FN_NAME  = NULL; 
-    HOOK_END_FN_NAME    = NULL;                    // Removing hook, setting to NULL
+    dime_hook_remove();
     pt_exit_ptracker();
     for(i=0 ; i<dime.dime_instances_size ; ++i) {
         if (dime.dime_instances[i].prp)
             dime.dime_instances[i].prp->clean(&dime.dime_instances[i]);
+        dime_admission_cleanup(&dime.dime_instances[i]);
     }
+    sp_cleanup();
+    pt_cleanup();
+    dime_config_cleanup();
     cleanup_mm_lib();
     DA_INFO("cleaning up module complete");
     DA_EXIT();
@@ -266,25 +538,40 @@ int do_page_fault_hook_start_new (struct pt_regs *regs,
                             unsigned long address,
                             int * hook_flag,
                             ulong * hook_timestamp) {
-    struct dime_instance_struct *dime_instance = pt_get_dime_instance_of_pid(&dime, current->tgid);
+    struct dime_instance_struct *dime_instance = pt_get_dime_instance_of_task(current);
 
     *hook_flag = 0;
     *hook_timestamp = sched_clock();
 
+    if(dime_instance && rcu_access_pointer(dime_instance->cgrp))
+        pt_join_cgroup(dime_instance, current);
+
     if(address != 0ul && dime_instance) {
         // Inject delays here
         pte_t *ptep = ml_get_ptep(current->mm, address);
         if(ml_is_inlist_pte(current->mm, address, ptep)) {
             atomic_long_inc(&dime_instance->duplecate_pfs);
             *hook_flag = 0;
+        } else if(ptep && !pte_none(*ptep) && !pte_present(*ptep)) {
+            *hook_flag = 2;     // page is swapped out, fault fetches it back
         } else {
             *hook_flag = 1;
         }
+        ml_put_ptep(ptep);
+        trace_dime_fault_start(dime_instance->instance_id, address, *hook_flag);
     }
 
     return 0;
 }
 
+// class of page mapped at address once fault is handled, anon if nothing is mapped
+static enum dime_page_class fault_page_class(struct mm_struct *mm, ulong address) {
+    pte_t *ptep = ml_get_ptep(mm, address);
+    enum dime_page_class class = (ptep && pte_present(*ptep)) ? dime_page_class(pte_page(*ptep)) : DIME_PAGE_ANON;
+    ml_put_ptep(ptep);
+    return class;
+}
+
 /*  do_page_fault_hook_end_new
  *
  *  Description:
@@ -295,40 +582,86 @@ int do_page_fault_hook_end_new (struct pt_regs *regs,
                             unsigned long address,
                             int * hook_flag,
                             ulong * hook_timestamp) {
-    if(*hook_flag == 1) {
-        struct dime_instance_struct *dime_instance = pt_get_dime_instance_of_pid(&dime, current->tgid);
-        unsigned long long time_pfh = 0,
+    if(*hook_flag) {
+        struct dime_instance_struct *dime_instance = pt_get_dime_instance_of_task(current);
+        unsigned long long time_fetch = 0,
+            time_pfh = 0,
             time_ap = 0,
             time_inject = 0,
             time_pfh_ap = 0,
             time_pfh_ap_inject = 0;
+        int inject = 0, tier;
+        bool local_fetch = false;
+        enum dime_page_class page_class;
+        struct dime_admission_struct *admission;
 
         if(address != 0ul && dime_instance) {
             // Inject delays here
             time_pfh = sched_clock() - *hook_timestamp;
             atomic_long_add(time_pfh, &dime_instance->time_pfh);
+
+            if(sp_map_resident(dime_instance, current->mm, address)) {
+                // page is already in local memory for another mapping, nothing to fetch
+                atomic_long_inc(&dime_instance->shared_pfs);
+                atomic_long_inc(&dime_instance->pagefaults);
+                return 0;
+            }
+
+            tier = dime_tier_fault(dime_instance, current->mm);
+            if(tier == DIME_TIER_OFFLOAD && *hook_flag == 2) {
+                // offloaded page was just swapped in from memory server
+                time_fetch = time_pfh;
+                atomic_long_inc(&dime_instance->offload_fetches);
+                atomic_long_add(time_fetch, &dime_instance->time_fetch);
+            } else if(tier == DIME_TIER_COMPRESS) {
+                // decompression is real, it may stand for the whole fetch
+                local_fetch = dime_compress_fault(dime_instance, current->mm, address);
+            }
+
+            page_class = fault_page_class(current->mm, address);
+            atomic_long_inc(page_class == DIME_PAGE_ANON ? &dime_instance->an_pagefaults : &dime_instance->pc_pagefaults);
+            dime_repart_fault(dime_instance, current->mm, address);
             
             time_ap = sched_clock();
             
-            if(dime_instance->prp && dime_instance->prp->add_page && dime_instance->prp->add_page(dime_instance, task_pid(current), address) == 1) {
+            // admission filter is freed after a grace period when the policy is removed
+            rcu_read_lock();
+            admission = rcu_dereference(dime_instance->admission);
+            if(dime_instance->prp && dime_instance->prp->add_page && admission) {
+                // page enters admission window, policy gets pages which pass admission
+                inject = dime_admission_add_page(dime_instance, admission, current->mm, address);
+                rcu_read_unlock();
+                sp_insert(dime_instance, current->mm, address);
+            } else {
+                rcu_read_unlock();
+                if(dime_instance->prp && dime_instance->prp->add_page && dime_instance->prp->add_page(dime_instance, current->mm, address) == 1) {
+                    inject = 1;
+                    if(dime_local_npages(dime_instance))
+                        sp_insert(dime_instance, current->mm, address);
+                }
             }
 
             time_ap = sched_clock() - time_ap;
             atomic_long_add(time_ap, &dime_instance->time_ap);
+            trace_dime_add_page(dime_instance->instance_id, address, inject, time_ap);
 
             time_pfh_ap = sched_clock() - *hook_timestamp;
             atomic_long_add(time_pfh_ap, &dime_instance->time_pfh_ap);
 
             time_inject = sched_clock();
 
-            inject_delay(dime_instance, time_pfh_ap);
+            // lost fetches, brownouts and latency spikes of the fabric, less real fetch time
+            if(!local_fetch)
+                inject_delay(dime_instance, (long long) dime_latency_fabric_ns(dime_instance) - (long long) time_fetch, page_class);
             //inject_delay(dime_instance, time_pfh);
 
             time_inject = sched_clock() - time_inject;
             atomic_long_add(time_inject, &dime_instance->time_inject);
+            atomic_long_add(time_inject, page_class == DIME_PAGE_ANON ? &dime_instance->an_time_inject : &dime_instance->pc_time_inject);
 
             time_pfh_ap_inject = sched_clock() - *hook_timestamp;
             atomic_long_add(time_pfh_ap_inject, &dime_instance->time_pfh_ap_inject);
+            trace_dime_fault_end(dime_instance->instance_id, address, time_pfh, time_ap, time_inject, time_pfh_ap_inject);
 
             atomic_long_inc(&dime_instance->pagefaults);
         }
@@ -337,9 +670,13 @@ int do_page_fault_hook_end_new (struct pt_regs *regs,
     return 0;
 }
 
+// Module of registered policy, guarded by dime_prp_lock
+static struct module *dime_prp_owner = NULL;
+static DEFINE_SPINLOCK(dime_prp_lock);
+
 // TODO:: no use of prp here, remove or rename function
 int register_page_replacement_policy(struct page_replacement_policy_struct *prp) {
-    int i, j;
+    int j;
     
     // initialize processes
     // TODO:: register unregister functions can be developed with more simplification,
@@ -349,18 +686,34 @@ int register_page_replacement_policy(struct page_replacement_policy_struct *prp)
     }
 
     for (j=0 ; j<dime.dime_instances_size ; ++j) {
-        for(i=0 ; i<dime.dime_instances[j].pid_count ; ++i) {
-            DA_INFO("adding process %d to tracking", dime.dime_instances[j].pid[i]);
+        // admission filter reads its window from config at insertion, like policies
+        if (dime_admission_init(&dime.dime_instances[j]) != 0) {
+            while (--j >= 0)
+                dime_admission_cleanup(&dime.dime_instances[j]);
+            pt_exit_ptracker();
+            return -1; // TODO:: valid error code
+        }
+    }
+
+    for (j=0 ; j<dime.dime_instances_size ; ++j) {
+        pt_protect_instance(&dime.dime_instances[j]);
+    }
 
-            pt_add_children(&dime.dime_instances[j], dime.dime_instances[j].pid[i]);
+    // policy module sets prp of all instances before registering
+    spin_lock(&dime_prp_lock);
+    for (j=0 ; j<dime.dime_instances_size ; ++j) {
+        if (dime.dime_instances[j].prp) {
+            dime_prp_owner = dime.dime_instances[j].prp->owner;
+            break;
         }
     }
+    spin_unlock(&dime_prp_lock);
     return 0;
 }
 
 int deregister_page_replacement_policy(struct page_replacement_policy_struct *prp) {
-    /*int j;
-
+    int j;
+    /*
     for (j=0 ; j<dime.dime_instances_size ; ++j) {
         if(dime.dime_instances[j].prp != prp) {
             DA_ERROR("the policy given is not registered with dime, please provide correct policy");
@@ -370,9 +723,49 @@ int deregister_page_replacement_policy(struct page_replacement_policy_struct *pr
         }
     }*/
 
+    spin_lock(&dime_prp_lock);
+    dime_prp_owner = NULL;
+    spin_unlock(&dime_prp_lock);
+
     pt_exit_ptracker();
+    for (j=0 ; j<dime.dime_instances_size ; ++j)
+        dime_admission_cleanup(&dime.dime_instances[j]);
+    // policy lists are cleaned, resident pages have no owner anymore
+    sp_cleanup();
     return 0;
 }
 
+/*  dime_prp_get
+ *
+ *  Description:
+ *      Returns policy of instance with a reference on the policy module, NULL
+ *      if there is none or it is being removed. Policy modules clear and free
+ *      prp of instances only in their exit, which can not start while the
+ *      reference is held. For callers outside fault hooks, e.g. procfs and
+ *      ioctl handlers; release with dime_prp_put.
+ */
+struct page_replacement_policy_struct * dime_prp_get(struct dime_instance_struct *dime_instance) {
+    struct page_replacement_policy_struct *prp = NULL;
+    struct module *owner;
+
+    spin_lock(&dime_prp_lock);
+    owner = dime_prp_owner;
+    if (owner && try_module_get(owner)) {
+        prp = READ_ONCE(dime_instance->prp);
+        if (!prp)
+            module_put(owner);
+    }
+    spin_unlock(&dime_prp_lock);
+
+    return prp;
+}
+
+void dime_prp_put(struct page_replacement_policy_struct *prp) {
+    if (prp)
+        module_put(prp->owner);
+}
+
 EXPORT_SYMBOL(register_page_replacement_policy);
-EXPORT_SYMBOL(deregister_page_replacement_policy);
\ No newline at end of file
+EXPORT_SYMBOL(deregister_page_replacement_policy);
+EXPORT_SYMBOL(dime_prp_get);
+EXPORT_SYMBOL(dime_prp_put);
\ No newline at end of file
@@ -0,0 +1,400 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/timekeeping.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
+#include <linux/prandom.h>
+#endif
+#include "da_mem_lib.h"
+#include "da_latency.h"
+
+/*****
+ *
+ *  Latency distributions and congestion schedule of instances.
+ *
+ *  Distribution of one way latency is turned into a table of
+ *  DIME_LATENCY_TABLE_SIZE equally likely quantiles when config is built,
+ *  so a page fault draws a sample with one PRNG step and one table load.
+ *
+ */
+
+static const char *dist_names[DIME_LATENCY_DIST_MAX] = {
+    [DIME_LATENCY_CONSTANT]     = "constant",
+    [DIME_LATENCY_NORMAL]       = "normal",
+    [DIME_LATENCY_LOGNORMAL]    = "lognormal",
+    [DIME_LATENCY_EMPIRICAL]    = "empirical",
+};
+
+/*
+ *  Standard normal quantiles * 1000 at (i + 0.5) / DIME_LATENCY_TABLE_SIZE
+ *  for upper half of the table, lower half is symmetric.
+ */
+static const s16 normal_quantile_milli[DIME_LATENCY_TABLE_SIZE / 2] = {
+       1,    4,    6,    9,   11,   13,   16,   18,   21,   23,   26,   28,   31,   33,   36,   38,
+      40,   43,   45,   48,   50,   53,   55,   58,   60,   62,   65,   67,   70,   72,   75,   77,
+      80,   82,   85,   87,   89,   92,   94,   97,   99,  102,  104,  107,  109,  112,  114,  117,
+     119,  121,  124,  126,  129,  131,  134,  136,  139,  141,  144,  146,  149,  151,  154,  156,
+     159,  161,  164,  166,  168,  171,  173,  176,  178,  181,  183,  186,  188,  191,  193,  196,
+     198,  201,  203,  206,  208,  211,  213,  216,  218,  221,  223,  226,  228,  231,  233,  236,
+     238,  241,  244,  246,  249,  251,  254,  256,  259,  261,  264,  266,  269,  271,  274,  276,
+     279,  282,  284,  287,  289,  292,  294,  297,  299,  302,  305,  307,  310,  312,  315,  317,
+     320,  323,  325,  328,  330,  333,  335,  338,  341,  343,  346,  348,  351,  354,  356,  359,
+     361,  364,  367,  369,  372,  375,  377,  380,  382,  385,  388,  390,  393,  396,  398,  401,
+     404,  406,  409,  412,  414,  417,  420,  422,  425,  428,  430,  433,  436,  438,  441,  444,
+     446,  449,  452,  455,  457,  460,  463,  465,  468,  471,  474,  476,  479,  482,  485,  487,
+     490,  493,  496,  498,  501,  504,  507,  510,  512,  515,  518,  521,  524,  526,  529,  532,
+     535,  538,  540,  543,  546,  549,  552,  555,  558,  560,  563,  566,  569,  572,  575,  578,
+     581,  583,  586,  589,  592,  595,  598,  601,  604,  607,  610,  613,  616,  619,  622,  625,
+     628,  631,  634,  637,  640,  643,  646,  649,  652,  655,  658,  661,  664,  667,  670,  673,
+     676,  679,  682,  685,  688,  691,  695,  698,  701,  704,  707,  710,  713,  717,  720,  723,
+     726,  729,  732,  736,  739,  742,  745,  749,  752,  755,  758,  762,  765,  768,  771,  775,
+     778,  781,  785,  788,  791,  795,  798,  801,  805,  808,  812,  815,  818,  822,  825,  829,
+     832,  836,  839,  843,  846,  850,  853,  857,  860,  864,  867,  871,  875,  878,  882,  885,
+     889,  893,  896,  900,  904,  907,  911,  915,  918,  922,  926,  930,  933,  937,  941,  945,
+     949,  953,  956,  960,  964,  968,  972,  976,  980,  984,  988,  992,  996, 1000, 1004, 1008,
+    1012, 1016, 1020, 1024, 1029, 1033, 1037, 1041, 1045, 1050, 1054, 1058, 1062, 1067, 1071, 1075,
+    1080, 1084, 1089, 1093, 1097, 1102, 1106, 1111, 1115, 1120, 1125, 1129, 1134, 1139, 1143, 1148,
+    1153, 1157, 1162, 1167, 1172, 1177, 1182, 1187, 1192, 1197, 1202, 1207, 1212, 1217, 1222, 1227,
+    1232, 1238, 1243, 1248, 1254, 1259, 1264, 1270, 1275, 1281, 1287, 1292, 1298, 1304, 1309, 1315,
+    1321, 1327, 1333, 1339, 1345, 1351, 1357, 1363, 1369, 1376, 1382, 1388, 1395, 1401, 1408, 1414,
+    1421, 1428, 1435, 1442, 1449, 1456, 1463, 1470, 1477, 1484, 1492, 1499, 1507, 1515, 1522, 1530,
+    1538, 1546, 1554, 1563, 1571, 1579, 1588, 1597, 1605, 1614, 1623, 1633, 1642, 1652, 1661, 1671,
+    1681, 1691, 1701, 1712, 1723, 1733, 1745, 1756, 1767, 1779, 1791, 1804, 1816, 1829, 1842, 1856,
+    1870, 1884, 1899, 1914, 1929, 1945, 1962, 1979, 1996, 2015, 2034, 2053, 2074, 2095, 2118, 2142,
+    2166, 2193, 2221, 2251, 2282, 2317, 2354, 2395, 2441, 2492, 2551, 2620, 2705, 2815, 2975, 3297,
+};
+
+static DEFINE_PER_CPU(struct rnd_state, dime_latency_rnd);
+
+int init_dime_latency(void) {
+    int cpu;
+
+    for_each_possible_cpu(cpu) {
+        u32 seed;
+        get_random_bytes(&seed, sizeof(seed));
+        prandom_seed_state(per_cpu_ptr(&dime_latency_rnd, cpu), seed);
+    }
+    return 0;
+}
+
+// uniform random number from per cpu state of latency draws
+u32 dime_latency_random(void) {
+    struct rnd_state *rnd = get_cpu_ptr(&dime_latency_rnd);
+    u32 r = prandom_u32_state(rnd);
+    put_cpu_ptr(&dime_latency_rnd);
+    return r;
+}
+
+const char * dime_latency_dist_name(enum dime_latency_dist dist) {
+    return dist < DIME_LATENCY_DIST_MAX ? dist_names[dist] : "unknown";
+}
+
+int dime_latency_parse_dist(const char *name) {
+    int i;
+
+    for(i=0 ; i<DIME_LATENCY_DIST_MAX ; ++i) {
+        if(strcmp(name, dist_names[i]) == 0)
+            return i;
+    }
+
+    DA_ERROR("invalid latency distribution : %s", name);
+    return -EINVAL;
+}
+
+/*  dime_latency_parse_cdf
+ *
+ *  Description:
+ *      Parses "permille:latency_ns,..." points of an empirical CDF, e.g.
+ *      "0:1000,500:1500,990:8000,1000:20000". Both columns must increase.
+ */
+int dime_latency_parse_cdf(char *value, struct dime_latency_cdf_point *cdf, int *cdf_points) {
+    char *point, *points = value;
+    int count = 0;
+
+    while( (point = strsep(&points, ",")) != NULL) {
+        char *ns = point;
+        u32 permille, latency_ns;
+
+        if(strlen(point) == 0)
+            continue;
+
+        point = strsep(&ns, ":");
+        if(!ns || kstrtou32(point, 10, &permille) || kstrtou32(ns, 10, &latency_ns) || permille > 1000) {
+            DA_ERROR("invalid latency cdf point : %s:%s", point, ns ? ns : "");
+            return -EINVAL;
+        }
+        if(count == DIME_LATENCY_CDF_MAX) {
+            DA_ERROR("latency cdf has more than %d points", DIME_LATENCY_CDF_MAX);
+            return -EINVAL;
+        }
+        if(count > 0 && (permille <= cdf[count-1].permille || latency_ns < cdf[count-1].latency_ns)) {
+            DA_ERROR("latency cdf points must be increasing : %u:%u", permille, latency_ns);
+            return -EINVAL;
+        }
+
+        cdf[count].permille   = permille;
+        cdf[count].latency_ns = latency_ns;
+        count++;
+    }
+
+    *cdf_points = count;
+    return 0;
+}
+
+// standard normal quantile * 1000 of table entry i
+static long normal_quantile(int i) {
+    int half = DIME_LATENCY_TABLE_SIZE / 2;
+    return i >= half ? normal_quantile_milli[i - half] : -normal_quantile_milli[half - 1 - i];
+}
+
+/*
+ *  value * exp(x / 1000), x clamped to [-10000, 10000]. Computed as
+ *  2^(x*log2(e)) with integer part as shift and a cubic for the fraction in
+ *  16.16 fixed point, error is about 0.01%.
+ */
+static u64 mul_exp_milli(u64 value, long x) {
+    long y, k;
+    u64 f, p;
+
+    x = clamp(x, -10000L, 10000L);
+    y = x * 94548 / 1000;                   // x * log2(e) in 16.16
+    k = y >> 16;                            // floor, also for negative y
+    f = y - (k << 16);                      // [0, 1) in 16.16
+
+    // 2^f ~ 1 + f*(0.6955 + f*(0.2260 + f*0.0785))
+    p = 5145;
+    p = 14811 + ((p * f) >> 16);
+    p = 45580 + ((p * f) >> 16);
+    p = 65536 + ((p * f) >> 16);
+
+    value *= p;
+    return k >= 0 ? (value << k) >> 16 : value >> (16 - k);
+}
+
+// one way latency at quantile q (in 1/DIME_LATENCY_TABLE_SIZE/2 units) of empirical CDF
+static u32 empirical_quantile(const struct dime_latency_profile *profile, u64 q) {
+    const struct dime_latency_cdf_point *cdf = profile->cdf;
+    u64 scale = 2 * DIME_LATENCY_TABLE_SIZE;     // q / scale is probability
+    int j;
+
+    if(q * 1000 <= cdf[0].permille * scale)
+        return cdf[0].latency_ns;
+
+    for(j=1 ; j<profile->cdf_points ; ++j) {
+        u64 lo = cdf[j-1].permille * scale, hi = cdf[j].permille * scale;
+        if(q * 1000 <= hi) {
+            u64 span = cdf[j].latency_ns - cdf[j-1].latency_ns;
+            return cdf[j-1].latency_ns + div64_u64(span * (q * 1000 - lo), hi - lo);
+        }
+    }
+
+    return cdf[profile->cdf_points-1].latency_ns;
+}
+
+/*  dime_latency_build_table
+ *
+ *  Description:
+ *      Validates profile of config and fills its quantile table, config must
+ *      have room for the table unless distribution is constant.
+ */
+int dime_latency_build_table(struct dime_config_struct *config) {
+    const struct dime_latency_profile *profile = &config->profile;
+    int i;
+
+    if(profile->congestion_period_ns && profile->congestion_duration_ns > profile->congestion_period_ns) {
+        DA_ERROR("congestion duration is longer than its period");
+        return -EINVAL;
+    }
+    if(profile->congestion_period_ns && profile->congestion_bandwidth_pct == 0) {
+        DA_ERROR("congestion_bandwidth_pct must be greater than zero");
+        return -EINVAL;
+    }
+    if(profile->dist == DIME_LATENCY_EMPIRICAL && profile->cdf_points == 0) {
+        DA_ERROR("empirical latency distribution needs latency_cdf");
+        return -EINVAL;
+    }
+
+    for(i=0 ; profile->dist != DIME_LATENCY_CONSTANT && i<DIME_LATENCY_TABLE_SIZE ; ++i) {
+        long long latency;
+
+        switch(profile->dist) {
+        case DIME_LATENCY_NORMAL:
+            latency = (long long) config->latency_ns + normal_quantile(i) * (long long) profile->stddev_ns / 1000;
+            break;
+        case DIME_LATENCY_LOGNORMAL:
+            latency = mul_exp_milli(config->latency_ns, normal_quantile(i) * (long) profile->sigma_milli / 1000);
+            break;
+        case DIME_LATENCY_EMPIRICAL:
+            latency = empirical_quantile(profile, 2*i + 1);
+            break;
+        default:
+            latency = config->latency_ns;
+        }
+
+        config->latency_table[i] = clamp_t(long long, latency, 0, U32_MAX);
+    }
+
+    return 0;
+}
+
+/*  dime_latency_delay_ns
+ *
+ *  Description:
+ *      Returns page fetch delay of one page fault of page_class, transmission
+ *      delay plus two way latency drawn from the distribution, scaled during
+ *      congestion. Distribution of page cache is that of anon scaled to its
+ *      own latency. Must be called inside rcu read section of config.
+ */
+ulong dime_latency_delay_ns(const struct dime_config_struct *config, enum dime_page_class page_class) {
+    const struct dime_latency_profile *profile = &config->profile;
+    ulong latency_ns = config->class_latency_ns[page_class];
+    ulong transmission_ns = config->transmission_ns[page_class];
+
+    if(likely(profile->dist == DIME_LATENCY_CONSTANT && profile->congestion_period_ns == 0))
+        return config->delay_ns[page_class];
+
+    if(profile->dist != DIME_LATENCY_CONSTANT) {
+        ulong sample = config->latency_table[dime_latency_random() & (DIME_LATENCY_TABLE_SIZE - 1)];
+
+        if(latency_ns == config->latency_ns)
+            latency_ns = sample;
+        else if(config->latency_ns)
+            latency_ns = div64_u64((u64) sample * latency_ns, config->latency_ns);
+    }
+
+    if(profile->congestion_period_ns) {
+        u64 phase;
+        div64_u64_rem(ktime_get_ns() - config->schedule_start_ns, profile->congestion_period_ns, &phase);
+        if(phase < profile->congestion_duration_ns) {
+            latency_ns = latency_ns * profile->congestion_latency_pct / 100;
+            transmission_ns = transmission_ns * 100 / profile->congestion_bandwidth_pct;
+        }
+    }
+
+    return transmission_ns + 2*latency_ns;
+}
+
+
+/*
+ *
+ *  Fabric faults
+ *
+ */
+
+#define FABRIC_MAX_LOSSES       16          // losses charged to one fetch at most
+#define FABRIC_SPIKE_SALT       0x5350494b45ULL
+#define FABRIC_GOLDEN           0x9e3779b97f4a7c15ULL
+
+// true with probability ppm per million, from low 32 bits of hash
+static inline bool fabric_draw(u64 hash, ulong ppm) {
+    return (((hash & 0xffffffffULL) * 1000000ULL) >> 32) < ppm;
+}
+
+int dime_latency_check_fabric(const struct dime_config_struct *config) {
+    const struct dime_fabric_profile *fabric = &config->fabric;
+
+    if(fabric->loss_ppm > 1000000 || fabric->spike_ppm > 1000000) {
+        DA_ERROR("loss_ppm and spike_ppm must be at most 1000000");
+        return -EINVAL;
+    }
+    if(fabric->brownout_period_ns && fabric->brownout_duration_ns > fabric->brownout_period_ns) {
+        DA_ERROR("brownout duration is longer than its period");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/*  dime_latency_fabric_ns
+ *
+ *  Description:
+ *      Returns delay added to one remote fetch of instance by fabric faults:
+ *      a timeout per lost attempt, the rest of a running brownout and a
+ *      latency spike. The n-th fetch after fabric_seed is set draws the same
+ *      losses and spike on every run, brownouts follow wall time from then.
+ */
+ulong dime_latency_fabric_ns(struct dime_instance_struct *dime_instance) {
+    const struct dime_fabric_profile *fabric;
+    ulong fabric_ns = 0, losses = 0;
+    u64 hash, phase;
+
+    rcu_read_lock();
+    fabric = &dime_config_get(dime_instance)->fabric;
+    if(likely(fabric->loss_ppm == 0 && fabric->brownout_period_ns == 0 && fabric->spike_ppm == 0))
+        goto exit;
+
+    hash = ml_hash64(fabric->seed ^ ((u64) atomic64_inc_return(&dime_instance->fabric_seq) * FABRIC_GOLDEN));
+
+    while(losses < FABRIC_MAX_LOSSES && fabric_draw(ml_hash64(hash + losses), fabric->loss_ppm))
+        ++losses;
+    if(losses) {
+        fabric_ns += losses * fabric->timeout_ns;
+        atomic_long_add(losses, &dime_instance->fabric_losses);
+    }
+
+    if(fabric->brownout_period_ns) {
+        div64_u64_rem(ktime_get_ns() - fabric->start_ns, fabric->brownout_period_ns, &phase);
+        if(phase < fabric->brownout_duration_ns) {
+            fabric_ns += fabric->brownout_duration_ns - phase;
+            atomic_long_inc(&dime_instance->fabric_brownouts);
+        }
+    }
+
+    if(fabric_draw(ml_hash64(hash ^ FABRIC_SPIKE_SALT), fabric->spike_ppm)) {
+        fabric_ns += fabric->spike_ns;
+        atomic_long_inc(&dime_instance->fabric_spikes);
+    }
+
+    atomic_long_add(fabric_ns, &dime_instance->time_fabric);
+exit:
+    rcu_read_unlock();
+    return fabric_ns;
+}
+
+// Prints fabric faults of config as one procfs column, e.g. "loss=100/200000,spike=10/5000000,seed=7", "-" if none
+void dime_latency_show_fabric(struct seq_file *m, const struct dime_config_struct *config) {
+    const struct dime_fabric_profile *fabric = &config->fabric;
+    const char *sep = "";
+
+    if(fabric->loss_ppm == 0 && fabric->brownout_period_ns == 0 && fabric->spike_ppm == 0) {
+        seq_putc(m, '-');
+        return;
+    }
+    if(fabric->loss_ppm) {
+        seq_printf(m, "loss=%lu/%lu", fabric->loss_ppm, fabric->timeout_ns);
+        sep = ",";
+    }
+    if(fabric->brownout_period_ns) {
+        seq_printf(m, "%sbrownout=%llu/%llu", sep,
+                    div_u64(fabric->brownout_period_ns, NSEC_PER_MSEC),
+                    div_u64(fabric->brownout_duration_ns, NSEC_PER_MSEC));
+        sep = ",";
+    }
+    if(fabric->spike_ppm) {
+        seq_printf(m, "%sspike=%lu/%lu", sep, fabric->spike_ppm, fabric->spike_ns);
+        sep = ",";
+    }
+    seq_printf(m, "%sseed=%llu", sep, fabric->seed);
+}
+
+// Prints profile of config as one procfs column, e.g. "normal/500,congestion=300000/30000/500/100"
+void dime_latency_show(struct seq_file *m, const struct dime_config_struct *config) {
+    const struct dime_latency_profile *profile = &config->profile;
+
+    seq_puts(m, dime_latency_dist_name(profile->dist));
+    if(profile->dist == DIME_LATENCY_NORMAL)
+        seq_printf(m, "/%lu", profile->stddev_ns);
+    else if(profile->dist == DIME_LATENCY_LOGNORMAL)
+        seq_printf(m, "/%lu", profile->sigma_milli);
+    else if(profile->dist == DIME_LATENCY_EMPIRICAL)
+        seq_printf(m, "/%d", profile->cdf_points);
+
+    if(profile->congestion_period_ns)
+        seq_printf(m, ",congestion=%llu/%llu/%lu/%lu",
+                    div_u64(profile->congestion_period_ns, NSEC_PER_MSEC),
+                    div_u64(profile->congestion_duration_ns, NSEC_PER_MSEC),
+                    profile->congestion_latency_pct, profile->congestion_bandwidth_pct);
+}
@@ -0,0 +1,20 @@
+#ifndef __DA_LATENCY_H__
+#define __DA_LATENCY_H__
+
+
+#include "common.h"
+
+int     init_dime_latency           (void);
+int     dime_latency_parse_dist     (const char *name);
+int     dime_latency_parse_cdf      (char *value, struct dime_latency_cdf_point *cdf, int *cdf_points);
+int     dime_latency_build_table    (struct dime_config_struct *config);
+ulong   dime_latency_delay_ns       (const struct dime_config_struct *config, enum dime_page_class page_class);
+u32     dime_latency_random         (void);
+int     dime_latency_check_fabric   (const struct dime_config_struct *config);
+ulong   dime_latency_fabric_ns      (struct dime_instance_struct *dime_instance);
+void    dime_latency_show_fabric    (struct seq_file *m, const struct dime_config_struct *config);
+void    dime_latency_show           (struct seq_file *m, const struct dime_config_struct *config);
+const char * dime_latency_dist_name (enum dime_latency_dist dist);
+
+
+#endif
@@ -13,27 +13,71 @@
 #include <asm/pgtable_types.h>
 
 #include <linux/pid.h>      // find_get_pid
+#include <linux/kallsyms.h>
+#include <linux/kprobes.h>
 
 #include "da_mem_lib.h"
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+void (*flush_tlb_mm_range_fp) (struct mm_struct *, unsigned long, unsigned long, unsigned int, bool) = NULL;
+#else
 void (*flush_tlb_mm_range_fp) (struct mm_struct *, unsigned long, unsigned long, unsigned long) = NULL;
+#endif
 EXPORT_SYMBOL(flush_tlb_mm_range_fp);
+void (*mmput_async_fp) (struct mm_struct *) = NULL;
+EXPORT_SYMBOL(mmput_async_fp);
+
+/*  ml_kallsyms_lookup_name
+ *
+ *  Description:
+ *      kallsyms_lookup_name is not exported since 5.7, its address is taken
+ *      from a kprobe planted on it instead
+ */
+unsigned long ml_kallsyms_lookup_name(const char *name) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,7,0)
+	static unsigned long (*lookup_fp) (const char *) = NULL;
+
+	if(!lookup_fp) {
+		struct kprobe kp = { .symbol_name = "kallsyms_lookup_name" };
+		if(register_kprobe(&kp) < 0) {
+			DA_ERROR("could not find symbol kallsyms_lookup_name");
+			return 0;
+		}
+		lookup_fp = (unsigned long (*) (const char *)) kp.addr;
+		unregister_kprobe(&kp);
+	}
+	return lookup_fp(name);
+#else
+	return kallsyms_lookup_name(name);
+#endif
+}
+EXPORT_SYMBOL(ml_kallsyms_lookup_name);
 
 int init_mem_lib (void) {
 	unsigned long fp = 0;
 	int ret = 0;
 	DA_ENTRY();
 
-	fp = kallsyms_lookup_name("flush_tlb_mm_range");
+	fp = ml_kallsyms_lookup_name("flush_tlb_mm_range");
 	if(fp==0) {
 		DA_ERROR("could not find symbol flush_tlb_mm_range");
 		flush_tlb_mm_range_fp = NULL;
 		ret = -1;  // TODO:: Error codes
 	} else {
-		flush_tlb_mm_range_fp = (void (*) (struct mm_struct *, unsigned long, unsigned long, unsigned long))fp;
+		flush_tlb_mm_range_fp = (typeof(flush_tlb_mm_range_fp))fp;
 		DA_INFO("registered flush_tlb_mm_range function pointer :%p", flush_tlb_mm_range_fp);
 	}
 
+	fp = ml_kallsyms_lookup_name("mmput_async");
+	if(fp==0) {
+		DA_ERROR("could not find symbol mmput_async");
+		mmput_async_fp = NULL;
+		ret = -1;  // TODO:: Error codes
+	} else {
+		mmput_async_fp = (typeof(mmput_async_fp))fp;
+		DA_INFO("registered mmput_async function pointer :%p", mmput_async_fp);
+	}
+
 	DA_EXIT();
 	return ret;
 }
@@ -42,6 +86,7 @@ int cleanup_mm_lib (void) {
 	DA_ENTRY();
 	DA_INFO("deregistering flush_tlb_mm_range function pointer :%p", flush_tlb_mm_range_fp);
 	flush_tlb_mm_range_fp = NULL;
+	mmput_async_fp = NULL;
 	DA_EXIT();
 	return 0;
 }
@@ -53,6 +98,9 @@ int cleanup_mm_lib (void) {
  */
 pte_t * ml_get_ptep(struct mm_struct *mm, unsigned long virt) {
 	struct page * page;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	p4d_t *p4d;
+#endif
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *pte;
@@ -65,26 +113,27 @@ pte_t * ml_get_ptep(struct mm_struct *mm, unsigned long virt) {
 		goto EXIT;
 	}
 	pgd = pgd_offset(mm, virt);
-	if(pgd == NULL)
-	DA_ERROR("pgd is null : address:%lu", virt);
 	if (pgd_none(*pgd) || pgd_bad(*pgd)) {
 		pte = NULL;
 		goto EXIT;
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+	p4d = p4d_offset(pgd, virt);
+	if (p4d_none(*p4d) || p4d_bad(*p4d)) {
+		pte = NULL;
+		goto EXIT;
+	}
+	pud = pud_offset(p4d, virt);
+#else
 	pud = pud_offset(pgd, virt);
-	if(pud == NULL)
-		DA_ERROR("pud is null : address:%lu", virt);
-
+#endif
 	if (pud_none(*pud) || pud_bad(*pud)) {
 		pte = NULL;
 		goto EXIT;
 	}
 
 	pmd = pmd_offset(pud, virt);
-	if(pmd == NULL)
-		DA_ERROR("pmd is null : address:%lu", virt);
-
 	if (pmd_none(*pmd) || pmd_bad(*pmd)) {
 		pte = NULL;
 		goto EXIT;
@@ -94,6 +143,7 @@ pte_t * ml_get_ptep(struct mm_struct *mm, unsigned long virt) {
 		goto EXIT;
 	}
 	if (!(page = pte_page(*pte))) {      // TODO:: Verify if required to check if page == NULL
+		pte_unmap(pte);
 		pte = NULL;
 		goto EXIT;
 	}
@@ -127,8 +177,13 @@ void ml_protect_all_pages(struct mm_struct * mm) {
 	if(mm) {
 		struct vm_area_struct *vma = NULL;
 		unsigned long vpage;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+		VMA_ITERATOR(vmi, mm, 0);
 
+		for_each_vma(vmi, vma) {
+#else
 		for (vma=mm->mmap ; vma ; vma=vma->vm_next) {
+#endif
 			for (vpage = vma->vm_start; vpage < vma->vm_end; vpage += PAGE_SIZE) {
 				//DA_DEBUG("protecting page %lu", vpage);
 				// ml_set_inlist(mm, vpage);
@@ -174,7 +229,7 @@ int ml_clear_accessed(struct mm_struct *mm, ulong address) {
 		// Protect page "address"
 		set_pte( ptep , pte_clear_flags(*ptep, _PAGE_ACCESSED) );
 
-		flush_tlb_page(mm, address);
+		ml_flush_tlb_page(mm, address);
 
 		return 1;	// Success
 	}
@@ -200,7 +255,7 @@ int ml_set_accessed(struct mm_struct *mm, ulong address) {
 	if(ptep && pte_present(*ptep)) {		// TODO:: why check if present
 		*ptep = pte_mkyoung(*ptep);
 
-		flush_tlb_page(mm, address);
+		ml_flush_tlb_page(mm, address);
 
 		return 1;	// Success
 	}
@@ -214,7 +269,7 @@ int ml_clear_dirty(struct mm_struct *mm, ulong address) {
 	if(ptep && pte_present(*ptep)) {		// TODO:: why check if present
 		*ptep = pte_mkclean(*ptep);
 
-		flush_tlb_page(mm, address);
+		ml_flush_tlb_page(mm, address);
 
 		return 1;	// Success
 	}
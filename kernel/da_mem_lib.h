@@ -1,14 +1,20 @@
 #ifndef __DA_MEM_LIB_H__
 #define __DA_MEM_LIB_H__
 
+#include <linux/version.h>
+#include <linux/mm.h>
+
 #include "../common/da_debug.h"
+#include "dime_trace.h"
 
 int init_mem_lib (void);
 int cleanup_mm_lib (void);
 /*  get_ptep
  *
  *  Description:
- *      Returns pointer to PTE corresponding to given virtual address
+ *      Returns pointer to PTE corresponding to given virtual address, mapped
+ *      with pte_offset_map, to be released with ml_put_ptep before sleeping.
+ *      Since 6.5 the map holds rcu read lock until pte_unmap.
  */
 pte_t * ml_get_ptep(struct mm_struct *mm, unsigned long virt);
 //struct page *ml_get_page_sruct(struct mm_struct *mm, unsigned long virt);
@@ -44,14 +50,57 @@ void ml_protect_all_pages(struct mm_struct * mm);
 
 struct task_struct * ml_get_task_struct(pid_t pid);
 struct mm_struct * ml_get_mm_struct(pid_t pid);
+unsigned long ml_kallsyms_lookup_name(const char *name);
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+extern void (*flush_tlb_mm_range_fp) (struct mm_struct *, unsigned long, unsigned long, unsigned int, bool);
+#else
 extern void (*flush_tlb_mm_range_fp) (struct mm_struct *, unsigned long, unsigned long, unsigned long);
+#endif
 
 // Function pointer to flush_tlb_page function. Since it is not exported symbol,
 // it has to be extracted using kallsyms_lookup_name function.
-static inline void flush_tlb_page(struct mm_struct *mm, unsigned long a) {
+static inline void ml_flush_tlb_page(struct mm_struct *mm, unsigned long a) {
 	a -= (a % PAGE_SIZE);	// page address start
+	trace_dime_tlb_flush(mm, a);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+	flush_tlb_mm_range_fp(mm, a, a + PAGE_SIZE, PAGE_SHIFT, false);
+#else
 	flush_tlb_mm_range_fp(mm, a, a + PAGE_SIZE, VM_NONE);
+#endif
+}
+
+static inline void ml_flush_tlb_range(struct mm_struct *mm, unsigned long start, unsigned long end) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,0,0)
+	flush_tlb_mm_range_fp(mm, start, end, PAGE_SHIFT, false);
+#else
+	flush_tlb_mm_range_fp(mm, start, end, VM_NONE);
+#endif
+}
+
+// mmap_sem is renamed to mmap_lock with its own api since 5.8
+static inline void ml_mmap_read_lock(struct mm_struct *mm) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	mmap_read_lock(mm);
+#else
+	down_read(&mm->mmap_sem);
+#endif
+}
+
+static inline int ml_mmap_read_trylock(struct mm_struct *mm) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	return mmap_read_trylock(mm);
+#else
+	return down_read_trylock(&mm->mmap_sem);
+#endif
+}
+
+static inline void ml_mmap_read_unlock(struct mm_struct *mm) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,8,0)
+	mmap_read_unlock(mm);
+#else
+	up_read(&mm->mmap_sem);
+#endif
 }
 
 static inline int ml_protect_pte(struct mm_struct *mm, ulong address, pte_t *ptep) {
@@ -61,7 +110,7 @@ static inline int ml_protect_pte(struct mm_struct *mm, ulong address, pte_t *pte
 		set_pte( ptep , pte_clear_flags(*ptep, _PAGE_PRESENT) );
 		set_pte( ptep , pte_set_flags(*ptep, _PAGE_PROTNONE) );
 
-		flush_tlb_page(mm, address);
+		ml_flush_tlb_page(mm, address);
 
 		return 1;	// Success
 	}
@@ -69,9 +118,27 @@ static inline int ml_protect_pte(struct mm_struct *mm, ulong address, pte_t *pte
 	return 0;		// Failure
 }
 
+// Releases pte of ml_get_ptep, NULL is ignored
+static inline void ml_put_ptep(pte_t *ptep) {
+	if(ptep)
+		pte_unmap(ptep);
+}
+
 static inline int ml_protect_page(struct mm_struct *mm, ulong address) {
 	pte_t* ptep = ml_get_ptep(mm, address);
-	return ml_protect_pte(mm, address, ptep);
+	int ret = ml_protect_pte(mm, address, ptep);
+	ml_put_ptep(ptep);
+	return ret;
+}
+
+// Undoes ml_protect_pte, no flush is needed since pte was not present
+static inline int ml_unprotect_pte(struct mm_struct *mm, ulong address, pte_t *ptep) {
+	if(ptep && pte_present(*ptep) && !(pte_flags(*ptep) & _PAGE_PRESENT)) {
+		set_pte( ptep , pte_clear_flags(pte_set_flags(*ptep, _PAGE_PRESENT), _PAGE_PROTNONE) );
+		return 1;	// Success
+	}
+
+	return 0;		// Failure
 }
 
 static inline int ml_is_inlist_pte(struct mm_struct *mm, ulong address, pte_t *ptep) {
@@ -101,4 +168,57 @@ static inline int ml_reset_inlist_pte(struct mm_struct *mm, ulong address, pte_t
 	return 0;           // Failure
 }
 
+extern void (*mmput_async_fp) (struct mm_struct *);
+
+/*
+ *  Local page list nodes are owned by mm, not by a task, so that all threads
+ *  of a process share them and a node stays valid when its faulting thread
+ *  exits. A node holds mm_count reference (ml_mm_hold), which keeps mm_struct
+ *  allocated. Page tables are touched only between ml_mm_get and ml_mm_put,
+ *  which fails once the process has exited.
+ */
+static inline void ml_mm_hold(struct mm_struct *mm) {
+	if(mm)
+		atomic_inc(&mm->mm_count);
+}
+
+static inline void ml_mm_release(struct mm_struct *mm) {
+	if(mm)
+		mmdrop(mm);
+}
+
+static inline int ml_mm_get(struct mm_struct *mm) {
+	return mm && atomic_inc_not_zero(&mm->mm_users);
+}
+
+// may be called under spinlocks, last user reference is dropped from workqueue
+static inline void ml_mm_put(struct mm_struct *mm) {
+	mmput_async_fp(mm);
+}
+
+// 64 bit finalizer of murmur3, every input bit affects every output bit
+static inline u64 ml_hash64(u64 h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// hash of page of mm, keys differ mostly in low bits of page number
+static inline u64 ml_page_hash(struct mm_struct *mm, ulong address) {
+	return ml_hash64((u64)(ulong)mm ^ (address >> PAGE_SHIFT));
+}
+
+// protects page of a node being evicted, nothing to do if owner has exited
+static inline int ml_protect_mm_page(struct mm_struct *mm, ulong address) {
+	int ret = 0;
+	if(ml_mm_get(mm)) {
+		ret = ml_protect_page(mm, address);
+		ml_mm_put(mm);
+	}
+	return ret;
+}
+
 #endif//__DA_MEM_LIB_H__
\ No newline at end of file
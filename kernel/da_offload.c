@@ -0,0 +1,344 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+#include <linux/workqueue.h>
+#include <linux/mman.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_offload.h"
+#include "da_compress.h"
+
+/*****
+ *
+ *  Offload of evicted pages to a memory server.
+ *
+ *  With tier=offload, a page evicted by the policy does not stay in local
+ *  DRAM. It is paged out with MADV_PAGEOUT on a worker, to the swap device
+ *  of highest priority, which is expected to be served by a memory server
+ *  process, e.g. dime_memserver over nbd. The frame is freed, and the next
+ *  access to the page fetches it back from the server through a real swap
+ *  in. Fault hooks find the fetch time in time_pfh, and injected delay is
+ *  reduced by it, so a fetch costs max(real, emulated) delay.
+ *
+ *  Evicted pages are told apart by their mm, registered on faults of an
+ *  instance with a tier; tier=compress is handled in da_compress.c. The
+ *  registry is pruned of exited processes every TIER_PRUNE_PERIOD_MS while
+ *  it is not empty, whatever the tier.
+ *  Eviction runs under policy locks, so pages are queued with a hold on
+ *  their mm. Pages evicted when the queue is full stay local. Only pages
+ *  mapped once are paged out; shared, mlocked and file pages are left to
+ *  the kernel's own rules of MADV_PAGEOUT.
+ *
+ */
+
+#define OFFLOAD_HASH_BITS       8
+#define OFFLOAD_QUEUE_SIZE      4096        // evicted pages waiting for the worker
+#define OFFLOAD_BATCH           32          // pages taken from queue under one hold of the lock
+#define TIER_PRUNE_PERIOD_MS    1000        // registered mms of exited processes are dropped this often
+
+// mm of a process of an instance with a tier, registered on its first fault
+struct offload_mm_struct {
+    struct hlist_node               node;
+    struct mm_struct                *mm;            // holds mm_count reference
+    struct dime_instance_struct     *dime_instance;
+};
+
+struct offload_request_struct {
+    struct mm_struct                *mm;            // holds mm_count reference
+    ulong                           address;
+    struct dime_instance_struct     *dime_instance;
+};
+
+static const char *tier_names[DIME_TIER_MAX] = {
+    [DIME_TIER_NONE]        = "none",
+    [DIME_TIER_OFFLOAD]     = "offload",
+    [DIME_TIER_COMPRESS]    = "compress",
+};
+
+static DEFINE_HASHTABLE(offload_mm_hash, OFFLOAD_HASH_BITS);
+static DEFINE_SPINLOCK(offload_lock);              // mm table and queue
+static struct offload_request_struct offload_queue[OFFLOAD_QUEUE_SIZE];
+static unsigned int offload_head = 0, offload_count = 0;
+static int offload_nr_mms = 0;
+static bool offload_active = false;
+
+static void offload_work_fn(struct work_struct *work);
+static DECLARE_WORK(offload_work, offload_work_fn);
+static void tier_prune_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(tier_prune_work, tier_prune_work_fn);
+
+// do_madvise takes mm of any process since 5.10, it is not exported
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+static int (*do_madvise_fp) (struct mm_struct *, unsigned long, size_t, int) = NULL;
+#endif
+
+int dime_tier_parse(const char *name) {
+    int i;
+
+    for(i=0 ; i<DIME_TIER_MAX ; ++i) {
+        if(strcmp(name, tier_names[i]) == 0)
+            return i;
+    }
+    DA_ERROR("invalid tier : %s", name);
+    return -EINVAL;
+}
+
+// Prints tier of config as one procfs column, "-" if pages stay local
+void dime_tier_show(struct seq_file *m, const struct dime_config_struct *config) {
+    if(config->tier == DIME_TIER_NONE)
+        seq_putc(m, '-');
+    else if(config->tier == DIME_TIER_COMPRESS)
+        dime_compress_show(m, config);
+    else
+        seq_puts(m, tier_names[config->tier]);
+}
+
+int dime_tier_check(const struct dime_config_struct *config) {
+    if(config->tier == DIME_TIER_COMPRESS)
+        return dime_compress_check(config);
+    if(config->tier != DIME_TIER_OFFLOAD)
+        return 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+    if(do_madvise_fp)
+        return 0;
+#endif
+    DA_ERROR("tier=offload needs do_madvise of kernel 5.10 or later");
+    return -EOPNOTSUPP;
+}
+
+static inline int offload_tier(struct dime_instance_struct *dime_instance) {
+    int tier;
+
+    rcu_read_lock();
+    tier = dime_config_get(dime_instance)->tier;
+    rcu_read_unlock();
+    return tier;
+}
+
+static struct offload_mm_struct *offload_find_mm(struct mm_struct *mm) {
+    struct offload_mm_struct *om;
+
+    hash_for_each_possible(offload_mm_hash, om, node, (ulong) mm) {
+        if(om->mm == mm)
+            return om;
+    }
+    return NULL;
+}
+
+/*  dime_tier_fault
+ *
+ *  Description:
+ *      Called on every emulated fault, returns tier of evicted pages of the
+ *      instance. mm is registered if instance has a tier, so that its
+ *      evicted pages are recognized. Runs with preemption disabled.
+ */
+int dime_tier_fault(struct dime_instance_struct *dime_instance, struct mm_struct *mm) {
+    struct offload_mm_struct *om;
+    int tier = offload_tier(dime_instance);
+
+    if(tier == DIME_TIER_NONE)
+        return tier;
+
+    spin_lock(&offload_lock);
+    om = offload_find_mm(mm);
+    if(om) {
+        om->dime_instance = dime_instance;      // process may have moved to another instance
+    } else if(offload_active && (om = kmalloc(sizeof(struct offload_mm_struct), GFP_ATOMIC)) != NULL) {
+        ml_mm_hold(mm);
+        om->mm = mm;
+        om->dime_instance = dime_instance;
+        hash_add(offload_mm_hash, &om->node, (ulong) mm);
+        WRITE_ONCE(offload_nr_mms, offload_nr_mms + 1);
+        if(offload_nr_mms == 1)
+            schedule_delayed_work(&tier_prune_work, msecs_to_jiffies(TIER_PRUNE_PERIOD_MS));
+    }
+    spin_unlock(&offload_lock);
+    return tier;
+}
+
+/*  dime_tier_evict
+ *
+ *  Description:
+ *      Queues page evicted by a policy for page out, if its mm belongs to an
+ *      instance with tier=offload, or compresses it for tier=compress. Page
+ *      must have been protected and mapped only by mm. Called under policy
+ *      locks.
+ */
+void dime_tier_evict(struct mm_struct *mm, ulong address) {
+    struct dime_instance_struct *compress_instance = NULL;
+    struct offload_mm_struct *om;
+    struct offload_request_struct *req;
+    bool queued = false;
+    int tier;
+
+    if(!READ_ONCE(offload_nr_mms))
+        return;
+
+    spin_lock(&offload_lock);
+    om = offload_find_mm(mm);
+    tier = om && offload_active ? offload_tier(om->dime_instance) : DIME_TIER_NONE;
+    if(tier == DIME_TIER_COMPRESS) {
+        compress_instance = om->dime_instance;
+    } else if(tier == DIME_TIER_OFFLOAD) {
+        if(offload_count < OFFLOAD_QUEUE_SIZE) {
+            req = &offload_queue[(offload_head + offload_count) % OFFLOAD_QUEUE_SIZE];
+            ml_mm_hold(mm);
+            req->mm = mm;
+            req->address = address & PAGE_MASK;
+            req->dime_instance = om->dime_instance;
+            ++offload_count;
+            queued = true;
+        } else {
+            atomic_long_inc(&om->dime_instance->offload_failed);
+        }
+    }
+    spin_unlock(&offload_lock);
+
+    if(queued)
+        queue_work(system_unbound_wq, &offload_work);
+    if(compress_instance)
+        dime_compress_evict(compress_instance, mm, address);
+}
+
+// page is still evicted: protected by DiME and not faulted in again since queued
+static int offload_is_evicted(struct mm_struct *mm, ulong address) {
+    pte_t *ptep = ml_get_ptep(mm, address);
+    int evicted = ptep && pte_present(*ptep) && !(pte_flags(*ptep) & _PAGE_PRESENT) && !ml_is_inlist_pte(mm, address, ptep);
+    ml_put_ptep(ptep);
+    return evicted;
+}
+
+// page was written to swap device and its frame freed
+static int offload_is_swapped(struct mm_struct *mm, ulong address) {
+    pte_t *ptep = ml_get_ptep(mm, address);
+    int swapped = ptep && !pte_none(*ptep) && !pte_present(*ptep);
+    ml_put_ptep(ptep);
+    return swapped;
+}
+
+static void offload_page(struct offload_request_struct *req) {
+    struct mm_struct *mm = req->mm;
+    int evicted, swapped = 0;
+
+    if(!ml_mm_get(mm))
+        return;     // process has exited
+
+    ml_mmap_read_lock(mm);
+    evicted = offload_is_evicted(mm, req->address);
+    ml_mmap_read_unlock(mm);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+    // reclaim writes page to swap device and frees the frame, pte becomes a swap entry
+    if(evicted && do_madvise_fp(mm, req->address, PAGE_SIZE, MADV_PAGEOUT) == 0) {
+        ml_mmap_read_lock(mm);
+        swapped = offload_is_swapped(mm, req->address);
+        ml_mmap_read_unlock(mm);
+    }
+#endif
+
+    if(evicted)
+        atomic_long_inc(swapped ? &req->dime_instance->offload_pages : &req->dime_instance->offload_failed);
+    ml_mm_put(mm);
+}
+
+// Drops mms of exited processes, runs again while any mm is registered
+static void tier_prune_work_fn(struct work_struct *work) {
+    struct offload_mm_struct *om;
+    struct hlist_node *tmp;
+    HLIST_HEAD(free_list);
+    int bkt;
+
+    spin_lock(&offload_lock);
+    hash_for_each_safe(offload_mm_hash, bkt, tmp, om, node) {
+        if(atomic_read(&om->mm->mm_users) == 0) {
+            hash_del(&om->node);
+            hlist_add_head(&om->node, &free_list);
+            WRITE_ONCE(offload_nr_mms, offload_nr_mms - 1);
+        }
+    }
+    if(offload_nr_mms && offload_active)
+        schedule_delayed_work(&tier_prune_work, msecs_to_jiffies(TIER_PRUNE_PERIOD_MS));
+    spin_unlock(&offload_lock);
+
+    hlist_for_each_entry_safe(om, tmp, &free_list, node) {
+        ml_mm_release(om->mm);
+        kfree(om);
+    }
+}
+
+static void offload_work_fn(struct work_struct *work) {
+    struct offload_request_struct batch[OFFLOAD_BATCH];
+    unsigned int i, n;
+
+    do {
+        spin_lock(&offload_lock);
+        n = min_t(unsigned int, offload_count, OFFLOAD_BATCH);
+        for(i=0 ; i<n ; ++i)
+            batch[i] = offload_queue[(offload_head + i) % OFFLOAD_QUEUE_SIZE];
+        offload_head = (offload_head + n) % OFFLOAD_QUEUE_SIZE;
+        offload_count -= n;
+        spin_unlock(&offload_lock);
+
+        for(i=0 ; i<n ; ++i) {
+            offload_page(&batch[i]);
+            ml_mm_release(batch[i].mm);
+            cond_resched();
+        }
+    } while(n);
+}
+
+int init_dime_offload(void) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+    unsigned long fp = ml_kallsyms_lookup_name("do_madvise");
+
+    if(fp == 0) {
+        DA_WARNING("could not find symbol do_madvise, tier=offload is not available");
+    } else {
+        do_madvise_fp = (typeof(do_madvise_fp))fp;
+        DA_INFO("registered do_madvise function pointer :%p", do_madvise_fp);
+    }
+#endif
+    spin_lock(&offload_lock);
+    offload_active = true;
+    spin_unlock(&offload_lock);
+    return 0;
+}
+
+void cleanup_dime_offload(void) {
+    struct offload_mm_struct *om;
+    struct hlist_node *tmp;
+    HLIST_HEAD(free_list);
+    int bkt;
+
+    spin_lock(&offload_lock);
+    offload_active = false;
+    spin_unlock(&offload_lock);
+
+    // pages still queued stay local
+    cancel_work_sync(&offload_work);
+    cancel_delayed_work_sync(&tier_prune_work);
+    for(; offload_count ; --offload_count) {
+        ml_mm_release(offload_queue[offload_head].mm);
+        offload_head = (offload_head + 1) % OFFLOAD_QUEUE_SIZE;
+    }
+
+    spin_lock(&offload_lock);
+    hash_for_each_safe(offload_mm_hash, bkt, tmp, om, node) {
+        hash_del(&om->node);
+        hlist_add_head(&om->node, &free_list);
+    }
+    WRITE_ONCE(offload_nr_mms, 0);
+    spin_unlock(&offload_lock);
+
+    hlist_for_each_entry_safe(om, tmp, &free_list, node) {
+        ml_mm_release(om->mm);
+        kfree(om);
+    }
+}
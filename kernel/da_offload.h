@@ -0,0 +1,16 @@
+#ifndef __DA_OFFLOAD_H__
+#define __DA_OFFLOAD_H__
+
+
+#include "common.h"
+
+int     init_dime_offload       (void);
+void    cleanup_dime_offload    (void);
+int     dime_tier_parse         (const char *name);
+void    dime_tier_show          (struct seq_file *m, const struct dime_config_struct *config);
+int     dime_tier_check         (const struct dime_config_struct *config);
+int     dime_tier_fault         (struct dime_instance_struct *dime_instance, struct mm_struct *mm);
+void    dime_tier_evict         (struct mm_struct *mm, ulong address);
+
+
+#endif
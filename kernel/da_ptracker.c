@@ -1,139 +1,675 @@
-#include <linux/kprobes.h>
+#include <linux/module.h>
+#include <linux/tracepoint.h>
 #include <linux/sched.h>
 #include <linux/sort.h>
+#include <linux/bsearch.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/llist.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/mm.h>
+#include <linux/sched/task.h>
+#include <linux/sched/signal.h>
+#endif
 
 #include "../common/da_debug.h"
 #include "da_mem_lib.h"
 #include "da_ptracker.h"
 
-struct dime_instance_struct * pt_get_dime_instance_of_pid (struct dime_struct *dime, pid_t pid) {
-    int i, j;
-    for (i=0 ; i<dime->dime_instances_size ; ++i) {
-        for (j=0 ; j<dime->dime_instances[i].pid_count ; ++j) {
-            if(dime->dime_instances[i].pid[j] == pid)
-                return &(dime->dime_instances[i]);
+#define PT_HASH_BITS            10
+#define PT_CGROUP_HASH_BITS     6
+
+// Global index of tracked processes of all instances, looked up on every page fault
+static DEFINE_HASHTABLE(pt_hash, PT_HASH_BITS);
+// Instances bound to a cgroup, by cgroup, looked up on faults of untracked tasks
+static DEFINE_HASHTABLE(pt_cgroup_hash, PT_CGROUP_HASH_BITS);
+// Serializes all modifications of pt_hash, pt_cgroup_hash and instance pid lists, readers use RCU
+static DEFINE_SPINLOCK(pt_lock);
+// Number of instances bound to a cgroup, cgroup check on fault path is skipped when zero
+static atomic_t pt_cgroup_count = ATOMIC_INIT(0);
+
+// Process joined through cgroup, whose pages are protected by pt_join_work
+struct pt_join_struct {
+    struct llist_node               node;
+    struct mm_struct                * mm;           // holds mm_users reference
+    pid_t                           tgid;
+};
+
+static LLIST_HEAD(pt_join_list);
+static void pt_join_work_fn(struct work_struct *work);
+static DECLARE_WORK(pt_join_work, pt_join_work_fn);
+
+
+// must be called with pt_lock held or inside rcu read section
+static struct pt_node_struct * __pt_lookup(struct pid *pid_s) {
+    struct pt_node_struct *node;
+
+    hash_for_each_possible_rcu(pt_hash, node, hash_node, (unsigned long)pid_s) {
+        if(node->pid_s == pid_s)
+            return node;
+    }
+
+    return NULL;
+}
+
+static void pt_node_free_rcu(struct rcu_head *head) {
+    struct pt_node_struct *node = container_of(head, struct pt_node_struct, rcu);
+    put_pid(node->pid_s);
+    kfree(node);
+}
+
+// must be called with pt_lock held, node is unlinked from pid hash and pid_list and freed after a grace period
+static void __pt_del(struct pt_node_struct *node) {
+    hash_del_rcu(&node->hash_node);
+    list_del_rcu(&node->list_node);
+    node->dime_instance->pid_count--;
+    call_rcu(&node->rcu, pt_node_free_rcu);
+}
+
+struct dime_instance_struct * pt_get_dime_instance_of_pid (struct pid *pid_s) {
+    struct pt_node_struct *node;
+    struct dime_instance_struct *dime_instance = NULL;
+
+    rcu_read_lock();
+    node = __pt_lookup(pid_s);
+    if(node)
+        dime_instance = node->dime_instance;
+    rcu_read_unlock();
+
+    return dime_instance;
+}
+
+int pt_find(struct dime_instance_struct *dime_instance, struct pid *pid_s) {
+    return pt_get_dime_instance_of_pid(pid_s) == dime_instance;
+}
+
+/*  pt_pid_of_mm
+ *
+ *  Description:
+ *      Returns pid, in pid namespace of the caller, of the tracked process
+ *      of the instance whose mm is mm, 0 if there is none. mm is only
+ *      compared, so it may be called under spinlocks.
+ */
+pid_t pt_pid_of_mm(struct dime_instance_struct *dime_instance, struct mm_struct *mm) {
+    struct pt_node_struct *node;
+    struct task_struct *ts;
+    pid_t pid = 0;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(node, &dime_instance->pid_list, list_node) {
+        ts = pid_task(node->pid_s, PIDTYPE_PID);
+        if(ts && READ_ONCE(ts->mm) == mm) {
+            pid = pid_vnr(node->pid_s);
+            break;
         }
     }
+    rcu_read_unlock();
+
+    return pid;
+}
+
+// must be called inside rcu read section
+static struct dime_instance_struct * __pt_get_dime_instance_of_cgroup(struct cgroup *cgrp) {
+    struct dime_instance_struct *dime_instance;
+
+    hash_for_each_possible_rcu(pt_cgroup_hash, dime_instance, cgroup_node, (unsigned long)cgrp) {
+        if(rcu_dereference(dime_instance->cgrp) == cgrp)
+            return dime_instance;
+    }
 
     return NULL;
 }
 
-int pt_find(struct dime_instance_struct *dime_instance, pid_t pid) {
-    int i;
-    for (i=0 ; i<dime_instance->pid_count ; ++i) {
-        if(dime_instance->pid[i] == pid)
-            return i;
+/*  pt_get_dime_instance_of_task
+ *
+ *  Description:
+ *      Returns instance emulating the task, either by tgid of the task in
+ *      tracking set or by the cgroup (v2) task currently belongs to.
+ */
+struct dime_instance_struct * pt_get_dime_instance_of_task (struct task_struct *tsk) {
+    struct pt_node_struct *node;
+    struct dime_instance_struct *dime_instance = NULL;
+
+    rcu_read_lock();
+    node = __pt_lookup(task_tgid(tsk));
+    if(node && !node->cgroup_member) {
+        dime_instance = node->dime_instance;
+    } else if(atomic_read(&pt_cgroup_count) > 0) {
+        // cgroup members are checked again on every fault, they might have moved out
+        dime_instance = __pt_get_dime_instance_of_cgroup(task_dfl_cgroup(tsk));
     }
+    rcu_read_unlock();
 
-    return -1;
+    return dime_instance;
 }
 
+// must be called with pt_lock held, pid_s must not be tracked
+static void __pt_link(struct dime_instance_struct *dime_instance, struct pt_node_struct *node, struct pid *pid_s, bool cgroup_member) {
+    node->pid_s         = get_pid(pid_s);
+    node->dime_instance = dime_instance;
+    node->cgroup_member = cgroup_member;
+    hash_add_rcu(pt_hash, &node->hash_node, (unsigned long)pid_s);
+    list_add_tail_rcu(&node->list_node, &dime_instance->pid_list);
+    dime_instance->pid_count++;
+}
 
-int pt_add(struct dime_instance_struct *dime_instance, pid_t pid) {
-    struct mm_struct *mm = NULL;
+/*  pt_insert
+ *
+ *  Description:
+ *      Adds tgid pid_s to tracking set of the instance, does not touch pages
+ *      of the process. Can be called from probe handlers.
+ */
+static int __pt_insert(struct dime_instance_struct *dime_instance, struct pid *pid_s, bool cgroup_member) {
+    struct pt_node_struct *node, *old;
+
+    node = (struct pt_node_struct*) kmalloc(sizeof(struct pt_node_struct), GFP_ATOMIC);
+    if(!node) {
+        DA_ERROR("unable to allocate memory");
+        return -ENOMEM;
+    }
+
+    spin_lock(&pt_lock);
+    old = __pt_lookup(pid_s);
+    if(old) {
+        spin_unlock(&pt_lock);
+        kfree(node);
+        if(old->dime_instance != dime_instance)
+            DA_WARNING("process is already tracked by instance %d : pid:%d", old->dime_instance->instance_id, pid_nr(pid_s));
+        return -EEXIST;
+    }
+
+    __pt_link(dime_instance, node, pid_s, cgroup_member);
+    spin_unlock(&pt_lock);
+
+    return 0;
+}
+
+int pt_insert(struct dime_instance_struct *dime_instance, struct pid *pid_s) {
+    return __pt_insert(dime_instance, pid_s, false);
+}
+EXPORT_SYMBOL(pt_insert);
+
+// Resolve pid number in pid namespace of the caller to referenced tgid, NULL if no such process
+struct pid * pt_get_tgid_nr(pid_t pid) {
+    struct task_struct *ts;
+    struct pid *tgid_s = NULL;
+
+    rcu_read_lock();
+    ts = pid_task(find_vpid(pid), PIDTYPE_PID);
+    if(ts)
+        tgid_s = get_pid(task_tgid(ts));
+    rcu_read_unlock();
+
+    if(!tgid_s)
+        DA_ERROR("no such process : pid:%d", pid);
+    return tgid_s;
+}
+
+int pt_insert_nr(struct dime_instance_struct *dime_instance, pid_t pid) {
+    struct pid *tgid_s = pt_get_tgid_nr(pid);
+    int ret;
+
+    if(!tgid_s)
+        return -ESRCH;
+
+    ret = pt_insert(dime_instance, tgid_s);
+    put_pid(tgid_s);
+    return ret == -EEXIST ? 0 : ret;
+}
+
+void pt_remove(struct pid *pid_s) {
+    struct pt_node_struct *node;
+
+    spin_lock(&pt_lock);
+    node = __pt_lookup(pid_s);
+    if(node) {
+        DA_INFO("process removed from tracking list : pid:%d", pid_nr(pid_s));
+        __pt_del(node);
+    }
+    spin_unlock(&pt_lock);
+}
+EXPORT_SYMBOL(pt_remove);
+
+void pt_clear(struct dime_instance_struct *dime_instance) {
+    struct pt_node_struct *node, *tmp;
+
+    spin_lock(&pt_lock);
+    list_for_each_entry_safe(node, tmp, &dime_instance->pid_list, list_node) {
+        __pt_del(node);
+    }
+    spin_unlock(&pt_lock);
+}
+
+static int pt_cmp_pid(const void *a, const void *b) {
+    unsigned long x = (unsigned long) *(struct pid * const *) a;
+    unsigned long y = (unsigned long) *(struct pid * const *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*  pt_set_pids
+ *
+ *  Description:
+ *      Replaces listed processes of the instance with tgids in pids, sorts
+ *      pids. Processes in both old and new set stay tracked throughout, so
+ *      page faults never miss them, processes joined through cgroup are kept.
+ *      Memory is allocated before the set is touched, on failure nothing
+ *      changes.
+ */
+int pt_set_pids(struct dime_instance_struct *dime_instance, struct pid **pids, int count) {
+    struct pt_node_struct **nodes, *node, *tmp;
+    int i, used = 0, added = 0, removed = 0, ret = 0;
+
+    nodes = (struct pt_node_struct **) kcalloc(count ? count : 1, sizeof(struct pt_node_struct *), GFP_KERNEL);
+    if(!nodes) {
+        DA_ERROR("unable to allocate memory");
+        return -ENOMEM;
+    }
+    for(i=0 ; i<count ; ++i) {
+        nodes[i] = (struct pt_node_struct*) kmalloc(sizeof(struct pt_node_struct), GFP_KERNEL);
+        if(!nodes[i]) {
+            DA_ERROR("unable to allocate memory");
+            ret = -ENOMEM;
+            goto set_pids_exit;
+        }
+    }
+
+    sort(pids, count, sizeof(struct pid *), pt_cmp_pid, NULL);
+
+    spin_lock(&pt_lock);
+    list_for_each_entry_safe(node, tmp, &dime_instance->pid_list, list_node) {
+        if(!node->cgroup_member && !bsearch(&node->pid_s, pids, count, sizeof(struct pid *), pt_cmp_pid)) {
+            __pt_del(node);
+            removed++;
+        }
+    }
+    for(i=0 ; i<count ; ++i) {
+        if(i > 0 && pids[i] == pids[i-1])
+            continue;
+
+        node = __pt_lookup(pids[i]);
+        if(node) {
+            if(node->dime_instance != dime_instance)
+                DA_WARNING("process is already tracked by instance %d : pid:%d", node->dime_instance->instance_id, pid_nr(pids[i]));
+            continue;
+        }
+        __pt_link(dime_instance, nodes[used++], pids[i], false);
+        added++;
+    }
+    spin_unlock(&pt_lock);
+
+    DA_INFO("instance %d pid set updated, added:%d removed:%d", dime_instance->instance_id, added, removed);
+
+set_pids_exit:
+    for(i=used ; i<count ; ++i)
+        kfree(nodes[i]);
+    kfree(nodes);
+    return ret;
+}
+
+
+// mm is referenced while its pages are protected, the process may be exiting
+static int pt_add_task(struct dime_instance_struct *dime_instance, struct task_struct *ts) {
+    struct mm_struct *mm = get_task_mm(ts);
 
-    mm = ml_get_mm_struct(pid);
     if(!mm) {
-        DA_ERROR("unable to add process, no such process : pid:%d", pid);
+        DA_ERROR("unable to add process, process has no mm : pid:%d", ts->pid);
         return -ESRCH;   /* No such process */
     }
 
-    DA_INFO("protecting all pages of process : pid:%d", pid);
+    DA_INFO("protecting all pages of process : pid:%d", ts->tgid);
     ml_protect_all_pages(mm);
+    ml_mm_put(mm);
 
-    // TODO:: check if list limit is reached
-
-    if(pt_find(dime_instance, pid) < 0) {
-        dime_instance->pid[dime_instance->pid_count++] = pid;
-        DA_INFO("process added to tracking list : pid:%d", pid);
+    if(pt_insert(dime_instance, task_tgid(ts)) == 0) {
+        DA_INFO("process added to tracking list : pid:%d", ts->tgid);
     } else {
-        DA_INFO("processs was already in tracking list : pid:%d", pid);
+        DA_INFO("processs was already in tracking list : pid:%d", ts->tgid);
     }
 
     return 0;
 }
 
-
-// Add parent pid and all the children pids to tracking list
-int pt_add_children(struct dime_instance_struct *dime_instance, pid_t ppid) {
+// Add parent and all its children to tracking list, threads are covered by their tgid
+static int pt_add_task_children(struct dime_instance_struct *dime_instance, struct task_struct *ts) {
     struct list_head * p;
-    struct task_struct *ts;
-    pid_t tmp_pid;
     int retval;
 
-    retval = pt_add(dime_instance, ppid);
+    retval = pt_add_task(dime_instance, ts);
     if(retval!=0)
         return retval;
 
-    ts = ml_get_task_struct(ppid);
+    DA_INFO("adding all processes of parent process : ppid:%d", ts->tgid);
+    list_for_each(p, &(ts->children)){
+        struct task_struct *tsk = list_entry(p, struct task_struct, sibling);
+        pt_add_task_children(dime_instance, tsk);
+    }
+
+    return 0;
+}
+
+int pt_add(struct dime_instance_struct *dime_instance, pid_t pid) {
+    struct task_struct *ts = ml_get_task_struct(pid);
+
+    if(!ts) {
+        DA_ERROR("unable to add process, no such process : pid:%d", pid);
+        return -ESRCH;   /* No such process */
+    }
+
+    return pt_add_task(dime_instance, ts);
+}
+
+int pt_add_children(struct dime_instance_struct *dime_instance, pid_t ppid) {
+    struct task_struct *ts = ml_get_task_struct(ppid);
+
     if(!ts) {
         DA_ERROR("unable to add process, no such process : ppid:%d", ppid);
         return -ESRCH;   /* No such process */
     }
 
-    DA_INFO("adding all processes of parent process : ppid:%d", ppid);
-    list_for_each(p, &(ts->children)){
-        struct task_struct *tsk = list_entry(p, struct task_struct, sibling);
-        // TODO:: take tgid instead of pid
-        tmp_pid = tsk->pid;
-        pt_add_children(dime_instance, tmp_pid);
+    return pt_add_task_children(dime_instance, ts);
+}
+
+// Protects pages of processes joined through cgroup, outside of page fault hooks
+static void pt_join_work_fn(struct work_struct *work) {
+    struct pt_join_struct *join, *tmp;
+
+    llist_for_each_entry_safe(join, tmp, llist_del_all(&pt_join_list), node) {
+        ml_mmap_read_lock(join->mm);
+        ml_protect_all_pages(join->mm);
+        ml_mmap_read_unlock(join->mm);
+        DA_INFO("pages of process joined through cgroup protected : pid:%d", join->tgid);
+        ml_mm_put(join->mm);
+        kfree(join);
+        cond_resched();
+    }
+}
+
+/*  pt_join_cgroup
+ *
+ *  Description:
+ *      Starts emulation of a member of instance cgroup seen for the first
+ *      time, i.e. a task forked in or moved into the cgroup. Called from page
+ *      fault hook, so the process is only tracked here, and its pages are
+ *      protected by pt_join_work. Faults before that are emulated as usual.
+ */
+void pt_join_cgroup(struct dime_instance_struct *dime_instance, struct task_struct *tsk) {
+    struct pt_node_struct *node;
+    struct pt_join_struct *join;
+    struct mm_struct *mm = tsk->mm;
+    bool tracked;
+
+    rcu_read_lock();
+    node = __pt_lookup(task_tgid(tsk));
+    tracked = node && node->dime_instance == dime_instance;
+    rcu_read_unlock();
+
+    if(tracked || !mm)
+        return;
+
+    join = (struct pt_join_struct*) kmalloc(sizeof(struct pt_join_struct), GFP_ATOMIC);
+    if(!join) {
+        DA_ERROR("unable to allocate memory");
+        return;
+    }
+    if(!ml_mm_get(mm)) {
+        kfree(join);
+        return;
+    }
+    join->mm = mm;
+    join->tgid = tsk->tgid;
+
+    if(node)
+        pt_remove(task_tgid(tsk));      // moved from cgroup of other instance
+
+    if(__pt_insert(dime_instance, task_tgid(tsk), true) != 0) {
+        ml_mm_put(mm);
+        kfree(join);
+        return;
+    }
+
+    DA_INFO("process joined through cgroup : pid:%d", tsk->tgid);
+    llist_add(&join->node, &pt_join_list);
+    schedule_work(&pt_join_work);
+}
+
+/*  pt_get_cgroup
+ *
+ *  Description:
+ *      Returns referenced cgroup v2 at path (relative to cgroup2 root), NULL
+ *      for empty path or ERR_PTR if there is no such cgroup.
+ */
+struct cgroup * pt_get_cgroup(const char *path) {
+    struct cgroup *cgrp;
+
+    if(!path || strlen(path) == 0)
+        return NULL;
+
+    cgrp = cgroup_get_from_path(path);
+    if(IS_ERR(cgrp))
+        DA_ERROR("no such cgroup : %s (error:%ld)", path, PTR_ERR(cgrp));
+    return cgrp;
+}
+
+/*  pt_set_cgroup
+ *
+ *  Description:
+ *      Binds instance to cgroup cgrp from pt_get_cgroup, taking over its
+ *      reference. Every task in that cgroup is emulated by the instance.
+ *      NULL unbinds. When replacing a cgroup, the instance enters the
+ *      cgroup hash again only after readers of the old bucket are done,
+ *      so members of the new cgroup join from then on.
+ */
+void pt_set_cgroup(struct dime_instance_struct *dime_instance, struct cgroup *cgrp) {
+    struct cgroup *old;
+    struct pt_node_struct *node, *tmp;
+
+    spin_lock(&pt_lock);
+    old = rcu_dereference_protected(dime_instance->cgrp, lockdep_is_held(&pt_lock));
+    if(old)
+        hash_del_rcu(&dime_instance->cgroup_node);
+    rcu_assign_pointer(dime_instance->cgrp, cgrp);
+    if(!old && cgrp) {
+        hash_add_rcu(pt_cgroup_hash, &dime_instance->cgroup_node, (unsigned long)cgrp);
+        atomic_inc(&pt_cgroup_count);
+    } else if(old && !cgrp)
+        atomic_dec(&pt_cgroup_count);
+
+    // processes joined through old cgroup will join again if still member
+    list_for_each_entry_safe(node, tmp, &dime_instance->pid_list, list_node) {
+        if(node->cgroup_member)
+            __pt_del(node);
+    }
+    spin_unlock(&pt_lock);
+
+    if(old) {
+        synchronize_rcu();
+        cgroup_put(old);
+        if(cgrp) {
+            spin_lock(&pt_lock);
+            hash_add_rcu(pt_cgroup_hash, &dime_instance->cgroup_node, (unsigned long)cgrp);
+            spin_unlock(&pt_lock);
+        }
+    }
+
+    DA_INFO("instance %d %s cgroup", dime_instance->instance_id, cgrp ? "bound to" : "unbound from");
+}
+
+/*  pt_protect_instance
+ *
+ *  Description:
+ *      Protects pages of all processes in the tracking set of the instance
+ *      and adds their children. Works on a snapshot of the set, since adding
+ *      children grows the set.
+ */
+int pt_protect_instance(struct dime_instance_struct *dime_instance) {
+    struct pt_node_struct *node;
+    struct pid **pids;
+    int i, count = 0, size;
+
+    size = dime_instance->pid_count;
+    if(size == 0)
+        return 0;
+
+    pids = (struct pid **) kmalloc(sizeof(struct pid *) * size, GFP_KERNEL);
+    if(!pids) {
+        DA_ERROR("unable to allocate memory");
+        return -ENOMEM;
+    }
+
+    spin_lock(&pt_lock);
+    list_for_each_entry(node, &dime_instance->pid_list, list_node) {
+        if(count == size)
+            break;
+        pids[count++] = get_pid(node->pid_s);
+    }
+    spin_unlock(&pt_lock);
+
+    for(i=0 ; i<count ; ++i) {
+        struct task_struct *ts = get_pid_task(pids[i], PIDTYPE_PID);
+        if(ts) {
+            DA_INFO("adding process %d to tracking", ts->tgid);
+            pt_add_task_children(dime_instance, ts);
+            put_task_struct(ts);
+        }
+        put_pid(pids[i]);
     }
 
+    kfree(pids);
     return 0;
 }
 
 
-struct dime_instance_struct * pt_find_parents(struct dime_struct *dime, struct task_struct *tsk) {
+struct dime_instance_struct * pt_find_parents(struct task_struct *tsk) {
     if (tsk) {
-        struct dime_instance_struct *dime_instance = pt_get_dime_instance_of_pid(dime, tsk->pid);
+        struct pt_node_struct *node;
+        struct dime_instance_struct *dime_instance = NULL;
+
+        // children of cgroup members join through the cgroup themselves
+        rcu_read_lock();
+        node = __pt_lookup(task_tgid(tsk));
+        if(node && !node->cgroup_member)
+            dime_instance = node->dime_instance;
+        rcu_read_unlock();
+
         if(dime_instance) {
-            DA_INFO("parent found in list : ppid:%d", tsk->pid);
+            DA_INFO("parent found in list : ppid:%d", tsk->tgid);
             return dime_instance;
         }
-            
+
         if(tsk->pid > 1)
-            return pt_find_parents(dime, tsk->parent);
+            return pt_find_parents(tsk->parent);
     }
 
     return NULL;
 }
 
 
-// jprobe handler function
-static ssize_t pt_jprobe_wake_up_new_task(struct task_struct *tsk) {
-    // TODO:: Traverse list of instances to find out in which instance the parent of this process belongs
-    struct dime_instance_struct *dime_instance = pt_find_parents(&dime, tsk);
+// sched_process_fork tracepoint probe
+static void pt_probe_sched_process_fork(void *data, struct task_struct *parent, struct task_struct *tsk) {
+    // New threads share the tgid of their process, which is already tracked
+    if(thread_group_leader(tsk)) {
+        struct dime_instance_struct *dime_instance = pt_find_parents(tsk);
 
-    if(dime_instance)
-        pt_add_children(dime_instance, tsk->pid);
-    jprobe_return();
-    return 0;
+        if(dime_instance)
+            pt_add_task_children(dime_instance, tsk);
+    }
 }
 
-static struct jprobe jprobe_wake_up_new_task_struct = {
-    .entry  =   pt_jprobe_wake_up_new_task,
-    .kp     =   {
-                    .symbol_name = "wake_up_new_task",
-                },
-};
+/*  pt_probe_sched_process_exit
+ *
+ *  Description:
+ *      sched_process_exit tracepoint probe, removes exiting process from its
+ *      instance once its last thread exits. The leader may exit before the
+ *      other threads, which keep faulting on pages of the process.
+ */
+static void pt_probe_sched_process_exit(void *data, struct task_struct *tsk) {
+    // thread group is dead once live drops to zero, which is before this tracepoint
+    if(atomic_read(&tsk->signal->live) != 0)
+        return;
+
+    // lockless lookup first, since every exiting process in system comes here
+    if(pt_get_dime_instance_of_pid(task_tgid(tsk)))
+        pt_remove(task_tgid(tsk));
+}
+
+static struct tracepoint *tp_sched_process_fork = NULL;
+static struct tracepoint *tp_sched_process_exit = NULL;
+
+// sched tracepoints are not exported to modules, find them by name
+static void pt_lookup_tracepoint(struct tracepoint *tp, void *priv) {
+    if(strcmp(tp->name, "sched_process_fork") == 0)
+        tp_sched_process_fork = tp;
+    else if(strcmp(tp->name, "sched_process_exit") == 0)
+        tp_sched_process_exit = tp;
+}
+
+static bool pt_registered = false;
 
 int pt_init_ptracker(void) {
     int ret;
 
-    ret = register_jprobe(&jprobe_wake_up_new_task_struct);
+    if(pt_registered)
+        return 0;
+
+    for_each_kernel_tracepoint(pt_lookup_tracepoint, NULL);
+    if(!tp_sched_process_fork || !tp_sched_process_exit) {
+        DA_ERROR("could not find sched_process_fork/sched_process_exit tracepoints");
+        return -ENOENT;
+    }
+
+    ret = tracepoint_probe_register(tp_sched_process_fork, pt_probe_sched_process_fork, NULL);
     if (ret < 0) {
-        DA_ERROR("wake_up_new_task jprobe failed, returned %d", ret);
+        DA_ERROR("sched_process_fork probe failed, returned %d", ret);
         return ret;
     }
-    DA_INFO("planted wake_up_new_task jprobe at %p, handler addr %p", jprobe_wake_up_new_task_struct.kp.addr, jprobe_wake_up_new_task_struct.entry);
+    DA_INFO("registered sched_process_fork probe, handler addr %p", pt_probe_sched_process_fork);
 
+    ret = tracepoint_probe_register(tp_sched_process_exit, pt_probe_sched_process_exit, NULL);
+    if (ret < 0) {
+        DA_ERROR("sched_process_exit probe failed, returned %d", ret);
+        tracepoint_probe_unregister(tp_sched_process_fork, pt_probe_sched_process_fork, NULL);
+        tracepoint_synchronize_unregister();
+        return ret;
+    }
+    DA_INFO("registered sched_process_exit probe, handler addr %p", pt_probe_sched_process_exit);
+
+    pt_registered = true;
     return 0;
 }
 
 void pt_exit_ptracker(void) {
-    DA_INFO("unregistering wake_up_new_task jprobe at %p...", jprobe_wake_up_new_task_struct.kp.addr);
-    unregister_jprobe(&jprobe_wake_up_new_task_struct);
+    if(!pt_registered)
+        return;
+
+    DA_INFO("unregistering sched_process_fork and sched_process_exit probes...");
+    tracepoint_probe_unregister(tp_sched_process_fork, pt_probe_sched_process_fork, NULL);
+    tracepoint_probe_unregister(tp_sched_process_exit, pt_probe_sched_process_exit, NULL);
+    tracepoint_synchronize_unregister();    // wait for running probes
+    pt_registered = false;
 
     DA_INFO("cleaning process tracker complete");
-}
\ No newline at end of file
+}
+
+// Drop tracking sets of all instances, called once on module exit
+void pt_cleanup(void) {
+    struct pt_join_struct *join, *tmp;
+    int i;
+
+    // pages of processes still waiting to join are left unprotected
+    cancel_work_sync(&pt_join_work);
+    llist_for_each_entry_safe(join, tmp, llist_del_all(&pt_join_list), node) {
+        ml_mm_put(join->mm);
+        kfree(join);
+    }
+
+    for(i=0 ; i<dime.dime_instances_size ; ++i) {
+        pt_set_cgroup(&dime.dime_instances[i], NULL);
+        pt_clear(&dime.dime_instances[i]);
+    }
+    rcu_barrier();      // wait for pending pt_node_free_rcu callbacks
+}
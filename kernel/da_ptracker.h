@@ -1,18 +1,50 @@
 #ifndef __DA_PTRACKER_H__
 #define __DA_PTRACKER_H__
 
-#include <linux/kprobes.h>
+#include <linux/tracepoint.h>
+#include <linux/pid.h>
+#include <linux/rculist.h>
+#include <linux/cgroup.h>
 
 #include "../common/da_debug.h"
 #include "common.h"
 
 
+/*
+ *  Tracked process entry. Each entry is keyed by struct pid of the thread
+ *  group leader (tgid), so it is independent of pid namespaces and of pid
+ *  number reuse. The same entry is linked in the global pid hash used by the
+ *  page fault hooks and in the per instance pid_list.
+ */
+struct pt_node_struct {
+    struct hlist_node               hash_node;      // link in global pid hash
+    struct list_head                list_node;      // link in dime_instance->pid_list
+    struct pid                      * pid_s;        // tgid of tracked process, referenced
+    struct dime_instance_struct     * dime_instance;
+    bool                            cgroup_member;  // joined through cgroup of the instance
+    struct rcu_head                 rcu;
+};
+
+
 int     pt_init_ptracker    (void);
 void    pt_exit_ptracker    (void);
+void    pt_cleanup          (void);
 int     pt_add              (struct dime_instance_struct *dime_instance, pid_t pid);
 int     pt_add_children     (struct dime_instance_struct *dime_instance, pid_t ppid);
-int     pt_find             (struct dime_instance_struct *dime_instance, pid_t pid);
+int     pt_insert           (struct dime_instance_struct *dime_instance, struct pid *pid_s);
+int     pt_insert_nr        (struct dime_instance_struct *dime_instance, pid_t pid);
+int     pt_set_pids         (struct dime_instance_struct *dime_instance, struct pid **pids, int count);
+void    pt_remove           (struct pid *pid_s);
+void    pt_clear            (struct dime_instance_struct *dime_instance);
+int     pt_protect_instance (struct dime_instance_struct *dime_instance);
+int     pt_find             (struct dime_instance_struct *dime_instance, struct pid *pid_s);
+pid_t   pt_pid_of_mm        (struct dime_instance_struct *dime_instance, struct mm_struct *mm);
+void    pt_set_cgroup       (struct dime_instance_struct *dime_instance, struct cgroup *cgrp);
+void    pt_join_cgroup      (struct dime_instance_struct *dime_instance, struct task_struct *tsk);
 
-struct dime_instance_struct * pt_get_dime_instance_of_pid (struct dime_struct *dime, pid_t pid);
+struct pid * pt_get_tgid_nr (pid_t pid);
+struct cgroup * pt_get_cgroup (const char *path);
+struct dime_instance_struct * pt_get_dime_instance_of_pid (struct pid *pid_s);
+struct dime_instance_struct * pt_get_dime_instance_of_task (struct task_struct *tsk);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,450 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/log2.h>
+#include <linux/workqueue.h>
+#include <linux/timekeeping.h>
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_config.h"
+#include "da_repart.h"
+
+/*****
+ *
+ *  Repartitioning of local memory across instances.
+ *
+ *  Marginal utility of an instance is the number of faults it would have
+ *  saved in the last period with step_npages more local pages. It is
+ *  estimated from refault distances: every fault stamps the page with the
+ *  fault clock of the instance, and a page faulted again after d faults
+ *  would have stayed local with more than d local pages. Refaults with
+ *  local_npages < d <= local_npages + step_npages are counted. Only pages
+ *  whose hash falls in a 1/REPART_SAMPLE sample are stamped, and counts are
+ *  scaled back.
+ *
+ *  Every period, step_npages move from the instance with lowest utility to
+ *  the one with highest, if it is higher by a margin. Loss of shrinking is
+ *  not observable, as hits do not fault, so gain of growing stands for it.
+ *
+ */
+
+#define PROCFS_NAME             "dime_repart"
+
+#define REPART_SAMPLE_SHIFT     4
+#define REPART_SAMPLE           (1 << REPART_SAMPLE_SHIFT)
+#define REPART_MIN_SLOTS        1024
+#define REPART_MIN_PERIOD_MS    100
+#define REPART_MARGIN_PCT       25          // receiver utility must exceed donor by this much
+#define REPART_HISTORY          64
+
+enum repart_objective {
+    REPART_HITS,                // faults saved
+    REPART_SLOWDOWN,            // fetch time saved, faults weighted by fetch delay of instance
+    REPART_OBJECTIVE_MAX,
+};
+
+static const char *objective_names[REPART_OBJECTIVE_MAX] = {
+    [REPART_HITS]       = "hits",
+    [REPART_SLOWDOWN]   = "slowdown",
+};
+
+struct repart_instance_struct {
+    u64                 *ghost;             // tag in high half, fault clock in low half
+    atomic_long_t       clock;              // faults of instance
+    atomic_long_t       gain;               // sampled refaults in (lo, hi] since last period
+    ulong               lo;                 // local_npages at last period
+    ulong               hi;                 // lo + step_npages
+    ulong               utility;            // smoothed over periods
+};
+
+struct repart_struct {
+    ulong               period_ms;
+    ulong               step_npages;
+    ulong               min_npages;
+    int                 objective;
+    ulong               slot_mask;
+    int                 ninstances;         // instances when enabled, later ones are not repartitioned
+    struct delayed_work work;
+    struct repart_instance_struct instances[];
+};
+
+struct repart_move_struct {
+    u64                 time_ms;
+    int                 from;
+    int                 to;
+    ulong               from_npages;        // local_npages after move
+    ulong               to_npages;
+    ulong               from_utility;
+    ulong               to_utility;
+};
+
+static struct repart_struct __rcu *repart = NULL;
+static DEFINE_MUTEX(repart_lock);           // serializes enable and disable
+
+static struct repart_move_struct history[REPART_HISTORY];
+static ulong history_count = 0;             // moves since module insertion
+static DEFINE_SPINLOCK(history_lock);
+
+
+/*  dime_repart_fault
+ *
+ *  Description:
+ *      Advances fault clock of instance and, for a sampled page, counts its
+ *      refault if it would have been a hit with step_npages more local pages.
+ *      Called for every fault fetched from remote memory. Stamps are updated
+ *      without lock, a lost race only loses one sample.
+ */
+void dime_repart_fault(struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address) {
+    struct repart_instance_struct *ri;
+    struct repart_struct *rp;
+    u64 hash, old;
+    u32 now, distance;
+
+    rcu_read_lock();
+    rp = rcu_dereference(repart);
+    if(!rp || dime_instance->instance_id >= rp->ninstances)
+        goto exit;
+
+    ri = &rp->instances[dime_instance->instance_id];
+    now = (u32) atomic_long_inc_return(&ri->clock);
+    hash = ml_page_hash(mm, address);
+    if(hash & (REPART_SAMPLE - 1))
+        goto exit;
+
+    old = xchg(&ri->ghost[(hash >> REPART_SAMPLE_SHIFT) & rp->slot_mask], (hash & 0xffffffff00000000ULL) | now);
+    if(old && (old >> 32) == (hash >> 32)) {
+        distance = now - (u32) old;
+        if(distance > READ_ONCE(ri->lo) && distance <= READ_ONCE(ri->hi))
+            atomic_long_inc(&ri->gain);
+    }
+
+exit:
+    rcu_read_unlock();
+}
+
+static void repart_record(int from, int to, ulong from_npages, ulong to_npages, ulong from_utility, ulong to_utility) {
+    struct repart_move_struct *move;
+
+    spin_lock(&history_lock);
+    move = &history[history_count % REPART_HISTORY];
+    move->time_ms       = ktime_get_ns() / NSEC_PER_MSEC;
+    move->from          = from;
+    move->to            = to;
+    move->from_npages   = from_npages;
+    move->to_npages     = to_npages;
+    move->from_utility  = from_utility;
+    move->to_utility    = to_utility;
+    ++history_count;
+    spin_unlock(&history_lock);
+}
+
+/*  repart_work_fn
+ *
+ *  Description:
+ *      Updates utility of every instance from refaults of last period and
+ *      moves step_npages of local memory from lowest to highest utility.
+ *      Donor shrinks first, so the sum of local_npages never grows. Only
+ *      instances with a resizable policy, no admission window and finite
+ *      local memory take part.
+ */
+static void repart_work_fn(struct work_struct *work) {
+    struct repart_struct *rp = container_of(to_delayed_work(work), struct repart_struct, work);
+    struct repart_instance_struct *ri;
+    struct dime_instance_struct *dime_instance;
+    struct dime_config_struct *config;
+    struct page_replacement_policy_struct *prp;
+    ulong local[MAX_DIME_INSTANCES], gain, delay_ns;
+    int i, n = min(smp_load_acquire(&dime.dime_instances_size), rp->ninstances);
+    int from = -1, to = -1;
+
+    for(i=0 ; i<n ; ++i) {
+        ri = &rp->instances[i];
+        dime_instance = &dime.dime_instances[i];
+
+        rcu_read_lock();
+        config = dime_config_get(dime_instance);
+        local[i] = config->local_npages;
+        delay_ns = config->delay_ns[DIME_PAGE_ANON];
+        rcu_read_unlock();
+
+        gain = atomic_long_xchg(&ri->gain, 0) << REPART_SAMPLE_SHIFT;
+        if(rp->objective == REPART_SLOWDOWN)
+            gain *= delay_ns;
+        ri->utility = (ri->utility + gain) / 2;
+
+        // policy or admission window sized at load time would not follow a move
+        prp = READ_ONCE(dime_instance->prp);
+        if(!prp || !prp->resizable || rcu_access_pointer(dime_instance->admission) || local[i] == 0)
+            continue;
+        if(to < 0 || ri->utility > rp->instances[to].utility)
+            to = i;
+        if(local[i] >= rp->min_npages + rp->step_npages && (from < 0 || ri->utility < rp->instances[from].utility))
+            from = i;
+    }
+
+    if(from >= 0 && to >= 0 && from != to
+            && rp->instances[to].utility * 100 > rp->instances[from].utility * (100 + REPART_MARGIN_PCT)) {
+        if(dime_config_set(&dime.dime_instances[from], -1, -1, local[from] - rp->step_npages) == 0) {
+            if(dime_config_set(&dime.dime_instances[to], -1, -1, local[to] + rp->step_npages) == 0) {
+                local[from] -= rp->step_npages;
+                local[to]   += rp->step_npages;
+                repart_record(from, to, local[from], local[to], rp->instances[from].utility, rp->instances[to].utility);
+                DA_DEBUG("moved %lu local pages from instance %d to %d", rp->step_npages, from, to);
+            } else {
+                dime_config_set(&dime.dime_instances[from], -1, -1, local[from]);
+            }
+        }
+    }
+
+    // refaults of next period are counted against new sizes
+    for(i=0 ; i<n ; ++i) {
+        WRITE_ONCE(rp->instances[i].lo, local[i]);
+        WRITE_ONCE(rp->instances[i].hi, local[i] + rp->step_npages);
+    }
+
+    schedule_delayed_work(&rp->work, msecs_to_jiffies(rp->period_ms));
+}
+
+static void repart_free(struct repart_struct *rp) {
+    int i;
+
+    for(i=0 ; i<rp->ninstances ; ++i)
+        vfree(rp->instances[i].ghost);
+    kfree(rp);
+}
+
+// must be called with repart_lock held
+static void repart_disable(void) {
+    struct repart_struct *rp = rcu_dereference_protected(repart, lockdep_is_held(&repart_lock));
+
+    if(!rp)
+        return;
+
+    RCU_INIT_POINTER(repart, NULL);
+    cancel_delayed_work_sync(&rp->work);
+    synchronize_rcu();      // faults in flight are done with ghost tables
+    repart_free(rp);
+    DA_INFO("repartitioning disabled");
+}
+
+/*  repart_enable
+ *
+ *  Description:
+ *      Starts controller over instances existing now. Ghost table of each
+ *      instance has twice as many slots as sampled pages of all local memory
+ *      plus one step, as any instance may grow to that. Must be called with
+ *      repart_lock held, after previous controller is disabled.
+ */
+static int repart_enable(ulong period_ms, ulong step_npages, ulong min_npages, int objective) {
+    struct repart_struct *rp;
+    ulong total = 0, slots;
+    int i, n = smp_load_acquire(&dime.dime_instances_size);
+
+    rcu_read_lock();
+    for(i=0 ; i<n ; ++i)
+        total += dime_config_get(&dime.dime_instances[i])->local_npages;
+    rcu_read_unlock();
+    slots = roundup_pow_of_two(max((2 * (total + step_npages)) >> REPART_SAMPLE_SHIFT, (ulong) REPART_MIN_SLOTS));
+
+    rp = (struct repart_struct*) kzalloc(sizeof(struct repart_struct) + n * sizeof(struct repart_instance_struct), GFP_KERNEL);
+    if(!rp) {
+        DA_ERROR("unable to allocate memory");
+        return -ENOMEM;
+    }
+    rp->period_ms   = period_ms;
+    rp->step_npages = step_npages;
+    rp->min_npages  = min_npages;
+    rp->objective   = objective;
+    rp->slot_mask   = slots - 1;
+    rp->ninstances  = n;
+    INIT_DELAYED_WORK(&rp->work, repart_work_fn);
+
+    rcu_read_lock();
+    for(i=0 ; i<n ; ++i) {
+        rp->instances[i].lo = dime_config_get(&dime.dime_instances[i])->local_npages;
+        rp->instances[i].hi = rp->instances[i].lo + step_npages;
+    }
+    rcu_read_unlock();
+
+    for(i=0 ; i<n ; ++i) {
+        rp->instances[i].ghost = (u64*) vzalloc(sizeof(u64) * slots);
+        if(!rp->instances[i].ghost) {
+            DA_ERROR("unable to allocate memory");
+            repart_free(rp);
+            return -ENOMEM;
+        }
+    }
+
+    rcu_assign_pointer(repart, rp);
+    schedule_delayed_work(&rp->work, msecs_to_jiffies(period_ms));
+    DA_INFO("repartitioning %d instances every %lu ms by %lu pages, ghost table %lu KB per instance",
+                n, period_ms, step_npages, (sizeof(u64) * slots) >> 10);
+    return 0;
+}
+
+
+/*
+ *
+ *  procfs
+ *
+ */
+
+/*  procfile_write
+ *
+ *  Description:
+ *      "period_ms=<ms> step_npages=<n> min_npages=<n> objective=hits|slowdown"
+ *      restarts controller with given parameters, others take defaults.
+ *      period_ms=0 stops it, local_npages of instances stay as they are.
+ */
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+    char *kbuf, *token_start, *token_end;
+    ulong period_ms = 0, step_npages = 256, min_npages = 0;
+    int objective = REPART_HITS, i;
+    ssize_t ret = 0;
+
+    kbuf = memdup_user_nul(buffer, length);
+    if (IS_ERR(kbuf)) {
+        return PTR_ERR(kbuf);
+    }
+
+    token_start = token_end = kbuf;
+    while( (token_start = strsep(&token_end, " \n")) != NULL) {
+        char *key, *value;
+        if(strlen(token_start) == 0)
+            continue;
+
+        key = value = token_start;
+        key = strsep(&value, "=");
+        if(!value) {
+            DA_ERROR("invalid token : %s", token_start);
+            ret = -EINVAL;
+        } else if(strcmp(key, "period_ms") == 0) {
+            ret = kstrtoul(value, 10, &period_ms);
+        } else if(strcmp(key, "step_npages") == 0) {
+            ret = kstrtoul(value, 10, &step_npages);
+        } else if(strcmp(key, "min_npages") == 0) {
+            ret = kstrtoul(value, 10, &min_npages);
+        } else if(strcmp(key, "objective") == 0) {
+            ret = -EINVAL;
+            for(i=0 ; i<REPART_OBJECTIVE_MAX ; ++i) {
+                if(strcmp(value, objective_names[i]) == 0) {
+                    objective = i;
+                    ret = 0;
+                }
+            }
+        } else {
+            DA_ERROR("unknown parameter : %s", key);
+            ret = -EINVAL;
+        }
+        if(ret) {
+            DA_ERROR("invalid value : %s", token_start);
+            ret = -EINVAL;
+            goto write_exit;
+        }
+    }
+
+    if(period_ms > 0 && (period_ms < REPART_MIN_PERIOD_MS || step_npages == 0)) {
+        DA_ERROR("period_ms must be at least %d and step_npages greater than zero", REPART_MIN_PERIOD_MS);
+        ret = -EINVAL;
+        goto write_exit;
+    }
+
+    mutex_lock(&repart_lock);
+    repart_disable();
+    if(period_ms > 0)
+        ret = repart_enable(period_ms, step_npages, max(min_npages, step_npages), objective);
+    mutex_unlock(&repart_lock);
+
+    if(ret == 0) {
+        *offset += length;
+        ret = length;
+    }
+
+write_exit:
+    kfree(kbuf);
+    return ret;
+}
+
+static void *procfile_seq_start(struct seq_file *m, loff_t *pos) {
+    return *pos == 0 ? SEQ_START_TOKEN : NULL;
+}
+
+static void *procfile_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++(*pos);
+    return NULL;
+}
+
+static void procfile_seq_stop(struct seq_file *m, void *v) {
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+    struct repart_struct *rp;
+    struct repart_move_struct *move;
+    ulong count, i;
+
+    mutex_lock(&repart_lock);
+    rp = rcu_dereference_protected(repart, lockdep_is_held(&repart_lock));
+    seq_puts(m, "period_ms step_npages min_npages objective moves\n");
+    if(rp)
+        seq_printf(m, "%lu %lu %lu %s %lu\n", rp->period_ms, rp->step_npages, rp->min_npages,
+                        objective_names[rp->objective], READ_ONCE(history_count));
+    else
+        seq_printf(m, "0 - - - %lu\n", READ_ONCE(history_count));
+
+    if(rp) {
+        seq_puts(m, "instance_id lo_npages utility\n");
+        for(i=0 ; i<rp->ninstances ; ++i)
+            seq_printf(m, "%lu %lu %lu\n", i, READ_ONCE(rp->instances[i].lo), READ_ONCE(rp->instances[i].utility));
+    }
+
+    // newest first
+    seq_puts(m, "time_ms from to from_local_npages to_local_npages from_utility to_utility\n");
+    spin_lock(&history_lock);
+    count = min(history_count, (ulong) REPART_HISTORY);
+    for(i=1 ; i<=count ; ++i) {
+        move = &history[(history_count - i) % REPART_HISTORY];
+        seq_printf(m, "%llu %d %d %lu %lu %lu %lu\n", move->time_ms, move->from, move->to,
+                        move->from_npages, move->to_npages, move->from_utility, move->to_utility);
+    }
+    spin_unlock(&history_lock);
+    mutex_unlock(&repart_lock);
+    return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+    .start  = procfile_seq_start,
+    .next   = procfile_seq_next,
+    .stop   = procfile_seq_stop,
+    .show   = procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &procfile_seq_ops);
+}
+
+DIME_DEFINE_PROC_OPS(repart_file_ops, procfile_open, procfile_write);
+
+int init_dime_repart(void) {
+    if(proc_create(PROCFS_NAME, S_IFREG | S_IRUGO | S_IWUSR, NULL, &repart_file_ops) == NULL) {
+        DA_ALERT("could not initialize /proc/%s\n", PROCFS_NAME);
+        return -ENOMEM;
+    }
+
+    DA_INFO("proc entry \"/proc/%s\" created\n", PROCFS_NAME);
+    return 0;
+}
+
+void cleanup_dime_repart(void) {
+    remove_proc_entry(PROCFS_NAME, NULL);
+
+    mutex_lock(&repart_lock);
+    repart_disable();
+    mutex_unlock(&repart_lock);
+    DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
+}
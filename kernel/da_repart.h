@@ -0,0 +1,12 @@
+#ifndef __DA_REPART_H__
+#define __DA_REPART_H__
+
+
+#include "common.h"
+
+int init_dime_repart(void);
+void cleanup_dime_repart(void);
+void dime_repart_fault(struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address);
+
+
+#endif
@@ -0,0 +1,367 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/timekeeping.h>
+#include <asm/uaccess.h>
+
+#include "../common/da_debug.h"
+#include "da_latency.h"
+#include "da_resource.h"
+
+/*****
+ *
+ *  Shared links and memory servers.
+ *
+ *  Instances attached to the same link or server contend for it. A fetch is
+ *  first served by the server, by the thread that frees up first, then
+ *  queues for the link. Each thread of a server and the link keep the
+ *  virtual time at which they are free again. A fetch reserves its slot
+ *  with a cmpxchg on that time, so no lock is taken on the fault path.
+ *  Reservations past the current time are queueing. Delay of a fetch grows
+ *  by its wait and service time at the server and its wait for the link.
+ *  Transfer time of the page itself is still given by bandwidth_bps of the
+ *  instance; bandwidth_bps of the link sets how long the link stays busy.
+ *
+ */
+
+#define PROCFS_NAME             "dime_resources"
+#define RESOURCE_EXP_TABLE_SIZE 64
+
+enum resource_type {
+    RESOURCE_LINK,
+    RESOURCE_SERVER,
+};
+
+enum resource_service_dist {
+    RESOURCE_SERVICE_CONSTANT,
+    RESOURCE_SERVICE_EXPONENTIAL,
+    RESOURCE_SERVICE_DIST_MAX,
+};
+
+static const char *service_dist_names[RESOURCE_SERVICE_DIST_MAX] = {
+    [RESOURCE_SERVICE_CONSTANT]     = "constant",
+    [RESOURCE_SERVICE_EXPONENTIAL]  = "exponential",
+};
+
+// quantiles * 1000 of exponential distribution with mean 1 at (i + 0.5) / RESOURCE_EXP_TABLE_SIZE
+static const u16 exp_quantile_milli[RESOURCE_EXP_TABLE_SIZE] = {
+       8,   24,   40,   56,   73,   90,  107,  125,  143,  161,  179,  198,  217,  237,  257,  277,
+     298,  319,  341,  363,  386,  409,  433,  458,  483,  508,  535,  562,  589,  618,  647,  678,
+     709,  741,  774,  809,  845,  882,  920,  960, 1002, 1045, 1091, 1138, 1188, 1241, 1297, 1356,
+    1418, 1485, 1556, 1633, 1717, 1808, 1908, 2019, 2144, 2287, 2454, 2655, 2906, 3243, 3753, 4852,
+};
+
+/*
+ *  A link is a resource with one thread whose service time is the time a
+ *  page takes at bandwidth_bps. Parameters are changed under resource_lock
+ *  and read without it; a fetch may see a mix of old and new values once.
+ */
+struct dime_resource_struct {
+    bool                defined;
+    ulong               bandwidth_bps;      // link only
+    ulong               service_ns;         // mean service time of one page
+    int                 service_dist;
+    int                 threads;
+    ulong               queue_depth;        // 0 if unbounded
+    u64                 defined_ns;         // ktime when defined, for utilization
+
+    atomic64_t          free_ns[DIME_SERVER_MAX_THREADS];      // ktime when thread is free again
+    atomic_long_t       requests;
+    atomic_long_t       busy_ns;            // sum of service times
+    atomic_long_t       wait_ns;            // sum of queueing delays
+    atomic64_t          max_wait_ns;
+    atomic_long_t       queue_full;         // fetches which found queue_depth fetches ahead
+};
+
+static struct dime_resource_struct links[DIME_MAX_LINKS];
+static struct dime_resource_struct servers[DIME_MAX_SERVERS];
+static DEFINE_MUTEX(resource_lock);        // serializes writers of procfs file
+
+
+static inline ulong resource_service_ns(struct dime_resource_struct *res) {
+    ulong service_ns = READ_ONCE(res->service_ns);
+
+    if(READ_ONCE(res->service_dist) == RESOURCE_SERVICE_EXPONENTIAL)
+        service_ns = service_ns * exp_quantile_milli[dime_latency_random() % RESOURCE_EXP_TABLE_SIZE] / 1000;
+    return service_ns;
+}
+
+/*  resource_reserve
+ *
+ *  Description:
+ *      Reserves thread of res which is free first for service_ns, from
+ *      arrive_ns on. Returns ktime at which service starts, a later start
+ *      than arrive_ns is queueing delay.
+ */
+static u64 resource_reserve(struct dime_resource_struct *res, u64 arrive_ns, ulong service_ns) {
+    int threads = clamp(READ_ONCE(res->threads), 1, DIME_SERVER_MAX_THREADS);
+    u64 free_ns, start_ns, wait_ns, max_ns;
+    int i, first;
+
+    do {
+        first = 0;
+        free_ns = atomic64_read(&res->free_ns[0]);
+        for(i=1 ; i<threads ; ++i) {
+            u64 thread_free_ns = atomic64_read(&res->free_ns[i]);
+            if(thread_free_ns < free_ns) {
+                free_ns = thread_free_ns;
+                first = i;
+            }
+        }
+        start_ns = max(free_ns, arrive_ns);
+    } while(atomic64_cmpxchg(&res->free_ns[first], free_ns, start_ns + service_ns) != free_ns);
+
+    wait_ns = start_ns - arrive_ns;
+    atomic_long_inc(&res->requests);
+    atomic_long_add(service_ns, &res->busy_ns);
+    atomic_long_add(wait_ns, &res->wait_ns);
+    max_ns = atomic64_read(&res->max_wait_ns);
+    while(wait_ns > max_ns && atomic64_cmpxchg(&res->max_wait_ns, max_ns, wait_ns) != max_ns)
+        max_ns = atomic64_read(&res->max_wait_ns);
+
+    // fetches ahead are about wait time over mean service time of a thread
+    if(res->queue_depth && wait_ns * threads >= (u64) res->queue_depth * READ_ONCE(res->service_ns))
+        atomic_long_inc(&res->queue_full);
+
+    return start_ns;
+}
+
+/*  dime_resource_delay_ns
+ *
+ *  Description:
+ *      Returns delay of one fetch at shared server and link of config, in
+ *      addition to latency and transfer time of the instance: wait and
+ *      service at the server, then wait for the link. Must be called inside
+ *      rcu read section of config.
+ */
+ulong dime_resource_delay_ns(const struct dime_config_struct *config) {
+    struct dime_resource_struct *res;
+    u64 now_ns = ktime_get_ns(), t_ns = now_ns;
+    ulong service_ns;
+
+    if(config->server != DIME_RESOURCE_NONE) {
+        res = &servers[config->server];
+        if(READ_ONCE(res->defined)) {
+            service_ns = resource_service_ns(res);
+            t_ns = resource_reserve(res, t_ns, service_ns) + service_ns;
+        }
+    }
+
+    if(config->link != DIME_RESOURCE_NONE) {
+        res = &links[config->link];
+        if(READ_ONCE(res->defined))
+            t_ns = resource_reserve(res, t_ns, READ_ONCE(res->service_ns));
+    }
+
+    return t_ns - now_ns;
+}
+
+static void resource_show_id(struct seq_file *m, ulong id) {
+    if(id == DIME_RESOURCE_NONE)
+        seq_putc(m, '-');
+    else
+        seq_printf(m, "%lu", id);
+}
+
+// Prints link and server of config as one procfs column, e.g. "0/2", "-/1", "-" if none
+void dime_resource_show(struct seq_file *m, const struct dime_config_struct *config) {
+    if(config->link == DIME_RESOURCE_NONE && config->server == DIME_RESOURCE_NONE) {
+        seq_putc(m, '-');
+        return;
+    }
+    resource_show_id(m, config->link);
+    seq_putc(m, '/');
+    resource_show_id(m, config->server);
+}
+
+
+/*
+ *
+ *  procfs
+ *
+ */
+
+// must be called with resource_lock held, counters restart with new parameters
+static void resource_define(struct dime_resource_struct *res, ulong bandwidth_bps, ulong service_ns,
+                            int service_dist, int threads, ulong queue_depth) {
+    u64 now_ns = ktime_get_ns();
+    int i;
+
+    WRITE_ONCE(res->defined, false);
+    res->bandwidth_bps  = bandwidth_bps;
+    res->service_ns     = service_ns;
+    res->service_dist   = service_dist;
+    res->threads        = threads;
+    res->queue_depth    = queue_depth;
+    res->defined_ns     = now_ns;
+    for(i=0 ; i<DIME_SERVER_MAX_THREADS ; ++i)
+        atomic64_set(&res->free_ns[i], now_ns);
+    atomic_long_set(&res->requests, 0);
+    atomic_long_set(&res->busy_ns, 0);
+    atomic_long_set(&res->wait_ns, 0);
+    atomic64_set(&res->max_wait_ns, 0);
+    atomic_long_set(&res->queue_full, 0);
+    smp_wmb();          // parameters before defined
+    WRITE_ONCE(res->defined, threads > 0);
+}
+
+/*  procfile_write
+ *
+ *  Description:
+ *      Defines one resource and restarts its counters :
+ *          "link=<id> bandwidth_bps=<bps> [queue_depth=<n>]"
+ *          "server=<id> threads=<n> service_ns=<ns> [service_dist=constant|exponential] [queue_depth=<n>]"
+ *      bandwidth_bps=0 or threads=0 removes it, attached instances then
+ *      see no contention.
+ */
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+    char *kbuf, *token_start, *token_end;
+    long link = -1, server = -1, bandwidth_bps = -1, threads = -1, service_ns = -1, queue_depth = 0;
+    int service_dist = RESOURCE_SERVICE_CONSTANT, i;
+    ssize_t ret = 0;
+
+    kbuf = memdup_user_nul(buffer, length);
+    if (IS_ERR(kbuf)) {
+        return PTR_ERR(kbuf);
+    }
+
+    token_start = token_end = kbuf;
+    while( (token_start = strsep(&token_end, " \n")) != NULL) {
+        char *key, *value;
+        if(strlen(token_start) == 0)
+            continue;
+
+        key = value = token_start;
+        key = strsep(&value, "=");
+        if(!value) {
+            ret = -EINVAL;
+        } else if(strcmp(key, "link") == 0) {
+            ret = kstrtol(value, 10, &link);
+        } else if(strcmp(key, "server") == 0) {
+            ret = kstrtol(value, 10, &server);
+        } else if(strcmp(key, "bandwidth_bps") == 0) {
+            ret = kstrtol(value, 10, &bandwidth_bps);
+        } else if(strcmp(key, "threads") == 0) {
+            ret = kstrtol(value, 10, &threads);
+        } else if(strcmp(key, "service_ns") == 0) {
+            ret = kstrtol(value, 10, &service_ns);
+        } else if(strcmp(key, "queue_depth") == 0) {
+            ret = kstrtol(value, 10, &queue_depth);
+        } else if(strcmp(key, "service_dist") == 0) {
+            ret = -EINVAL;
+            for(i=0 ; i<RESOURCE_SERVICE_DIST_MAX ; ++i) {
+                if(strcmp(value, service_dist_names[i]) == 0) {
+                    service_dist = i;
+                    ret = 0;
+                }
+            }
+        } else {
+            ret = -EINVAL;
+        }
+        if(ret || (value && value[0] == '-')) {
+            DA_ERROR("invalid resource parameter : %s%s%s", key, value ? "=" : "", value ? value : "");
+            ret = -EINVAL;
+            goto write_exit;
+        }
+    }
+
+    mutex_lock(&resource_lock);
+    if(link >= 0 && server < 0 && link < DIME_MAX_LINKS && bandwidth_bps >= 0) {
+        resource_define(&links[link], bandwidth_bps,
+                        bandwidth_bps ? ((PAGE_SIZE * 8ULL) * 1000000000ULL) / bandwidth_bps : 0,
+                        RESOURCE_SERVICE_CONSTANT, bandwidth_bps ? 1 : 0, queue_depth);
+    } else if(server >= 0 && link < 0 && server < DIME_MAX_SERVERS && threads >= 0 && threads <= DIME_SERVER_MAX_THREADS
+                && (threads == 0 || service_ns >= 0)) {
+        resource_define(&servers[server], 0, max(service_ns, 0L), service_dist, threads, queue_depth);
+    } else {
+        DA_ERROR("link=<0..%d> needs bandwidth_bps, server=<0..%d> needs threads=<0..%d> and service_ns",
+                    DIME_MAX_LINKS-1, DIME_MAX_SERVERS-1, DIME_SERVER_MAX_THREADS);
+        ret = -EINVAL;
+    }
+    mutex_unlock(&resource_lock);
+
+    if(ret == 0) {
+        *offset += length;
+        ret = length;
+    }
+
+write_exit:
+    kfree(kbuf);
+    return ret;
+}
+
+static void show_resource(struct seq_file *m, const char *type, int id, struct dime_resource_struct *res) {
+    ulong requests = atomic_long_read(&res->requests), wait_ns = atomic_long_read(&res->wait_ns);
+    u64 elapsed_ns = (ktime_get_ns() - res->defined_ns) * res->threads;
+    ulong util_permille = elapsed_ns ? div64_u64((u64) atomic_long_read(&res->busy_ns) * 1000, elapsed_ns) : 0;
+
+    seq_printf(m, "%-6s %2d %13lu %7d %10lu %11s %11lu %12lu %4lu.%lu %14lu %12lu %12llu %10lu\n",
+                    type, id, res->bandwidth_bps, res->threads, res->service_ns,
+                    service_dist_names[res->service_dist], res->queue_depth,
+                    requests, util_permille / 10, util_permille % 10,
+                    wait_ns, requests ? wait_ns / requests : 0,
+                    (unsigned long long) atomic64_read(&res->max_wait_ns),
+                    atomic_long_read(&res->queue_full));
+}
+
+static void *procfile_seq_start(struct seq_file *m, loff_t *pos) {
+    return *pos == 0 ? SEQ_START_TOKEN : NULL;
+}
+
+static void *procfile_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++(*pos);
+    return NULL;
+}
+
+static void procfile_seq_stop(struct seq_file *m, void *v) {
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+    int i;
+
+    seq_puts(m, "type   id bandwidth_bps threads service_ns service_dist queue_depth     requests util_pct    wait_ns_sum  wait_ns_avg  wait_ns_max queue_full\n");
+    mutex_lock(&resource_lock);
+    for(i=0 ; i<DIME_MAX_LINKS ; ++i) {
+        if(links[i].defined)
+            show_resource(m, "link", i, &links[i]);
+    }
+    for(i=0 ; i<DIME_MAX_SERVERS ; ++i) {
+        if(servers[i].defined)
+            show_resource(m, "server", i, &servers[i]);
+    }
+    mutex_unlock(&resource_lock);
+    return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+    .start  = procfile_seq_start,
+    .next   = procfile_seq_next,
+    .stop   = procfile_seq_stop,
+    .show   = procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &procfile_seq_ops);
+}
+
+DIME_DEFINE_PROC_OPS(resource_file_ops, procfile_open, procfile_write);
+
+int init_dime_resource(void) {
+    if(proc_create(PROCFS_NAME, S_IFREG | S_IRUGO | S_IWUSR, NULL, &resource_file_ops) == NULL) {
+        DA_ALERT("could not initialize /proc/%s\n", PROCFS_NAME);
+        return -ENOMEM;
+    }
+
+    DA_INFO("proc entry \"/proc/%s\" created\n", PROCFS_NAME);
+    return 0;
+}
+
+void cleanup_dime_resource(void) {
+    remove_proc_entry(PROCFS_NAME, NULL);
+    DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
+}
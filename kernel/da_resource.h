@@ -0,0 +1,17 @@
+#ifndef __DA_RESOURCE_H__
+#define __DA_RESOURCE_H__
+
+
+#include "common.h"
+
+#define DIME_MAX_LINKS              16
+#define DIME_MAX_SERVERS            16
+#define DIME_SERVER_MAX_THREADS     64
+
+int     init_dime_resource      (void);
+void    cleanup_dime_resource   (void);
+void    dime_resource_show      (struct seq_file *m, const struct dime_config_struct *config);
+ulong   dime_resource_delay_ns  (const struct dime_config_struct *config);
+
+
+#endif
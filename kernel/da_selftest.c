@@ -0,0 +1,526 @@
+#include <linux/module.h>    // included for all kernel modules
+#include <linux/kernel.h>    // included for KERN_INFO
+#include <linux/init.h>      // included for __init and __exit macros
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/uaccess.h>
+#include <linux/random.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
+#include <linux/prandom.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/clock.h>
+#endif
+
+#include "../common/da_debug.h"
+#include "da_ptracker.h"
+#include "common.h"
+
+
+/*****
+ *
+ *  Self test of the fault path and of the inserted page replacement policy.
+ *
+ *  Inserting this module runs the tests in context of insmod process, which
+ *  is added to the instance under test for the duration of the tests:
+ *      - access patterns are replayed on an anonymous region mapped in
+ *        insmod, each access is a user space write that goes through page
+ *        fault hooks, and fault count of the instance is checked against a
+ *        model of the policy
+ *      - add_page of the policy is called from 1 to threads kernel threads
+ *        on synthetic pages to measure its throughput and latency, with
+ *        eviction once the local memory is full
+ *
+ *  Policy module is held for the duration of the tests. Synthetic pages have
+ *  no mm and evict pages of processes of the instance while the benchmark
+ *  runs; policies with drop_unowned free them afterwards, FIFO treats their
+ *  slots as empty already.
+ *
+ *  Results are logged, insertion fails with -EINVAL if a check failed and
+ *  module can be removed right away otherwise. Use a dedicated instance with
+ *  transparent huge pages disabled, see user/test/selftest.sh.
+ *
+ */
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Abhishek Ghogare, Dhantu");
+MODULE_DESCRIPTION("Dime self test");
+
+static int instance_id = 0;
+module_param(instance_id, int, 0444);
+MODULE_PARM_DESC(instance_id, "Instance under test, must have a policy inserted");
+
+static int npages = 0;
+module_param(npages, int, 0444);
+MODULE_PARM_DESC(npages, "Pages touched by patterns, default is twice local_npages");
+
+static int passes = 3;
+module_param(passes, int, 0444);
+MODULE_PARM_DESC(passes, "Accesses of each pattern, in multiples of npages");
+
+static int threads = 0;
+module_param(threads, int, 0444);
+MODULE_PARM_DESC(threads, "Max threads of add_page benchmark, default is online cpus");
+
+static int bench_ops = 100000;
+module_param(bench_ops, int, 0444);
+MODULE_PARM_DESC(bench_ops, "add_page calls per benchmark thread");
+
+static int lru_tolerance_pct = 25;
+module_param(lru_tolerance_pct, int, 0444);
+MODULE_PARM_DESC(lru_tolerance_pct, "Allowed deviation of LRU policy from exact LRU, in percent");
+
+static ulong seed = 1;
+module_param(seed, ulong, 0444);
+MODULE_PARM_DESC(seed, "Seed of random patterns");
+
+
+#define ST_STRIDE       7       // pages between accesses of strided pattern
+
+enum st_pattern {
+    ST_SEQUENTIAL = 0,
+    ST_STRIDED,
+    ST_ZIPFIAN,
+    ST_SHIFT,
+    ST_PATTERNS,
+};
+
+static const char *st_pattern_names[ST_PATTERNS] = {"sequential", "strided", "zipfian", "shift"};
+
+// page indexes of one pattern, in order of access
+struct st_trace {
+    u32     *pages;
+    ulong   len;
+    ulong   region;             // pages mapped for the pattern
+};
+
+
+/*  st_zipf_cdf
+ *
+ *  Description:
+ *      Cumulative weights of zipf distribution with exponent 1 over n ranks,
+ *      rank i weighs 2^32/(i+1). Returns NULL on allocation failure.
+ */
+static u64 * st_zipf_cdf(ulong n) {
+    u64 *cdf = (u64*) vmalloc(sizeof(u64) * n);
+    u64 sum = 0;
+    ulong i;
+
+    if(!cdf)
+        return NULL;
+    for(i=0 ; i<n ; ++i) {
+        sum += (1ULL << 32) / (i + 1);
+        cdf[i] = sum;
+    }
+    return cdf;
+}
+
+static ulong st_zipf_sample(u64 *cdf, ulong n, struct rnd_state *rnd) {
+    u64 r = ((((u64) prandom_u32_state(rnd)) << 32) | prandom_u32_state(rnd)) % cdf[n-1];
+    ulong lo = 0, hi = n - 1;
+
+    // first rank whose cumulative weight exceeds r
+    while(lo < hi) {
+        ulong mid = lo + (hi - lo) / 2;
+        if(cdf[mid] > r)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/*  st_make_trace
+ *
+ *  Description:
+ *      Generates page accesses of pattern over n pages. Working set shift
+ *      pattern uses a set of 3/4 local pages, which moves by half of its
+ *      size midway. Returns 0 on success.
+ */
+static int st_make_trace(enum st_pattern pattern, ulong n, ulong local, struct st_trace *trace) {
+    struct rnd_state rnd;
+    ulong i, ws;
+    u64 *cdf;
+
+    trace->len = n * passes;
+    trace->region = n;
+    trace->pages = (u32*) vmalloc(sizeof(u32) * trace->len);
+    if(!trace->pages)
+        return -ENOMEM;
+    prandom_seed_state(&rnd, seed + pattern);
+
+    switch(pattern) {
+    case ST_SEQUENTIAL:
+        for(i=0 ; i<trace->len ; ++i)
+            trace->pages[i] = i % n;
+        break;
+    case ST_STRIDED:
+        trace->region = n * ST_STRIDE;
+        for(i=0 ; i<trace->len ; ++i)
+            trace->pages[i] = (i % n) * ST_STRIDE;
+        break;
+    case ST_ZIPFIAN:
+        cdf = st_zipf_cdf(n);
+        if(!cdf) {
+            vfree(trace->pages);
+            return -ENOMEM;
+        }
+        for(i=0 ; i<trace->len ; ++i)
+            trace->pages[i] = st_zipf_sample(cdf, n, &rnd);
+        vfree(cdf);
+        break;
+    case ST_SHIFT:
+        ws = local ? (local * 3) / 4 : n / 2;
+        ws = ws ? ws : 1;
+        trace->region = ws + ws / 2;
+        for(i=0 ; i<trace->len ; ++i)
+            trace->pages[i] = (i < trace->len / 2 ? 0 : ws / 2) + prandom_u32_state(&rnd) % ws;
+        break;
+    default:
+        vfree(trace->pages);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+
+/*  st_sim_fifo
+ *
+ *  Description:
+ *      Faults of the trace with FIFO replacement of local pages, 0 local
+ *      pages being unlimited local memory as for the policies.
+ */
+static long st_sim_fifo(struct st_trace *trace, ulong local) {
+    unsigned long *resident = vzalloc(BITS_TO_LONGS(trace->region) * sizeof(unsigned long));
+    u32 *ring = local ? (u32*) vmalloc(sizeof(u32) * local) : NULL;
+    long faults = 0;
+    ulong i;
+
+    if(!resident || (local && !ring)) {
+        vfree(resident);
+        vfree(ring);
+        return -ENOMEM;
+    }
+
+    for(i=0 ; i<trace->len ; ++i) {
+        u32 page = trace->pages[i];
+
+        if(test_bit(page, resident))
+            continue;
+        if(local) {
+            if(faults >= local)
+                clear_bit(ring[faults % local], resident);
+            ring[faults % local] = page;
+        }
+        set_bit(page, resident);
+        faults++;
+    }
+
+    vfree(resident);
+    vfree(ring);
+    return faults;
+}
+
+/*  st_sim_lru
+ *
+ *  Description:
+ *      Faults of the trace with exact LRU replacement, kept as a list of
+ *      resident pages in prev/next arrays indexed by page.
+ */
+static long st_sim_lru(struct st_trace *trace, ulong local) {
+    const u32 none = U32_MAX;
+    u32 *prev = (u32*) vmalloc(sizeof(u32) * trace->region);
+    u32 *next = (u32*) vmalloc(sizeof(u32) * trace->region);
+    unsigned long *resident = vzalloc(BITS_TO_LONGS(trace->region) * sizeof(unsigned long));
+    u32 head = none, tail = none;       // head is most recently used
+    ulong count = 0, i;
+    long faults = 0;
+
+    if(!prev || !next || !resident) {
+        faults = -ENOMEM;
+        goto EXIT_SIM;
+    }
+
+    for(i=0 ; i<trace->len ; ++i) {
+        u32 page = trace->pages[i];
+
+        if(test_bit(page, resident)) {
+            if(page == head)
+                continue;
+            // unlink, it is relinked at head below
+            next[prev[page]] = next[page];
+            if(next[page] != none)
+                prev[next[page]] = prev[page];
+            else
+                tail = prev[page];
+        } else {
+            faults++;
+            if(local && count == local) {
+                u32 victim = tail;
+                tail = prev[victim];
+                if(tail != none)
+                    next[tail] = none;
+                else
+                    head = none;
+                clear_bit(victim, resident);
+                count--;
+            }
+            set_bit(page, resident);
+            count++;
+        }
+
+        prev[page] = none;
+        next[page] = head;
+        if(head != none)
+            prev[head] = page;
+        head = page;
+        if(tail == none)
+            tail = page;
+    }
+
+EXIT_SIM:
+    vfree(prev);
+    vfree(next);
+    vfree(resident);
+    return faults;
+}
+
+// pages touched at least once, no policy can fault less
+static long st_compulsory(struct st_trace *trace) {
+    unsigned long *seen = vzalloc(BITS_TO_LONGS(trace->region) * sizeof(unsigned long));
+    long count = 0;
+    ulong i;
+
+    if(!seen)
+        return -ENOMEM;
+    for(i=0 ; i<trace->len ; ++i)
+        if(!test_and_set_bit(trace->pages[i], seen))
+            count++;
+    vfree(seen);
+    return count;
+}
+
+
+/*  st_check_faults
+ *
+ *  Description:
+ *      Compares faults of the policy with its model. FIFO is deterministic
+ *      and must match exactly. LRU policy approximates LRU with accessed
+ *      bits and keeps some pages free, so it must be within tolerance of
+ *      exact LRU. Random can only be bounded by compulsory faults and accesses.
+ *      Returns 0 if check passed.
+ */
+static int st_check_faults(u32 policy, struct st_trace *trace, ulong local, long faults) {
+    long compulsory = st_compulsory(trace), expected = -1, slack;
+
+    if(compulsory < 0)
+        return compulsory;
+
+    switch(policy) {
+    case DIME_STATS_POLICY_FIFO:
+        expected = st_sim_fifo(trace, local);
+        DA_INFO("  fifo model : %ld faults", expected);
+        return expected < 0 ? expected : (faults == expected ? 0 : -1);
+    case DIME_STATS_POLICY_LRU:
+        expected = st_sim_lru(trace, local);
+        if(expected < 0)
+            return expected;
+        slack = (expected * lru_tolerance_pct) / 100;
+        DA_INFO("  lru model : %ld faults, allowed %ld..%ld", expected, expected - slack, expected + slack);
+        return (faults >= compulsory && faults >= expected - slack && faults <= expected + slack) ? 0 : -1;
+    default:
+        DA_INFO("  bounds : %ld..%lu faults", compulsory, trace->len);
+        return (faults >= compulsory && faults <= trace->len) ? 0 : -1;
+    }
+}
+
+/*  st_run_pattern
+ *
+ *  Description:
+ *      Replays pattern on a fresh anonymous region of current process, one
+ *      write per access, and checks instance fault count. Returns 0 if passed.
+ */
+static int st_run_pattern(struct dime_instance_struct *dime_instance, u32 policy, enum st_pattern pattern, ulong n, ulong local) {
+    struct st_trace trace;
+    ulong addr, i;
+    long faults;
+    u64 start_ns, elapsed_ns;
+    int ret;
+
+    ret = st_make_trace(pattern, n, local, &trace);
+    if(ret) {
+        DA_ERROR("unable to generate %s pattern : %d", st_pattern_names[pattern], ret);
+        return ret;
+    }
+
+    addr = vm_mmap(NULL, 0, trace.region * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, 0);
+    if(IS_ERR_VALUE(addr)) {
+        DA_ERROR("unable to map %lu pages : %ld", trace.region, (long) addr);
+        vfree(trace.pages);
+        return (int) addr;
+    }
+
+    faults = atomic_long_read(&dime_instance->pagefaults);
+    start_ns = sched_clock();
+    for(i=0 ; i<trace.len ; ++i) {
+        if(put_user((u32) i, (u32 __user *) (addr + (ulong) trace.pages[i] * PAGE_SIZE))) {
+            DA_ERROR("write to %lx failed", addr + (ulong) trace.pages[i] * PAGE_SIZE);
+            ret = -EFAULT;
+            break;
+        }
+    }
+    elapsed_ns = sched_clock() - start_ns;
+    faults = atomic_long_read(&dime_instance->pagefaults) - faults;
+    vm_munmap(addr, trace.region * PAGE_SIZE);
+
+    if(!ret) {
+        DA_INFO("%s : %lu accesses over %lu pages, %ld faults, %llu ns/access",
+                st_pattern_names[pattern], trace.len, trace.region, faults, elapsed_ns / trace.len);
+        ret = st_check_faults(policy, &trace, local, faults);
+        if(ret)
+            DA_ERROR("%s : FAILED", st_pattern_names[pattern]);
+    }
+
+    vfree(trace.pages);
+    return ret;
+}
+
+
+struct st_bench_thread_struct {
+    struct dime_instance_struct     * dime_instance;
+    struct page_replacement_policy_struct * prp;    // held by init_module
+    int                             id;
+    struct completion               * start;        // completed for all threads at once
+    u64                             time_ns;
+    struct completion               done;
+};
+
+static int st_bench_thread(void *data) {
+    struct st_bench_thread_struct *arg = data;
+    // synthetic pages of distinct ranges, no mm so eviction has nothing to protect
+    ulong base = ((ulong) arg->id + 1) << 36;
+    u64 start_ns;
+    int i;
+
+    wait_for_completion(arg->start);
+
+    start_ns = sched_clock();
+    for(i=0 ; i<bench_ops ; ++i)
+        arg->prp->add_page(arg->dime_instance, NULL, base + (ulong) i * PAGE_SIZE);
+    arg->time_ns = sched_clock() - start_ns;
+
+    complete(&arg->done);
+    return 0;
+}
+
+/*  st_bench
+ *
+ *  Description:
+ *      Calls add_page of the policy from nthreads threads at once and logs
+ *      throughput over all threads and mean latency of a call.
+ */
+static int st_bench(struct dime_instance_struct *dime_instance, struct page_replacement_policy_struct *prp, int nthreads) {
+    struct st_bench_thread_struct *args;
+    struct task_struct *tsk;
+    struct completion start;
+    u64 max_ns = 0, sum_ns = 0;
+    int i, started = 0;
+
+    args = (struct st_bench_thread_struct*) kcalloc(nthreads, sizeof(struct st_bench_thread_struct), GFP_KERNEL);
+    if(!args)
+        return -ENOMEM;
+
+    init_completion(&start);
+    for(i=0 ; i<nthreads ; ++i) {
+        args[i].dime_instance = dime_instance;
+        args[i].prp = prp;
+        args[i].id = i;
+        args[i].start = &start;
+        init_completion(&args[i].done);
+
+        tsk = kthread_run(st_bench_thread, &args[i], "dime_selftest/%d", i);
+        if(IS_ERR(tsk)) {
+            DA_ERROR("unable to start thread : %ld", PTR_ERR(tsk));
+            break;
+        }
+        started++;
+    }
+
+    complete_all(&start);
+    for(i=0 ; i<started ; ++i) {
+        wait_for_completion(&args[i].done);
+        max_ns = max(max_ns, args[i].time_ns);
+        sum_ns += args[i].time_ns;
+    }
+
+    if(started == nthreads && max_ns)
+        DA_INFO("add_page : %2d threads, %llu ops/s, %llu ns/op",
+                nthreads, ((u64) bench_ops * nthreads * 1000000000ULL) / max_ns, sum_ns / ((u64) bench_ops * nthreads));
+
+    kfree(args);
+    return started == nthreads ? 0 : -EAGAIN;
+}
+
+
+int init_module(void) {
+    struct dime_instance_struct *dime_instance;
+    struct page_replacement_policy_struct *prp;
+    struct dime_stats_policy policy_stats = { .id = DIME_STATS_POLICY_NONE };
+    ulong local, n;
+    int failed = 0, p, t, max_threads;
+    DA_ENTRY();
+
+    if(passes <= 0 || bench_ops <= 0) {
+        DA_ERROR("passes and bench_ops must be greater than zero");
+        return -EINVAL;
+    }
+    if(instance_id < 0 || instance_id >= smp_load_acquire(&dime.dime_instances_size)) {
+        DA_ERROR("no such instance : %d", instance_id);
+        return -EINVAL;
+    }
+    dime_instance = &dime.dime_instances[instance_id];
+
+    // policy module can not be removed while tests call it
+    prp = dime_prp_get(dime_instance);
+    if(!prp || !prp->add_page) {
+        DA_ERROR("no policy inserted for instance : %d", instance_id);
+        dime_prp_put(prp);
+        return -EINVAL;
+    }
+    if(prp->get_stats)
+        prp->get_stats(dime_instance, &policy_stats);
+
+    local = dime_local_npages(dime_instance);
+    n = npages > 0 ? npages : (local ? 2 * local : 4096);
+    DA_INFO("selftest of instance %d : policy %u, local_npages %lu, npages %lu, passes %d",
+            instance_id, policy_stats.id, local, n, passes);
+
+    if(pt_insert(dime_instance, task_tgid(current))) {
+        DA_ERROR("unable to track insmod process");
+        dime_prp_put(prp);
+        return -EINVAL;
+    }
+    for(p=0 ; p<ST_PATTERNS ; ++p)
+        failed += st_run_pattern(dime_instance, policy_stats.id, p, n, local) ? 1 : 0;
+    pt_remove(task_tgid(current));
+
+    max_threads = threads > 0 ? threads : num_online_cpus();
+    for(t=1 ; t<=max_threads ; t = (t < max_threads && t * 2 > max_threads) ? max_threads : t * 2)
+        failed += st_bench(dime_instance, prp, t) ? 1 : 0;
+    if(prp->drop_unowned)
+        prp->drop_unowned(dime_instance);
+    dime_prp_put(prp);
+
+    DA_INFO("selftest of instance %d : %s, %d failed", instance_id, failed ? "FAILED" : "passed", failed);
+    DA_EXIT();
+    return failed ? -EINVAL : 0;
+}
+
+void cleanup_module(void) {
+}
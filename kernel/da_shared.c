@@ -0,0 +1,386 @@
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_shared.h"
+#include "da_offload.h"
+
+#define SP_HASH_BITS    12
+#define SP_LOCK_BITS    8
+
+/*
+ *  Resident pages of all instances, by pfn for faults of other mappers and
+ *  by owner for evictions. Buckets of both hashes are guarded by
+ *  1 << SP_LOCK_BITS striped locks, so faults of unrelated pages do not
+ *  serialize. An entry is linked and unlinked holding the locks of both its
+ *  buckets, taken in address order by sp_lock_pair; its mapper list is
+ *  guarded by the lock of its pfn bucket. Locks are taken under policy
+ *  locks, so they never sleep.
+ */
+static DEFINE_HASHTABLE(sp_pfn_hash, SP_HASH_BITS);
+static DEFINE_HASHTABLE(sp_owner_hash, SP_HASH_BITS);
+static spinlock_t sp_locks[1 << SP_LOCK_BITS] = {
+    [0 ... (1 << SP_LOCK_BITS) - 1] = __SPIN_LOCK_UNLOCKED(sp_locks)
+};
+
+
+static inline ulong sp_owner_key(struct mm_struct *mm, ulong address) {
+    return (ulong)mm ^ (address >> PAGE_SHIFT);
+}
+
+// lock of the bucket of key, same bucket function as hash_add of both hashes
+static inline spinlock_t * sp_bucket_lock(ulong key) {
+    return &sp_locks[hash_min(key, SP_HASH_BITS) & ((1 << SP_LOCK_BITS) - 1)];
+}
+
+static inline spinlock_t * sp_pfn_lock(ulong pfn) {
+    return sp_bucket_lock(pfn);
+}
+
+static inline spinlock_t * sp_owner_lock(struct mm_struct *mm, ulong address) {
+    return sp_bucket_lock(sp_owner_key(mm, address));
+}
+
+static void sp_lock_pair(spinlock_t *a, spinlock_t *b) {
+    if(a == b) {
+        spin_lock(a);
+        return;
+    }
+    if(a > b)
+        swap(a, b);
+    spin_lock(a);
+    spin_lock_nested(b, SINGLE_DEPTH_NESTING);
+}
+
+static void sp_unlock_pair(spinlock_t *a, spinlock_t *b) {
+    if(a != b)
+        spin_unlock(b);
+    spin_unlock(a);
+}
+
+// must be called with owner bucket lock held
+static struct sp_page_struct * __sp_lookup_owner(struct mm_struct *mm, ulong address) {
+    struct sp_page_struct *sp;
+
+    hash_for_each_possible(sp_owner_hash, sp, owner_node, sp_owner_key(mm, address)) {
+        if(sp->mm == mm && sp->address == address)
+            return sp;
+    }
+
+    return NULL;
+}
+
+// must be called with pfn bucket lock held
+static struct sp_page_struct * __sp_lookup_pfn(struct dime_instance_struct *dime_instance, ulong pfn) {
+    struct sp_page_struct *sp;
+
+    hash_for_each_possible(sp_pfn_hash, sp, pfn_node, pfn) {
+        if(sp->pfn == pfn && sp->dime_instance == dime_instance)
+            return sp;
+    }
+
+    return NULL;
+}
+
+// must be called with both bucket locks of sp held, entry is freed with sp_free once they are dropped
+static void __sp_del(struct sp_page_struct *sp) {
+    hash_del(&sp->pfn_node);
+    hash_del(&sp->owner_node);
+}
+
+/*  sp_free
+ *
+ *  Description:
+ *      Frees an entry removed from hashes. If protect is set, mappers which
+ *      still map the page are protected, so that they fault on next access.
+ *      Returns number of mappers protected.
+ */
+static int sp_free(struct sp_page_struct *sp, int protect) {
+    struct sp_mapper_struct *mapper, *tmp;
+    int count = 0;
+
+    list_for_each_entry_safe(mapper, tmp, &sp->mappers, list_node) {
+        if(protect && ml_mm_get(mapper->mm)) {
+            pte_t *ptep = ml_get_ptep(mapper->mm, mapper->address);
+            if(ml_is_inlist_pte(mapper->mm, mapper->address, ptep) && pte_pfn(*ptep) == sp->pfn)
+                count += ml_protect_pte(mapper->mm, mapper->address, ptep);
+            ml_put_ptep(ptep);
+            ml_mm_put(mapper->mm);
+        }
+        ml_mm_release(mapper->mm);
+        kfree(mapper);
+    }
+    ml_mm_release(sp->mm);
+    kfree(sp);
+
+    return count;
+}
+
+// owner still holds the page in local memory, entry is stale otherwise
+static int sp_owner_maps(struct sp_page_struct *sp) {
+    pte_t *ptep;
+    int ret;
+
+    if(!ml_mm_get(sp->mm))
+        return 0;
+    ptep = ml_get_ptep(sp->mm, sp->address);
+    ret = ml_is_inlist_pte(sp->mm, sp->address, ptep) && pte_pfn(*ptep) == sp->pfn;
+    ml_put_ptep(ptep);
+    ml_mm_put(sp->mm);
+
+    return ret;
+}
+
+/*  sp_take_owner
+ *
+ *  Description:
+ *      Removes entry of owner mapping from hashes, if any. Lock of its pfn
+ *      bucket is only known after lookup, so the entry is looked up again
+ *      under both locks, and again if it was replaced meanwhile.
+ */
+static struct sp_page_struct * sp_take_owner(struct mm_struct *mm, ulong address) {
+    spinlock_t *owner_lock = sp_owner_lock(mm, address), *pfn_lock;
+    struct sp_page_struct *sp;
+
+    for(;;) {
+        spin_lock(owner_lock);
+        sp = __sp_lookup_owner(mm, address);
+        pfn_lock = sp ? sp_pfn_lock(sp->pfn) : NULL;
+        spin_unlock(owner_lock);
+        if(!sp)
+            return NULL;
+
+        sp_lock_pair(owner_lock, pfn_lock);
+        sp = __sp_lookup_owner(mm, address);
+        if(sp && sp_pfn_lock(sp->pfn) == pfn_lock) {
+            __sp_del(sp);
+            sp_unlock_pair(owner_lock, pfn_lock);
+            return sp;
+        }
+        sp_unlock_pair(owner_lock, pfn_lock);
+        if(!sp)
+            return NULL;
+    }
+}
+
+/*  sp_take_pfn
+ *
+ *  Description:
+ *      Removes entry of pfn of the instance from hashes, if any, same as
+ *      sp_take_owner. If stale is set, entry is only removed if its owner
+ *      no longer maps the page.
+ */
+static struct sp_page_struct * sp_take_pfn(struct dime_instance_struct *dime_instance, ulong pfn, int stale) {
+    spinlock_t *pfn_lock = sp_pfn_lock(pfn), *owner_lock;
+    struct sp_page_struct *sp;
+
+    for(;;) {
+        spin_lock(pfn_lock);
+        sp = __sp_lookup_pfn(dime_instance, pfn);
+        owner_lock = sp ? sp_owner_lock(sp->mm, sp->address) : NULL;
+        spin_unlock(pfn_lock);
+        if(!sp)
+            return NULL;
+
+        sp_lock_pair(pfn_lock, owner_lock);
+        sp = __sp_lookup_pfn(dime_instance, pfn);
+        if(sp && sp_owner_lock(sp->mm, sp->address) == owner_lock) {
+            if(stale && sp_owner_maps(sp))
+                sp = NULL;
+            else
+                __sp_del(sp);
+            sp_unlock_pair(pfn_lock, owner_lock);
+            return sp;
+        }
+        sp_unlock_pair(pfn_lock, owner_lock);
+        if(!sp)
+            return NULL;
+    }
+}
+
+
+/*  sp_map_resident
+ *
+ *  Description:
+ *      Called after a fault of mm at address was handled. If the page now
+ *      mapped there is resident in local memory of the instance under
+ *      another mapping, mm is recorded as its mapper and marked in list.
+ *      Returns 1 if page is resident and no remote fetch is needed, else 0.
+ */
+int sp_map_resident(struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address) {
+    pte_t *ptep = ml_get_ptep(mm, address);
+    struct sp_page_struct *sp, *stale = NULL;
+    struct sp_mapper_struct *mapper;
+    spinlock_t *pfn_lock;
+    ulong pfn;
+    int resident = 0;
+
+    if(!ptep || !pte_present(*ptep)) {
+        ml_put_ptep(ptep);
+        return 0;
+    }
+
+    pfn = pte_pfn(*ptep);
+    pfn_lock = sp_pfn_lock(pfn);
+    spin_lock(pfn_lock);
+    sp = __sp_lookup_pfn(dime_instance, pfn);
+    if(sp && !sp_owner_maps(sp)) {
+        // owner unmapped the page or has exited without eviction, removed under both locks below
+        stale = sp;
+        sp = NULL;
+    }
+
+    if(sp) {
+        list_for_each_entry(mapper, &sp->mappers, list_node) {
+            if(mapper->mm == mm && (mapper->address & PAGE_MASK) == (address & PAGE_MASK)) {
+                resident = 1;
+                break;
+            }
+        }
+
+        if(!resident) {
+            mapper = (struct sp_mapper_struct*) kmalloc(sizeof(struct sp_mapper_struct), GFP_ATOMIC);
+            if(mapper) {
+                mapper->mm = mm;
+                mapper->address = address;
+                ml_mm_hold(mm);
+                list_add_tail(&mapper->list_node, &sp->mappers);
+                resident = 1;
+            }
+        }
+
+        if(resident)
+            ml_set_inlist_pte(mm, address, ptep);
+    }
+    spin_unlock(pfn_lock);
+    ml_put_ptep(ptep);
+
+    if(stale && (stale = sp_take_pfn(dime_instance, pfn, 1)) != NULL)
+        sp_free(stale, 0);
+
+    return resident;
+}
+
+/*  sp_insert
+ *
+ *  Description:
+ *      Records page mapped at address of mm as resident, after policy has
+ *      placed it in local memory under this owner mapping.
+ */
+void sp_insert(struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address) {
+    pte_t *ptep = ml_get_ptep(mm, address);
+    struct sp_page_struct *sp, *old;
+    spinlock_t *pfn_lock, *owner_lock = sp_owner_lock(mm, address);
+    ulong pfn;
+
+    if(!ptep || !pte_present(*ptep)) {
+        ml_put_ptep(ptep);
+        return;
+    }
+    pfn = pte_pfn(*ptep);
+    ml_put_ptep(ptep);
+
+    // called from fault hook with preemption disabled in kprobe mode
+    sp = (struct sp_page_struct*) kmalloc(sizeof(struct sp_page_struct), GFP_ATOMIC);
+    if(!sp) {
+        DA_ERROR("unable to allocate memory");
+        return;
+    }
+    sp->pfn = pfn;
+    sp->dime_instance = dime_instance;
+    sp->mm = mm;
+    sp->address = address;
+    INIT_LIST_HEAD(&sp->mappers);
+    ml_mm_hold(mm);
+    pfn_lock = sp_pfn_lock(sp->pfn);
+
+    for(;;) {
+        sp_lock_pair(pfn_lock, owner_lock);
+        if(!__sp_lookup_owner(mm, address) && !__sp_lookup_pfn(dime_instance, sp->pfn)) {
+            hash_add(sp_pfn_hash, &sp->pfn_node, sp->pfn);
+            hash_add(sp_owner_hash, &sp->owner_node, sp_owner_key(mm, address));
+            sp_unlock_pair(pfn_lock, owner_lock);
+            return;
+        }
+        sp_unlock_pair(pfn_lock, owner_lock);
+
+        // both are stale, owner was added again or page lost its owner without eviction
+        if((old = sp_take_owner(mm, address)) != NULL)
+            sp_free(old, 0);
+        if((old = sp_take_pfn(dime_instance, sp->pfn, 0)) != NULL)
+            sp_free(old, 0);
+    }
+}
+
+/*  sp_protect_pte
+ *
+ *  Description:
+ *      Evicts page of owner mapping whose pte is ptep, page tables of mm must
+ *      be held. Protects owner and every other mapper of the page. A page
+ *      of a single mapping goes to the tier of its instance.
+ */
+int sp_protect_pte(struct mm_struct *mm, ulong address, pte_t *ptep) {
+    struct sp_page_struct *sp = sp_take_owner(mm, address);
+    int ret = ml_protect_pte(mm, address, ptep);
+
+    if(sp)
+        sp_free(sp, 1);
+    else if(ret)
+        dime_tier_evict(mm, address);
+    return ret;
+}
+
+/*  sp_protect_mm_page
+ *
+ *  Description:
+ *      Same as sp_protect_pte for a node of policy list, mappers are
+ *      protected even if owner has exited.
+ */
+int sp_protect_mm_page(struct mm_struct *mm, ulong address) {
+    struct sp_page_struct *sp = sp_take_owner(mm, address);
+    int ret = ml_protect_mm_page(mm, address);
+
+    if(sp)
+        sp_free(sp, 1);
+    else if(ret)
+        dime_tier_evict(mm, address);
+    return ret;
+}
+
+/*  sp_cleanup
+ *
+ *  Description:
+ *      Drops all entries when policy lists are cleaned, pages are left as
+ *      they are mapped.
+ */
+void sp_cleanup(void) {
+    struct dime_instance_struct *dime_instance;
+    struct sp_page_struct *sp;
+    spinlock_t *pfn_lock;
+    ulong pfn;
+    int bkt;
+
+    for(bkt=0 ; bkt<HASH_SIZE(sp_pfn_hash) ; ++bkt) {
+        pfn_lock = &sp_locks[bkt & ((1 << SP_LOCK_BITS) - 1)];
+        for(;;) {
+            spin_lock(pfn_lock);
+            sp = hlist_entry_safe(sp_pfn_hash[bkt].first, struct sp_page_struct, pfn_node);
+            if(sp) {
+                pfn = sp->pfn;
+                dime_instance = sp->dime_instance;
+            }
+            spin_unlock(pfn_lock);
+            if(!sp)
+                break;
+
+            if((sp = sp_take_pfn(dime_instance, pfn, 0)) != NULL)
+                sp_free(sp, 0);
+        }
+    }
+}
+
+EXPORT_SYMBOL(sp_protect_pte);
+EXPORT_SYMBOL(sp_protect_mm_page);
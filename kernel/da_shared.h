@@ -0,0 +1,41 @@
+#ifndef __DA_SHARED_H__
+#define __DA_SHARED_H__
+
+#include <linux/mm.h>
+
+#include "../common/da_debug.h"
+#include "common.h"
+
+
+/*
+ *  Local residency of physical pages. A page placed by the policy is
+ *  resident under its owner mapping (mm, address), the one stored in policy
+ *  list. Faults of other tracked mappings on the same pfn, e.g. COW pages of
+ *  forked children or shared page cache, are recorded as mappers instead of
+ *  taking another local slot and another remote fetch. Evicting the owner
+ *  protects every mapper, so next access from any of them is a remote fetch.
+ */
+struct sp_mapper_struct {
+    struct list_head                list_node;
+    struct mm_struct                * mm;           // holds mm_count reference
+    ulong                           address;
+};
+
+struct sp_page_struct {
+    struct hlist_node               pfn_node;       // link in pfn hash
+    struct hlist_node               owner_node;     // link in owner hash
+    ulong                           pfn;
+    struct dime_instance_struct     * dime_instance;
+    struct mm_struct                * mm;           // owner, holds mm_count reference
+    ulong                           address;
+    struct list_head                mappers;        // list of sp_mapper_struct
+};
+
+
+void    sp_cleanup          (void);
+int     sp_map_resident     (struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address);
+void    sp_insert           (struct dime_instance_struct *dime_instance, struct mm_struct *mm, ulong address);
+int     sp_protect_pte      (struct mm_struct *mm, ulong address, pte_t *ptep);
+int     sp_protect_mm_page  (struct mm_struct *mm, ulong address);
+
+#endif
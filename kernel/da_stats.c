@@ -0,0 +1,159 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/timekeeping.h>
+#include "da_stats.h"
+#include "da_compress.h"
+
+/*****
+ *
+ *  Binary stats interface, see common/dime_stats.h for the ABI.
+ *
+ */
+
+static bool dime_stats_registered = false;
+
+/*  fill_instance_stats
+ *
+ *  Description:
+ *      Reads counters of an instance and of its policy into stats, one by
+ *      one while faults keep updating them, so related counters may be
+ *      apart by the faults in between. Policy module is held while its
+ *      counters are read.
+ */
+static void fill_instance_stats(struct dime_instance_struct *dime_instance, struct dime_stats_instance *stats) {
+    struct page_replacement_policy_struct *prp;
+    struct dime_config_struct *config;
+
+    stats->version              = DIME_STATS_VERSION;
+    stats->size                 = sizeof(struct dime_stats_instance);
+    stats->instance_id          = dime_instance->instance_id;
+    stats->pid_count            = dime_instance->pid_count;
+    stats->timestamp_ns         = ktime_get_ns();
+
+    rcu_read_lock();
+    config = dime_config_get(dime_instance);
+    stats->latency_ns           = config->latency_ns;
+    stats->bandwidth_bps        = config->bandwidth_bps;
+    stats->local_npages         = config->local_npages;
+    rcu_read_unlock();
+
+    stats->pagefaults           = atomic_long_read(&dime_instance->pagefaults);
+    stats->duplicate_pfs        = atomic_long_read(&dime_instance->duplecate_pfs);
+    stats->pc_pagefaults        = atomic_long_read(&dime_instance->pc_pagefaults);
+    stats->an_pagefaults        = atomic_long_read(&dime_instance->an_pagefaults);
+    stats->time_pfh             = atomic_long_read(&dime_instance->time_pfh);
+    stats->time_ap              = atomic_long_read(&dime_instance->time_ap);
+    stats->time_inject          = atomic_long_read(&dime_instance->time_inject);
+    stats->time_pfh_ap          = atomic_long_read(&dime_instance->time_pfh_ap);
+    stats->time_pfh_ap_inject   = atomic_long_read(&dime_instance->time_pfh_ap_inject);
+
+    stats->policy.id            = DIME_STATS_POLICY_NONE;
+    stats->policy.count         = 0;
+    prp = dime_prp_get(dime_instance);
+    if(prp && prp->get_stats)
+        prp->get_stats(dime_instance, &stats->policy);
+    dime_prp_put(prp);
+
+    stats->an_time_inject       = atomic_long_read(&dime_instance->an_time_inject);
+    stats->pc_time_inject       = atomic_long_read(&dime_instance->pc_time_inject);
+    stats->shared_pfs           = atomic_long_read(&dime_instance->shared_pfs);
+    stats->adm_admitted         = atomic_long_read(&dime_instance->adm_admitted);
+    stats->adm_rejected         = atomic_long_read(&dime_instance->adm_rejected);
+    stats->time_queue           = atomic_long_read(&dime_instance->time_queue);
+    stats->fabric_losses        = atomic_long_read(&dime_instance->fabric_losses);
+    stats->fabric_brownouts     = atomic_long_read(&dime_instance->fabric_brownouts);
+    stats->fabric_spikes        = atomic_long_read(&dime_instance->fabric_spikes);
+    stats->time_fabric          = atomic_long_read(&dime_instance->time_fabric);
+    stats->offload_pages        = atomic_long_read(&dime_instance->offload_pages);
+    stats->offload_failed       = atomic_long_read(&dime_instance->offload_failed);
+    stats->offload_fetches      = atomic_long_read(&dime_instance->offload_fetches);
+    stats->time_fetch           = atomic_long_read(&dime_instance->time_fetch);
+    stats->compress_stored      = atomic_long_read(&dime_instance->compress_stored);
+    stats->compress_rejected    = atomic_long_read(&dime_instance->compress_rejected);
+    stats->compress_evicted     = atomic_long_read(&dime_instance->compress_evicted);
+    stats->compress_hits        = atomic_long_read(&dime_instance->compress_hits);
+    stats->time_compress        = atomic_long_read(&dime_instance->time_compress);
+    stats->time_decompress      = atomic_long_read(&dime_instance->time_decompress);
+    dime_compress_usage(dime_instance, &stats->pool_npages, &stats->pool_bytes, &stats->pool_alloc_bytes);
+    stats->warm_restored        = atomic_long_read(&dime_instance->warm_restored);
+    stats->warm_skipped         = atomic_long_read(&dime_instance->warm_skipped);
+    stats->time_clamped         = atomic_long_read(&dime_instance->time_clamped);
+}
+
+static long dime_stats_ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+    void __user *uarg = (void __user *) arg;
+
+    if(_IOC_TYPE(cmd) != DIME_STATS_IOC_MAGIC)
+        return -ENOTTY;
+
+    // match on number only, size encoded in cmd changes when struct grows
+    switch(_IOC_NR(cmd)) {
+    case _IOC_NR(DIME_STATS_IOC_COUNT): {
+        __u32 count = dime.dime_instances_size;
+        return put_user(count, (__u32 __user *) uarg);
+    }
+    case _IOC_NR(DIME_STATS_IOC_GET): {
+        struct dime_stats_instance stats;
+        __u32 size;
+
+        // version, size and instance_id are the only input fields
+        if(copy_from_user(&stats, uarg, offsetof(struct dime_stats_instance, pid_count)))
+            return -EFAULT;
+        if(stats.version != DIME_STATS_VERSION)
+            return -EINVAL;
+        if(stats.size < offsetof(struct dime_stats_instance, policy))
+            return -EINVAL;         // caller must take at least all instance counters
+        if(stats.instance_id >= dime.dime_instances_size)
+            return -ENOENT;
+
+        size = min_t(__u32, stats.size, sizeof(struct dime_stats_instance));
+        memset(&stats.pid_count, 0, sizeof(stats) - offsetof(struct dime_stats_instance, pid_count));
+        fill_instance_stats(&dime.dime_instances[stats.instance_id], &stats);
+
+        if(copy_to_user(uarg, &stats, size))
+            return -EFAULT;
+        return 0;
+    }
+    default:
+        return -ENOTTY;
+    }
+}
+
+static const struct file_operations dime_stats_fops = {
+    .owner          = THIS_MODULE,
+    .unlocked_ioctl = dime_stats_ioctl,
+    .compat_ioctl   = dime_stats_ioctl,     // layout is same for 32 bit callers
+    .llseek         = noop_llseek,
+};
+
+static struct miscdevice dime_stats_dev = {
+    .minor  = MISC_DYNAMIC_MINOR,
+    .name   = "dime_stats",
+    .fops   = &dime_stats_fops,
+    .mode   = S_IRUGO,
+};
+
+int init_dime_stats(void) {
+    int ret = misc_register(&dime_stats_dev);
+
+    if(ret) {
+        DA_ALERT("could not register %s : %d", DIME_STATS_DEVICE, ret);
+        return ret;
+    }
+    dime_stats_registered = true;
+
+    DA_INFO("stats device \"%s\" created", DIME_STATS_DEVICE);
+    return 0;
+}
+
+void cleanup_dime_stats(void) {
+    if(!dime_stats_registered)
+        return;
+
+    misc_deregister(&dime_stats_dev);
+    dime_stats_registered = false;
+    DA_INFO("stats device \"%s\" removed", DIME_STATS_DEVICE);
+}
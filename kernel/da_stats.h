@@ -0,0 +1,11 @@
+#ifndef __DA_STATS_H__
+#define __DA_STATS_H__
+
+
+#include "common.h"
+
+int init_dime_stats(void);
+void cleanup_dime_stats(void);
+
+
+#endif
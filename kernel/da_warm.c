@@ -0,0 +1,412 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/ctype.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/mm.h>
+#include <linux/sched/task.h>
+#endif
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_ptracker.h"
+#include "da_shared.h"
+#include "da_warm.h"
+
+/*****
+ *
+ *  Warm start of local memory across module reloads.
+ *
+ *  Reading /proc/dime_warm takes a checkpoint of the local pages of every
+ *  instance whose policy can export them, one line per page :
+ *      instance_id pid address list age
+ *  list is a policy specific list of the page, age is the number of pages
+ *  of the same list added after it, 0 for the hottest page. Pages of each
+ *  list come coldest first.
+ *
+ *  Writing the lines back, once instances are configured and a policy is
+ *  loaded again, makes each page local again without a fault : its pte is
+ *  unprotected and the policy adds it as hottest page of its list. Pages
+ *  are restored in the order written, so a checkpoint read back as is
+ *  keeps the order of each list. Pages which are no longer mapped, were
+ *  swapped out, are already local or belong to a process not tracked by
+ *  the instance are skipped.
+ *
+ */
+
+#define PROCFS_NAME             "dime_warm"
+
+#define WARM_MIN_RECORDS        4096
+
+struct warm_record_struct {
+    int                             instance_id;
+    pid_t                           pid;
+    ulong                           address;
+    int                             list;
+    ulong                           age;
+};
+
+// checkpoint taken when file is opened for reading
+struct warm_snapshot_struct {
+    struct warm_record_struct       *records;
+    ulong                           count;
+    ulong                           size;
+
+    // instance being exported
+    struct dime_instance_struct     *dime_instance;
+    struct mm_struct                *last_mm;       // pages of a process mostly come in runs
+    pid_t                           last_pid;
+};
+
+// process of the last restored record
+struct warm_restore_struct {
+    struct dime_instance_struct     *dime_instance;
+    pid_t                           pid;
+    struct mm_struct                *mm;            // mm_users reference, NULL if process is not emulated
+};
+
+
+// export_pages callback, runs under policy locks
+static int warm_export_page(void *arg, struct mm_struct *mm, ulong address, int list) {
+    struct warm_snapshot_struct *snap = arg;
+    struct warm_record_struct *record;
+
+    if(snap->count == snap->size)
+        return -ENOSPC;
+
+    if(mm != snap->last_mm) {
+        snap->last_mm = mm;
+        snap->last_pid = pt_pid_of_mm(snap->dime_instance, mm);
+    }
+    if(snap->last_pid == 0)
+        return 0;       // process has exited or left the instance
+
+    record = &snap->records[snap->count++];
+    record->instance_id = snap->dime_instance->instance_id;
+    record->pid = snap->last_pid;
+    record->address = address & PAGE_MASK;
+    record->list = clamp(list, 0, DIME_WARM_LISTS - 1);
+    return 0;
+}
+
+// sets ages of records of instance from first on, walking each list from its hottest page
+static void warm_set_ages(struct warm_snapshot_struct *snap, ulong first) {
+    ulong younger[DIME_WARM_LISTS] = {0};
+    ulong i;
+
+    for(i=snap->count ; i-- > first ; )
+        snap->records[i].age = younger[snap->records[i].list]++;
+}
+
+static int warm_grow(struct warm_snapshot_struct *snap, ulong size) {
+    struct warm_record_struct *records = vmalloc(sizeof(struct warm_record_struct) * size);
+
+    if(!records) {
+        DA_ERROR("unable to allocate memory");
+        return -ENOMEM;
+    }
+    if(snap->records) {
+        memcpy(records, snap->records, sizeof(struct warm_record_struct) * snap->count);
+        vfree(snap->records);
+    }
+    snap->records = records;
+    snap->size = size;
+    return 0;
+}
+
+/*  warm_snapshot
+ *
+ *  Description:
+ *      Exports local pages of all instances into snap. If a policy holds
+ *      more pages than there is room for, records are grown and the
+ *      instance is exported again.
+ */
+static int warm_snapshot(struct warm_snapshot_struct *snap) {
+    struct page_replacement_policy_struct *prp;
+    ulong first, size = WARM_MIN_RECORDS;
+    int i, ret;
+
+    for(i=0 ; i<dime.dime_instances_size ; ++i)
+        size += dime_local_npages(&dime.dime_instances[i]);
+    ret = warm_grow(snap, size);
+    if(ret)
+        return ret;
+
+    for(i=0 ; i<dime.dime_instances_size ; ++i) {
+        prp = dime_prp_get(&dime.dime_instances[i]);
+        if(!prp || !prp->export_pages) {
+            dime_prp_put(prp);
+            continue;
+        }
+
+        first = snap->count;
+        snap->dime_instance = &dime.dime_instances[i];
+        do {
+            snap->count = first;
+            snap->last_mm = NULL;
+            ret = prp->export_pages(snap->dime_instance, warm_export_page, snap);
+        } while(ret == -ENOSPC && (ret = warm_grow(snap, snap->size * 2)) == 0);
+        dime_prp_put(prp);
+        if(ret)
+            return ret;
+
+        warm_set_ages(snap, first);
+        DA_INFO("instance %d : %lu local pages exported", i, snap->count - first);
+    }
+    return 0;
+}
+
+static void warm_restore_put(struct warm_restore_struct *restore) {
+    if(restore->mm)
+        mmput(restore->mm);
+    restore->mm = NULL;
+}
+
+// mm of process pid if the instance emulates it, cached for following records of the process
+static struct mm_struct *warm_restore_get_mm(struct warm_restore_struct *restore, struct dime_instance_struct *dime_instance, pid_t pid) {
+    struct pid *pid_s;
+    struct task_struct *ts = NULL;
+
+    if(restore->dime_instance == dime_instance && restore->pid == pid)
+        return restore->mm;
+
+    warm_restore_put(restore);
+    restore->dime_instance = dime_instance;
+    restore->pid = pid;
+
+    pid_s = find_get_pid(pid);
+    if(pid_s) {
+        ts = get_pid_task(pid_s, PIDTYPE_PID);
+        put_pid(pid_s);
+    }
+    if(ts) {
+        // pages of other processes were never protected by DiME
+        if(pt_get_dime_instance_of_task(ts) == dime_instance)
+            restore->mm = get_task_mm(ts);
+        put_task_struct(ts);
+    }
+    return restore->mm;
+}
+
+/*  warm_restore_page
+ *
+ *  Description:
+ *      Makes page local again without a fault, as the fault hook would
+ *      after a fault on it : page mapped by another process of instance is
+ *      already local, else policy places it. Returns 1 if page was made
+ *      local.
+ */
+static int warm_restore_page(struct dime_instance_struct *dime_instance, struct page_replacement_policy_struct *prp,
+                                struct mm_struct *mm, ulong address, int list) {
+    struct vm_area_struct *vma;
+    pte_t *ptep = NULL;
+    int ret = 0;
+
+    ml_mmap_read_lock(mm);
+    vma = find_vma(mm, address);
+    if(vma && vma->vm_start <= address && (vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+        ptep = ml_get_ptep(mm, address);
+
+    // not mapped, swapped out, or faulted in since reload
+    if(!ptep || !pte_present(*ptep) || ml_is_inlist_pte(mm, address, ptep)) {
+        ml_put_ptep(ptep);
+        goto restore_exit;
+    }
+
+    ml_unprotect_pte(mm, address, ptep);
+    ml_put_ptep(ptep);
+    if(!sp_map_resident(dime_instance, mm, address)) {
+        prp->restore_page(dime_instance, mm, address, list);
+        if(dime_local_npages(dime_instance))
+            sp_insert(dime_instance, mm, address);
+    }
+    ret = 1;
+
+restore_exit:
+    ml_mmap_read_unlock(mm);
+    return ret;
+}
+
+static int warm_restore_line(struct warm_restore_struct *restore, char *line) {
+    struct dime_instance_struct *dime_instance;
+    struct page_replacement_policy_struct *prp;
+    struct mm_struct *mm;
+    int instance_id, list;
+    pid_t pid;
+    ulong address, age;
+
+    line = strim(line);
+    if(!isdigit(line[0]))
+        return 0;       // empty or header line
+
+    if(sscanf(line, "%d %d %lx %d %lu", &instance_id, &pid, &address, &list, &age) != 5 ||
+            instance_id < 0 || list < 0 || list >= DIME_WARM_LISTS) {
+        DA_ERROR("invalid record : %s", line);
+        return -EINVAL;
+    }
+    if(instance_id >= dime.dime_instances_size) {
+        DA_ERROR("no such instance : %d", instance_id);
+        return -EINVAL;
+    }
+
+    dime_instance = &dime.dime_instances[instance_id];
+    prp = dime_prp_get(dime_instance);
+    if(!prp || !prp->restore_page) {
+        dime_prp_put(prp);
+        DA_ERROR("policy of instance %d can not restore pages", instance_id);
+        return -EOPNOTSUPP;
+    }
+
+    mm = warm_restore_get_mm(restore, dime_instance, pid);
+    if(mm && warm_restore_page(dime_instance, prp, mm, address & PAGE_MASK, list))
+        atomic_long_inc(&dime_instance->warm_restored);
+    else
+        atomic_long_inc(&dime_instance->warm_skipped);
+    dime_prp_put(prp);
+    return 0;
+}
+
+/*  procfile_write
+ *
+ *  Description:
+ *      Restores records of whole lines in buffer. A line split at the end
+ *      of the buffer is not consumed, the writer passes it again with its
+ *      next write. Records before an invalid one stay restored.
+ */
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+    struct warm_restore_struct restore = {0};
+    char *kbuf, *line, *next, *last;
+    size_t consumed = length;
+    ssize_t ret = 0;
+
+    kbuf = memdup_user_nul(buffer, length);
+    if (IS_ERR(kbuf)) {
+        return PTR_ERR(kbuf);
+    }
+
+    last = strrchr(kbuf, '\n');
+    if(last && last[1] != '\0') {
+        last[1] = '\0';
+        consumed = last + 1 - kbuf;
+    }
+
+    next = kbuf;
+    while((line = strsep(&next, "\n")) != NULL) {
+        ret = warm_restore_line(&restore, line);
+        if(ret)
+            break;
+        cond_resched();
+    }
+    warm_restore_put(&restore);
+    kfree(kbuf);
+
+    if(ret)
+        return ret;
+    *offset += consumed;
+    return consumed;
+}
+
+static void *procfile_seq_start(struct seq_file *m, loff_t *pos) {
+    struct warm_snapshot_struct *snap = m->private;
+
+    if(*pos == 0)
+        return SEQ_START_TOKEN;
+    if(*pos <= snap->count)
+        return &snap->records[*pos - 1];
+    return NULL;
+}
+
+static void *procfile_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    ++*pos;
+    return procfile_seq_start(m, pos);
+}
+
+static void procfile_seq_stop(struct seq_file *m, void *v) {
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+    struct warm_record_struct *record = v;
+
+    if(v == SEQ_START_TOKEN) {
+        seq_puts(m, "instance_id pid address list age\n");
+        return 0;
+    }
+
+    seq_printf(m, "%d %d 0x%lx %d %lu\n", record->instance_id, record->pid, record->address, record->list, record->age);
+    return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+    .start  = procfile_seq_start,
+    .next   = procfile_seq_next,
+    .stop   = procfile_seq_stop,
+    .show   = procfile_show,
+};
+
+static int procfile_release(struct inode *inode, struct file *file) {
+    struct warm_snapshot_struct *snap = ((struct seq_file *) file->private_data)->private;
+
+    vfree(snap->records);
+    return seq_release_private(inode, file);
+}
+
+// checkpoint is taken once per open for reading, a restore only opens for writing
+static int procfile_open(struct inode *inode, struct file *file) {
+    struct warm_snapshot_struct *snap;
+    int ret;
+
+    snap = __seq_open_private(file, &procfile_seq_ops, sizeof(struct warm_snapshot_struct));
+    if(!snap)
+        return -ENOMEM;
+    if(!(file->f_mode & FMODE_READ))
+        return 0;
+
+    ret = warm_snapshot(snap);
+    if(ret)
+        procfile_release(inode, file);
+    return ret;
+}
+
+// snapshot is freed on release, so DIME_DEFINE_PROC_OPS with seq_release does not fit
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+static const struct proc_ops warm_file_ops = {
+    .proc_open      = procfile_open,
+    .proc_read      = seq_read,
+    .proc_lseek     = seq_lseek,
+    .proc_release   = procfile_release,
+    .proc_write     = procfile_write,
+};
+#else
+static const struct file_operations warm_file_ops = {
+    .owner          = THIS_MODULE,
+    .open           = procfile_open,
+    .read           = seq_read,
+    .llseek         = seq_lseek,
+    .release        = procfile_release,
+    .write          = procfile_write,
+};
+#endif
+
+int init_dime_warm(void) {
+    // addresses of emulated processes are not for everyone
+    if(proc_create(PROCFS_NAME, S_IFREG | S_IRUSR | S_IWUSR, NULL, &warm_file_ops) == NULL) {
+        DA_ALERT("could not initialize /proc/%s\n", PROCFS_NAME);
+        return -ENOMEM;
+    }
+
+    DA_INFO("proc entry \"/proc/%s\" created\n", PROCFS_NAME);
+    return 0;
+}
+
+void cleanup_dime_warm(void) {
+    remove_proc_entry(PROCFS_NAME, NULL);
+    DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
+}
@@ -0,0 +1,11 @@
+#ifndef __DA_WARM_H__
+#define __DA_WARM_H__
+
+
+#include "common.h"
+
+int init_dime_warm(void);
+void cleanup_dime_warm(void);
+
+
+#endif
@@ -0,0 +1,454 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/hashtable.h>
+#include <linux/workqueue.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/mm.h>
+#endif
+
+#include "../common/da_debug.h"
+#include "da_mem_lib.h"
+#include "da_wss.h"
+
+/*****
+ *
+ *  Working set size estimation of any process, emulated or not.
+ *
+ *  Each watched process is scanned every interval_ms on a worker: accessed
+ *  bits of all its mapped pages are tested and cleared, and every page keeps
+ *  the number of scans since it was last seen accessed (its age). Working set
+ *  over the last w intervals is the number of pages younger than w, reported
+ *  for w = 1, 2, 4 .. WSS_MAX_WINDOW.
+ *
+ */
+
+#define PROCFS_NAME             "dime_wss"
+
+#define WSS_NR_WINDOWS          7
+#define WSS_MAX_WINDOW          (1 << (WSS_NR_WINDOWS - 1))
+#define WSS_HISTORY             32          // last wss_1 values shown
+#define WSS_MIN_INTERVAL_MS     100
+#define WSS_HASH_BITS           10
+
+#define WSS_AGE_MAX             254
+#define WSS_AGE_NONE            255         // no page was mapped at last scan
+
+// ages of pages under one page table page
+struct wss_chunk_struct {
+    struct hlist_node       node;
+    ulong                   base;           // PMD aligned address
+    ulong                   gen;            // scan which last visited chunk
+    u8                      age[PTRS_PER_PTE];
+};
+
+struct wss_target_struct {
+    struct list_head        list;
+    struct pid              *pid;
+    uint                    interval_ms;    // protected by wss_lock
+    bool                    exited;
+    bool                    stopping;
+
+    // results, written by scan_work under wss_lock
+    ulong                   scans;
+    ulong                   rss;
+    ulong                   wss[WSS_NR_WINDOWS];
+    ulong                   history[WSS_HISTORY];
+    uint                    history_len;
+
+    // only touched by scan_work, or after it is cancelled
+    struct delayed_work     scan_work;
+    DECLARE_HASHTABLE(chunks, WSS_HASH_BITS);
+};
+
+static LIST_HEAD(wss_targets);
+static DEFINE_MUTEX(wss_lock);             // protects wss_targets and results of targets
+
+
+static struct wss_chunk_struct * wss_chunk_get(struct wss_target_struct *target, ulong base) {
+    struct wss_chunk_struct *chunk;
+
+    hash_for_each_possible(target->chunks, chunk, node, base) {
+        if(chunk->base == base)
+            return chunk;
+    }
+
+    chunk = (struct wss_chunk_struct*) kmalloc(sizeof(struct wss_chunk_struct), GFP_KERNEL);
+    if(!chunk)
+        return NULL;
+    chunk->base = base;
+    chunk->gen = target->scans - 1;     // freed after scan unless visited
+    memset(chunk->age, WSS_AGE_NONE, sizeof(chunk->age));
+    hash_add(target->chunks, &chunk->node, base);
+    return chunk;
+}
+
+static void wss_chunks_free(struct wss_target_struct *target, ulong keep_gen, bool all) {
+    struct wss_chunk_struct *chunk;
+    struct hlist_node *tmp;
+    int bkt;
+
+    hash_for_each_safe(target->chunks, bkt, tmp, chunk, node) {
+        if(all || chunk->gen != keep_gen) {
+            hash_del(&chunk->node);
+            kfree(chunk);
+        }
+    }
+}
+
+/*  wss_scan_range
+ *
+ *  Description:
+ *      Ages pages of [start, end) within one PMD of vma and counts them into
+ *      hist by age. Accessed bit of a page in local list of an emulated
+ *      process is only read, as it is owned by the page replacement policy.
+ *      Huge pages have no page table page and are skipped. Returns number of
+ *      accessed bits cleared.
+ */
+static ulong wss_scan_range(struct wss_target_struct *target, struct vm_area_struct *vma,
+                            ulong start, ulong end, ulong *hist, ulong *rss) {
+    struct mm_struct *mm = vma->vm_mm;
+    struct wss_chunk_struct *chunk;
+    pte_t *ptep, *pte;
+    ulong address, cleared = 0;
+    bool first = (target->scans == 0);
+    u8 *age;
+    int young;
+
+    // chunk may be allocated, so it is looked up before pte is mapped
+    chunk = wss_chunk_get(target, start & PMD_MASK);
+    if(!chunk)
+        return 0;
+    ptep = ml_get_ptep(mm, start);
+    if(!ptep)
+        return 0;
+    chunk->gen = target->scans;
+
+    // ptes of one PMD are contiguous
+    for(address=start, pte=ptep ; address<end ; address+=PAGE_SIZE, ++pte) {
+        age = &chunk->age[(address >> PAGE_SHIFT) & (PTRS_PER_PTE - 1)];
+        if(!pte_present(*pte)) {
+            *age = WSS_AGE_NONE;
+            continue;
+        }
+
+        if(ml_is_inlist_pte(mm, address, pte)) {
+            young = pte_young(*pte);
+        } else {
+            young = ptep_test_and_clear_young(vma, address, pte);
+            cleared += young;
+        }
+
+        if(young)
+            *age = 0;
+        else if(*age == WSS_AGE_NONE)
+            *age = first ? WSS_AGE_MAX : 1;     // history before first scan is unknown
+        else if(*age < WSS_AGE_MAX)
+            ++(*age);
+
+        ++(*rss);
+        if(*age < WSS_MAX_WINDOW)
+            ++hist[*age];
+    }
+    ml_put_ptep(ptep);
+    return cleared;
+}
+
+static void wss_scan_mm(struct wss_target_struct *target, struct mm_struct *mm, ulong *hist, ulong *rss) {
+    struct vm_area_struct *vma = NULL;
+    ulong start, end, cleared;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+    VMA_ITERATOR(vmi, mm, 0);
+
+    for_each_vma(vmi, vma) {
+#else
+    for (vma=mm->mmap ; vma ; vma=vma->vm_next) {
+#endif
+        if(vma->vm_flags & (VM_IO | VM_PFNMAP))
+            continue;
+
+        cleared = 0;
+        for(start=vma->vm_start ; start<vma->vm_end ; start=end) {
+            end = min((start & PMD_MASK) + PMD_SIZE, vma->vm_end);
+            cleared += wss_scan_range(target, vma, start, end, hist, rss);
+        }
+
+        // cached translations would not set accessed bit again
+        if(cleared)
+            ml_flush_tlb_range(mm, vma->vm_start, vma->vm_end);
+        cond_resched();
+    }
+}
+
+/*  wss_scan_work
+ *
+ *  Description:
+ *      Scans watched process once, publishes working set sizes and queues
+ *      next scan. First scan only clears accessed bits, so it publishes
+ *      nothing. Stops once process has exited.
+ */
+static void wss_scan_work(struct work_struct *work) {
+    struct wss_target_struct *target = container_of(to_delayed_work(work), struct wss_target_struct, scan_work);
+    ulong hist[WSS_MAX_WINDOW] = {0}, rss = 0, wss = 0;
+    struct task_struct *task;
+    struct mm_struct *mm = NULL;
+    int i, w;
+
+    task = get_pid_task(target->pid, PIDTYPE_PID);
+    if(task) {
+        mm = get_task_mm(task);
+        put_task_struct(task);
+    }
+    if(!mm) {
+        mutex_lock(&wss_lock);
+        target->exited = true;
+        mutex_unlock(&wss_lock);
+        wss_chunks_free(target, 0, true);
+        return;
+    }
+
+    ml_mmap_read_lock(mm);
+    wss_scan_mm(target, mm, hist, &rss);
+    ml_mmap_read_unlock(mm);
+    mmput(mm);
+
+    // drop chunks of unmapped ranges
+    wss_chunks_free(target, target->scans, false);
+
+    mutex_lock(&wss_lock);
+    if(target->scans > 0) {
+        for(i=0, w=0 ; i<WSS_MAX_WINDOW ; ++i) {
+            wss += hist[i];
+            if(i+1 == (1 << w))
+                target->wss[w++] = wss;
+        }
+        memmove(&target->history[1], &target->history[0], sizeof(ulong) * (WSS_HISTORY-1));
+        target->history[0] = target->wss[0];
+        target->history_len = min(target->history_len + 1, (uint) WSS_HISTORY);
+    }
+    target->rss = rss;
+    ++target->scans;
+    if(!target->stopping)
+        queue_delayed_work(system_unbound_wq, &target->scan_work, msecs_to_jiffies(target->interval_ms));
+    mutex_unlock(&wss_lock);
+}
+
+
+/*
+ *
+ *  procfs
+ *
+ */
+
+// must be called with wss_lock held
+static struct wss_target_struct * wss_find(pid_t nr) {
+    struct wss_target_struct *target;
+
+    list_for_each_entry(target, &wss_targets, list) {
+        if(pid_nr(target->pid) == nr)
+            return target;
+    }
+    return NULL;
+}
+
+// target must be unlinked and stopping, must be called without wss_lock held
+static void wss_free(struct wss_target_struct *target) {
+    cancel_delayed_work_sync(&target->scan_work);
+    wss_chunks_free(target, 0, true);
+    put_pid(target->pid);
+    kfree(target);
+}
+
+static int wss_start(pid_t nr, uint interval_ms) {
+    struct wss_target_struct *target;
+    struct pid *pid = find_get_pid(nr);
+
+    if(!pid) {
+        DA_ERROR("no such process : %d", nr);
+        return -ESRCH;
+    }
+
+    target = (struct wss_target_struct*) kzalloc(sizeof(struct wss_target_struct), GFP_KERNEL);
+    if(!target) {
+        DA_ERROR("unable to allocate memory");
+        put_pid(pid);
+        return -ENOMEM;
+    }
+    target->pid = pid;
+    target->interval_ms = interval_ms;
+    hash_init(target->chunks);
+    INIT_DELAYED_WORK(&target->scan_work, wss_scan_work);
+
+    list_add_tail(&target->list, &wss_targets);
+    queue_delayed_work(system_unbound_wq, &target->scan_work, 0);
+    return 0;
+}
+
+/*  procfile_write
+ *
+ *  Description:
+ *      "pid=<pid> interval_ms=<ms>" starts watching process, or changes its
+ *      interval from the next scan on. interval_ms=0 stops watching. An
+ *      exited process stays listed until it is stopped or started again.
+ */
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+    struct wss_target_struct *target, *old = NULL;
+    char *kbuf, *token_start, *token_end;
+    int nr = -1, interval_ms = -1;
+    ssize_t ret = 0;
+
+    kbuf = memdup_user_nul(buffer, length);
+    if (IS_ERR(kbuf)) {
+        return PTR_ERR(kbuf);
+    }
+
+    token_start = token_end = kbuf;
+    while( (token_start = strsep(&token_end, " \n")) != NULL) {
+        char *key, *value;
+        if(strlen(token_start) == 0)
+            continue;
+
+        key = value = token_start;
+        key = strsep(&value, "=");
+        if(!value) {
+            DA_ERROR("invalid token : %s", token_start);
+            ret = -EINVAL;
+        } else if(strcmp(key, "pid") == 0) {
+            if(kstrtoint(value, 10, &nr) != 0 || nr <= 0)
+                ret = -EINVAL;
+        } else if(strcmp(key, "interval_ms") == 0) {
+            if(kstrtoint(value, 10, &interval_ms) != 0 || interval_ms < 0)
+                ret = -EINVAL;
+        } else {
+            DA_ERROR("unknown parameter : %s", key);
+            ret = -EINVAL;
+        }
+        if(ret)
+            goto write_exit;
+    }
+
+    if(nr < 0 || interval_ms < 0) {
+        DA_ERROR("pid and interval_ms are required");
+        ret = -EINVAL;
+        goto write_exit;
+    }
+    if(interval_ms > 0 && interval_ms < WSS_MIN_INTERVAL_MS) {
+        DA_ERROR("interval_ms must be at least %d", WSS_MIN_INTERVAL_MS);
+        ret = -EINVAL;
+        goto write_exit;
+    }
+
+    mutex_lock(&wss_lock);
+    target = wss_find(nr);
+    if(target && interval_ms > 0 && !target->exited) {
+        target->interval_ms = interval_ms;
+        mod_delayed_work(system_unbound_wq, &target->scan_work, msecs_to_jiffies(interval_ms));
+    } else {
+        if(target) {
+            list_del(&target->list);
+            target->stopping = true;
+            old = target;
+        }
+        if(interval_ms > 0)
+            ret = wss_start(nr, interval_ms);
+    }
+    mutex_unlock(&wss_lock);
+
+    if(old)
+        wss_free(old);
+
+    if(ret == 0) {
+        *offset += length;
+        ret = length;
+    }
+
+write_exit:
+    kfree(kbuf);
+    return ret;
+}
+
+static void *procfile_seq_start(struct seq_file *m, loff_t *pos) {
+    mutex_lock(&wss_lock);
+    if(*pos == 0)
+        seq_printf(m, "pid interval_ms scans rss wss_1 wss_2 wss_4 wss_8 wss_16 wss_32 wss_64 history_wss_1\n");
+    return seq_list_start(&wss_targets, *pos);
+}
+
+static void *procfile_seq_next(struct seq_file *m, void *v, loff_t *pos) {
+    return seq_list_next(v, &wss_targets, pos);
+}
+
+static void procfile_seq_stop(struct seq_file *m, void *v) {
+    mutex_unlock(&wss_lock);
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+    struct wss_target_struct *target = list_entry(v, struct wss_target_struct, list);
+    int i;
+
+    seq_printf(m, "%d ", pid_vnr(target->pid));
+    if(target->exited)
+        seq_puts(m, "- ");
+    else
+        seq_printf(m, "%u ", target->interval_ms);
+    seq_printf(m, "%lu %lu", target->scans, target->rss);
+    for(i=0 ; i<WSS_NR_WINDOWS ; ++i)
+        seq_printf(m, " %lu", target->wss[i]);
+
+    // newest first
+    seq_putc(m, ' ');
+    if(target->history_len == 0)
+        seq_putc(m, '-');
+    for(i=0 ; i<target->history_len ; ++i)
+        seq_printf(m, "%s%lu", i ? "," : "", target->history[i]);
+    seq_putc(m, '\n');
+    return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+    .start  = procfile_seq_start,
+    .next   = procfile_seq_next,
+    .stop   = procfile_seq_stop,
+    .show   = procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+    return seq_open(file, &procfile_seq_ops);
+}
+
+DIME_DEFINE_PROC_OPS(wss_file_ops, procfile_open, procfile_write);
+
+int init_dime_wss(void) {
+    if(proc_create(PROCFS_NAME, S_IFREG | S_IRUGO | S_IWUSR, NULL, &wss_file_ops) == NULL) {
+        DA_ALERT("could not initialize /proc/%s\n", PROCFS_NAME);
+        return -ENOMEM;
+    }
+
+    DA_INFO("proc entry \"/proc/%s\" created\n", PROCFS_NAME);
+    return 0;
+}
+
+void cleanup_dime_wss(void) {
+    struct wss_target_struct *target, *tmp;
+    LIST_HEAD(stopped);
+
+    remove_proc_entry(PROCFS_NAME, NULL);
+
+    mutex_lock(&wss_lock);
+    list_for_each_entry(target, &wss_targets, list)
+        target->stopping = true;
+    list_splice_init(&wss_targets, &stopped);
+    mutex_unlock(&wss_lock);
+
+    list_for_each_entry_safe(target, tmp, &stopped, list)
+        wss_free(target);
+    DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
+}
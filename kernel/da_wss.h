@@ -0,0 +1,11 @@
+#ifndef __DA_WSS_H__
+#define __DA_WSS_H__
+
+
+#include "common.h"
+
+int init_dime_wss(void);
+void cleanup_dime_wss(void);
+
+
+#endif
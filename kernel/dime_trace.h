@@ -0,0 +1,199 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM dime
+
+#if !defined(__DIME_TRACE_H__) || defined(TRACE_HEADER_MULTI_READ)
+#define __DIME_TRACE_H__
+
+#include <linux/tracepoint.h>
+
+/*****
+ *
+ *  Static tracepoints of DiME, available as dime:* events in perf and ftrace.
+ *  e.g. :
+ *      perf record -e 'dime:*' -a -- sleep 10
+ *      echo 1 > /sys/kernel/debug/tracing/events/dime/enable
+ *
+ *  Disabled tracepoints cost a static branch. Tracepoints are created in
+ *  da_kmodule.c and exported for policy modules. All times are in ns.
+ *
+ */
+
+TRACE_EVENT(dime_fault_start,
+
+	TP_PROTO(int instance_id, unsigned long address, int emulated),
+
+	TP_ARGS(instance_id, address, emulated),
+
+	TP_STRUCT__entry(
+		__field(int,			instance_id)
+		__field(unsigned long,	address)
+		__field(int,			emulated)
+	),
+
+	TP_fast_assign(
+		__entry->instance_id	= instance_id;
+		__entry->address		= address;
+		__entry->emulated		= emulated;
+	),
+
+	TP_printk("instance=%d address=0x%lx emulated=%d",
+		__entry->instance_id, __entry->address, __entry->emulated)
+);
+
+TRACE_EVENT(dime_fault_end,
+
+	TP_PROTO(int instance_id, unsigned long address, u64 time_pfh, u64 time_ap, u64 time_inject, u64 time_total),
+
+	TP_ARGS(instance_id, address, time_pfh, time_ap, time_inject, time_total),
+
+	TP_STRUCT__entry(
+		__field(int,			instance_id)
+		__field(unsigned long,	address)
+		__field(u64,			time_pfh)
+		__field(u64,			time_ap)
+		__field(u64,			time_inject)
+		__field(u64,			time_total)
+	),
+
+	TP_fast_assign(
+		__entry->instance_id	= instance_id;
+		__entry->address		= address;
+		__entry->time_pfh		= time_pfh;
+		__entry->time_ap		= time_ap;
+		__entry->time_inject	= time_inject;
+		__entry->time_total		= time_total;
+	),
+
+	TP_printk("instance=%d address=0x%lx pfh=%llu ap=%llu inject=%llu total=%llu",
+		__entry->instance_id, __entry->address,
+		__entry->time_pfh, __entry->time_ap, __entry->time_inject, __entry->time_total)
+);
+
+TRACE_EVENT(dime_add_page,
+
+	TP_PROTO(int instance_id, unsigned long address, int inject, u64 time_ap),
+
+	TP_ARGS(instance_id, address, inject, time_ap),
+
+	TP_STRUCT__entry(
+		__field(int,			instance_id)
+		__field(unsigned long,	address)
+		__field(int,			inject)
+		__field(u64,			time_ap)
+	),
+
+	TP_fast_assign(
+		__entry->instance_id	= instance_id;
+		__entry->address		= address;
+		__entry->inject			= inject;
+		__entry->time_ap		= time_ap;
+	),
+
+	TP_printk("instance=%d address=0x%lx inject=%d ap=%llu",
+		__entry->instance_id, __entry->address, __entry->inject, __entry->time_ap)
+);
+
+// Local page of victim mm is protected by policy, background is set when evicted by policy thread
+TRACE_EVENT(dime_evict,
+
+	TP_PROTO(int instance_id, struct mm_struct *mm, unsigned long address, int background),
+
+	TP_ARGS(instance_id, mm, address, background),
+
+	TP_STRUCT__entry(
+		__field(int,			instance_id)
+		__field(const void *,	mm)
+		__field(unsigned long,	address)
+		__field(int,			background)
+	),
+
+	TP_fast_assign(
+		__entry->instance_id	= instance_id;
+		__entry->mm				= mm;
+		__entry->address		= address;
+		__entry->background		= background;
+	),
+
+	TP_printk("instance=%d mm=%p address=0x%lx background=%d",
+		__entry->instance_id, __entry->mm, __entry->address, __entry->background)
+);
+
+TRACE_EVENT(dime_inject_delay,
+
+	TP_PROTO(int instance_id, u64 delay, u64 waited),
+
+	TP_ARGS(instance_id, delay, waited),
+
+	TP_STRUCT__entry(
+		__field(int,			instance_id)
+		__field(u64,			delay)
+		__field(u64,			waited)
+	),
+
+	TP_fast_assign(
+		__entry->instance_id	= instance_id;
+		__entry->delay			= delay;
+		__entry->waited			= waited;
+	),
+
+	TP_printk("instance=%d delay=%llu waited=%llu",
+		__entry->instance_id, __entry->delay, __entry->waited)
+);
+
+TRACE_EVENT(dime_kswapd_balance,
+
+	TP_PROTO(int instance_id, long freed, long to_inactive, long to_active, long free_size, u64 time_balance),
+
+	TP_ARGS(instance_id, freed, to_inactive, to_active, free_size, time_balance),
+
+	TP_STRUCT__entry(
+		__field(int,			instance_id)
+		__field(long,			freed)
+		__field(long,			to_inactive)
+		__field(long,			to_active)
+		__field(long,			free_size)
+		__field(u64,			time_balance)
+	),
+
+	TP_fast_assign(
+		__entry->instance_id	= instance_id;
+		__entry->freed			= freed;
+		__entry->to_inactive	= to_inactive;
+		__entry->to_active		= to_active;
+		__entry->free_size		= free_size;
+		__entry->time_balance	= time_balance;
+	),
+
+	TP_printk("instance=%d freed=%ld to_inactive=%ld to_active=%ld free_size=%ld time=%llu",
+		__entry->instance_id, __entry->freed, __entry->to_inactive, __entry->to_active,
+		__entry->free_size, __entry->time_balance)
+);
+
+TRACE_EVENT(dime_tlb_flush,
+
+	TP_PROTO(struct mm_struct *mm, unsigned long address),
+
+	TP_ARGS(mm, address),
+
+	TP_STRUCT__entry(
+		__field(const void *,	mm)
+		__field(unsigned long,	address)
+	),
+
+	TP_fast_assign(
+		__entry->mm				= mm;
+		__entry->address		= address;
+	),
+
+	TP_printk("mm=%p address=0x%lx", __entry->mm, __entry->address)
+);
+
+#endif//__DIME_TRACE_H__
+
+// Header is not in include/trace/events, look for it in module directory
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE dime_trace
+
+#include <trace/define_trace.h>
@@ -0,0 +1,553 @@
+#include <linux/module.h>    // included for all kernel modules
+#include <linux/kernel.h>    // included for KERN_INFO
+#include <linux/init.h>      // included for __init and __exit macros
+#include <linux/sched.h>
+#include <asm/pgtable.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/hash.h>
+#include <linux/log2.h>
+#include <asm/pgtable_types.h>
+#include <linux/proc_fs.h>
+#include <asm/uaccess.h>
+
+#include "da_mem_lib.h"
+#include "da_shared.h"
+
+#include "prp_arc.h"
+#include "../common/da_debug.h"
+#include "common.h"
+
+
+/*****
+ *
+ *  Adaptive replacement policy. DiME sees only faults, not hits of local
+ *  pages, so ARC is implemented in its CLOCK form (CAR) : t1 and t2 are
+ *  clocks, a page referenced since it was last scanned moves to t2 tail
+ *  instead of being evicted. Ghost hits adapt target size p of t1 on every
+ *  fault, as in ARC.
+ *
+ */
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Abhishek Ghogare, Dhantu");
+MODULE_DESCRIPTION("Dime ARC page replacement policy");
+
+
+static inline struct prp_arc_struct *to_prp_arc_struct(struct page_replacement_policy_struct *prp) {
+	return container_of(prp, struct prp_arc_struct, prp);
+}
+
+
+/*
+ *
+ *	Policy procfs file
+ *
+ */
+#define PROCFS_NAME			"dime_prp_config"
+
+static int procfile_open(struct inode *inode, struct file *file);
+static ssize_t procfile_write(struct file *, const char __user *, size_t, loff_t *);
+
+struct proc_dir_entry *dime_config_entry;
+
+DIME_DEFINE_PROC_OPS(cmd_file_ops, procfile_open, procfile_write);
+
+int init_dime_prp_config_procfs(void) {
+	dime_config_entry = proc_create(PROCFS_NAME, S_IFREG | S_IRUGO, NULL, &cmd_file_ops);
+
+	if (dime_config_entry == NULL) {
+		remove_proc_entry(PROCFS_NAME, NULL);
+
+		DA_ALERT("could not initialize /proc/%s\n", PROCFS_NAME);
+		return -ENOMEM;
+	}
+
+	proc_set_user(dime_config_entry, KUIDT_INIT(0), KGIDT_INIT(0));
+	proc_set_size(dime_config_entry, 37);
+
+	DA_INFO("proc entry \"/proc/%s\" created\n", PROCFS_NAME);
+	return 0;
+}
+
+void cleanup_dime_prp_config_procfs(void) {
+	remove_proc_entry(PROCFS_NAME, NULL);
+	DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
+}
+
+static int procfile_show(struct seq_file *m, void *v) {
+	struct dime_instance_struct *dime_instance = v;
+	struct prp_arc_struct *prp;
+
+	if(v == SEQ_START_TOKEN) {
+		//			 1  2        3        4       5       6       7       8       9        10       11       12
+		seq_puts(m, "id c        p        t1_size t2_size b1_size b2_size b1_hits b2_hits  t1_evict t2_evict t1->t2\n");
+		return 0;
+	}
+
+	if(!dime_instance->prp)
+		return 0;		// instance added after policy was inserted
+
+	prp = to_prp_arc_struct(dime_instance->prp);
+	seq_printf(m,
+				//1  2    3    4    5    6    7    8    9    10   11   12
+				"%2d %8lu %8lu %7lu %7lu %7lu %7lu %7lu %8lu %8lu %8lu %8lu\n",
+				dime_instance->instance_id,						// 1
+				prp->c,											// 2
+				READ_ONCE(prp->p),								// 3
+				READ_ONCE(prp->t1_size),						// 4
+				READ_ONCE(prp->t2_size),						// 5
+				READ_ONCE(prp->b1_size),						// 6
+				READ_ONCE(prp->b2_size),						// 7
+				atomic_long_read(&prp->stats.b1_hits),			// 8
+				atomic_long_read(&prp->stats.b2_hits),			// 9
+				atomic_long_read(&prp->stats.t1_evict),			// 10
+				atomic_long_read(&prp->stats.t2_evict),			// 11
+				atomic_long_read(&prp->stats.t1_to_t2));		// 12
+	return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+	.start	= dime_instance_seq_start,
+	.next	= dime_instance_seq_next,
+	.stop	= dime_instance_seq_stop,
+	.show	= procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+	return seq_open(file, &procfile_seq_ops);
+}
+
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+	return length;
+}
+
+
+/*
+ *
+ *	Ghost lists, all functions must be called with prp_arc->lock held
+ *
+ */
+static inline struct hlist_head * ghost_bucket(struct prp_arc_struct *prp_arc, struct mm_struct *mm, ulong page) {
+	return &prp_arc->ghost_hash[hash_long((ulong)mm ^ page, prp_arc->ghost_hash_bits)];
+}
+
+static struct prp_arc_ghost * ghost_lookup(struct prp_arc_struct *prp_arc, struct mm_struct *mm, ulong page) {
+	struct prp_arc_ghost *ghost;
+
+	hlist_for_each_entry(ghost, ghost_bucket(prp_arc, mm, page), hash_node) {
+		if(ghost->mm == mm && ghost->page == page)
+			return ghost;
+	}
+	return NULL;
+}
+
+static void ghost_remove(struct prp_arc_struct *prp_arc, struct prp_arc_ghost *ghost) {
+	hlist_del(&ghost->hash_node);
+	list_move_tail(&ghost->list_node, &prp_arc->free_ghosts);
+	if(ghost->list == PRP_ARC_B1)
+		prp_arc->b1_size--;
+	else
+		prp_arc->b2_size--;
+	ghost->list = 0;
+}
+
+// drops oldest ghost of b1 or b2
+static void ghost_discard(struct prp_arc_struct *prp_arc, int list) {
+	struct list_head *head = (list == PRP_ARC_B1 ? &prp_arc->b1 : &prp_arc->b2);
+
+	if(!list_empty(head))
+		ghost_remove(prp_arc, list_first_entry(head, struct prp_arc_ghost, list_node));
+}
+
+static void ghost_add(struct prp_arc_struct *prp_arc, int list, struct mm_struct *mm, ulong address) {
+	struct prp_arc_ghost *ghost;
+
+	if(!mm)
+		return;
+	if(list_empty(&prp_arc->free_ghosts))
+		ghost_discard(prp_arc, prp_arc->b1_size ? PRP_ARC_B1 : PRP_ARC_B2);
+
+	ghost = list_first_entry(&prp_arc->free_ghosts, struct prp_arc_ghost, list_node);
+	ghost->mm = mm;
+	ghost->page = address >> PAGE_SHIFT;
+	ghost->list = list;
+	hlist_add_head(&ghost->hash_node, ghost_bucket(prp_arc, mm, ghost->page));
+	if(list == PRP_ARC_B1) {
+		list_move_tail(&ghost->list_node, &prp_arc->b1);
+		prp_arc->b1_size++;
+	} else {
+		list_move_tail(&ghost->list_node, &prp_arc->b2);
+		prp_arc->b2_size++;
+	}
+}
+
+
+/*  page_referenced
+ *
+ *  Description:
+ *      Clears accessed bit of the page of node and returns 1 if it was set,
+ *      else protects the page so that it will be faulted in future and
+ *      returns 0. A page of an exited process counts as not referenced.
+ */
+static int page_referenced(struct lpl_node_struct *node) {
+	pte_t	*ptep;
+	int		referenced = 0;
+
+	if(!ml_mm_get(node->mm)) {
+		// protects remaining mappers of the page
+		if(node->mm)
+			sp_protect_mm_page(node->mm, node->address);
+		return 0;
+	}
+
+	ptep = ml_get_ptep(node->mm, node->address);
+	if(ptep && pte_present(*ptep) && pte_young(*ptep)) {
+		*ptep = pte_mkold(*ptep);
+		referenced = 1;
+	} else if(ptep) {
+		sp_protect_pte(node->mm, node->address, ptep);
+	}
+	ml_put_ptep(ptep);
+	ml_mm_put(node->mm);
+
+	return referenced;
+}
+
+/*  replace
+ *
+ *  Description:
+ *      Evicts one page, from t1 while t1 is at least its target size p,
+ *      else from t2, and remembers it in ghost list of its clock. Must be
+ *      called with lock held on a full cache. Returns node of evicted page.
+ */
+static struct lpl_node_struct * replace(struct dime_instance_struct *dime_instance, struct prp_arc_struct *prp_arc) {
+	struct lpl_node_struct *node;
+
+	while(1) {
+		if(prp_arc->t1_size >= max(1UL, prp_arc->p)) {
+			node = list_first_entry(&prp_arc->t1, struct lpl_node_struct, list_node);
+			if(page_referenced(node)) {
+				list_move_tail(&node->list_node, &prp_arc->t2);
+				prp_arc->t1_size--;
+				prp_arc->t2_size++;
+				atomic_long_inc(&prp_arc->stats.t1_to_t2);
+				continue;
+			}
+			list_del(&node->list_node);
+			prp_arc->t1_size--;
+			ghost_add(prp_arc, PRP_ARC_B1, node->mm, node->address);
+			atomic_long_inc(&prp_arc->stats.t1_evict);
+		} else {
+			node = list_first_entry(&prp_arc->t2, struct lpl_node_struct, list_node);
+			if(page_referenced(node)) {
+				list_move_tail(&node->list_node, &prp_arc->t2);
+				continue;
+			}
+			list_del(&node->list_node);
+			prp_arc->t2_size--;
+			ghost_add(prp_arc, PRP_ARC_B2, node->mm, node->address);
+			atomic_long_inc(&prp_arc->stats.t2_evict);
+		}
+
+		if(node->mm)
+			trace_dime_evict(dime_instance->instance_id, node->mm, node->address, 0);
+		return node;
+	}
+}
+
+/*  __add_page
+ *
+ *  Description:
+ *      On a full cache evicts a page and trims ghost lists to c pages of
+ *      history per clock. A page found in a ghost list adapts p, towards t1
+ *      for a b1 hit and towards t2 for a b2 hit, and enters t2. Other pages
+ *      enter t1. A restored page enters list, PRP_ARC_T1 or PRP_ARC_T2, and
+ *      its ghost is dropped without adapting p.
+ */
+static int __add_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address, int list) {
+	pte_t					* c_ptep			= (c_mm == NULL ? NULL : ml_get_ptep(c_mm, address));
+	struct prp_arc_struct	* prp_arc			= to_prp_arc_struct(dime_instance->prp);
+	struct lpl_node_struct	* node				= NULL;
+	struct prp_arc_ghost	* ghost;
+	struct mm_struct		* old_mm			= NULL;
+	ulong					delta;
+
+	if (dime_local_npages(dime_instance) == 0 || prp_arc->c == 0) {
+		// no need to add this address
+		// we can treat this case as infinite local pages, and no need to inject delay on any of the page
+		ml_put_ptep(c_ptep);
+		return 1;
+	}
+
+	spin_lock(&prp_arc->lock);
+	ghost = ghost_lookup(prp_arc, c_mm, address >> PAGE_SHIFT);
+	if(ghost && list) {
+		ghost_remove(prp_arc, ghost);
+		ghost = NULL;
+	}
+
+	if(prp_arc->t1_size + prp_arc->t2_size >= prp_arc->c) {
+		node = replace(dime_instance, prp_arc);
+		old_mm = node->mm;
+
+		if(!ghost) {
+			if(prp_arc->t1_size + prp_arc->b1_size >= prp_arc->c)
+				ghost_discard(prp_arc, PRP_ARC_B1);
+			else if(prp_arc->t1_size + prp_arc->t2_size + prp_arc->b1_size + prp_arc->b2_size >= 2 * prp_arc->c)
+				ghost_discard(prp_arc, PRP_ARC_B2);
+		}
+	} else {
+		node = (struct lpl_node_struct*) kmalloc(sizeof(struct lpl_node_struct), GFP_ATOMIC);
+		if(!node) {
+			spin_unlock(&prp_arc->lock);
+			ml_put_ptep(c_ptep);
+			DA_ERROR("unable to allocate memory");
+			return 1;
+		}
+	}
+
+	if(list == PRP_ARC_T2) {
+		list_add_tail(&node->list_node, &prp_arc->t2);
+		prp_arc->t2_size++;
+	} else if(!ghost) {
+		list_add_tail(&node->list_node, &prp_arc->t1);
+		prp_arc->t1_size++;
+	} else {
+		if(ghost->list == PRP_ARC_B1) {
+			delta = max(1UL, prp_arc->b2_size / max(1UL, prp_arc->b1_size));
+			prp_arc->p = min(prp_arc->p + delta, prp_arc->c);
+			atomic_long_inc(&prp_arc->stats.b1_hits);
+		} else {
+			delta = max(1UL, prp_arc->b1_size / max(1UL, prp_arc->b2_size));
+			prp_arc->p = prp_arc->p > delta ? prp_arc->p - delta : 0;
+			atomic_long_inc(&prp_arc->stats.b2_hits);
+		}
+		ghost_remove(prp_arc, ghost);
+		list_add_tail(&node->list_node, &prp_arc->t2);
+		prp_arc->t2_size++;
+	}
+
+	node->mm = c_mm;
+	node->address = address;
+	ml_mm_hold(c_mm);
+	ml_set_inlist_pte(c_mm, address, c_ptep);
+	spin_unlock(&prp_arc->lock);
+	ml_put_ptep(c_ptep);
+
+	// drop reference to previous owner, evicted page was already protected
+	ml_mm_release(old_mm);
+	return 1;
+}
+
+int add_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address) {
+	return __add_page(dime_instance, c_mm, address, 0);
+}
+
+void restore_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address, int list) {
+	__add_page(dime_instance, c_mm, address, list == PRP_ARC_T2 ? PRP_ARC_T2 : PRP_ARC_T1);
+}
+
+/*  export_pages
+ *
+ *  Description:
+ *      t1 then t2, each from its clock hand. Ghosts and p are not exported,
+ *      they adapt again after a restore.
+ */
+int export_pages(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg) {
+	struct prp_arc_struct	* prp_arc			= to_prp_arc_struct(dime_instance->prp);
+	struct lpl_node_struct	* node;
+	int						ret					= 0;
+
+	spin_lock(&prp_arc->lock);
+	list_for_each_entry(node, &prp_arc->t1, list_node) {
+		if(node->mm && (ret = fn(arg, node->mm, node->address, PRP_ARC_T1)) != 0)
+			goto export_exit;
+	}
+	list_for_each_entry(node, &prp_arc->t2, list_node) {
+		if(node->mm && (ret = fn(arg, node->mm, node->address, PRP_ARC_T2)) != 0)
+			goto export_exit;
+	}
+export_exit:
+	spin_unlock(&prp_arc->lock);
+	return ret;
+}
+
+/*  peek_victim
+ *
+ *  Description:
+ *      Page at clock hand of the list replace would evict from. replace
+ *      skips referenced pages, so victim is the next candidate rather than
+ *      the exact page.
+ */
+int peek_victim(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address,
+					struct mm_struct ** victim_mm, ulong * victim_address) {
+	struct prp_arc_struct	* prp_arc			= to_prp_arc_struct(dime_instance->prp);
+	struct lpl_node_struct	* node				= NULL;
+
+	spin_lock(&prp_arc->lock);
+	if(prp_arc->c && prp_arc->t1_size + prp_arc->t2_size >= prp_arc->c) {
+		if(prp_arc->t1_size >= max(1UL, prp_arc->p))
+			node = list_first_entry(&prp_arc->t1, struct lpl_node_struct, list_node);
+		else
+			node = list_first_entry(&prp_arc->t2, struct lpl_node_struct, list_node);
+		*victim_mm = node->mm;
+		*victim_address = node->address;
+	}
+	spin_unlock(&prp_arc->lock);
+
+	return node != NULL;
+}
+
+void get_stats (struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats) {
+	struct prp_arc_struct *prp_arc = to_prp_arc_struct(dime_instance->prp);
+	__u64 *v = stats->value;
+
+	stats->id = DIME_STATS_POLICY_ARC;
+	stats->count = DIME_STATS_ARC_COUNT;
+	v[DIME_STATS_ARC_C]			= prp_arc->c;
+	v[DIME_STATS_ARC_P]			= READ_ONCE(prp_arc->p);
+	v[DIME_STATS_ARC_T1_SIZE]	= READ_ONCE(prp_arc->t1_size);
+	v[DIME_STATS_ARC_T2_SIZE]	= READ_ONCE(prp_arc->t2_size);
+	v[DIME_STATS_ARC_B1_SIZE]	= READ_ONCE(prp_arc->b1_size);
+	v[DIME_STATS_ARC_B2_SIZE]	= READ_ONCE(prp_arc->b2_size);
+	v[DIME_STATS_ARC_B1_HITS]	= atomic_long_read(&prp_arc->stats.b1_hits);
+	v[DIME_STATS_ARC_B2_HITS]	= atomic_long_read(&prp_arc->stats.b2_hits);
+	v[DIME_STATS_ARC_T1_EVICT]	= atomic_long_read(&prp_arc->stats.t1_evict);
+	v[DIME_STATS_ARC_T2_EVICT]	= atomic_long_read(&prp_arc->stats.t2_evict);
+	v[DIME_STATS_ARC_T1_TO_T2]	= atomic_long_read(&prp_arc->stats.t1_to_t2);
+}
+
+// frees nodes of pages without mm, returns number freed
+static ulong drop_unowned_nodes(struct list_head *head) {
+	struct lpl_node_struct *node, *tmp;
+	ulong count = 0;
+
+	list_for_each_entry_safe(node, tmp, head, list_node) {
+		if(node->mm)
+			continue;
+		list_del(&node->list_node);
+		kfree(node);
+		count++;
+	}
+	return count;
+}
+
+/*  drop_unowned
+ *
+ *  Description:
+ *      Frees resident pages added without mm, cache gets free room for them.
+ *      Their ghosts, if any, age out of ghost lists as usual.
+ */
+void drop_unowned(struct dime_instance_struct *dime_instance) {
+	struct prp_arc_struct *prp_arc = to_prp_arc_struct(dime_instance->prp);
+
+	spin_lock(&prp_arc->lock);
+	prp_arc->t1_size -= drop_unowned_nodes(&prp_arc->t1);
+	prp_arc->t2_size -= drop_unowned_nodes(&prp_arc->t2);
+	spin_unlock(&prp_arc->lock);
+}
+
+static void clean_nodes(struct list_head *head) {
+	while (!list_empty(head)) {
+		struct lpl_node_struct *node = list_first_entry(head, struct lpl_node_struct, list_node);
+		list_del(&node->list_node);
+		ml_mm_release(node->mm);
+		kfree(node);
+	}
+}
+
+void clean_list (struct dime_instance_struct *dime_instance) {
+	struct prp_arc_struct *prp_arc = to_prp_arc_struct(dime_instance->prp);
+	DA_ENTRY();
+
+	dime_instance->prp->add_page = NULL;
+	clean_nodes(&prp_arc->t1);
+	clean_nodes(&prp_arc->t2);
+	vfree(prp_arc->ghosts);
+	kfree(prp_arc->ghost_hash);
+
+	dime_instance->prp = NULL;
+	kfree(prp_arc);
+	DA_EXIT();
+}
+
+
+int init_module(void) {
+	int ret = 0;
+	int i;
+	ulong j;
+	DA_ENTRY();
+
+	for(i=0 ; i<dime.dime_instances_size ; ++i) {
+		struct prp_arc_struct *prp_arc = (struct prp_arc_struct*) kzalloc(sizeof(struct prp_arc_struct), GFP_KERNEL);
+		if(!prp_arc) {
+			DA_ERROR("unable to allocate memory");
+			return -1; // TODO:: Error codes
+		}
+
+		prp_arc->prp = (struct page_replacement_policy_struct) {
+			.add_page 	= add_page,
+			.clean 		= clean_list,
+			.get_stats	= get_stats,
+			.peek_victim	= peek_victim,
+			.export_pages	= export_pages,
+			.restore_page	= restore_page,
+			.drop_unowned	= drop_unowned,
+			.owner		= THIS_MODULE,
+		};
+		spin_lock_init(&prp_arc->lock);
+		INIT_LIST_HEAD(&prp_arc->t1);
+		INIT_LIST_HEAD(&prp_arc->t2);
+		INIT_LIST_HEAD(&prp_arc->b1);
+		INIT_LIST_HEAD(&prp_arc->b2);
+		INIT_LIST_HEAD(&prp_arc->free_ghosts);
+		prp_arc->c = dime_local_npages(&dime.dime_instances[i]);
+
+		// one ghost more than c, replacement adds a ghost before history is trimmed
+		prp_arc->ghost_hash_bits = ilog2(roundup_pow_of_two(prp_arc->c + 1));
+		prp_arc->ghosts = (struct prp_arc_ghost*) vzalloc(sizeof(struct prp_arc_ghost) * (prp_arc->c + 1));
+		prp_arc->ghost_hash = (struct hlist_head*) kcalloc(1UL << prp_arc->ghost_hash_bits, sizeof(struct hlist_head), GFP_KERNEL);
+		if(!prp_arc->ghosts || !prp_arc->ghost_hash) {
+			DA_ERROR("unable to allocate memory");
+			vfree(prp_arc->ghosts);
+			kfree(prp_arc->ghost_hash);
+			kfree(prp_arc);
+			return -1; // TODO:: Error codes
+		}
+		for(j=0 ; j<=prp_arc->c ; ++j)
+			list_add_tail(&prp_arc->ghosts[j].list_node, &prp_arc->free_ghosts);
+
+		dime.dime_instances[i].prp = &(prp_arc->prp);
+	}
+
+	ret = register_page_replacement_policy(NULL);
+
+	if(init_dime_prp_config_procfs()<0) {
+		ret = -1;
+	}
+
+	DA_INFO("initializing arc prp module complete");
+	DA_EXIT();
+	return ret;    // Non-zero return means that the module couldn't be loaded.
+}
+
+void cleanup_module(void) {
+	int i;
+	DA_ENTRY();
+
+	cleanup_dime_prp_config_procfs();
+
+	for(i=0 ; i<dime.dime_instances_size ; ++i) {
+		if(dime.dime_instances[i].prp)
+			clean_list(&dime.dime_instances[i]);
+	}
+
+	deregister_page_replacement_policy(NULL);
+
+	DA_INFO("cleaning up arc prp module complete");
+	DA_EXIT();
+}
@@ -0,0 +1,67 @@
+#ifndef __DA_LOCAL_PAGE_LIST_H__
+#define __DA_LOCAL_PAGE_LIST_H__
+
+#include "common.h"
+
+#define PRP_ARC_B1		1
+#define PRP_ARC_B2		2
+
+// lists of a page for warm start
+#define PRP_ARC_T1		1
+#define PRP_ARC_T2		2
+
+/*
+ *  Recently evicted page, remembered by its (mm, page) key only. No mm
+ *  reference is held, a reused mm pointer at worst adapts p once wrongly.
+ */
+struct prp_arc_ghost {
+	struct hlist_node	hash_node;
+	struct list_head	list_node;		// in b1, b2 or free ghosts
+	struct mm_struct	*mm;
+	ulong				page;			// address >> PAGE_SHIFT
+	int					list;			// PRP_ARC_B1 or PRP_ARC_B2, 0 if free
+};
+
+struct prp_arc_stats {
+	atomic_long_t	b1_hits;			// faults on pages evicted from t1
+	atomic_long_t	b2_hits;			// faults on pages evicted from t2
+	atomic_long_t	t1_evict;
+	atomic_long_t	t2_evict;
+	atomic_long_t	t1_to_t2;			// referenced pages of t1 promoted at replacement
+};
+
+struct prp_arc_struct {
+	struct page_replacement_policy_struct prp;
+
+	spinlock_t			lock;			// protects lists, ghosts and p
+	ulong				c;				// local pages, fixed at load time
+	ulong				p;				// target size of t1, adapted on ghost hits
+
+	// resident pages of lpl_node_struct, clock hand at head of each list
+	struct list_head	t1;				// seen once since last eviction
+	struct list_head	t2;				// seen again
+	ulong				t1_size;
+	ulong				t2_size;
+
+	// ghosts of recently evicted pages, oldest at head
+	struct list_head	b1;
+	struct list_head	b2;
+	ulong				b1_size;
+	ulong				b2_size;
+	struct list_head	free_ghosts;
+	struct prp_arc_ghost	*ghosts;		// pool of c+1 ghosts
+	struct hlist_head	*ghost_hash;
+	int					ghost_hash_bits;
+
+	struct prp_arc_stats	stats;
+};
+
+int		add_page		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address);		// Returns 1 if delay should be injected, else 0
+void	clean_list		(struct dime_instance_struct *dime_instance);
+void	get_stats		(struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats);
+int		peek_victim		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, struct mm_struct ** victim_mm, ulong * victim_address);
+int		export_pages	(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg);
+void	restore_page	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, int list);
+void	drop_unowned	(struct dime_instance_struct *dime_instance);
+
+#endif//__DA_LOCAL_PAGE_LIST_H__
@@ -12,11 +12,14 @@
 #include <linux/mm.h>
 #include <linux/list.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
 #include <asm/pgtable_types.h>
 #include <linux/proc_fs.h>
 #include <asm/uaccess.h>
 
 #include "da_mem_lib.h"
+#include "da_shared.h"
 
 #include "prp_fifo.h"
 #include "../common/da_debug.h"
@@ -38,27 +41,32 @@ static inline struct prp_fifo_struct *to_prp_fifo_struct(struct page_replacement
 	return container_of(prp, struct prp_fifo_struct, prp);
 }
 
+// slots currently holding a page, over all rings
+static ulong prp_fifo_local_size(struct prp_fifo_struct *prp_fifo) {
+	ulong size = 0, claimed;
+	int r;
+
+	for(r=0 ; r<prp_fifo->nrings ; ++r) {
+		claimed = atomic_long_read(&prp_fifo->rings[r].tail);
+		size += claimed < prp_fifo->rings[r].nslots ? claimed : prp_fifo->rings[r].nslots;
+	}
+	return size;
+}
+
 
 /*
  *
  *	Policy procfs file
  *
  */
-#define PROCFS_MAX_SIZE		102400
 #define PROCFS_NAME			"dime_prp_config"
-static char procfs_buffer[PROCFS_MAX_SIZE];     // The buffer used to store character for this module
-static unsigned long procfs_buffer_size = 0;    // The size of the buffer
 
-static ssize_t procfile_read(struct file*, char*, size_t, loff_t*);
-static ssize_t procfile_write(struct file *, const char *, size_t, loff_t *);
+static int procfile_open(struct inode *inode, struct file *file);
+static ssize_t procfile_write(struct file *, const char __user *, size_t, loff_t *);
 
 struct proc_dir_entry *dime_config_entry;
 
-static struct file_operations cmd_file_ops = {  
-	.owner = THIS_MODULE,
-	.read = procfile_read,
-	.write = procfile_write,
-};
+DIME_DEFINE_PROC_OPS(cmd_file_ops, procfile_open, procfile_write);
 
 int init_dime_prp_config_procfs(void) {
 	dime_config_entry = proc_create(PROCFS_NAME, S_IFREG | S_IRUGO, NULL, &cmd_file_ops);
@@ -85,128 +93,196 @@ void cleanup_dime_prp_config_procfs(void) {
 	DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
 }
 
-static ssize_t procfile_read(struct file *file, char *buffer, size_t length, loff_t *offset) {
-	int ret;
-	int seg_size;
-	
-	if(*offset == 0) {
-		// offset is 0, so first call to read the file.
-		// Initialize buffer with config parameters currently set
-		int i;
-		//											 1  2
-		procfs_buffer_size = sprintf(procfs_buffer, "id local_size\n");
-		for(i=0 ; i<dime.dime_instances_size ; ++i) {
-			struct prp_fifo_struct *prp = to_prp_fifo_struct(dime.dime_instances[i].prp);
-			procfs_buffer_size += sprintf(procfs_buffer+procfs_buffer_size, 
-																		//1  2
-																		"%2d %10lu\n", 
-																		dime.dime_instances[i].instance_id,				// 1
-																		atomic_long_read(&prp->local.size));				// 2
-		}
-	}
+static int procfile_show(struct seq_file *m, void *v) {
+	struct dime_instance_struct *dime_instance = v;
+	struct prp_fifo_struct *prp;
 
-	// calculate max size of block that can be read
-	seg_size = length < procfs_buffer_size ? length : procfs_buffer_size;
-	if (*offset >= procfs_buffer_size) {
-		ret  = 0;   // offset value beyond the available data to read, finish reading
-	} else {
-		memcpy(buffer, procfs_buffer, seg_size);
-		*offset += seg_size;    // increment offset value
-		ret = seg_size;         // return number of bytes read
+	if(v == SEQ_START_TOKEN) {
+		//			 1  2
+		seq_puts(m, "id local_size\n");
+		return 0;
 	}
 
-	return ret;
+	if(!dime_instance->prp)
+		return 0;		// instance added after policy was inserted
+
+	prp = to_prp_fifo_struct(dime_instance->prp);
+	seq_printf(m,
+				//1  2
+				"%2d %10lu\n",
+				dime_instance->instance_id,							// 1
+				prp_fifo_local_size(prp));							// 2
+	return 0;
 }
 
-static ssize_t procfile_write(struct file *file, const char *buffer, size_t length, loff_t *offset) {
+static const struct seq_operations procfile_seq_ops = {
+	.start	= dime_instance_seq_start,
+	.next	= dime_instance_seq_next,
+	.stop	= dime_instance_seq_stop,
+	.show	= procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+	return seq_open(file, &procfile_seq_ops);
+}
+
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
 	return length;
 }
 
 
-int add_page(struct dime_instance_struct *dime_instance, struct pid * c_pid, ulong address) {
-	struct task_struct		* c_ts				= pid_task(c_pid, PIDTYPE_PID);
-	struct mm_struct		* c_mm				= (c_ts == NULL ? NULL : c_ts->mm);
+/*  add_page
+ *
+ *  Description:
+ *      Claims next slot of the ring with a single atomic increment of tail,
+ *      evicts its previous occupant and stores the faulting page in it.
+ *      Concurrent faults claim distinct slots, so no global lock is taken.
+ *      With class quotas, page only replaces pages of its own class.
+ */
+int add_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address) {
 	pte_t					* c_ptep			= (c_mm == NULL ? NULL : ml_get_ptep(c_mm, address));
 	struct page				* c_page			= (c_ptep == NULL ? NULL : pte_page(*c_ptep));
 
-	struct lpl_node_struct	* node_to_replace	= NULL;
+	struct prp_fifo_slot	* slot				= NULL;
 	struct prp_fifo_struct	* prp_fifo			= to_prp_fifo_struct(dime_instance->prp);
-	int 					ret_execute_delay 	= 0;
+	struct prp_fifo_ring	* ring				= &prp_fifo->rings[0];
+	int 					ret_execute_delay 	= 1;
+	ulong					pos;
 
-	if (dime_instance->local_npages == 0) {
+	if (dime_local_npages(dime_instance) == 0 || prp_fifo->nslots == 0) {
 		// no need to add this address
 		// we can treat this case as infinite local pages, and no need to inject delay on any of the page
-		ret_execute_delay = 1;
 		goto COUNT_PAGEFAULTS;
-	} else if (dime_instance->local_npages > atomic_long_read(&prp_fifo->local.size)) {
-		atomic_long_inc(&prp_fifo->local.size);
-		// Since there is still free space locally for remote pages, delay should not be injected
-		ret_execute_delay = 1;
-		node_to_replace = (struct lpl_node_struct*) kmalloc(sizeof(struct lpl_node_struct), GFP_KERNEL);
-
-		if(!node_to_replace) {
-			DA_ERROR("unable to allocate memory");
-			atomic_long_dec(&prp_fifo->local.size);
-			return ret_execute_delay;
-		}
-	} else {
-		write_lock(&prp_fifo->local.lock);
-		node_to_replace = list_first_entry_or_null(&prp_fifo->local.head, struct lpl_node_struct, list_node);
-		list_del_rcu(&node_to_replace->list_node);
-		write_unlock(&prp_fifo->local.lock);
-
-		if(node_to_replace->pid_s->numbers[0].nr <= 0)
-			 DA_ERROR("invalid pid: %d : address:%lu", node_to_replace->pid_s->numbers[0].nr, node_to_replace->address);
-		ml_protect_page(ml_get_mm_struct(node_to_replace->pid_s->numbers[0].nr), node_to_replace->address);
-		// Since local pages are occupied, delay should be injected
-		ret_execute_delay = 1;
 	}
 
-	node_to_replace->address = address;
-	node_to_replace->pid_s = c_pid;
+	if(prp_fifo->nrings > 1 && c_page)
+		ring = &prp_fifo->rings[dime_page_class(c_page)];
 
-	write_lock(&prp_fifo->local.lock);
-	list_add_tail_rcu(&(node_to_replace->list_node), &prp_fifo->local.head);
-	write_unlock(&prp_fifo->local.lock);
+	pos = (ulong) atomic_long_inc_return(&ring->tail) - 1;
+	slot = &ring->slots[pos % ring->nslots];
+
+	spin_lock(&slot->lock);
+	if(slot->mm) {
+		// oldest page in local memory, protect it so that it will be faulted in future
+		trace_dime_evict(dime_instance->instance_id, slot->mm, slot->address, 0);
+		sp_protect_mm_page(slot->mm, slot->address);
+		ml_mm_release(slot->mm);
+	}
+	slot->address = address;
+	slot->mm = c_mm;
+	ml_mm_hold(c_mm);
+	spin_unlock(&slot->lock);
 
 COUNT_PAGEFAULTS:
+	// pagefaults of each class are counted by fault hook
 	ml_set_inlist_pte(c_mm, address, c_ptep);
-	if(c_page) {
-		if( ((unsigned long)(c_page->mapping) & (unsigned long)0x01) != 0 ) {
-			atomic_long_inc(&dime_instance->an_pagefaults);
-			//DA_INFO("pc : %lx", address);
-		} else {
-			atomic_long_inc(&dime_instance->pc_pagefaults);
-			//DA_INFO("an : %lx", address);
-		}
-	} else {
-		DA_ERROR("invalid page mapping %lx : %p : %p", address, c_page, c_page->mapping);
-	}
+	ml_put_ptep(c_ptep);
 
 	return ret_execute_delay;
 }
 
-void __lpl_CleanList (struct list_head *head) {
-	DA_ENTRY();
+/*  peek_victim
+ *
+ *  Description:
+ *      Occupant of the slot which next add_page of the page would claim.
+ *      A concurrent fault may claim the slot first, so victim is a hint.
+ */
+int peek_victim(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address,
+					struct mm_struct ** victim_mm, ulong * victim_address) {
+	pte_t					* c_ptep			= (c_mm == NULL ? NULL : ml_get_ptep(c_mm, address));
+	struct prp_fifo_struct	* prp_fifo			= to_prp_fifo_struct(dime_instance->prp);
+	struct prp_fifo_ring	* ring				= &prp_fifo->rings[0];
+	struct prp_fifo_slot	* slot;
+	int						ret					= 0;
+
+	if(prp_fifo->nrings > 1 && c_ptep && pte_present(*c_ptep))
+		ring = &prp_fifo->rings[dime_page_class(pte_page(*c_ptep))];
+	ml_put_ptep(c_ptep);
+
+	if (prp_fifo->nslots == 0)
+		return 0;
+
+	slot = &ring->slots[(ulong) atomic_long_read(&ring->tail) % ring->nslots];
+	spin_lock(&slot->lock);
+	if(slot->mm) {
+		*victim_mm = slot->mm;
+		*victim_address = slot->address;
+		ret = 1;
+	}
+	spin_unlock(&slot->lock);
+
+	return ret;
+}
 
-	while (!list_empty(head)) {
-		struct lpl_node_struct *node = list_first_entry(head, struct lpl_node_struct, list_node);
-		list_del_rcu(&node->list_node);
-		kfree(node);
+/*  export_pages
+ *
+ *  Description:
+ *      Walks each ring from the slot which is claimed next, i.e. from the
+ *      oldest page to the newest. List of a page is its ring.
+ */
+int export_pages(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg) {
+	struct prp_fifo_struct	* prp_fifo			= to_prp_fifo_struct(dime_instance->prp);
+	struct prp_fifo_ring	* ring;
+	struct prp_fifo_slot	* slot;
+	struct mm_struct		* mm;
+	ulong					claimed, start, i, address;
+	int						r, ret;
+
+	for(r=0 ; r<prp_fifo->nrings ; ++r) {
+		ring = &prp_fifo->rings[r];
+		if(ring->nslots == 0)
+			continue;
+		claimed = atomic_long_read(&ring->tail);
+		start = claimed < ring->nslots ? 0 : claimed % ring->nslots;
+		for(i=0 ; i<min(claimed, ring->nslots) ; ++i) {
+			slot = &ring->slots[(start + i) % ring->nslots];
+			spin_lock(&slot->lock);
+			mm = slot->mm;
+			address = slot->address;
+			spin_unlock(&slot->lock);
+			if(mm && (ret = fn(arg, mm, address, r)) != 0)
+				return ret;
+		}
 	}
+	return 0;
+}
 
-	DA_EXIT();
+// Ring follows class of the page, so a restored page claims next slot like a fault
+void restore_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong address, int list) {
+	add_page(dime_instance, c_mm, address);
+}
+
+void get_stats (struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats) {
+	struct prp_fifo_struct *prp_fifo = to_prp_fifo_struct(dime_instance->prp);
+
+	stats->id = DIME_STATS_POLICY_FIFO;
+	stats->count = DIME_STATS_FIFO_COUNT;
+	stats->value[DIME_STATS_FIFO_LOCAL_SIZE]	= prp_fifo_local_size(prp_fifo);
+	stats->value[DIME_STATS_FIFO_NSLOTS]		= prp_fifo->nslots;
 }
 
 void lpl_CleanList (struct dime_instance_struct *dime_instance) {
 	struct prp_fifo_struct *prp_fifo = to_prp_fifo_struct(dime_instance->prp);
-	__lpl_CleanList(&prp_fifo->local.head);
+	ulong i;
+	DA_ENTRY();
+
+	for(i=0 ; i<prp_fifo->nslots ; ++i) {
+		ml_mm_release(prp_fifo->slots[i].mm);
+		prp_fifo->slots[i].mm = NULL;
+	}
+	vfree(prp_fifo->slots);
+	prp_fifo->slots = NULL;
+	prp_fifo->nslots = 0;
+	prp_fifo->nrings = 0;
+
+	DA_EXIT();
 }
 
 
 int init_module(void) {
 	int ret = 0;
-	int i;
+	int i, r;
+	ulong j, class_npages[DIME_PAGE_CLASSES];
     DA_ENTRY();
 
     for(i=0 ; i<dime.dime_instances_size ; ++i) {
@@ -216,19 +292,48 @@ int init_module(void) {
 			return -1; // TODO:: Error codes
 		}
 
-		dime.dime_instances[i].prp = &(prp_fifo->prp);
-
 		*prp_fifo = (struct prp_fifo_struct) {
 			.prp = {
 				.add_page 	= add_page,
 				.clean 		= lpl_CleanList,
+				.get_stats	= get_stats,
+				.peek_victim	= peek_victim,
+				.export_pages	= export_pages,
+				.restore_page	= restore_page,
+				.owner		= THIS_MODULE,
 			},
-			.local = (struct lpl){
-				.head = LIST_HEAD_INIT(prp_fifo->local.head),
-				.size = ATOMIC_LONG_INIT(0),
-				.lock = __RW_LOCK_UNLOCKED(prp_fifo->local.lock),
-			},
+			.slots	= NULL,
+			.nslots	= dime_local_npages(&dime.dime_instances[i]),
+			.nrings	= 1,
 		};
+
+		// class quotas are fixed at load time, ring of each class gets its share of slots
+		for(r=0 ; r<DIME_PAGE_CLASSES ; ++r)
+			class_npages[r] = dime_class_npages(&dime.dime_instances[i], r);
+		if(class_npages[DIME_PAGE_ANON] && class_npages[DIME_PAGE_CACHE]) {
+			prp_fifo->nrings = DIME_PAGE_CLASSES;
+			prp_fifo->nslots = class_npages[DIME_PAGE_ANON] + class_npages[DIME_PAGE_CACHE];
+		}
+
+		if(prp_fifo->nslots) {
+			prp_fifo->slots = (struct prp_fifo_slot*) vzalloc(sizeof(struct prp_fifo_slot) * prp_fifo->nslots);
+			if(!prp_fifo->slots) {
+				DA_ERROR("unable to allocate memory");
+				kfree(prp_fifo);
+				return -1; // TODO:: Error codes
+			}
+			for(j=0 ; j<prp_fifo->nslots ; ++j)
+				spin_lock_init(&prp_fifo->slots[j].lock);
+		}
+
+		for(r=0, j=0 ; r<prp_fifo->nrings ; ++r) {
+			prp_fifo->rings[r].slots = prp_fifo->slots + j;
+			prp_fifo->rings[r].nslots = prp_fifo->nrings > 1 ? class_npages[r] : prp_fifo->nslots;
+			atomic_long_set(&prp_fifo->rings[r].tail, 0);
+			j += prp_fifo->rings[r].nslots;
+		}
+
+		dime.dime_instances[i].prp = &(prp_fifo->prp);
 	}
 
     ret = register_page_replacement_policy(NULL);
@@ -3,16 +3,38 @@
 
 #include "common.h"
 
+/*
+ *  Slot of the FIFO ring, holds one local page. Slot lock only serializes
+ *  faults which claimed the same slot after ring wrapped around.
+ */
+struct prp_fifo_slot {
+	struct mm_struct	*mm;			// owner mm, holds mm_count reference
+	ulong				address;
+	spinlock_t			lock;
+};
+
+struct prp_fifo_ring {
+	struct prp_fifo_slot	*slots;
+	ulong					nslots;
+	atomic_long_t			tail;		// total slots claimed, next slot is tail % nslots
+};
+
 struct prp_fifo_struct {
 	struct page_replacement_policy_struct prp;
 
-	struct lpl local;
-	atomic_long_t lpl_count;
+	struct prp_fifo_slot	*slots;		// all local pages, sized to local_npages at load time
+	ulong					nslots;
+
+	// one ring per page class if class quotas were set at load time, else only rings[0] over all slots
+	struct prp_fifo_ring	rings[DIME_PAGE_CLASSES];
+	int						nrings;
 };
 
-int		test_list		(ulong address);
-int		add_page		(struct dime_instance_struct *dime_instance, struct pid * pid_s, ulong address);		// Returns 1 if delay should be injected, else 0
+int		add_page		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address);		// Returns 1 if delay should be injected, else 0
 void	lpl_CleanList	(struct dime_instance_struct *dime_instance);
-void	__lpl_CleanList (struct list_head *head);
+void	get_stats		(struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats);
+int		peek_victim		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, struct mm_struct ** victim_mm, ulong * victim_address);
+int		export_pages	(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg);
+void	restore_page	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, int list);
 
 #endif//__DA_LOCAL_PAGE_LIST_H__
@@ -14,11 +14,16 @@
 #include <linux/slab.h>
 #include <asm/pgtable_types.h>
 #include <linux/kthread.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,11,0)
+#include <linux/sched/clock.h>
+#endif
 #include <linux/proc_fs.h>
 #include <asm/uaccess.h>
 #include <asm/pgtable_types.h>
 
 #include "da_mem_lib.h"
+#include "da_shared.h"
 
 #include "prp_lru.h"
 #include "../common/da_debug.h"
@@ -53,21 +58,15 @@ static inline struct prp_lru_struct *to_prp_lru_struct(struct page_replacement_p
 
 
 
-#define PROCFS_MAX_SIZE		102400
 #define PROCFS_NAME			"dime_prp_config"
-static char procfs_buffer[PROCFS_MAX_SIZE];     // The buffer used to store character for this module
-static unsigned long procfs_buffer_size = 0;    // The size of the buffer
 
-static ssize_t procfile_read(struct file*, char*, size_t, loff_t*);
-static ssize_t procfile_write(struct file *, const char *, size_t, loff_t *);
+static int procfile_open(struct inode *inode, struct file *file);
+static ssize_t procfile_write(struct file *, const char __user *, size_t, loff_t *);
 
 struct proc_dir_entry *dime_config_entry;
 
-static struct file_operations cmd_file_ops = {  
-	.owner = THIS_MODULE,
-	.read = procfile_read,
-	.write = procfile_write,
-};
+DIME_DEFINE_PROC_OPS(cmd_file_ops, procfile_open, procfile_write);
+
 
 int init_dime_prp_config_procfs(void) {
 	dime_config_entry = proc_create(PROCFS_NAME, S_IFREG | S_IRUGO, NULL, &cmd_file_ops);
@@ -94,67 +93,68 @@ void cleanup_dime_prp_config_procfs(void) {
 	DA_INFO("proc entry \"/proc/%s\" removed\n", PROCFS_NAME);
 }
 
-static ssize_t procfile_read(struct file *file, char *buffer, size_t length, loff_t *offset) {
-	int ret;
-	int seg_size;
-	
-	if(*offset == 0) {
-		// offset is 0, so first call to read the file.
-		// Initialize buffer with config parameters currently set
-		int i;
-		//											 1  1A         1B            4         5        6         7        8         9          10        11         12        13         14         15          16         17          18        19         20        21         22        23        24        25	     26           27
-		procfs_buffer_size = sprintf(procfs_buffer, "id kswp_sleep free_max_size free_size apc_size inpc_size aan_size inan_size free_evict apc_evict inpc_evict aan_evict inan_evict fapc_evict finpc_evict faan_evict finan_evict apc->free inpc->free aan->free inan->free apc->inpc inpc->apc aan->inan inan->aan inpc->apc_pf inan->aan_pf\n");
-		for(i=0 ; i<dime.dime_instances_size ; ++i) {
-			struct prp_lru_struct *prp = to_prp_lru_struct(dime.dime_instances[i].prp);
-			ulong free_list_size = (MIN_FREE_PAGES_PERCENT * dime.dime_instances[i].local_npages)/100;
-			free_list_size = free_list_size < free_list_max_size ? free_list_size : free_list_max_size;
-			procfs_buffer_size += sprintf(procfs_buffer+procfs_buffer_size, 
-											//1  1A   1B       4   5   6   7    8    9     10   11    12   13    14    15    16    17    18   19    20   21    22   23   24   25   26    27
-											"%2d %10d %13lu %9lu %8lu %9lu %8lu %9lu %10lu %9lu %10lu %9lu %10lu %10lu %11lu %10lu %11lu %9lu %10lu %9lu %10lu %9lu %9lu %9lu %9lu %12lu %12lu\n", 
-																		dime.dime_instances[i].instance_id,						// 1
-																		kswapd_sleep_ms,										// 1A
-																		free_list_size,											// 1B
-																		atomic_long_read(&prp->free.size),						// 4
-																		atomic_long_read(&prp->active_pc.size),					// 5
-																		atomic_long_read(&prp->inactive_pc.size),				// 6
-																		atomic_long_read(&prp->active_an.size),					// 7
-																		atomic_long_read(&prp->inactive_an.size),				// 8
-																		atomic_long_read(&prp->stats.free_evict),				// 9
-																		atomic_long_read(&prp->stats.active_pc_evict),			// 10
-																		atomic_long_read(&prp->stats.inactive_pc_evict),		// 11
-																		atomic_long_read(&prp->stats.active_an_evict),			// 12
-																		atomic_long_read(&prp->stats.inactive_an_evict),		// 13
-																		atomic_long_read(&prp->stats.force_active_pc_evict),	// 14
-																		atomic_long_read(&prp->stats.force_inactive_pc_evict),	// 15
-																		atomic_long_read(&prp->stats.force_active_an_evict),	// 16
-																		atomic_long_read(&prp->stats.force_inactive_an_evict),	// 17
-																		atomic_long_read(&prp->stats.pc_active_to_free_moved),	// 18
-																		atomic_long_read(&prp->stats.pc_inactive_to_free_moved),	// 19
-																		atomic_long_read(&prp->stats.an_active_to_free_moved),		// 20
-																		atomic_long_read(&prp->stats.an_inactive_to_free_moved),	// 21
-																		atomic_long_read(&prp->stats.pc_active_to_inactive_moved),	// 22
-																		atomic_long_read(&prp->stats.pc_inactive_to_active_moved),	// 23
-																		atomic_long_read(&prp->stats.an_active_to_inactive_moved),	// 24
-																		atomic_long_read(&prp->stats.an_inactive_to_active_moved),	// 25
-																		atomic_long_read(&prp->stats.pc_inactive_to_active_pf_moved),	// 26
-																		atomic_long_read(&prp->stats.an_inactive_to_active_pf_moved));	// 27
-		}
-	}
+static int procfile_show(struct seq_file *m, void *v) {
+	struct dime_instance_struct *dime_instance = v;
+	struct prp_lru_struct *prp;
+	ulong free_list_size;
 
-	// calculate max size of block that can be read
-	seg_size = length < procfs_buffer_size ? length : procfs_buffer_size;
-	if (*offset >= procfs_buffer_size) {
-		ret  = 0;   // offset value beyond the available data to read, finish reading
-	} else {
-		memcpy(buffer, procfs_buffer, seg_size);
-		*offset += seg_size;    // increment offset value
-		ret = seg_size;         // return number of bytes read
+	if(v == SEQ_START_TOKEN) {
+		//           1  1A         1B            4         5        6         7        8         9          10        11         12        13         14         15          16         17          18        19         20        21         22        23        24        25	     26           27
+		seq_puts(m, "id kswp_sleep free_max_size free_size apc_size inpc_size aan_size inan_size free_evict apc_evict inpc_evict aan_evict inan_evict fapc_evict finpc_evict faan_evict finan_evict apc->free inpc->free aan->free inan->free apc->inpc inpc->apc aan->inan inan->aan inpc->apc_pf inan->aan_pf\n");
+		return 0;
 	}
 
-	return ret;
+	if(!dime_instance->prp)
+		return 0;		// instance added after policy was inserted
+
+	prp = to_prp_lru_struct(dime_instance->prp);
+	free_list_size = (MIN_FREE_PAGES_PERCENT * dime_local_npages(dime_instance))/100;
+	free_list_size = free_list_size < free_list_max_size ? free_list_size : free_list_max_size;
+	seq_printf(m,
+				//1  1A   1B       4   5   6   7    8    9     10   11    12   13    14    15    16    17    18   19    20   21    22   23   24   25   26    27
+				"%2d %10d %13lu %9lu %8lu %9lu %8lu %9lu %10lu %9lu %10lu %9lu %10lu %10lu %11lu %10lu %11lu %9lu %10lu %9lu %10lu %9lu %9lu %9lu %9lu %12lu %12lu\n",
+				dime_instance->instance_id,						// 1
+				kswapd_sleep_ms,										// 1A
+				free_list_size,											// 1B
+				atomic_long_read(&prp->free.size),						// 4
+				atomic_long_read(&prp->active_pc.size),					// 5
+				atomic_long_read(&prp->inactive_pc.size),				// 6
+				atomic_long_read(&prp->active_an.size),					// 7
+				atomic_long_read(&prp->inactive_an.size),				// 8
+				atomic_long_read(&prp->stats.free_evict),				// 9
+				atomic_long_read(&prp->stats.active_pc_evict),			// 10
+				atomic_long_read(&prp->stats.inactive_pc_evict),		// 11
+				atomic_long_read(&prp->stats.active_an_evict),			// 12
+				atomic_long_read(&prp->stats.inactive_an_evict),		// 13
+				atomic_long_read(&prp->stats.force_active_pc_evict),	// 14
+				atomic_long_read(&prp->stats.force_inactive_pc_evict),	// 15
+				atomic_long_read(&prp->stats.force_active_an_evict),	// 16
+				atomic_long_read(&prp->stats.force_inactive_an_evict),	// 17
+				atomic_long_read(&prp->stats.pc_active_to_free_moved),	// 18
+				atomic_long_read(&prp->stats.pc_inactive_to_free_moved),	// 19
+				atomic_long_read(&prp->stats.an_active_to_free_moved),		// 20
+				atomic_long_read(&prp->stats.an_inactive_to_free_moved),	// 21
+				atomic_long_read(&prp->stats.pc_active_to_inactive_moved),	// 22
+				atomic_long_read(&prp->stats.pc_inactive_to_active_moved),	// 23
+				atomic_long_read(&prp->stats.an_active_to_inactive_moved),	// 24
+				atomic_long_read(&prp->stats.an_inactive_to_active_moved),	// 25
+				atomic_long_read(&prp->stats.pc_inactive_to_active_pf_moved),	// 26
+				atomic_long_read(&prp->stats.an_inactive_to_active_pf_moved));	// 27
+	return 0;
+}
+
+static const struct seq_operations procfile_seq_ops = {
+	.start	= dime_instance_seq_start,
+	.next	= dime_instance_seq_next,
+	.stop	= dime_instance_seq_stop,
+	.show	= procfile_show,
+};
+
+static int procfile_open(struct inode *inode, struct file *file) {
+	return seq_open(file, &procfile_seq_ops);
 }
 
-static ssize_t procfile_write(struct file *file, const char *buffer, size_t length, loff_t *offset) {
+static ssize_t procfile_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
 	return length;
 }
 
@@ -185,23 +185,14 @@ struct lpl_node_struct * evict_first_page(struct lpl *from_list) {
 	node_to_evict = list_first_entry_or_null(&from_list->head, struct lpl_node_struct, list_node);
 	
 	if(node_to_evict) {
-		struct task_struct		* i_ts		= NULL;
-		struct mm_struct		* i_mm		= NULL;
-		pte_t					* i_ptep	= NULL;
-
 		// remove node from list
 		list_del_rcu(&node_to_evict->list_node);
 		atomic_long_dec(&from_list->size);
 
 		write_unlock(&from_list->lock);
 
-		// get pte pointer
-		i_ts	= pid_task(node_to_evict->pid_s, PIDTYPE_PID);
-		i_mm	= (i_ts == NULL ? NULL : i_ts->mm);
-		i_ptep	= (i_mm == NULL ? NULL : ml_get_ptep(i_mm, node_to_evict->address));
-
 		// protect page
-		ml_protect_pte(i_mm, node_to_evict->address, i_ptep);
+		sp_protect_mm_page(node_to_evict->mm, node_to_evict->address);
 	} else {
 		write_unlock(&from_list->lock);
 	}
@@ -222,7 +213,6 @@ struct lpl_node_struct * evict_single_page(struct lpl *from_list, struct lpl *ac
 	write_lock(&from_list->lock);
 	for(iternode = from_list->head.next ; iternode != &from_list->head ; iternode = iternode->next) {
 		struct lpl_node_struct	* i_node	= NULL;
-		struct task_struct		* i_ts		= NULL;
 		struct mm_struct		* i_mm		= NULL;
 		pte_t					* i_ptep	= NULL;
 		int accessed, dirty;
@@ -241,10 +231,11 @@ struct lpl_node_struct * evict_single_page(struct lpl *from_list, struct lpl *ac
 		list_del_rcu(&(i_node->list_node));
 		atomic_long_dec(&from_list->size);
 
-		i_ts	= pid_task(i_node->pid_s, PIDTYPE_PID);
-		i_mm	= (i_ts == NULL ? NULL : i_ts->mm);
+		i_mm	= (ml_mm_get(i_node->mm) ? i_node->mm : NULL);
 		i_ptep	= (i_mm == NULL ? NULL : ml_get_ptep(i_mm, i_node->address));
 		if(!i_ptep) {
+			if(i_mm)
+				ml_mm_put(i_mm);
 			node_to_evict = i_node;
 			break;
 		}
@@ -259,9 +250,13 @@ struct lpl_node_struct * evict_single_page(struct lpl *from_list, struct lpl *ac
 			(*from_to_active_moved)++;
 		} else {
 			node_to_evict = i_node;
-			ml_protect_pte(i_mm, i_node->address, i_ptep);
+			sp_protect_pte(i_mm, i_node->address, i_ptep);
+			ml_put_ptep(i_ptep);
+			ml_mm_put(i_mm);
 			break;
 		}
+		ml_put_ptep(i_ptep);
+		ml_mm_put(i_mm);
 	}
 
 	// reposition list head to this point, so that next time we wont scan again previously scanned nodes
@@ -280,30 +275,109 @@ struct lpl_node_struct * evict_single_page(struct lpl *from_list, struct lpl *ac
 }
 
 
-int add_page(struct dime_instance_struct *dime_instance, struct pid * c_pid, ulong c_addr) {
-	struct task_struct		* c_ts				= pid_task(c_pid, PIDTYPE_PID);
-	struct mm_struct		* c_mm				= (c_ts == NULL ? NULL : c_ts->mm);
+/*  evict_class_page
+ *
+ *  Description:
+ *      Evicts a page from lists of page_class only, used when the class has
+ *      used up its quota of local pages. Returns NULL if lists of class are empty
+ */
+static struct lpl_node_struct * evict_class_page(struct prp_lru_struct *prp_lru, enum dime_page_class page_class) {
+	struct lpl_node_struct	* node_to_evict			= NULL;
+	int						from_to_active_moved	= 0;
+
+	if(page_class == DIME_PAGE_ANON) {
+		node_to_evict = evict_single_page(&prp_lru->inactive_an, &prp_lru->active_an, &from_to_active_moved);
+		atomic_long_add(from_to_active_moved, &prp_lru->stats.an_inactive_to_active_pf_moved);
+		if(node_to_evict) {
+			atomic_long_inc(&prp_lru->stats.inactive_an_evict);
+			return node_to_evict;
+		}
+		from_to_active_moved = 0;
+		node_to_evict = evict_single_page(&prp_lru->active_an, &prp_lru->active_an, &from_to_active_moved);
+		if(node_to_evict) {
+			atomic_long_inc(&prp_lru->stats.active_an_evict);
+			return node_to_evict;
+		}
+		node_to_evict = evict_first_page(&prp_lru->inactive_an);
+		if(node_to_evict) {
+			atomic_long_inc(&prp_lru->stats.force_inactive_an_evict);
+			return node_to_evict;
+		}
+		node_to_evict = evict_first_page(&prp_lru->active_an);
+		if(node_to_evict)
+			atomic_long_inc(&prp_lru->stats.force_active_an_evict);
+	} else {
+		node_to_evict = evict_single_page(&prp_lru->inactive_pc, &prp_lru->active_pc, &from_to_active_moved);
+		atomic_long_add(from_to_active_moved, &prp_lru->stats.pc_inactive_to_active_pf_moved);
+		if(node_to_evict) {
+			atomic_long_inc(&prp_lru->stats.inactive_pc_evict);
+			return node_to_evict;
+		}
+		from_to_active_moved = 0;
+		node_to_evict = evict_single_page(&prp_lru->active_pc, &prp_lru->active_pc, &from_to_active_moved);
+		if(node_to_evict) {
+			atomic_long_inc(&prp_lru->stats.active_pc_evict);
+			return node_to_evict;
+		}
+		node_to_evict = evict_first_page(&prp_lru->inactive_pc);
+		if(node_to_evict) {
+			atomic_long_inc(&prp_lru->stats.force_inactive_pc_evict);
+			return node_to_evict;
+		}
+		node_to_evict = evict_first_page(&prp_lru->active_pc);
+		if(node_to_evict)
+			atomic_long_inc(&prp_lru->stats.force_active_pc_evict);
+	}
+
+	return node_to_evict;
+}
+
+/*  __add_page
+ *
+ *  Description:
+ *      Takes a free node or evicts a page, and places page at tail of active
+ *      or inactive list of its class. Faults place pages in active list.
+ */
+static int __add_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong c_addr, int list) {
 	pte_t					* c_ptep			= (c_mm == NULL ? NULL : ml_get_ptep(c_mm, c_addr));
 	struct page				* c_page			= (c_ptep == NULL ? NULL : pte_page(*c_ptep));
 
 	struct lpl_node_struct	* node_to_evict		= NULL;
 	struct prp_lru_struct	* prp_lru			= to_prp_lru_struct(dime_instance->prp);
 	int 					ret_execute_delay	= 1;
-
-	if (dime_instance->local_npages == 0) {
+	int						from_free			= 0;	// node was evicted earlier by kswapd
+	ulong					local_npages		= dime_local_npages(dime_instance);
+	enum dime_page_class	page_class			= (c_page == NULL ? DIME_PAGE_ANON : dime_page_class(c_page));
+	ulong					class_npages		= dime_class_npages(dime_instance, page_class);
+	struct lpl				* class_active		= (page_class == DIME_PAGE_ANON ? &prp_lru->active_an : &prp_lru->active_pc);
+	struct lpl				* class_inactive	= (page_class == DIME_PAGE_ANON ? &prp_lru->inactive_an : &prp_lru->inactive_pc);
+	struct lpl				* target			= (list == PRP_LRU_INACTIVE ? class_inactive : class_active);
+
+	if (local_npages == 0) {
 		// no need to add this address
 		// we can treat this case as infinite local pages, and no need to inject delay on any of the page
 		ret_execute_delay = 1;
 		goto EXIT_ADD_PAGE;
-	} else if (dime_instance->local_npages > atomic_long_read(&prp_lru->lpl_count)) {
+	}
+
+	// class has used up its quota, replace one of its own pages
+	if (class_npages && atomic_long_read(&class_active->size) + atomic_long_read(&class_inactive->size) >= class_npages) {
+		node_to_evict = evict_class_page(prp_lru, page_class);
+		if(node_to_evict)
+			goto FREE_NODE_FOUND;
+	}
+
+	if (local_npages > atomic_long_read(&prp_lru->lpl_count)) {
 		// Since there is still free space locally for remote pages, delay should not be injected
 		ret_execute_delay = 1;
-		node_to_evict = (struct lpl_node_struct*) kmalloc(sizeof(struct lpl_node_struct), GFP_KERNEL);
+		// called from fault hook, inside rcu read section when pages come through admission
+		node_to_evict = (struct lpl_node_struct*) kmalloc(sizeof(struct lpl_node_struct), GFP_ATOMIC);
 
 		if(!node_to_evict) {
 			DA_ERROR("unable to allocate memory");
 			goto EXIT_ADD_PAGE;
 		} else {
+			node_to_evict->mm = NULL;
 			atomic_long_inc(&prp_lru->lpl_count);
 			atomic_long_inc(&prp_lru->stats.free_evict);
 		}
@@ -322,6 +396,7 @@ int add_page(struct dime_instance_struct *dime_instance, struct pid * c_pid, ulo
 				write_unlock(&prp_lru->free.lock);
 				atomic_long_dec(&prp_lru->free.size);
 				atomic_long_inc(&prp_lru->stats.free_evict);
+				from_free = 1;
 				goto FREE_NODE_FOUND;
 			} else {
 				write_unlock(&prp_lru->free.lock);
@@ -396,8 +471,14 @@ int add_page(struct dime_instance_struct *dime_instance, struct pid * c_pid, ulo
 
 FREE_NODE_FOUND:
 
+	if(node_to_evict->mm && !from_free)
+		trace_dime_evict(dime_instance->instance_id, node_to_evict->mm, node_to_evict->address, 0);
+
+	// drop reference to previous owner, evicted page was already protected
+	ml_mm_release(node_to_evict->mm);
 	node_to_evict->address = c_addr;
-	node_to_evict->pid_s = c_pid;
+	node_to_evict->mm = c_mm;
+	ml_mm_hold(c_mm);
 	
 	// Sometimes bulk pagefault requests come and evicting any page from these requests will again trigger pagefault.
 	// This happens recursively if accessed bit is not set for each requested page.
@@ -407,30 +488,25 @@ FREE_NODE_FOUND:
 	ml_set_inlist_pte(c_mm, c_addr, c_ptep);
 
 
-	if(c_page) {
-		if( ((unsigned long)(c_page->mapping) & (unsigned long)0x01) != 0 ) {
-			write_lock(&prp_lru->active_an.lock);
-			list_add_tail_rcu(&(node_to_evict->list_node), &prp_lru->active_an.head);
-			atomic_long_inc(&prp_lru->active_an.size);
-			write_unlock(&prp_lru->active_an.lock);
-
-			atomic_long_inc(&dime_instance->an_pagefaults);
-		} else {
-			write_lock(&prp_lru->active_pc.lock);
-			list_add_tail_rcu(&(node_to_evict->list_node), &prp_lru->active_pc.head);
-			atomic_long_inc(&prp_lru->active_pc.size);
-			write_unlock(&prp_lru->active_pc.lock);
-
-			atomic_long_inc(&dime_instance->pc_pagefaults);
-		}
-	} else {
-		DA_ERROR("invalid c_page mapping : %p : %p", c_page, c_page->mapping);
-	}
+	// pagefaults of each class are counted by fault hook
+	write_lock(&target->lock);
+	list_add_tail_rcu(&(node_to_evict->list_node), &target->head);
+	atomic_long_inc(&target->size);
+	write_unlock(&target->lock);
 
 EXIT_ADD_PAGE:
+	ml_put_ptep(c_ptep);
 
 	return ret_execute_delay;
 }
+
+int add_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong c_addr) {
+	return __add_page(dime_instance, c_mm, c_addr, PRP_LRU_ACTIVE);
+}
+
+void restore_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong c_addr, int list) {
+	__add_page(dime_instance, c_mm, c_addr, list);
+}
 /*
 LRU pages belong to one of two linked list, the "active" and the "inactive" list. 
 Page movement is driven by memory pressure. Pages are taken from the end of the inactive list to be freed. 
@@ -472,11 +548,12 @@ struct stats_struct balance_lists(struct lpl *active_list, struct lpl *inactive_
 	write_lock(&active_list->lock);
 	for(iternode = active_list->head.next ; iternode != &active_list->head && target > 0; iternode = iternode->next) {
 		struct lpl_node_struct	* i_node	= list_entry(iternode, struct lpl_node_struct, list_node);
-		struct task_struct		* i_ts		= pid_task(i_node->pid_s, PIDTYPE_PID);
-		struct mm_struct		* i_mm		= (i_ts == NULL ? NULL : i_ts->mm);
+		struct mm_struct		* i_mm		= (ml_mm_get(i_node->mm) ? i_node->mm : NULL);
 		pte_t					* i_ptep	= (i_mm == NULL ? NULL : ml_get_ptep(i_mm, i_node->address));
 
 		if(!i_ptep) {
+			if(i_mm)
+				ml_mm_put(i_mm);
 			iternode = iternode->prev;
 
 			list_del_rcu(&i_node->list_node);
@@ -506,6 +583,8 @@ struct stats_struct balance_lists(struct lpl *active_list, struct lpl *inactive_
 			// clear accessed bit
 			*i_ptep = pte_mkold(*i_ptep);
 		}
+		ml_put_ptep(i_ptep);
+		ml_mm_put(i_mm);
 	}
 
 	// reposition list head to this point, so that next time we wont scan again previously scanned nodes
@@ -520,11 +599,12 @@ struct stats_struct balance_lists(struct lpl *active_list, struct lpl *inactive_
 	write_lock(&inactive_list->lock);
 	for(iternode = inactive_list->head.next ; iternode != &inactive_list->head; iternode = iternode->next) {
 		struct lpl_node_struct	* i_node	= list_entry(iternode, struct lpl_node_struct, list_node);
-		struct task_struct		* i_ts		= pid_task(i_node->pid_s, PIDTYPE_PID);
-		struct mm_struct		* i_mm		= (i_ts == NULL ? NULL : i_ts->mm);
+		struct mm_struct		* i_mm		= (ml_mm_get(i_node->mm) ? i_node->mm : NULL);
 		pte_t					* i_ptep	= (i_mm == NULL ? NULL : ml_get_ptep(i_mm, i_node->address));
 
 		if(!i_ptep) {
+			if(i_mm)
+				ml_mm_put(i_mm);
 			iternode = iternode->prev;
 
 			list_del_rcu(&i_node->list_node);
@@ -551,6 +631,8 @@ struct stats_struct balance_lists(struct lpl *active_list, struct lpl *inactive_
 			atomic_long_inc(&stats.pc_inactive_to_active_moved);
 			*i_ptep = pte_mkold(*i_ptep);
 		}
+		ml_put_ptep(i_ptep);
+		ml_mm_put(i_mm);
 	}
 	write_unlock(&inactive_list->lock);
 
@@ -576,11 +658,12 @@ int try_to_free_pages(struct dime_instance_struct *dime_instance, struct lpl *pl
 	write_lock(&pl->lock);
 	for(iternode = pl->head.next ; iternode != &pl->head && target > 0; iternode = iternode->next) {
 		struct lpl_node_struct	* i_node	= list_entry(iternode, struct lpl_node_struct, list_node);
-		struct task_struct		* i_ts		= pid_task(i_node->pid_s, PIDTYPE_PID);
-		struct mm_struct		* i_mm		= (i_ts == NULL ? NULL : i_ts->mm);
+		struct mm_struct		* i_mm		= (ml_mm_get(i_node->mm) ? i_node->mm : NULL);
 		pte_t					* i_ptep	= (i_mm == NULL ? NULL : ml_get_ptep(i_mm, i_node->address));
 
 		if(!i_ptep) {
+			if(i_mm)
+				ml_mm_put(i_mm);
 			iternode = iternode->prev;
 
 			list_del_rcu(&i_node->list_node);
@@ -604,7 +687,7 @@ int try_to_free_pages(struct dime_instance_struct *dime_instance, struct lpl *pl
 			// inject delay if dirty page
 			if(pte_dirty(*i_ptep)) {
 				// emulate page flush, inject delay
-				inject_delay(dime_instance, 0);
+				inject_delay(dime_instance, 0, dime_page_class(pte_page(*i_ptep)));
 
 				// clear dirty bit
 				*i_ptep = pte_mkclean(*i_ptep);
@@ -613,10 +696,13 @@ int try_to_free_pages(struct dime_instance_struct *dime_instance, struct lpl *pl
 			list_add_tail_rcu(&i_node->list_node, &local_free_list.head);
 			atomic_long_inc(&local_free_list.size);
 
-			ml_protect_pte(i_mm, i_node->address, i_ptep);
+			sp_protect_pte(i_mm, i_node->address, i_ptep);
+			trace_dime_evict(dime_instance->instance_id, i_mm, i_node->address, 1);
 			target--;
 			moved_free++;
 		}
+		ml_put_ptep(i_ptep);
+		ml_mm_put(i_mm);
 	}
 
 	// reposition list head to this point, so that next time we wont scan again previously scanned nodes
@@ -642,16 +728,20 @@ int balance_local_page_lists(void) {
 	for(i=0 ; i<dime.dime_instances_size ; ++i) {
 		int free_target = 0;
 		int required_free_size = 0;
+		long freed = 0, to_inactive = 0, to_active = 0;
+		ulong local_npages;
+		u64 time_balance = sched_clock();
 		dime_instance = &(dime.dime_instances[i]);
 		prp_lru = to_prp_lru_struct(dime_instance->prp);
+		local_npages = dime_local_npages(dime_instance);
 		//if(prp_lru->lpl_count < dime_instance->local_npages)
 			//|| prp_lru->free.size >= (MIN_FREE_PAGES_PERCENT * dime_instance->local_npages)/100)
 			// no need to evict pages for this dime instance
 		//	continue;
 
-		required_free_size = (MIN_FREE_PAGES_PERCENT * dime_instance->local_npages)/100;
+		required_free_size = (MIN_FREE_PAGES_PERCENT * local_npages)/100;
 		required_free_size = required_free_size < free_list_max_size ? required_free_size : free_list_max_size;
-		free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + dime_instance->local_npages - atomic_long_read(&prp_lru->lpl_count));
+		free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + local_npages - atomic_long_read(&prp_lru->lpl_count));
 		if(free_target > 0) {
 			/*int target_pi = prp_lru->inactive_pc.size - (18 * dime_instance->local_npages)/100;
 			int target_pa = prp_lru->active_pc.size   - (27 * dime_instance->local_npages)/100;
@@ -677,21 +767,25 @@ int balance_local_page_lists(void) {
 			try_to_free_pages(dime_instance, &prp_lru->active_pc, target_aa, &prp_lru->free);
 			*/
 
-			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + dime_instance->local_npages - atomic_long_read(&prp_lru->lpl_count));
+			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + local_npages - atomic_long_read(&prp_lru->lpl_count));
 			free_target = free_target > 0 ? try_to_free_pages(dime_instance, &prp_lru->inactive_pc, free_target, &prp_lru->free) : 0;
 			atomic_long_add(free_target, &prp_lru->stats.pc_inactive_to_free_moved);
+			freed += free_target;
 			
-			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + dime_instance->local_npages - atomic_long_read(&prp_lru->lpl_count));
+			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + local_npages - atomic_long_read(&prp_lru->lpl_count));
 			free_target = free_target > 0 ? try_to_free_pages(dime_instance, &prp_lru->inactive_an, free_target, &prp_lru->free) : 0;
 			atomic_long_add(free_target, &prp_lru->stats.an_inactive_to_free_moved);
+			freed += free_target;
 			
-			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + dime_instance->local_npages - atomic_long_read(&prp_lru->lpl_count));
+			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + local_npages - atomic_long_read(&prp_lru->lpl_count));
 			free_target = free_target > 0 ? try_to_free_pages(dime_instance, &prp_lru->active_pc, free_target, &prp_lru->free) : 0;
 			atomic_long_add(free_target, &prp_lru->stats.pc_active_to_free_moved);
+			freed += free_target;
 			
-			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + dime_instance->local_npages - atomic_long_read(&prp_lru->lpl_count));
+			free_target = required_free_size - (atomic_long_read(&prp_lru->free.size) + local_npages - atomic_long_read(&prp_lru->lpl_count));
 			free_target = free_target > 0 ? try_to_free_pages(dime_instance, &prp_lru->active_pc, free_target, &prp_lru->free) : 0;
 			atomic_long_add(free_target, &prp_lru->stats.an_active_to_free_moved);
+			freed += free_target;
 		}
 
 		/*if(prp_lru->inactive_pc.size < (prp_lru->active_pc.size+prp_lru->inactive_pc.size)*40/100)*/ {
@@ -703,6 +797,9 @@ int balance_local_page_lists(void) {
 				atomic_long_add(atomic_long_read(&stats.pc_active_to_free_moved)		, &prp_lru->stats.pc_active_to_free_moved);
 				atomic_long_add(atomic_long_read(&stats.pc_inactive_to_active_moved)	, &prp_lru->stats.pc_inactive_to_active_moved);
 				atomic_long_add(atomic_long_read(&stats.pc_active_to_inactive_moved)	, &prp_lru->stats.pc_active_to_inactive_moved);
+				freed += atomic_long_read(&stats.pc_inactive_to_free_moved) + atomic_long_read(&stats.pc_active_to_free_moved);
+				to_inactive += atomic_long_read(&stats.pc_active_to_inactive_moved);
+				to_active += atomic_long_read(&stats.pc_inactive_to_active_moved);
 			}
 		}
 
@@ -715,8 +812,14 @@ int balance_local_page_lists(void) {
 				atomic_long_add(atomic_long_read(&stats.pc_active_to_free_moved)		, &prp_lru->stats.an_active_to_free_moved);
 				atomic_long_add(atomic_long_read(&stats.pc_inactive_to_active_moved)	, &prp_lru->stats.an_inactive_to_active_moved);
 				atomic_long_add(atomic_long_read(&stats.pc_active_to_inactive_moved)	, &prp_lru->stats.an_active_to_inactive_moved);
+				freed += atomic_long_read(&stats.pc_inactive_to_free_moved) + atomic_long_read(&stats.pc_active_to_free_moved);
+				to_inactive += atomic_long_read(&stats.pc_active_to_inactive_moved);
+				to_active += atomic_long_read(&stats.pc_inactive_to_active_moved);
 			}
 		}
+
+		trace_dime_kswapd_balance(dime_instance->instance_id, freed, to_inactive, to_active,
+									atomic_long_read(&prp_lru->free.size), sched_clock() - time_balance);
 	}
 
 	return 0;
@@ -734,18 +837,164 @@ static int dime_kswapd_fn(void *unused) {
 		balance_local_page_lists();
 	}
 	DA_INFO("dime_kswapd thread STOPPING");
-	do_exit(0);
 	return 0;
 }
 
 
 
+// first node of list, or NULL if list is empty
+static int peek_first_page(struct lpl *list, struct mm_struct ** victim_mm, ulong * victim_address) {
+	struct lpl_node_struct *node;
+	int ret = 0;
+
+	read_lock(&list->lock);
+	node = list_first_entry_or_null(&list->head, struct lpl_node_struct, list_node);
+	if(node) {
+		*victim_mm = node->mm;
+		*victim_address = node->address;
+		ret = 1;
+	}
+	read_unlock(&list->lock);
+
+	return ret;
+}
+
+/*  peek_victim
+ *
+ *  Description:
+ *      Oldest page of the first list add_page would evict from, with class
+ *      lists first if class of the page is at its quota. add_page skips
+ *      referenced pages, so victim is the oldest candidate rather than the
+ *      exact page. No victim if local pages are left or kswapd freed some.
+ */
+int peek_victim(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong c_addr,
+					struct mm_struct ** victim_mm, ulong * victim_address) {
+	pte_t					* c_ptep			= (c_mm == NULL ? NULL : ml_get_ptep(c_mm, c_addr));
+	struct prp_lru_struct	* prp_lru			= to_prp_lru_struct(dime_instance->prp);
+	enum dime_page_class	page_class			= ((c_ptep && pte_present(*c_ptep)) ? dime_page_class(pte_page(*c_ptep)) : DIME_PAGE_ANON);
+	ulong					class_npages		= dime_class_npages(dime_instance, page_class);
+	struct lpl				* class_active		= (page_class == DIME_PAGE_ANON ? &prp_lru->active_an : &prp_lru->active_pc);
+	struct lpl				* class_inactive	= (page_class == DIME_PAGE_ANON ? &prp_lru->inactive_an : &prp_lru->inactive_pc);
+
+	ml_put_ptep(c_ptep);
+	if (class_npages && atomic_long_read(&class_active->size) + atomic_long_read(&class_inactive->size) >= class_npages) {
+		if(peek_first_page(class_inactive, victim_mm, victim_address) || peek_first_page(class_active, victim_mm, victim_address))
+			return 1;
+	}
+
+	if (dime_local_npages(dime_instance) > atomic_long_read(&prp_lru->lpl_count) || atomic_long_read(&prp_lru->free.size) > 0)
+		return 0;
+
+	return peek_first_page(&prp_lru->inactive_pc, victim_mm, victim_address)
+			|| peek_first_page(&prp_lru->inactive_an, victim_mm, victim_address)
+			|| peek_first_page(&prp_lru->active_pc, victim_mm, victim_address)
+			|| peek_first_page(&prp_lru->active_an, victim_mm, victim_address);
+}
+
+// moves nodes of pages without mm to free list, they have nothing to protect
+static void drop_unowned_list(struct lpl *list, struct lpl *free) {
+	struct lpl_node_struct	* node, * tmp;
+	struct lpl				local_free_list	= {
+												.head = LIST_HEAD_INIT(local_free_list.head),
+												.size = ATOMIC_LONG_INIT(0),
+												.lock = __RW_LOCK_UNLOCKED(local_free_list.lock)
+											};
+
+	write_lock(&list->lock);
+	list_for_each_entry_safe(node, tmp, &list->head, list_node) {
+		if(node->mm)
+			continue;
+		list_del_rcu(&node->list_node);
+		atomic_long_dec(&list->size);
+		list_add_tail_rcu(&node->list_node, &local_free_list.head);
+		atomic_long_inc(&local_free_list.size);
+	}
+	write_unlock(&list->lock);
+
+	append_local_page_list(free, &local_free_list);
+}
+
+void drop_unowned(struct dime_instance_struct *dime_instance) {
+	struct prp_lru_struct *prp_lru = to_prp_lru_struct(dime_instance->prp);
+
+	drop_unowned_list(&prp_lru->inactive_pc, &prp_lru->free);
+	drop_unowned_list(&prp_lru->inactive_an, &prp_lru->free);
+	drop_unowned_list(&prp_lru->active_pc, &prp_lru->free);
+	drop_unowned_list(&prp_lru->active_an, &prp_lru->free);
+}
+
+// passes pages of list to fn from head, i.e. oldest first
+static int export_list(struct lpl *list, int list_id, dime_export_fn fn, void *arg) {
+	struct lpl_node_struct *node;
+	int ret = 0;
+
+	read_lock(&list->lock);
+	list_for_each_entry(node, &list->head, list_node) {
+		if(node->mm && (ret = fn(arg, node->mm, node->address, list_id)) != 0)
+			break;
+	}
+	read_unlock(&list->lock);
+
+	return ret;
+}
+
+/*  export_pages
+ *
+ *  Description:
+ *      Inactive lists first, then active lists, in the order add_page
+ *      evicts from them. Pages of free list are already evicted.
+ */
+int export_pages(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg) {
+	struct prp_lru_struct *prp_lru = to_prp_lru_struct(dime_instance->prp);
+	int ret;
+
+	if((ret = export_list(&prp_lru->inactive_pc, PRP_LRU_INACTIVE, fn, arg)) != 0 ||
+			(ret = export_list(&prp_lru->inactive_an, PRP_LRU_INACTIVE, fn, arg)) != 0 ||
+			(ret = export_list(&prp_lru->active_pc, PRP_LRU_ACTIVE, fn, arg)) != 0)
+		return ret;
+	return export_list(&prp_lru->active_an, PRP_LRU_ACTIVE, fn, arg);
+}
+
+void get_stats (struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats) {
+	struct prp_lru_struct *prp_lru = to_prp_lru_struct(dime_instance->prp);
+	__u64 *v = stats->value;
+
+	stats->id = DIME_STATS_POLICY_LRU;
+	stats->count = DIME_STATS_LRU_COUNT;
+	v[DIME_STATS_LRU_LPL_COUNT] = atomic_long_read(&prp_lru->lpl_count);
+	v[DIME_STATS_LRU_FREE_SIZE] = atomic_long_read(&prp_lru->free.size);
+	v[DIME_STATS_LRU_ACTIVE_PC_SIZE] = atomic_long_read(&prp_lru->active_pc.size);
+	v[DIME_STATS_LRU_INACTIVE_PC_SIZE] = atomic_long_read(&prp_lru->inactive_pc.size);
+	v[DIME_STATS_LRU_ACTIVE_AN_SIZE] = atomic_long_read(&prp_lru->active_an.size);
+	v[DIME_STATS_LRU_INACTIVE_AN_SIZE] = atomic_long_read(&prp_lru->inactive_an.size);
+	v[DIME_STATS_LRU_FREE_EVICT] = atomic_long_read(&prp_lru->stats.free_evict);
+	v[DIME_STATS_LRU_ACTIVE_PC_EVICT] = atomic_long_read(&prp_lru->stats.active_pc_evict);
+	v[DIME_STATS_LRU_ACTIVE_AN_EVICT] = atomic_long_read(&prp_lru->stats.active_an_evict);
+	v[DIME_STATS_LRU_INACTIVE_PC_EVICT] = atomic_long_read(&prp_lru->stats.inactive_pc_evict);
+	v[DIME_STATS_LRU_INACTIVE_AN_EVICT] = atomic_long_read(&prp_lru->stats.inactive_an_evict);
+	v[DIME_STATS_LRU_FORCE_ACTIVE_PC_EVICT] = atomic_long_read(&prp_lru->stats.force_active_pc_evict);
+	v[DIME_STATS_LRU_FORCE_ACTIVE_AN_EVICT] = atomic_long_read(&prp_lru->stats.force_active_an_evict);
+	v[DIME_STATS_LRU_FORCE_INACTIVE_PC_EVICT] = atomic_long_read(&prp_lru->stats.force_inactive_pc_evict);
+	v[DIME_STATS_LRU_FORCE_INACTIVE_AN_EVICT] = atomic_long_read(&prp_lru->stats.force_inactive_an_evict);
+	v[DIME_STATS_LRU_PC_ACTIVE_TO_INACTIVE_MOVED] = atomic_long_read(&prp_lru->stats.pc_active_to_inactive_moved);
+	v[DIME_STATS_LRU_AN_ACTIVE_TO_INACTIVE_MOVED] = atomic_long_read(&prp_lru->stats.an_active_to_inactive_moved);
+	v[DIME_STATS_LRU_PC_INACTIVE_TO_ACTIVE_MOVED] = atomic_long_read(&prp_lru->stats.pc_inactive_to_active_moved);
+	v[DIME_STATS_LRU_AN_INACTIVE_TO_ACTIVE_MOVED] = atomic_long_read(&prp_lru->stats.an_inactive_to_active_moved);
+	v[DIME_STATS_LRU_PC_INACTIVE_TO_ACTIVE_PF_MOVED] = atomic_long_read(&prp_lru->stats.pc_inactive_to_active_pf_moved);
+	v[DIME_STATS_LRU_AN_INACTIVE_TO_ACTIVE_PF_MOVED] = atomic_long_read(&prp_lru->stats.an_inactive_to_active_pf_moved);
+	v[DIME_STATS_LRU_PC_ACTIVE_TO_FREE_MOVED] = atomic_long_read(&prp_lru->stats.pc_active_to_free_moved);
+	v[DIME_STATS_LRU_AN_ACTIVE_TO_FREE_MOVED] = atomic_long_read(&prp_lru->stats.an_active_to_free_moved);
+	v[DIME_STATS_LRU_PC_INACTIVE_TO_FREE_MOVED] = atomic_long_read(&prp_lru->stats.pc_inactive_to_free_moved);
+	v[DIME_STATS_LRU_AN_INACTIVE_TO_FREE_MOVED] = atomic_long_read(&prp_lru->stats.an_inactive_to_free_moved);
+}
+
 void __lpl_CleanList (struct list_head *prp) {
 	DA_ENTRY();
 
 	while (!list_empty(prp)) {
 		struct lpl_node_struct *node = list_first_entry(prp, struct lpl_node_struct, list_node);
 		list_del_rcu(&node->list_node);
+		ml_mm_release(node->mm);
 		kfree(node);
 	}
 
@@ -849,6 +1098,13 @@ int init_module(void) {
 
 		prp_lru->prp.add_page = add_page;
 		prp_lru->prp.clean = lpl_CleanList;
+		prp_lru->prp.get_stats = get_stats;
+		prp_lru->prp.peek_victim = peek_victim;
+		prp_lru->prp.export_pages = export_pages;
+		prp_lru->prp.restore_page = restore_page;
+		prp_lru->prp.drop_unowned = drop_unowned;
+		prp_lru->prp.resizable = 1;
+		prp_lru->prp.owner = THIS_MODULE;
 
 
 		// Set policy pointer at the end of initialization
@@ -29,6 +29,10 @@ struct stats_struct {
 	atomic_long_t	an_inactive_to_free_moved;
 };
 
+// lists of a page for warm start, class of the page picks anon or page cache list
+#define PRP_LRU_ACTIVE		0
+#define PRP_LRU_INACTIVE	1
+
 struct prp_lru_struct {
 	struct page_replacement_policy_struct prp;
 
@@ -45,8 +49,13 @@ struct prp_lru_struct {
 };
 
 
-int		add_page		(struct dime_instance_struct *dime_instance, struct pid * pid_s, ulong address);		// Returns 1 if delay should be injected, else 0
+int		add_page		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address);		// Returns 1 if delay should be injected, else 0
 void	lpl_CleanList	(struct dime_instance_struct *dime_instance);
+void	get_stats		(struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats);
+int		peek_victim		(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, struct mm_struct ** victim_mm, ulong * victim_address);
+int		export_pages	(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg);
+void	restore_page	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong address, int list);
+void	drop_unowned	(struct dime_instance_struct *dime_instance);
 void	__lpl_CleanList	(struct list_head *prp);
 
 #endif//__DA_LOCAL_PAGE_LIST_H__
@@ -16,9 +16,11 @@
 #include <linux/proc_fs.h>
 #include <asm/uaccess.h>
 #include <linux/random.h>
-#include <linux/spinlock_types.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
 
 #include "da_mem_lib.h"
+#include "da_shared.h"
 
 #include "prp_random.h"
 #include "../common/da_debug.h"
@@ -40,83 +42,224 @@ static struct prp_random_struct *to_prp_random_struct(struct page_replacement_po
 	return container_of(prp, struct prp_random_struct, prp);
 }
 
-int add_page (struct dime_instance_struct *dime_instance, struct pid * c_pid, ulong c_addr) {
-	struct task_struct		* c_ts				= pid_task(c_pid, PIDTYPE_PID);
-	struct mm_struct		* c_mm				= (c_ts == NULL ? NULL : c_ts->mm);
+/*  shard_place_page
+ *
+ *  Description:
+ *      Stores page in a free slot of the shard, or if evict is set and shard
+ *      is full, in place of a randomly selected page of the shard which gets
+ *      protected. Returns 1 if page was stored, 0 otherwise.
+ */
+static int shard_place_page(struct dime_instance_struct *dime_instance, struct prp_random_pool *pool, struct prp_random_shard *shard,
+								int evict, struct mm_struct *c_mm, ulong c_addr, pte_t *c_ptep) {
+	struct prp_random_struct* prp_random	= to_prp_random_struct(dime_instance->prp);
+	struct prp_random_slot	* slot	= NULL;
+
+	if(shard->size == 0)
+		return 0;
+
+	spin_lock(&shard->lock);
+	if(shard->used < shard->size) {
+		slot = &prp_random->slots[shard->start + shard->used];
+		shard->used++;
+		atomic_long_dec(&pool->free_slots);
+	} else if(evict) {
+		slot = &prp_random->slots[shard->start + prandom_u32_state(&shard->rnd) % shard->size];
+
+		// protect random last address, so that it will be faulted in future
+		trace_dime_evict(dime_instance->instance_id, slot->mm, slot->address, 0);
+		sp_protect_mm_page(slot->mm, slot->address);
+		ml_mm_release(slot->mm);
+	} else {
+		spin_unlock(&shard->lock);
+		return 0;
+	}
+
+	slot->address = c_addr;
+	slot->mm = c_mm;
+	ml_mm_hold(c_mm);
+
+	ml_set_inlist_pte(c_mm, c_addr, c_ptep);
+	spin_unlock(&shard->lock);
+
+	return 1;
+}
+
+int add_page (struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong c_addr) {
 	pte_t					* c_ptep			= (c_mm == NULL ? NULL : ml_get_ptep(c_mm, c_addr));
 	struct page				* c_page			= (c_ptep == NULL ? NULL : pte_page(*c_ptep));
 
-	struct lpl_node_struct	* node_to_replace	= NULL;
 	struct prp_random_struct* prp_random		= to_prp_random_struct(dime_instance->prp);
+	struct prp_random_pool	* pool				= &prp_random->pools[0];
 	int 					ret_execute_delay 	= 0;
+	int						cpu, i;
 
-	if (dime_instance->local_npages == 0) {
+	if (dime_local_npages(dime_instance) == 0 || prp_random->nslots == 0) {
 		// no need to add this address
 		// we can treat this case as infinite local pages, and no need to inject delay on any of the page
 		ret_execute_delay = 1;
-		return ret_execute_delay;
-	} else {
-		unsigned long rnd = 0;
-		do {
-			get_random_bytes(&rnd, sizeof(unsigned long));
-			rnd %= prp_random->lpl_size;
-		} while(!spin_trylock(&prp_random->lpl[rnd]->lock));
+		goto EXIT_ADD_PAGE;
+	}
 
-		// protect random last address, so that it will be faulted in future
-		node_to_replace = prp_random->lpl[rnd];
-		if(node_to_replace->address) {
-			if(node_to_replace->pid_s->numbers[0].nr <= 0)
-				 DA_ERROR("invalid pid: %d : address:%lu", node_to_replace->pid_s->numbers[0].nr, node_to_replace->address);
+	// with class quotas, page only replaces pages of its own class
+	if(prp_random->npools > 1 && c_page)
+		pool = &prp_random->pools[dime_page_class(c_page)];
 
-			ml_protect_page(ml_get_mm_struct(node_to_replace->pid_s->numbers[0].nr), node_to_replace->address);
-		}
+	// task may migrate after reading cpu id, shard lock keeps it correct anyway
+	cpu = raw_smp_processor_id() % prp_random->nshards;
 
-		node_to_replace->address = c_addr;
-		node_to_replace->pid_s = c_pid;
+	// own shard, then free slots of other shards until whole pool is filled,
+	// then evict from own shard, and steal from others only if own shard has no slots
+	if(shard_place_page(dime_instance, pool, &pool->shards[cpu], 0, c_mm, c_addr, c_ptep))
+		goto PAGE_ADDED;
 
-		ml_set_inlist_pte(c_mm, c_addr, c_ptep);
+	for(i=1 ; i<prp_random->nshards && atomic_long_read(&pool->free_slots) > 0 ; ++i) {
+		if(shard_place_page(dime_instance, pool, &pool->shards[(cpu + i) % prp_random->nshards], 0, c_mm, c_addr, c_ptep))
+			goto PAGE_ADDED;
+	}
 
-		spin_unlock(&prp_random->lpl[rnd]->lock);
+	for(i=0 ; i<prp_random->nshards ; ++i) {
+		if(shard_place_page(dime_instance, pool, &pool->shards[(cpu + i) % prp_random->nshards], 1, c_mm, c_addr, c_ptep))
+			goto PAGE_ADDED;
+	}
 
-		// Since local pages are occupied, delay should be injected
-		ret_execute_delay = 1;
+	DA_ERROR("no slot found for page %lx", c_addr);
+	goto EXIT_ADD_PAGE;
+
+PAGE_ADDED:
+	// Since local pages are occupied, delay should be injected, pagefaults of each class are counted by fault hook
+	ret_execute_delay = 1;
 
-		if(c_page) {
-			if( ((unsigned long)(c_page->mapping) & (unsigned long)0x01) != 0 ) {
-				atomic_long_inc(&dime_instance->an_pagefaults);
-				//DA_DEBUG("this is anonymous page: %lu, pid: %d", address, node->pid);
-			} else {
-				atomic_long_inc(&dime_instance->pc_pagefaults);
-				//DA_DEBUG("this is pagecache page: %lu, pid: %d", address, node->pid);
+EXIT_ADD_PAGE:
+	ml_put_ptep(c_ptep);
+	return ret_execute_delay;
+}
+
+/*  drop_unowned
+ *
+ *  Description:
+ *      Frees slots of pages added without mm. Last filled slot of the shard
+ *      takes place of a freed one, so that filled slots stay contiguous.
+ */
+void drop_unowned(struct dime_instance_struct *dime_instance) {
+	struct prp_random_struct	* prp_random	= to_prp_random_struct(dime_instance->prp);
+	struct prp_random_shard		* shard;
+	struct prp_random_slot		* slot;
+	ulong						i;
+	int							p, s;
+
+	for(p=0 ; p<prp_random->npools ; ++p) {
+		for(s=0 ; s<prp_random->nshards ; ++s) {
+			shard = &prp_random->pools[p].shards[s];
+			spin_lock(&shard->lock);
+			for(i=0 ; i<shard->used ; ) {
+				slot = &prp_random->slots[shard->start + i];
+				if(slot->mm) {
+					++i;
+					continue;
+				}
+				shard->used--;
+				*slot = prp_random->slots[shard->start + shard->used];
+				atomic_long_inc(&prp_random->pools[p].free_slots);
 			}
-		} else {
-			DA_ERROR("invalid page mapping %lx : %p : %p", c_addr, c_page, c_page->mapping);
+			spin_unlock(&shard->lock);
 		}
 	}
+}
 
-	return ret_execute_delay;
+/*  export_pages
+ *
+ *  Description:
+ *      Filled slots of every shard. Pages have no order and are all in list
+ *      0, victims are drawn at random.
+ */
+int export_pages(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg) {
+	struct prp_random_struct	* prp_random	= to_prp_random_struct(dime_instance->prp);
+	struct prp_random_shard		* shard;
+	struct prp_random_slot		* slot;
+	ulong						i;
+	int							s, ret			= 0;
+
+	for(s=0 ; s<prp_random->nshards * prp_random->npools ; ++s) {
+		shard = &prp_random->shards[s];
+		spin_lock(&shard->lock);
+		for(i=0 ; i<shard->used ; ++i) {
+			slot = &prp_random->slots[shard->start + i];
+			if(slot->mm && (ret = fn(arg, slot->mm, slot->address, 0)) != 0)
+				break;
+		}
+		spin_unlock(&shard->lock);
+		if(ret)
+			return ret;
+	}
+	return 0;
+}
+
+void restore_page(struct dime_instance_struct *dime_instance, struct mm_struct * c_mm, ulong c_addr, int list) {
+	add_page(dime_instance, c_mm, c_addr);
 }
 
 void clean_list (struct dime_instance_struct *dime_instance) {
-	int i;
+	ulong i;
 	struct prp_random_struct *prp_random = NULL;
 	DA_ENTRY();
 	prp_random = to_prp_random_struct(dime_instance->prp);
 	dime_instance->prp->add_page = NULL;
 
-	for(i=0 ; i<prp_random->lpl_size ; ++i) {
-		kfree(prp_random->lpl[i]);
+	for(i=0 ; i<prp_random->nslots ; ++i) {
+		ml_mm_release(prp_random->slots[i].mm);
 	}
-	kfree(prp_random->lpl);
+	vfree(prp_random->slots);
+	kfree(prp_random->shards);
 
 	dime_instance->prp = NULL;
 	DA_EXIT();
 }
 
 
+void get_stats (struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats) {
+	struct prp_random_struct *prp_random = to_prp_random_struct(dime_instance->prp);
+	ulong free_slots = 0;
+	int p;
+
+	for(p=0 ; p<prp_random->npools ; ++p)
+		free_slots += atomic_long_read(&prp_random->pools[p].free_slots);
+
+	stats->id = DIME_STATS_POLICY_RANDOM;
+	stats->count = DIME_STATS_RANDOM_COUNT;
+	stats->value[DIME_STATS_RANDOM_FREE_SLOTS]	= free_slots;
+	stats->value[DIME_STATS_RANDOM_NSLOTS]		= prp_random->nslots;
+	stats->value[DIME_STATS_RANDOM_NSHARDS]		= prp_random->nshards;
+}
+
+
+/*  init_pool
+ *
+ *  Description:
+ *      Splits npages slots from start evenly in shards of the pool and
+ *      seeds shard random generators.
+ */
+static void init_pool(struct prp_random_struct *prp_random, struct prp_random_pool *pool, ulong start, ulong npages) {
+	int i;
+
+	atomic_long_set(&pool->free_slots, npages);
+	for(i=0 ; i<prp_random->nshards ; ++i) {
+		struct prp_random_shard *shard = &pool->shards[i];
+		u64 seed;
+
+		get_random_bytes(&seed, sizeof(seed));
+		spin_lock_init(&shard->lock);
+		shard->start	= start;
+		shard->size		= npages / prp_random->nshards + (i < npages % prp_random->nshards ? 1 : 0);
+		shard->used		= 0;
+		prandom_seed_state(&shard->rnd, seed);
+		start += shard->size;
+	}
+}
+
 int init_module (void) {
 	int ret = 0;
-	int i, j;
+	int i, p;
+	ulong start, class_npages[DIME_PAGE_CLASSES];
 	DA_ENTRY();
 
 	for(i=0 ; i<dime.dime_instances_size ; ++i) {
@@ -130,23 +273,51 @@ int init_module (void) {
 			.prp = {
 				.add_page 	= add_page,
 				.clean 		= clean_list,
+				.get_stats	= get_stats,
+				.export_pages	= export_pages,
+				.restore_page	= restore_page,
+				.drop_unowned	= drop_unowned,
+				.owner		= THIS_MODULE,
 			},
-			.lpl			= NULL,
-			.lpl_size		= dime.dime_instances[i].local_npages,
-			.lock			= __RW_LOCK_UNLOCKED(prp_random->lock),
+			.slots			= NULL,
+			.nslots			= dime_local_npages(&dime.dime_instances[i]),
+			.shards			= NULL,
+			.nshards		= 1,
+			.npools			= 1,
 		};
 
-		prp_random->lpl = (struct lpl_node_struct **) kmalloc(sizeof(struct lpl_node_struct *) * dime.dime_instances[i].local_npages, GFP_KERNEL);
-		if(!prp_random->lpl) {
+		// class quotas are fixed at load time, pool of each class gets its share of slots
+		for(p=0 ; p<DIME_PAGE_CLASSES ; ++p)
+			class_npages[p] = dime_class_npages(&dime.dime_instances[i], p);
+		if(class_npages[DIME_PAGE_ANON] && class_npages[DIME_PAGE_CACHE]) {
+			prp_random->npools = DIME_PAGE_CLASSES;
+			prp_random->nslots = class_npages[DIME_PAGE_ANON] + class_npages[DIME_PAGE_CACHE];
+		}
+
+		// one shard per possible cpu, but as few as needed so that each one
+		// keeps PRP_RANDOM_SHARD_MIN_SLOTS slots of its smallest pool to pick victims from
+		prp_random->nshards = (int) clamp_t(ulong,
+				(prp_random->npools > 1 ? min(class_npages[DIME_PAGE_ANON], class_npages[DIME_PAGE_CACHE]) : prp_random->nslots)
+					/ PRP_RANDOM_SHARD_MIN_SLOTS,
+				1, nr_cpu_ids);
+
+		prp_random->shards = (struct prp_random_shard *) kcalloc(prp_random->nshards * prp_random->npools, sizeof(struct prp_random_shard), GFP_KERNEL);
+		prp_random->slots = (struct prp_random_slot *) vzalloc(sizeof(struct prp_random_slot) * (prp_random->nslots ? prp_random->nslots : 1));
+		if(!prp_random->shards || !prp_random->slots) {
 			DA_ERROR("unable to allocate memory");
+			kfree(prp_random->shards);
+			vfree(prp_random->slots);
+			kfree(prp_random);
 			return -1; // TODO:: Error codes
 		}
-		for(j=0 ; j<prp_random->lpl_size ; ++j) {
-			prp_random->lpl[j] = (struct lpl_node_struct *) kmalloc(sizeof(struct lpl_node_struct), GFP_KERNEL);
-			*prp_random->lpl[j] = (struct lpl_node_struct) {0};
-			prp_random->lpl[j]->lock = __SPIN_LOCK_UNLOCKED(prp_random->lpl[j]->lock);
+		for(p=0, start=0 ; p<prp_random->npools ; ++p) {
+			ulong npages = prp_random->npools > 1 ? class_npages[p] : prp_random->nslots;
+
+			prp_random->pools[p].shards = prp_random->shards + p * prp_random->nshards;
+			init_pool(prp_random, &prp_random->pools[p], start, npages);
+			start += npages;
 		}
-//		rwlock_init(&(prp_random->lock));
+
 		dime.dime_instances[i].prp = &(prp_random->prp);
 	}
 
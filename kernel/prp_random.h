@@ -1,18 +1,62 @@
 #ifndef __DA_LOCAL_PAGE_LIST_H__
 #define __DA_LOCAL_PAGE_LIST_H__
 
+#include <linux/random.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,9,0)
+#include <linux/prandom.h>
+#endif
+
 #include "common.h"
 
+// fewest slots of a shard, victim is drawn from slots of the faulting cpu's shard only
+#define PRP_RANDOM_SHARD_MIN_SLOTS	64
+
+struct prp_random_slot {
+	struct mm_struct	*mm;			// owner mm, holds mm_count reference
+	ulong				address;
+};
+
+/*
+ *  Slice of slots of a cpu, or of a few cpus if local memory is small. Faults
+ *  on a cpu fill and evict in its own shard, so threads on different cpus do
+ *  not contend on the same lock.
+ */
+struct prp_random_shard {
+	spinlock_t			lock;
+	ulong				start;			// first slot of shard in prp_random_struct.slots
+	ulong				size;			// slots in shard
+	ulong				used;			// slots filled, [start, start+used) hold pages
+	struct rnd_state	rnd;			// victim selection, protected by lock
+} ____cacheline_aligned_in_smp;
+
+/*
+ *  Local pages of one page class, or of all pages if there are no class
+ *  quotas. Pages are placed and evicted only within their pool.
+ */
+struct prp_random_pool {
+	struct prp_random_shard	*shards;	// nshards shards of pool
+	atomic_long_t			free_slots;	// slots not yet filled over all shards of pool
+};
+
 struct prp_random_struct {
 	struct page_replacement_policy_struct prp;
 
-	struct lpl_node_struct **lpl;
-	unsigned long lpl_size;			// Max size of array allocated
-	
-	rwlock_t lock;
+	struct prp_random_slot	*slots;		// contiguous array of local_npages slots
+	ulong					nslots;
+	struct prp_random_shard	*shards;	// nshards in each pool
+	int						nshards;	// shards per pool, up to one per possible cpu
+
+	// one pool per page class if class quotas were set at load time, else only pools[0]
+	struct prp_random_pool	pools[DIME_PAGE_CLASSES];
+	int						npools;
 };
 
-int		add_page	(struct dime_instance_struct *dime_instance, struct pid * pid_s, ulong c_addr);		// Returns 1 if delay should be injected, else 0
+int		add_page	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong c_addr);		// Returns 1 if delay should be injected, else 0
 void	clean_list	(struct dime_instance_struct *dime_instance);
+void	get_stats	(struct dime_instance_struct *dime_instance, struct dime_stats_policy *stats);
+int		export_pages	(struct dime_instance_struct *dime_instance, dime_export_fn fn, void *arg);
+void	restore_page	(struct dime_instance_struct *dime_instance, struct mm_struct * mm, ulong c_addr, int list);
+void	drop_unowned	(struct dime_instance_struct *dime_instance);
 
 #endif//__DA_LOCAL_PAGE_LIST_H__
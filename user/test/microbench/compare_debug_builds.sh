@@ -0,0 +1,79 @@
+#!/bin/bash
+
+# Compares fault path overhead of debug log build variants of DiME :
+#	runtime : every log call tests da_debug_flag
+#	static  : log levels are static keys patched when da_debug_flag changes
+#	off     : static keys, DA_ENTRY/DA_EXIT/DA_DEBUG compiled out
+# Run as root :
+#	./compare_debug_builds.sh [npages] [fault hook] [debug variants..]
+# Cycles are kernel mode cycles of the benchmark while it faults, counted
+# by perf stat, so they cover the whole fault path, not only DiME hooks.
+
+# Change pwd to script path
+SCRIPT_PATH="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+KERNEL_PATH=$SCRIPT_PATH/../../../kernel
+
+npages=${1:-20000}
+hook=${2:-kprobe}
+shift $(( $# < 2 ? $# : 2 ))
+variants=${@:-runtime static off}
+
+# latency and transmission delay are set to zero, only hook and policy overhead remains
+latency_ns=0
+bandwidth_bps=100000000000000000
+local_npages=$((npages / 2))
+# alert, warning, error and info, same enabled levels for all variants
+da_debug_flag=15
+perf_out=`mktemp`
+
+function remove_modules {
+	for module in prp_fifo_module kmodule
+	do
+		if [ `lsmod | grep "^$module " | wc -l` -gt 0 ]
+		then
+			rmmod $module || exit 1
+		fi
+	done
+}
+
+function run_variant {
+	variant=$1
+
+	echo "[SH]:	Building $variant debug logs.."
+	make -C $KERNEL_PATH clean > /dev/null
+	make -C $KERNEL_PATH DIME_FAULT_HOOK=$hook DIME_DEBUG=$variant > /dev/null || exit 1
+
+	$SCRIPT_PATH/test_microbench $npages > /dev/null &
+	pid=$!
+	sleep 3
+
+	remove_modules
+	insmod $KERNEL_PATH/kmodule.ko pid=$pid latency_ns=$latency_ns local_npages=$local_npages bandwidth_bps=$bandwidth_bps da_debug_flag=$da_debug_flag || exit 1
+	insmod $KERNEL_PATH/prp_fifo_module.ko || exit 1
+
+	# count kernel cycles from the start signal until the benchmark exits
+	: > $perf_out
+	perf stat -x, -e cycles:k -o $perf_out -p $pid > /dev/null 2>&1 &
+	perf_pid=$!
+	sleep 1
+	kill -USR1 $pid
+	wait $pid
+	wait $perf_pid
+
+	# columns : page_fault_count time_ap_ppf time_pfh_ap_inject_ppf
+	stats=(`cat /proc/dime_config | awk '{if($1=="0") print $5, $15, $18}'`)
+	remove_modules
+
+	# "-" if perf is missing or cycles are not counted, e.g. in a VM without PMU
+	cycles=`awk -F, -v faults=${stats[0]} '$3 ~ /^cycles/ && $1 ~ /^[0-9]+$/ && faults > 0 {printf "%.0f", $1 / faults}' $perf_out 2>/dev/null`
+	printf "%-8s %12s %12s %14s %16s\n" $variant ${stats[0]} ${stats[1]} ${stats[2]} ${cycles:--}
+}
+
+echo never > /sys/kernel/mm/transparent_hugepage/enabled
+
+printf "%-8s %12s %12s %14s %16s\n" "debug" "page_faults" "ap_ns/fault" "total_ns/fault" "kcycles/fault"
+for variant in $variants
+do
+	run_variant $variant
+done
+rm -f $perf_out
@@ -0,0 +1,65 @@
+#!/bin/bash
+
+# Compares per page fault overhead of the fault hook variants of DiME.
+# "patch" needs the patched 4.9.44 kernel (kernel/fault.c.diff), "kprobe"
+# works on any kernel. Run as root from a kernel where both are possible to
+# compare them, otherwise pass only the available one:
+#	./compare_fault_hooks.sh [npages] [hook variants..]
+
+# Change pwd to script path
+SCRIPT_PATH="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+KERNEL_PATH=$SCRIPT_PATH/../../../kernel
+
+npages=${1:-20000}
+shift
+variants=${@:-patch kprobe}
+
+# latency and transmission delay are set to zero, only hook and policy overhead remains
+latency_ns=0
+bandwidth_bps=100000000000000000
+local_npages=$((npages / 2))
+
+function remove_modules {
+	for module in prp_fifo_module kmodule
+	do
+		if [ `lsmod | grep "^$module " | wc -l` -gt 0 ]
+		then
+			rmmod $module || exit 1
+		fi
+	done
+}
+
+function run_variant {
+	variant=$1
+
+	echo "[SH]:	Building $variant fault hook.."
+	make -C $KERNEL_PATH clean > /dev/null
+	make -C $KERNEL_PATH DIME_FAULT_HOOK=$variant > /dev/null || exit 1
+
+	$SCRIPT_PATH/test_microbench $npages > /dev/null &
+	pid=$!
+	sleep 3
+
+	remove_modules
+	insmod $KERNEL_PATH/kmodule.ko pid=$pid latency_ns=$latency_ns local_npages=$local_npages bandwidth_bps=$bandwidth_bps || exit 1
+	insmod $KERNEL_PATH/prp_fifo_module.ko || exit 1
+
+	start_time_ns=`date +%s%N`
+	kill -USR1 $pid
+	wait $pid
+	end_time_ns=`date +%s%N`
+
+	# columns : page_fault_count time_pfh_ppf time_ap_ppf time_pfh_ap_inject_ppf
+	stats=`cat /proc/dime_config | awk '{if($1=="0") print $5, $14, $15, $18}'`
+	remove_modules
+
+	printf "%-8s %12s %14s %14s %14s %16s\n" $variant $stats $(( (end_time_ns - start_time_ns) / 1000 ))
+}
+
+echo never > /sys/kernel/mm/transparent_hugepage/enabled
+
+printf "%-8s %12s %14s %14s %14s %16s\n" "hook" "page_faults" "pfh_ns/fault" "ap_ns/fault" "total_ns/fault" "wall_time_us"
+for variant in $variants
+do
+	run_variant $variant
+done
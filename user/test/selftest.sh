@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Runs in-kernel self test (kernel/da_selftest.c) against each page
+# replacement policy, no external workload needed. Run as root after
+# building kernel modules:
+#	./selftest.sh [local_npages] [policies..]
+# Exits non zero if any policy failed, details are in dmesg.
+#
+# The add_page benchmark fills local memory of the instance under test
+# with synthetic pages, evicting pages of processes tracked by it, so
+# run it on an instance with no workload attached. Synthetic pages are
+# dropped from the policy when the benchmark ends.
+
+# Change pwd to script path
+SCRIPT_PATH="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+KERNEL_PATH=$SCRIPT_PATH/../../kernel
+
+local_npages=${1:-2000}
+shift
+policies=${@:-fifo lru random arc}
+
+# zero delay, only hook and policy overhead remains
+latency_ns=0
+bandwidth_bps=100000000000000000
+
+function remove_modules {
+	for module in dime_selftest_module prp_fifo_module prp_lru_module prp_random_module prp_arc_module kmodule
+	do
+		if [ `lsmod | grep "^$module " | wc -l` -gt 0 ]
+		then
+			rmmod $module || exit 1
+		fi
+	done
+}
+
+# huge pages would map many pages per fault
+echo never > /sys/kernel/mm/transparent_hugepage/enabled
+
+failed=0
+for policy in $policies
+do
+	remove_modules
+	insmod $KERNEL_PATH/kmodule.ko latency_ns=$latency_ns local_npages=$local_npages bandwidth_bps=$bandwidth_bps || exit 1
+	insmod $KERNEL_PATH/prp_${policy}_module.ko || exit 1
+
+	dmesg -c > /dev/null
+	if insmod $KERNEL_PATH/dime_selftest_module.ko instance_id=0
+	then
+		echo "[SH]:	$policy passed"
+	else
+		echo "[SH]:	$policy FAILED"
+		failed=1
+	fi
+	dmesg | grep -E "selftest|sequential|strided|zipfian|shift|model|bounds|add_page"
+done
+
+remove_modules
+exit $failed
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/nbd.h>
+
+/*****
+ *
+ *  Memory server of DiME tier=offload. Serves an nbd device over a UNIX
+ *  socket pair and keeps its blocks in own memory, so the device can be
+ *  used as swap standing in for remote memory.
+ *      dime_memserver [-d nbd_device] [-s size_mb] [-i stats_interval_s]
+ *  Memory of a block is taken when it is first written and given back when
+ *  swap discards it. Then, as root,
+ *      mkswap /dev/nbd0 && swapon --discard -p 32767 /dev/nbd0
+ *  makes evicted pages go to this server. Memory of the server is locked,
+ *  so it is never swapped to itself. The device also becomes first swap
+ *  target of global reclaim, which then waits on this process while it
+ *  allocates memory for blocks, so it is meant for a test host where it is
+ *  the only swap area and memory is not overcommitted.
+ *
+ */
+
+#define BLOCK_SIZE          4096
+
+// nbd transmission phase, all fields big endian
+#define REQUEST_MAGIC       0x25609513
+#define REPLY_MAGIC         0x67446698
+#define CMD_MASK            0xffff
+
+struct nbd_req {
+    uint32_t    magic;
+    uint32_t    type;
+    uint64_t    handle;
+    uint64_t    from;
+    uint32_t    len;
+} __attribute__((packed));
+
+struct nbd_rep {
+    uint32_t    magic;
+    uint32_t    error;
+    uint64_t    handle;
+} __attribute__((packed));
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT         4
+#endif
+#ifndef MLOCK_ONFAULT
+#define MLOCK_ONFAULT       1
+#endif
+
+struct server {
+    char        *arena;         // blocks of the device
+    uint8_t     *held;          // block has been written and not discarded
+    uint64_t    size;
+    uint64_t    nblocks;
+    uint64_t    held_blocks;
+    uint64_t    reads, writes, trims;
+    uint64_t    read_bytes, write_bytes;
+};
+
+static volatile sig_atomic_t stop = 0;
+static int nbd_fd = -1;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-d nbd_device] [-s size_mb] [-i stats_interval_s]\n", prog);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// kernel sends NBD_CMD_DISC on disconnect, which ends serve loop
+static void on_signal(int sig) {
+    (void) sig;
+    stop = 1;
+    if(nbd_fd >= 0)
+        ioctl(nbd_fd, NBD_DISCONNECT);
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while(len) {
+        ssize_t n = read(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while(len) {
+        ssize_t n = write(fd, p, len);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void print_stats(const struct server *srv) {
+    printf("held_pages %llu reads %llu writes %llu trims %llu read_bytes %llu write_bytes %llu\n",
+            (unsigned long long) srv->held_blocks, (unsigned long long) srv->reads,
+            (unsigned long long) srv->writes, (unsigned long long) srv->trims,
+            (unsigned long long) srv->read_bytes, (unsigned long long) srv->write_bytes);
+    fflush(stdout);
+}
+
+static void mark_blocks(struct server *srv, uint64_t from, uint64_t len, int held) {
+    uint64_t b;
+    for(b = from / BLOCK_SIZE ; b < (from + len + BLOCK_SIZE - 1) / BLOCK_SIZE ; ++b) {
+        if(srv->held[b] != held) {
+            srv->held[b] = held;
+            srv->held_blocks += held ? 1 : -1;
+        }
+    }
+}
+
+// gives memory of whole blocks in range back, they read as zero afterwards
+static void discard(struct server *srv, uint64_t from, uint64_t len) {
+    uint64_t start = (from + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    uint64_t end = (from + len) / BLOCK_SIZE * BLOCK_SIZE;
+
+    if(end <= start)
+        return;
+    // locked memory cannot be dropped, range is locked again on next write
+    munlock(srv->arena + start, end - start);
+    madvise(srv->arena + start, end - start, MADV_DONTNEED);
+    syscall(SYS_mlock2, srv->arena + start, end - start, MLOCK_ONFAULT);
+    mark_blocks(srv, start, end - start, 0);
+}
+
+static int serve(struct server *srv, int sock, double interval) {
+    struct nbd_req req;
+    struct nbd_rep rep;
+    double next = interval > 0 ? now_s() + interval : 0;
+
+    while(!stop) {
+        uint32_t type, len;
+        uint64_t from;
+
+        if(read_all(sock, &req, sizeof(req)))
+            return stop ? 0 : -1;
+        if(be32toh(req.magic) != REQUEST_MAGIC) {
+            fprintf(stderr, "bad request magic %x\n", be32toh(req.magic));
+            return -1;
+        }
+        type = be32toh(req.type) & CMD_MASK;
+        from = be64toh(req.from);
+        len = be32toh(req.len);
+
+        rep.magic = htobe32(REPLY_MAGIC);
+        rep.error = 0;
+        rep.handle = req.handle;
+        if(type != NBD_CMD_DISC && (from > srv->size || len > srv->size - from))
+            rep.error = htobe32(EINVAL);
+
+        switch(type) {
+        case NBD_CMD_READ:
+            if(write_all(sock, &rep, sizeof(rep)) || (!rep.error && write_all(sock, srv->arena + from, len)))
+                return -1;
+            srv->reads++;
+            srv->read_bytes += len;
+            break;
+        case NBD_CMD_WRITE:
+            if(rep.error) {
+                fprintf(stderr, "write out of device, from %llu len %u\n", (unsigned long long) from, len);
+                return -1;      // payload can not be skipped safely
+            }
+            if(read_all(sock, srv->arena + from, len))
+                return -1;
+            mark_blocks(srv, from, len, 1);
+            srv->writes++;
+            srv->write_bytes += len;
+            if(write_all(sock, &rep, sizeof(rep)))
+                return -1;
+            break;
+        case NBD_CMD_TRIM:
+            if(!rep.error) {
+                discard(srv, from, len);
+                srv->trims++;
+            }
+            if(write_all(sock, &rep, sizeof(rep)))
+                return -1;
+            break;
+        case NBD_CMD_FLUSH:
+            if(write_all(sock, &rep, sizeof(rep)))
+                return -1;
+            break;
+        case NBD_CMD_DISC:
+            return 0;
+        default:
+            rep.error = htobe32(EINVAL);
+            if(write_all(sock, &rep, sizeof(rep)))
+                return -1;
+        }
+
+        if(next && now_s() >= next) {
+            print_stats(srv);
+            next += interval;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = "/dev/nbd0";
+    uint64_t size_mb = 1024;
+    double interval = 0;
+    struct server srv;
+    int opt, sv[2], ret;
+    pid_t child;
+
+    while((opt = getopt(argc, argv, "d:s:i:h")) != -1) {
+        switch(opt) {
+        case 'd': device = optarg; break;
+        case 's': size_mb = strtoull(optarg, NULL, 0); break;
+        case 'i': interval = atof(optarg); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if(size_mb == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    memset(&srv, 0, sizeof(srv));
+    srv.size = size_mb << 20;
+    srv.nblocks = srv.size / BLOCK_SIZE;
+    srv.arena = mmap(NULL, srv.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    srv.held = calloc(srv.nblocks, 1);
+    if(srv.arena == MAP_FAILED || !srv.held) {
+        fprintf(stderr, "could not allocate %llu MB\n", (unsigned long long) size_mb);
+        return 1;
+    }
+    // pages held for swap must never be swapped themselves
+    if(mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT)) {
+        perror("mlockall");
+        return 1;
+    }
+
+    nbd_fd = open(device, O_RDWR);
+    if(nbd_fd < 0) {
+        perror(device);
+        return 1;
+    }
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+        perror("socketpair");
+        return 1;
+    }
+    ioctl(nbd_fd, NBD_CLEAR_SOCK);
+    if(ioctl(nbd_fd, NBD_SET_BLKSIZE, (unsigned long) BLOCK_SIZE) ||
+            ioctl(nbd_fd, NBD_SET_SIZE_BLOCKS, (unsigned long) srv.nblocks) ||
+            ioctl(nbd_fd, NBD_SET_FLAGS, (unsigned long) (NBD_FLAG_HAS_FLAGS | NBD_FLAG_SEND_FLUSH | NBD_FLAG_SEND_TRIM)) ||
+            ioctl(nbd_fd, NBD_SET_SOCK, sv[0])) {
+        perror("nbd setup");
+        return 1;
+    }
+
+    // NBD_DO_IT runs the device until disconnect, in its own process
+    child = fork();
+    if(child < 0) {
+        perror("fork");
+        return 1;
+    }
+    if(child == 0) {
+        close(sv[1]);
+        if(ioctl(nbd_fd, NBD_DO_IT) && errno != EPIPE)
+            perror("NBD_DO_IT");
+        ioctl(nbd_fd, NBD_CLEAR_QUE);
+        ioctl(nbd_fd, NBD_CLEAR_SOCK);
+        _exit(0);
+    }
+    close(sv[0]);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("serving %s, %llu MB\n", device, (unsigned long long) size_mb);
+    fflush(stdout);
+
+    ret = serve(&srv, sv[1], interval);
+    if(ret)
+        fprintf(stderr, "connection lost\n");
+    if(!stop)
+        ioctl(nbd_fd, NBD_DISCONNECT);
+    close(sv[1]);
+    waitpid(child, NULL, 0);
+    print_stats(&srv);
+    return ret ? 1 : 0;
+}
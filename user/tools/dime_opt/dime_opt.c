@@ -0,0 +1,520 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/*****
+ *
+ *  Computes fault counts of Belady's OPT (MIN) replacement for a trace of
+ *  page accesses, and of FIFO, LRU and random on the same trace, for a sweep
+ *  of local sizes.
+ *      dime_opt [-l local_npages,...] [-i instance_id] [-p page_shift] [-s seed] [trace]
+ *  Trace is read from file or stdin. Each line is one of
+ *      perf script output of dime:dime_fault_start, pid is taken from perf
+ *          columns, faults with emulated=0 are skipped
+ *      valgrind lackey output, " L 7ff000398,8"
+ *      "[pid] address", address in hex
+ *  Without -l, local sizes are powers of two up to the number of pages.
+ *
+ */
+
+#define NEVER       UINT32_MAX
+#define NONE        UINT32_MAX
+
+struct trace {
+    uint32_t    *ids;           // dense page id of each access
+    uint32_t    *next;          // index of next access of same page, NEVER if none
+    size_t      nevents;
+    size_t      capacity;
+    size_t      npages;
+};
+
+// (pid, page) to dense id, open addressing
+struct page_map {
+    uint64_t    *keys;
+    uint32_t    *ids;
+    size_t      capacity;       // power of two
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-l local_npages,...] [-i instance_id] [-p page_shift] [-s seed] [trace]\n", prog);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *xmalloc(size_t size) {
+    void *p = malloc(size ? size : 1);
+    if(!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if(!p) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static inline uint64_t hash_key(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void page_map_init(struct page_map *map, size_t capacity) {
+    map->capacity = capacity;
+    map->keys = xmalloc(sizeof(uint64_t) * capacity);
+    map->ids = xmalloc(sizeof(uint32_t) * capacity);
+    memset(map->ids, 0xff, sizeof(uint32_t) * capacity);
+}
+
+// doubles capacity, called when map is half full
+static void page_map_grow(struct page_map *map) {
+    struct page_map old = *map;
+    size_t i;
+
+    page_map_init(map, old.capacity * 2);
+    for(i=0 ; i<old.capacity ; ++i) {
+        if(old.ids[i] != NONE) {
+            size_t slot = hash_key(old.keys[i]) & (map->capacity - 1);
+            while(map->ids[slot] != NONE)
+                slot = (slot + 1) & (map->capacity - 1);
+            map->keys[slot] = old.keys[i];
+            map->ids[slot] = old.ids[i];
+        }
+    }
+    free(old.keys);
+    free(old.ids);
+}
+
+// returns id of key, new pages get next id
+static uint32_t page_map_get(struct page_map *map, uint64_t key, size_t *npages) {
+    size_t slot;
+
+    if(*npages * 2 >= map->capacity)
+        page_map_grow(map);
+
+    slot = hash_key(key) & (map->capacity - 1);
+    while(map->ids[slot] != NONE) {
+        if(map->keys[slot] == key)
+            return map->ids[slot];
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->keys[slot] = key;
+    map->ids[slot] = (uint32_t) (*npages)++;
+    return map->ids[slot];
+}
+
+
+/*
+ *
+ *  Trace parsing
+ *
+ */
+
+// pid of perf script line, number before " [cpu]" or before "/tid", 0 if not found
+static uint64_t perf_pid(const char *line, const char *event) {
+    const char *p = event;
+
+    while(p > line && *p != '[')
+        --p;
+    if(p == line)
+        return 0;
+    --p;
+    while(p > line && *p == ' ')
+        --p;
+    while(p > line && p[-1] >= '0' && p[-1] <= '9')
+        --p;
+    if(p > line && p[-1] == '/') {
+        // "pid/tid", skip tid
+        p -= 2;
+        while(p > line && p[-1] >= '0' && p[-1] <= '9')
+            --p;
+    }
+    return strtoull(p, NULL, 10);
+}
+
+/*  parse_line
+ *
+ *  Description:
+ *      Returns 1 and fills pid and address if line is a page access of
+ *      instance_id (any instance if negative), else 0.
+ */
+static int parse_line(char *line, long instance_id, uint64_t *pid, uint64_t *address) {
+    char *p = line, *end, *field;
+    uint64_t first;
+
+    while(*p == ' ' || *p == '\t')
+        ++p;
+    if(*p == '\0' || *p == '\n' || *p == '#')
+        return 0;
+
+    if((field = strstr(p, "dime_fault_start:")) != NULL) {
+        char *instance = strstr(field, "instance="), *addr = strstr(field, "address="), *emulated = strstr(field, "emulated=");
+
+        if(!addr || (emulated && emulated[9] == '0'))
+            return 0;       // page was already in local list, no remote access
+        if(instance_id >= 0 && instance && strtol(instance + 9, NULL, 10) != instance_id)
+            return 0;
+        *pid = perf_pid(line, field);
+        *address = strtoull(addr + 8, NULL, 16);
+        return 1;
+    }
+
+    if((*p == 'I' || *p == 'L' || *p == 'S' || *p == 'M') && p[1] == ' ') {
+        // valgrind lackey
+        *pid = 0;
+        *address = strtoull(p + 2, &end, 16);
+        return end != p + 2;
+    }
+
+    first = strtoull(p, &end, 16);
+    if(end == p)
+        return 0;
+    while(*end == ' ' || *end == '\t')
+        ++end;
+    if(*end == '\0' || *end == '\n') {
+        *pid = 0;
+        *address = first;
+        return 1;
+    }
+
+    // "pid address", pid was decimal
+    *pid = strtoull(p, NULL, 10);
+    *address = strtoull(end, &p, 16);
+    return p != end;
+}
+
+static void trace_append(struct trace *trace, uint32_t id) {
+    if(trace->nevents == trace->capacity) {
+        trace->capacity = trace->capacity ? 2 * trace->capacity : (1 << 20);
+        trace->ids = realloc(trace->ids, sizeof(uint32_t) * trace->capacity);
+        if(!trace->ids) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    trace->ids[trace->nevents++] = id;
+}
+
+static int trace_read(FILE *file, long instance_id, int page_shift, struct trace *trace) {
+    struct page_map map;
+    char *line = NULL;
+    size_t line_size = 0;
+    uint64_t pid, address;
+    ssize_t i;
+
+    memset(trace, 0, sizeof(*trace));
+    page_map_init(&map, 1 << 16);
+
+    while(getline(&line, &line_size, file) != -1) {
+        if(!parse_line(line, instance_id, &pid, &address))
+            continue;
+        if(trace->nevents == NEVER - 1) {
+            fprintf(stderr, "trace is truncated at %zu accesses\n", trace->nevents);
+            break;
+        }
+        trace_append(trace, page_map_get(&map, (pid << 40) ^ (address >> page_shift), &trace->npages));
+    }
+    free(line);
+    free(map.keys);
+    free(map.ids);
+
+    // next use of every access, walking backwards with last use of each page
+    trace->next = xmalloc(sizeof(uint32_t) * trace->nevents);
+    {
+        uint32_t *last = xmalloc(sizeof(uint32_t) * trace->npages);
+        memset(last, 0xff, sizeof(uint32_t) * trace->npages);
+        for(i=(ssize_t) trace->nevents-1 ; i>=0 ; --i) {
+            trace->next[i] = last[trace->ids[i]];
+            last[trace->ids[i]] = (uint32_t) i;
+        }
+        free(last);
+    }
+    return 0;
+}
+
+
+/*
+ *
+ *  Policies, each returns faults of trace with local pages
+ *
+ */
+
+/*  sim_opt
+ *
+ *  Description:
+ *      Belady's MIN, evicts resident page whose next use is farthest. Pages
+ *      are kept in a max heap on next use, indexed by page, so a hit updates
+ *      its page in place and heap never holds more than local pages.
+ */
+static uint64_t sim_opt(const struct trace *trace, size_t local) {
+    uint32_t *heap_next = xmalloc(sizeof(uint32_t) * local);
+    uint32_t *heap_id = xmalloc(sizeof(uint32_t) * local);
+    uint32_t *pos = xmalloc(sizeof(uint32_t) * trace->npages);
+    uint64_t faults = 0;
+    size_t size = 0, i, h, c;
+
+    memset(pos, 0xff, sizeof(uint32_t) * trace->npages);
+
+#define HEAP_SET(h, nx, id) do { heap_next[h] = (nx); heap_id[h] = (id); pos[id] = (uint32_t) (h); } while(0)
+
+    for(i=0 ; i<trace->nevents ; ++i) {
+        uint32_t id = trace->ids[i], nx = trace->next[i];
+
+        if(pos[id] != NONE) {
+            // next use only grows, sift up
+            h = pos[id];
+            while(h > 0 && heap_next[(h - 1) / 2] < nx) {
+                HEAP_SET(h, heap_next[(h - 1) / 2], heap_id[(h - 1) / 2]);
+                h = (h - 1) / 2;
+            }
+            HEAP_SET(h, nx, id);
+            continue;
+        }
+
+        faults++;
+        if(size < local) {
+            h = size++;
+            while(h > 0 && heap_next[(h - 1) / 2] < nx) {
+                HEAP_SET(h, heap_next[(h - 1) / 2], heap_id[(h - 1) / 2]);
+                h = (h - 1) / 2;
+            }
+            HEAP_SET(h, nx, id);
+            continue;
+        }
+
+        // evict root and sift new page down from there
+        pos[heap_id[0]] = NONE;
+        h = 0;
+        while((c = 2 * h + 1) < size) {
+            if(c + 1 < size && heap_next[c + 1] > heap_next[c])
+                c++;
+            if(heap_next[c] <= nx)
+                break;
+            HEAP_SET(h, heap_next[c], heap_id[c]);
+            h = c;
+        }
+        HEAP_SET(h, nx, id);
+    }
+
+#undef HEAP_SET
+
+    free(heap_next);
+    free(heap_id);
+    free(pos);
+    return faults;
+}
+
+static uint64_t sim_fifo(const struct trace *trace, size_t local) {
+    uint32_t *ring = xmalloc(sizeof(uint32_t) * local);
+    uint8_t *resident = xcalloc(trace->npages, 1);
+    uint64_t faults = 0;
+    size_t size = 0, head = 0, i;
+
+    for(i=0 ; i<trace->nevents ; ++i) {
+        uint32_t id = trace->ids[i];
+
+        if(resident[id])
+            continue;
+        faults++;
+        if(size == local) {
+            resident[ring[head]] = 0;
+            ring[head] = id;
+            head = (head + 1) % local;
+        } else {
+            ring[size++] = id;
+        }
+        resident[id] = 1;
+    }
+
+    free(ring);
+    free(resident);
+    return faults;
+}
+
+// exact LRU, doubly linked list over page ids, most recent at head
+static uint64_t sim_lru(const struct trace *trace, size_t local) {
+    uint32_t *prev = xmalloc(sizeof(uint32_t) * trace->npages);
+    uint32_t *next = xmalloc(sizeof(uint32_t) * trace->npages);
+    uint8_t *resident = xcalloc(trace->npages, 1);
+    uint32_t head = NONE, tail = NONE;
+    uint64_t faults = 0;
+    size_t size = 0, i;
+
+    for(i=0 ; i<trace->nevents ; ++i) {
+        uint32_t id = trace->ids[i];
+
+        if(resident[id]) {
+            if(id == head)
+                continue;
+            // unlink
+            next[prev[id]] = next[id];
+            if(next[id] != NONE)
+                prev[next[id]] = prev[id];
+            else
+                tail = prev[id];
+        } else {
+            faults++;
+            if(size == local) {
+                uint32_t victim = tail;
+                tail = prev[victim];
+                if(tail != NONE)
+                    next[tail] = NONE;
+                else
+                    head = NONE;
+                resident[victim] = 0;
+            } else {
+                size++;
+            }
+            resident[id] = 1;
+        }
+
+        // push at head
+        prev[id] = NONE;
+        next[id] = head;
+        if(head != NONE)
+            prev[head] = id;
+        head = id;
+        if(tail == NONE)
+            tail = id;
+    }
+
+    free(prev);
+    free(next);
+    free(resident);
+    return faults;
+}
+
+static inline uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static uint64_t sim_random(const struct trace *trace, size_t local, uint64_t seed) {
+    uint32_t *slots = xmalloc(sizeof(uint32_t) * local);
+    uint8_t *resident = xcalloc(trace->npages, 1);
+    uint64_t faults = 0, state = seed ? seed : 1;
+    size_t size = 0, i;
+
+    for(i=0 ; i<trace->nevents ; ++i) {
+        uint32_t id = trace->ids[i];
+
+        if(resident[id])
+            continue;
+        faults++;
+        if(size == local) {
+            size_t s = xorshift64(&state) % local;
+            resident[slots[s]] = 0;
+            slots[s] = id;
+        } else {
+            slots[size++] = id;
+        }
+        resident[id] = 1;
+    }
+
+    free(slots);
+    free(resident);
+    return faults;
+}
+
+static double gap_pct(uint64_t faults, uint64_t opt) {
+    return opt ? (100.0 * ((double) faults - (double) opt)) / (double) opt : 0.0;
+}
+
+int main(int argc, char *argv[]) {
+    struct trace trace;
+    size_t *sizes = NULL, nsizes = 0, i;
+    long instance_id = -1;
+    int page_shift = 12, opt;
+    uint64_t seed = 1;
+    double start, opt_time = 0;
+    FILE *file = stdin;
+    char *sizes_arg = NULL;
+
+    while((opt = getopt(argc, argv, "l:i:p:s:h")) != -1) {
+        switch(opt) {
+        case 'l': sizes_arg = optarg; break;
+        case 'i': instance_id = strtol(optarg, NULL, 10); break;
+        case 'p': page_shift = (int) strtol(optarg, NULL, 10); break;
+        case 's': seed = strtoull(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(optind < argc) {
+        file = fopen(argv[optind], "r");
+        if(!file) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+
+    start = now_s();
+    trace_read(file, instance_id, page_shift, &trace);
+    if(file != stdin)
+        fclose(file);
+    fprintf(stderr, "read %zu accesses of %zu pages in %.2fs\n", trace.nevents, trace.npages, now_s() - start);
+    if(trace.nevents == 0)
+        return 1;
+
+    if(sizes_arg) {
+        char *token, *rest = sizes_arg;
+        sizes = xmalloc(sizeof(size_t) * (strlen(sizes_arg) / 2 + 1));
+        while((token = strsep(&rest, ",")) != NULL) {
+            if(*token && strtoull(token, NULL, 10) > 0)
+                sizes[nsizes++] = strtoull(token, NULL, 10);
+        }
+    } else {
+        size_t local;
+        sizes = xmalloc(sizeof(size_t) * 66);
+        for(local=1 ; local<trace.npages ; local*=2)
+            sizes[nsizes++] = local;
+        sizes[nsizes++] = trace.npages;
+    }
+
+    printf("# accesses %zu pages %zu\n", trace.nevents, trace.npages);
+    printf("%12s %12s %12s %12s %12s %9s %9s %9s\n", "local_npages", "opt", "fifo", "lru", "random", "fifo_gap%", "lru_gap%", "rand_gap%");
+    for(i=0 ; i<nsizes ; ++i) {
+        uint64_t f_opt, f_fifo, f_lru, f_random;
+
+        start = now_s();
+        f_opt = sim_opt(&trace, sizes[i]);
+        opt_time += now_s() - start;
+        f_fifo = sim_fifo(&trace, sizes[i]);
+        f_lru = sim_lru(&trace, sizes[i]);
+        f_random = sim_random(&trace, sizes[i], seed);
+
+        printf("%12zu %12llu %12llu %12llu %12llu %9.2f %9.2f %9.2f\n", sizes[i],
+                (unsigned long long) f_opt, (unsigned long long) f_fifo,
+                (unsigned long long) f_lru, (unsigned long long) f_random,
+                gap_pct(f_fifo, f_opt), gap_pct(f_lru, f_opt), gap_pct(f_random, f_opt));
+        fflush(stdout);
+    }
+    if(opt_time > 0)
+        fprintf(stderr, "opt : %.1f M accesses/s\n", (double) trace.nevents * nsizes / opt_time / 1e6);
+
+    free(sizes);
+    free(trace.ids);
+    free(trace.next);
+    return 0;
+}
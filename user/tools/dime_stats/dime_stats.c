@@ -0,0 +1,122 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "dime_stats_lib.h"
+
+/*****
+ *
+ *  Prints binary stats snapshots of DiME instances.
+ *      dime_stats [-i instance_id] [-n interval_ms] [-c count]
+ *  Without -i all instances are printed. With -n snapshots are repeated
+ *  every interval_ms, -c limits number of rounds (0 runs until killed).
+ *
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-i instance_id] [-n interval_ms] [-c count]\n", prog);
+}
+
+static void print_instance(const struct dime_stats_instance *s) {
+    __u32 i;
+
+    printf("instance %u ts_ns %llu pids %u\n", s->instance_id, (unsigned long long) s->timestamp_ns, s->pid_count);
+    printf("\tlatency_ns %llu bandwidth_bps %llu local_npages %llu\n",
+            (unsigned long long) s->latency_ns, (unsigned long long) s->bandwidth_bps,
+            (unsigned long long) s->local_npages);
+    printf("\tpagefaults %llu duplicate_pfs %llu pc_pagefaults %llu an_pagefaults %llu\n",
+            (unsigned long long) s->pagefaults, (unsigned long long) s->duplicate_pfs,
+            (unsigned long long) s->pc_pagefaults, (unsigned long long) s->an_pagefaults);
+    printf("\ttime_pfh %llu time_ap %llu time_inject %llu time_pfh_ap %llu time_pfh_ap_inject %llu\n",
+            (unsigned long long) s->time_pfh, (unsigned long long) s->time_ap,
+            (unsigned long long) s->time_inject, (unsigned long long) s->time_pfh_ap,
+            (unsigned long long) s->time_pfh_ap_inject);
+    printf("\tan_time_inject %llu pc_time_inject %llu shared_pfs %llu\n",
+            (unsigned long long) s->an_time_inject, (unsigned long long) s->pc_time_inject,
+            (unsigned long long) s->shared_pfs);
+    printf("\tadm_admitted %llu adm_rejected %llu time_queue %llu\n",
+            (unsigned long long) s->adm_admitted, (unsigned long long) s->adm_rejected,
+            (unsigned long long) s->time_queue);
+    printf("\tfabric_losses %llu fabric_brownouts %llu fabric_spikes %llu time_fabric %llu\n",
+            (unsigned long long) s->fabric_losses, (unsigned long long) s->fabric_brownouts,
+            (unsigned long long) s->fabric_spikes, (unsigned long long) s->time_fabric);
+    printf("\toffload_pages %llu offload_failed %llu offload_fetches %llu time_fetch %llu\n",
+            (unsigned long long) s->offload_pages, (unsigned long long) s->offload_failed,
+            (unsigned long long) s->offload_fetches, (unsigned long long) s->time_fetch);
+    printf("\tcompress_stored %llu compress_rejected %llu compress_evicted %llu compress_hits %llu\n",
+            (unsigned long long) s->compress_stored, (unsigned long long) s->compress_rejected,
+            (unsigned long long) s->compress_evicted, (unsigned long long) s->compress_hits);
+    printf("\ttime_compress %llu time_decompress %llu\n",
+            (unsigned long long) s->time_compress, (unsigned long long) s->time_decompress);
+    printf("\tpool_npages %llu pool_bytes %llu pool_alloc_bytes %llu\n",
+            (unsigned long long) s->pool_npages, (unsigned long long) s->pool_bytes,
+            (unsigned long long) s->pool_alloc_bytes);
+    printf("\twarm_restored %llu warm_skipped %llu\n",
+            (unsigned long long) s->warm_restored, (unsigned long long) s->warm_skipped);
+    printf("\ttime_clamped %llu\n", (unsigned long long) s->time_clamped);
+
+    printf("\tpolicy %s\n", dime_stats_policy_name(s->policy.id));
+    for(i=0 ; i<s->policy.count ; ++i) {
+        const char *name = dime_stats_value_name(s->policy.id, i);
+        if(name)
+            printf("\t\t%s %llu\n", name, (unsigned long long) s->policy.value[i]);
+        else
+            printf("\t\tvalue[%u] %llu\n", i, (unsigned long long) s->policy.value[i]);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct dime_stats_instance stats;
+    long instance_id = -1, interval_ms = 0, rounds = 1;
+    __u32 count, id;
+    int fd, opt, ret = 0;
+
+    while((opt = getopt(argc, argv, "i:n:c:h")) != -1) {
+        switch(opt) {
+        case 'i': instance_id = strtol(optarg, NULL, 10); break;
+        case 'n': interval_ms = strtol(optarg, NULL, 10); rounds = 0; break;
+        case 'c': rounds = strtol(optarg, NULL, 10); break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    fd = dime_stats_open();
+    if(fd < 0) {
+        fprintf(stderr, "could not open %s : %s\n", DIME_STATS_DEVICE, strerror(-fd));
+        return 1;
+    }
+
+    for(long r=0 ; rounds == 0 || r < rounds ; ++r) {
+        if(r > 0 && interval_ms > 0) {
+            struct timespec ts = { interval_ms / 1000, (interval_ms % 1000) * 1000000 };
+            nanosleep(&ts, NULL);
+        }
+
+        ret = dime_stats_count(fd, &count);
+        if(ret < 0) {
+            fprintf(stderr, "could not read instance count : %s\n", strerror(-ret));
+            break;
+        }
+
+        for(id=0 ; id<count ; ++id) {
+            if(instance_id >= 0 && id != (__u32) instance_id)
+                continue;
+
+            ret = dime_stats_read(fd, id, &stats);
+            if(ret < 0) {
+                fprintf(stderr, "could not read instance %u : %s\n", id, strerror(-ret));
+                break;
+            }
+            print_instance(&stats);
+        }
+        if(ret < 0)
+            break;
+        fflush(stdout);
+    }
+
+    close(fd);
+    return ret < 0 ? 1 : 0;
+}
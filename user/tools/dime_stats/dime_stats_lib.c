@@ -0,0 +1,83 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include "dime_stats_lib.h"
+
+static const char *fifo_value_names[DIME_STATS_FIFO_COUNT] = {
+    "local_size", "nslots",
+};
+
+static const char *random_value_names[DIME_STATS_RANDOM_COUNT] = {
+    "free_slots", "nslots", "nshards",
+};
+
+static const char *lru_value_names[DIME_STATS_LRU_COUNT] = {
+    "lpl_count", "free_size",
+    "active_pc_size", "inactive_pc_size", "active_an_size", "inactive_an_size",
+    "free_evict", "active_pc_evict", "active_an_evict", "inactive_pc_evict", "inactive_an_evict",
+    "force_active_pc_evict", "force_active_an_evict", "force_inactive_pc_evict", "force_inactive_an_evict",
+    "pc_active_to_inactive_moved", "an_active_to_inactive_moved",
+    "pc_inactive_to_active_moved", "an_inactive_to_active_moved",
+    "pc_inactive_to_active_pf_moved", "an_inactive_to_active_pf_moved",
+    "pc_active_to_free_moved", "an_active_to_free_moved",
+    "pc_inactive_to_free_moved", "an_inactive_to_free_moved",
+};
+
+static const char *arc_value_names[DIME_STATS_ARC_COUNT] = {
+    "c", "p", "t1_size", "t2_size", "b1_size", "b2_size",
+    "b1_hits", "b2_hits", "t1_evict", "t2_evict", "t1_to_t2",
+};
+
+int dime_stats_open(void) {
+    int fd = open(DIME_STATS_DEVICE, O_RDONLY | O_CLOEXEC);
+    return fd < 0 ? -errno : fd;
+}
+
+int dime_stats_count(int fd, __u32 *count) {
+    return ioctl(fd, DIME_STATS_IOC_COUNT, count) < 0 ? -errno : 0;
+}
+
+/*  dime_stats_read
+ *
+ *  Description:
+ *      Reads snapshot of one instance. Fields added by a newer kernel are
+ *      dropped, fields unknown to an older kernel are left zero.
+ */
+int dime_stats_read(int fd, __u32 instance_id, struct dime_stats_instance *stats) {
+    memset(stats, 0, sizeof(*stats));
+    stats->version      = DIME_STATS_VERSION;
+    stats->size         = sizeof(*stats);
+    stats->instance_id  = instance_id;
+
+    if(ioctl(fd, DIME_STATS_IOC_GET, stats) < 0)
+        return -errno;
+    if(stats->policy.count > DIME_STATS_POLICY_MAX)
+        stats->policy.count = DIME_STATS_POLICY_MAX;
+    return 0;
+}
+
+const char* dime_stats_policy_name(__u32 policy_id) {
+    switch(policy_id) {
+    case DIME_STATS_POLICY_FIFO:    return "fifo";
+    case DIME_STATS_POLICY_LRU:     return "lru";
+    case DIME_STATS_POLICY_RANDOM:  return "random";
+    case DIME_STATS_POLICY_ARC:     return "arc";
+    default:                        return "none";
+    }
+}
+
+const char* dime_stats_value_name(__u32 policy_id, __u32 index) {
+    switch(policy_id) {
+    case DIME_STATS_POLICY_FIFO:
+        return index < DIME_STATS_FIFO_COUNT ? fifo_value_names[index] : NULL;
+    case DIME_STATS_POLICY_LRU:
+        return index < DIME_STATS_LRU_COUNT ? lru_value_names[index] : NULL;
+    case DIME_STATS_POLICY_RANDOM:
+        return index < DIME_STATS_RANDOM_COUNT ? random_value_names[index] : NULL;
+    case DIME_STATS_POLICY_ARC:
+        return index < DIME_STATS_ARC_COUNT ? arc_value_names[index] : NULL;
+    default:
+        return NULL;
+    }
+}
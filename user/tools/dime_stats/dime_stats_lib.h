@@ -0,0 +1,19 @@
+#ifndef __DIME_STATS_LIB_H__
+#define __DIME_STATS_LIB_H__
+
+#include "../../../common/dime_stats.h"
+
+/*****
+ *
+ *  Thin wrapper over /dev/dime_stats for monitoring tools.
+ *  All functions return negative errno on failure.
+ *
+ */
+
+int         dime_stats_open     (void);
+int         dime_stats_count    (int fd, __u32 *count);
+int         dime_stats_read     (int fd, __u32 instance_id, struct dime_stats_instance *stats);
+const char* dime_stats_policy_name  (__u32 policy_id);
+const char* dime_stats_value_name   (__u32 policy_id, __u32 index);
+
+#endif//__DIME_STATS_LIB_H__
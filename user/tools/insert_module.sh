@@ -15,12 +15,14 @@ Insert module with config file
 
 Mandatory arguments to long options are mandatory for short options too.
   -p, --pids       <value>   a comma (,) separated list of pids to add into emulator
+  -g, --cgroup     <value>   cgroup v2 path whose tasks to add into emulator
   -c, --config     <value>   path to config file
 "
 }
 
 config=""
 pids=""
+cgroup=""
 while [[ $# -ge 1 ]]
 do
     key="$1"
@@ -33,6 +35,10 @@ do
             pids="$2"
             shift 2
             ;;
+        -g|--cgroup)
+            cgroup="$2"
+            shift 2
+            ;;
         -h|--help)
             usage
             exit 0
@@ -46,8 +52,8 @@ do
 done
 
 
-if [ "$pids" == "" ]; then
-	echo "Please provide ',' separated list of pids"
+if [ "$pids" == "" ] && [ "$cgroup" == "" ]; then
+	echo "Please provide ',' separated list of pids or a cgroup"
 	echo "Try '$0 -h|--help' for more information"
 	exit 1
 elif [ "$config" == "" ]; then
@@ -77,6 +83,9 @@ fi
 if [ "$da_debug_flag" != "" ]; then
 	parameter_list+=" da_debug_flag=$da_debug_flag"
 fi
+if [ "$cgroup" != "" ]; then
+	parameter_list+=" cgroup=$cgroup"
+fi
 
 
 # Disable huge pages